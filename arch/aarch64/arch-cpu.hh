@@ -30,6 +30,8 @@ struct arch_cpu {
     void init_on_cpu();
     int smp_idx; /* index into the cpus array */
     u64 mpid;    /* actual MPID as read from the cpu */
+    u64 core_id; /* equal for threads of the same core */
+    u64 llc_id;  /* equal for cpus of the same cluster */
 };
 
 struct arch_thread {
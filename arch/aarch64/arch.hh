@@ -62,6 +62,12 @@ inline void halt_no_interrupts()
     processor::halt_no_interrupts();
 }
 
+// Busy-wait loop hint
+inline void pause()
+{
+    processor::yield();
+}
+
 class irq_flag {
 public:
     void save() {
@@ -27,6 +27,10 @@ bool interrupt_manager::easy_register(std::initializer_list<msix_binding> b)
 {
     return false;
 }
+bool interrupt_manager::easy_register(const std::vector<msix_binding>& b)
+{
+    return false;
+}
 void interrupt_manager::easy_unregister() {}
 
 std::vector<msix_vector *> interrupt_manager::request_vectors(unsigned n) {
@@ -23,6 +23,11 @@ inline void wfi()
     asm volatile ("wfi" ::: "memory");
 }
 
+inline void yield()
+{
+    asm volatile ("yield" ::: "memory");
+}
+
 inline void irq_enable()
 {
     asm volatile ("msr daifclr, #2; isb; " ::: "memory");
@@ -53,9 +53,21 @@ void smp_init()
         abort("smp_init: failed to get cpus mpids from device tree.\n");
     }
 
+    // With MPIDR.MT set, Aff0 numbers the threads of a core; otherwise it
+    // numbers the cores of a cluster, which usually share an L2. The device
+    // tree only has the affinity fields, so take MT from the boot cpu.
+    bool mt = processor::read_mpidr() & (1ULL << 24);
     for (int i = 0; i < nr_cpus; i++) {
         auto c = new sched::cpu(i);
         c->arch.mpid = mpids[i];
+        auto aff = mpids[i] & 0xff00ffffffULL;
+        if (mt) {
+            c->arch.core_id = aff >> 8;
+            c->arch.llc_id = aff >> 16;
+        } else {
+            c->arch.core_id = aff;
+            c->arch.llc_id = aff >> 8;
+        }
         c->arch.smp_idx = i;
         c->arch.initstack.next = smp_stack_free;  /* setup thread stack */
         smp_stack_free = &c->arch.initstack;
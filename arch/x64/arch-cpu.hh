@@ -45,6 +45,9 @@ struct arch_cpu {
     char percpu_exception_stack[nr_exception_stacks][4096] __attribute__((aligned(16)));
     u32 apic_id;
     u32 acpi_id;
+    // Topology ids, equal for cpus sharing a core or a last level cache
+    u32 core_id;
+    u32 llc_id;
     u64 gdt[nr_gdt];
     void init_on_cpu();
     void set_ist_entry(unsigned ist, char* base, size_t size);
@@ -61,6 +61,12 @@ inline void halt_no_interrupts()
     processor::cli_hlt();
 }
 
+// Busy-wait loop hint
+inline void pause()
+{
+    processor::pause();
+}
+
 class irq_flag {
 public:
     // need to clear the red zone when playing with the stack. also, can't
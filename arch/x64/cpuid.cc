@@ -8,6 +8,7 @@
 #include <osv/drivers_config.h>
 #include "cpuid.hh"
 #include "processor.hh"
+#include <algorithm>
 #if CONF_drivers_xen
 #include "xen.hh"
 #endif
@@ -177,4 +178,112 @@ features_type::features_type()
     process_cpuid(*this);
 }
 
+const topology_type& topology()
+{
+    static topology_type t;
+    return t;
+}
+
+namespace {
+
+// Number of bits needed to enumerate n ids
+unsigned id_bits(unsigned n)
+{
+    unsigned bits = 0;
+    while ((1u << bits) < n) {
+        bits++;
+    }
+    return bits;
+}
+
+// Leaf 0x1F and 0xB enumerate topology levels by subleaf; each reports its
+// type and the shift to the next level's id. Returns false if neither leaf
+// is implemented.
+bool process_extended_topology(topology_type& t)
+{
+    auto max = cpuid(0).a;
+    for (unsigned leaf : { 0x1fu, 0xbu }) {
+        if (leaf > max || cpuid(leaf, 0).b == 0) {
+            continue;
+        }
+        for (unsigned subleaf = 0; ; subleaf++) {
+            auto r = cpuid(leaf, subleaf);
+            auto type = (r.c >> 8) & 0xff;
+            if (type == 0) {
+                break;
+            }
+            if (type == 1) {
+                t.smt_shift = r.a & 0x1f;
+            }
+            t.pkg_shift = r.a & 0x1f;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Leaf 1 gives the number of logical processors in a package, and leaf 4
+// the number of cores.
+void process_legacy_topology(topology_type& t)
+{
+    auto max = cpuid(0).a;
+    auto r = cpuid(1);
+    if (!(r.d & (1 << 28))) {
+        return;
+    }
+    unsigned logical = (r.b >> 16) & 0xff;
+    unsigned cores = 1;
+    if (max >= 4) {
+        cores = (cpuid(4, 0).a >> 26) + 1;
+    }
+    t.pkg_shift = id_bits(logical);
+    t.smt_shift = id_bits(std::max(logical / cores, 1u));
+}
+
+// Deterministic cache parameters: walk the caches and take the number of
+// processors sharing the highest level one.
+bool process_cache_leaf(topology_type& t, unsigned leaf)
+{
+    unsigned level = 0;
+    for (unsigned subleaf = 0; ; subleaf++) {
+        auto r = cpuid(leaf, subleaf);
+        if ((r.a & 0x1f) == 0) {
+            break;
+        }
+        auto l = (r.a >> 5) & 0x7;
+        if (l >= level) {
+            level = l;
+            t.llc_shift = id_bits(((r.a >> 14) & 0xfff) + 1);
+        }
+    }
+    return level != 0;
+}
+
+void process_llc(topology_type& t)
+{
+    if (cpuid(0).a >= 4 && process_cache_leaf(t, 4)) {
+        return;
+    }
+    // AMD reports cache topology in its extended leaves, if TOPOEXT is set
+    auto ext_max = cpuid(0x80000000).a;
+    if (ext_max >= 0x8000001d && (cpuid(0x80000001).c & (1 << 22)) &&
+            process_cache_leaf(t, 0x8000001d)) {
+        return;
+    }
+    t.llc_shift = t.pkg_shift;
+}
+
+}
+
+// Without topology information every processor is its own package.
+topology_type::topology_type()
+    : smt_shift(0), llc_shift(0), pkg_shift(0)
+{
+    if (!process_extended_topology(*this)) {
+        process_legacy_topology(*this);
+    }
+    process_llc(*this);
+    llc_shift = std::max(llc_shift, smt_shift);
+}
+
 }
@@ -43,6 +43,19 @@ struct features_type {
 extern const features_type& features();
 extern const std::string& features_str();
 
+// Processor topology, from CPUID leaf 0x1F or 0xB (leaves 1 and 4 on older
+// processors), and the cache parameters of leaf 4 (0x8000001D on AMD).
+// An APIC id shifted right by one of these identifies the core, the last
+// level cache and the package that processor belongs to.
+struct topology_type {
+    topology_type();
+    unsigned smt_shift;
+    unsigned llc_shift;
+    unsigned pkg_shift;
+};
+
+extern const topology_type& topology();
+
 }
 
 
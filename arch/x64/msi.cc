@@ -130,6 +130,11 @@ static inline void set_affinity_and_wake(
 }
 
 bool interrupt_manager::easy_register(std::initializer_list<msix_binding> bindings)
+{
+    return easy_register(std::vector<msix_binding>(bindings));
+}
+
+bool interrupt_manager::easy_register(const std::vector<msix_binding>& bindings)
 {
     unsigned n = bindings.size();
 
@@ -251,6 +251,10 @@ inline void sti_hlt() {
     asm volatile ("sti; hlt" : : : "memory");
 }
 
+inline void pause() {
+    asm volatile ("pause" : : : "memory");
+}
+
 inline u8 inb(u16 port)
 {
     u8 r;
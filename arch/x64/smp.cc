@@ -49,6 +49,8 @@ static void register_cpu(unsigned cpu_id, u32 apic_id, u32 acpi_id = 0)
     auto c = new sched::cpu(cpu_id);
     c->arch.apic_id = apic_id;
     c->arch.acpi_id = acpi_id;
+    c->arch.core_id = apic_id >> processor::topology().smt_shift;
+    c->arch.llc_id = apic_id >> processor::topology().llc_shift;
     c->arch.initstack.next = smp_stack_free;
     smp_stack_free = &c->arch.initstack;
     sched::cpus.push_back(c);
@@ -40,10 +40,12 @@
 
 #include <osv/mutex.h>
 #include <osv/clock.hh>
+#include <bsd/sys/sys/queue.h>
 
 struct callout {
-	/* OSv waiter thread for drain (drain) */
-	void *waiter_thread;
+	/* Timing wheel slot linkage, and the wheel (CPU) owning the callout */
+	LIST_ENTRY(callout) c_links;
+	void *c_wheel;
 	/* State of this entry */
 	int c_flags;
 	uint64_t c_ticks;
@@ -6,11 +6,14 @@
  */
 
 #include <mutex>
-#include <set>
+#include <vector>
+#include <algorithm>
+#include <string>
 #include "osv/trace.hh"
 #include <osv/debug.hh>
 #include <osv/sched.hh>
 #include <osv/clock.hh>
+#include <osv/condvar.h>
 using namespace osv::clock::literals;
 
 #include <bsd/porting/rwlock.h>
@@ -19,194 +22,369 @@ using namespace osv::clock::literals;
 #include <bsd/porting/sync_stub.h>
 
 TRACEPOINT(trace_callout_init, "C=%p", void *);
-TRACEPOINT(trace_callout_reset, "C=%p to_ticks=%d fn=%p arg=%p", void *, uint64_t, void *, void *);
+TRACEPOINT(trace_callout_reset, "C=%p to_ticks=%d fn=%p arg=%p cpu=%d", void *, uint64_t, void *, void *, unsigned);
 TRACEPOINT(trace_callout_stop_wait, "C=%p", void *);
 TRACEPOINT(trace_callout_stop, "C=%p flags=%d, is_drain=%d", void *, int, int);
-TRACEPOINT(trace_callout_thread_waiting, "C=%p", void *);
-TRACEPOINT(trace_callout_thread_retry, "C=%p", void *);
-TRACEPOINT(trace_callout_thread_dispatching, "C=%p fn=%p", void *, void *);
-TRACEPOINT(trace_callout_thread_waking, "C=%p thread=%p", void *, void *);
-
-int _callout_stop_safe_locked(struct callout *c, int safe);
+TRACEPOINT(trace_callout_migrate, "C=%p from=%d to=%d", void *, unsigned, unsigned);
+TRACEPOINT(trace_callout_thread_waiting, "cpu=%d until=%d", unsigned, uint64_t);
+TRACEPOINT(trace_callout_thread_cascade, "cpu=%d level=%d slot=%d", unsigned, unsigned, unsigned);
+TRACEPOINT(trace_callout_thread_dispatching, "C=%p fn=%p latency=%d ns", void *, void *, int64_t);
+TRACEPOINT(trace_callout_thread_cancelled, "C=%p", void *);
+TRACEPOINT(trace_callout_thread_late, "C=%p fn=%p latency=%d ns", void *, void *, int64_t);
 
 namespace callouts {
 
-    struct callout_compare {
-        bool operator() (callout *a, callout *b) const {
-            if (a->c_to_ns == b->c_to_ns) {
-                return (a < b);
-            }
+    // Each CPU keeps its callouts in a hierarchical timing wheel (Varghese
+    // and Lauck): level 0 has one slot per tick, and every level above has
+    // slots 64 times wider, so four levels cover 2^24 ticks (about 4.6
+    // hours at hz=1000). Arming and cancelling a callout are O(1) list
+    // operations on its slot; a coarse slot is refiled into the finer
+    // levels ("cascaded") when time reaches it. Callouts further out than
+    // the last level are parked in it and refiled each time around.
+    //
+    // A callout belongs to one wheel (c_wheel) and everything about it is
+    // protected by that wheel's lock. An idle callout moves to the wheel of
+    // the CPU re-arming it, so it fires on the CPU that armed it, on that
+    // CPU's dispatcher thread.
+    constexpr unsigned slot_bits = 6;
+    constexpr unsigned slots = 1U << slot_bits;
+    constexpr unsigned slot_mask = slots - 1;
+    constexpr unsigned levels = 4;
+    constexpr u64 max_delta = (u64(1) << (slot_bits * levels)) - 1;
+    constexpr u64 never = ~u64(0);
+
+    // Handlers starting this late are traced as trace_callout_thread_late
+    constexpr int64_t late_ns = 2 * ticks2ns(1);
+
+    LIST_HEAD(callout_list, callout);
+
+    static u64 uptime_ticks(void)
+    {
+        return ns2ticks(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                osv::clock::uptime::now().time_since_epoch()).count());
+    }
 
-            return (a->c_to_ns < b->c_to_ns);
-        }
+    class wheel {
+    public:
+        explicit wheel(sched::cpu* cpu);
+        void start(void);
+        void arm(callout *c);
+        int stop(callout *c, bool is_drain);
+        bool running(callout *c) const { return _running == c; }
+        unsigned cpu_id(void) const { return _cpu->id; }
+
+        // Protects the wheel and the callouts on it
+        mutex _mtx;
+    private:
+        void add(callout *c);
+        void cascade(unsigned level, unsigned slot);
+        u64 next_expiry(void);
+        void run_tick(void);
+        void dispatch(callout *c);
+        void do_work(void);
+    private:
+        sched::cpu* _cpu;
+        sched::thread* _thread = nullptr;
+        callout_list _slots[levels][slots];
+        // Callouts of the tick being run, not dispatched yet
+        callout_list _expired;
+        // The next tick to run
+        u64 _now;
+        // The tick the dispatcher sleeps until
+        u64 _wakeup = never;
+        unsigned _pending = 0;
+        // The callout being dispatched, and whether its handler has been
+        // called yet or it got stopped while we waited for its lock
+        callout *_running = nullptr;
+        bool _in_handler = false;
+        bool _cancel_running = false;
+        condvar _drained;
     };
 
-    // We manage callouts in a single ordered set
-    std::set<callout *, callout_compare> _callouts;
-
-    // Both global data and callout structure are protected using this lock
-    mutex _callout_mutex;
-    void lock(void) { _callout_mutex.lock(); }
-    void unlock(void) { _callout_mutex.unlock(); }
+    std::vector<wheel*> _wheels;
 
-    // The callout dispatcher thread
-    sched::thread *_callout_dispatcher = nullptr;
-    bool _have_work = false;
-
-    void add_callout(callout *c)
+    wheel* current_wheel(void)
     {
-        _callouts.insert(c);
+        return _wheels[sched::cpu::current()->id];
     }
 
-    void remove_callout(callout *c)
+    // Returns the wheel owning the callout, locked. A callout which was
+    // never armed is given to the current CPU.
+    wheel* lock_callout(callout *c)
     {
-        _callouts.erase(c);
-    }
-
-    callout *get_one(void)
-    {
-        if (_callouts.empty()) {
-            return (nullptr);
+        auto w = static_cast<wheel*>(__atomic_load_n(&c->c_wheel, __ATOMIC_ACQUIRE));
+        if (!w) {
+            void *expected = nullptr;
+            w = current_wheel();
+            if (!__atomic_compare_exchange_n(&c->c_wheel, &expected, w, false,
+                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                w = static_cast<wheel*>(expected);
+            }
+        }
+        while (true) {
+            w->_mtx.lock();
+            auto owner = static_cast<wheel*>(__atomic_load_n(&c->c_wheel, __ATOMIC_ACQUIRE));
+            if (owner == w) {
+                return w;
+            }
+            // Moved to another CPU while we waited for the lock
+            w->_mtx.unlock();
+            w = owner;
         }
-        return (*_callouts.begin());
     }
 
-    // FIXME: optimize this function
-    bool have_callout(callout *c)
+    wheel::wheel(sched::cpu* cpu)
+        : _cpu(cpu)
+        , _now(uptime_ticks())
     {
-        for (auto i: _callouts) {
-            if (i == c) {
-                return (true);
+        for (auto& level : _slots) {
+            for (auto& slot : level) {
+                LIST_INIT(&slot);
             }
         }
+        LIST_INIT(&_expired);
+    }
 
-        return (false);
+    void wheel::start(void)
+    {
+        _thread = sched::thread::make([this] { do_work(); },
+                sched::thread::attr().name("callout" + std::to_string(_cpu->id)).pin(_cpu));
+        _thread->start();
     }
 
-    void mark_have_work(void)
+    void wheel::add(callout *c)
     {
-        _have_work = true;
+        u64 expires = std::max(c->c_time, _now);
+        u64 delta = expires - _now;
+        if (delta > max_delta) {
+            delta = max_delta;
+            expires = _now + max_delta;
+        }
+        unsigned level = 0;
+        while (delta >> (slot_bits * (level + 1))) {
+            level++;
+        }
+        auto slot = (expires >> (slot_bits * level)) & slot_mask;
+        LIST_INSERT_HEAD(&_slots[level][slot], c, c_links);
     }
 
-    // wakes the dispatcher
-    void wake_dispatcher(void)
+    void wheel::arm(callout *c)
     {
-        _callout_dispatcher->wake();
+        add(c);
+        _pending++;
+        if (c->c_time < _wakeup) {
+            _wakeup = c->c_time;
+            _thread->wake();
+        }
     }
-}
 
-static sched::thread* callout_get_waiter(struct callout *c)
-{
-    return reinterpret_cast<sched::thread*>(c->waiter_thread);
-}
+    int wheel::stop(callout *c, bool is_drain)
+    {
+        int result = 0;
 
-static void callout_set_waiter(struct callout *c, sched::thread* t)
-{
-    if (t != NULL)
-        assert(c->waiter_thread == NULL);
+        trace_callout_stop(c, c->c_flags, is_drain);
 
-    c->waiter_thread = reinterpret_cast<void*>(t);
-}
+        if (_running == c) {
+            if (!_in_handler) {
+                // The dispatcher is still waiting for the callout's lock;
+                // make it skip the handler
+                _cancel_running = true;
+            }
+            // A drain must also wait for the dispatcher to let go of the
+            // callout's lock, as the callout may be freed once we return.
+            if (is_drain && sched::thread::current() != _thread) {
+                trace_callout_stop_wait(c);
+                while (_running == c) {
+                    _drained.wait(&_mtx);
+                }
+                result = 1;
+            }
+        }
 
-static void _callout_thread(void)
-{
-    callouts::lock();
+        // The handler may have re-armed the callout while we drained it
+        if (callout_pending(c)) {
+            LIST_REMOVE(c, c_links);
+            _pending--;
+        }
 
-    while (true) {
+        // Clear flags
+        c->c_flags &= ~(CALLOUT_ACTIVE | CALLOUT_PENDING | CALLOUT_COMPLETED);
 
-        // Wait for work
-        sched::thread::wait_until(callouts::_callout_mutex, [] {
-            return (callouts::get_one() != nullptr);
-        });
+        return (result);
+    }
 
-        // get the first callout with the earliest time
-        callout *c = callouts::get_one();
+    void wheel::cascade(unsigned level, unsigned slot)
+    {
+        callout_list refile;
+        LIST_INIT(&refile);
+        LIST_SWAP(&refile, &_slots[level][slot], callout, c_links);
 
-        assert(c->c_flags & (CALLOUT_ACTIVE | CALLOUT_PENDING));
+        trace_callout_thread_cascade(_cpu->id, level, slot);
 
-        //////////////////////
-        // Wait for timeout //
-        //////////////////////
+        callout *c;
+        while ((c = LIST_FIRST(&refile)) != nullptr) {
+            LIST_REMOVE(c, c_links);
+            add(c);
+        }
+    }
 
-        auto cur = osv::clock::uptime::now();
-        bool expired = true;
-        if (cur < c->c_to_ns-1_ms) {
-            sched::timer t(*sched::thread::current());
-            t.set(c->c_to_ns);
+    // The first tick at which there is anything to do: a level 0 slot to
+    // run, or a coarser slot to cascade.
+    u64 wheel::next_expiry(void)
+    {
+        if (!_pending) {
+            return never;
+        }
 
-            trace_callout_thread_waiting(c);
-            sched::thread::wait_until(callouts::_callout_mutex, [&] {
-                return ( (t.expired()) || (callouts::_have_work));
-            });
+        u64 next = never;
+        for (u64 t = _now; t < _now + slots; t++) {
+            if (!LIST_EMPTY(&_slots[0][t & slot_mask])) {
+                next = t;
+                break;
+            }
+        }
 
-            callouts::_have_work = false;
-            expired = t.expired();
+        // A coarse slot is cascaded at the first tick of its span, which
+        // may come before the callouts already on level 0
+        for (unsigned level = 1; level < levels; level++) {
+            auto shift = slot_bits * level;
+            u64 first = (_now + (u64(1) << shift) - 1) >> shift;
+            for (u64 i = 0; i < slots; i++) {
+                u64 t = (first + i) << shift;
+                if (t >= next) {
+                    break;
+                }
+                if (!LIST_EMPTY(&_slots[level][(t >> shift) & slot_mask])) {
+                    next = t;
+                    break;
+                }
+            }
         }
+        return next;
+    }
 
-        if (!expired  || (!callouts::have_callout(c))) {
-            trace_callout_thread_retry(c);
-            continue;
+    void wheel::run_tick(void)
+    {
+        for (unsigned level = 1; level < levels; level++) {
+            if ((_now >> (slot_bits * (level - 1))) & slot_mask) {
+                break;
+            }
+            cascade(level, (_now >> (slot_bits * level)) & slot_mask);
         }
 
-        ///////////////
-        // Dispatch! //
-        ///////////////
+        // Callouts re-armed from the handlers go to later ticks
+        LIST_SWAP(&_expired, &_slots[0][_now & slot_mask], callout, c_links);
+        _now++;
+
+        callout *c;
+        while ((c = LIST_FIRST(&_expired)) != nullptr) {
+            LIST_REMOVE(c, c_links);
+            dispatch(c);
+        }
+    }
+
+    void wheel::dispatch(callout *c)
+    {
+        assert(c->c_flags & (CALLOUT_ACTIVE | CALLOUT_PENDING));
 
         auto fn = c->c_fn;
         auto arg = c->c_arg;
+        auto due = c->c_to_ns;
         struct mtx* c_mtx = c->c_mtx;
         struct rwlock* c_rwlock = c->c_rwlock;
         bool return_unlocked = ((c->c_flags & CALLOUT_RETURNUNLOCKED) == 0);
 
-        if (c_rwlock)
-            rw_wlock(c_rwlock);
-        if (c_mtx)
-            mtx_lock(c_mtx);
-
         c->c_flags &= ~CALLOUT_PENDING;
-
-        callouts::unlock();
-
-        // Callout handler
-        trace_callout_thread_dispatching(c, (void*)fn);
-        fn(arg);
-
-        callouts::lock();
-
-        sched::thread* waiter = nullptr;
+        _pending--;
+        _running = c;
+        _in_handler = false;
+        _cancel_running = false;
 
         //
-        // note: after the handler have been invoked the callout structure
-        // can look much differently, the handler may reschedule the callout
-        // or even freed it.
+        // note: the callout's lock is taken without holding the wheel lock,
+        // as callout_reset() and callout_stop() are called with the callout
+        // lock held. If either ran meanwhile the callout must not fire, and
+        // may even have been freed.
         //
-        // if the callout is in the set it means that it hasn't been freed
-        // by the user
-        //
-        // reset || drain || !stop
-        if (callouts::have_callout(c)) {
-
-            waiter = callout_get_waiter(c);
-            callout_set_waiter(c, NULL);
-            // if the callout hadn't been reschedule, remove it
-            if ( ((c->c_flags & CALLOUT_PENDING) == 0) || (waiter) ) {
-                c->c_flags |= CALLOUT_COMPLETED;
-                callouts::remove_callout(c);
+        if (c_rwlock || c_mtx) {
+            DROP_LOCK(_mtx) {
+                if (c_rwlock)
+                    rw_wlock(c_rwlock);
+                if (c_mtx)
+                    mtx_lock(c_mtx);
+            }
+            if (_cancel_running) {
+                trace_callout_thread_cancelled(c);
+                DROP_LOCK(_mtx) {
+                    if (c_rwlock)
+                        rw_wunlock(c_rwlock);
+                    if (c_mtx)
+                        mtx_unlock(c_mtx);
+                }
+                _running = nullptr;
+                _drained.wake_all();
+                return;
             }
         }
+        _in_handler = true;
 
-        // FIXME: should we do this in case the caller called callout_stop?
-        if (return_unlocked) {
-            if (c_rwlock)
-                rw_wunlock(c_rwlock);
-            if (c_mtx)
-                mtx_unlock(c_mtx);
+        auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                osv::clock::uptime::now() - due).count();
+        trace_callout_thread_dispatching(c, (void*)fn, latency);
+        if (latency > late_ns) {
+            trace_callout_thread_late(c, (void*)fn, latency);
         }
 
-        // if we have a waiter then the callout structure must be valid
-        if (waiter) {
-            trace_callout_thread_waking(c, waiter);
-            waiter->wake();
+        DROP_LOCK(_mtx) {
+            // Callout handler. The callout may be re-armed or freed by it,
+            // so it isn't looked at afterwards.
+            fn(arg);
+
+            if (return_unlocked) {
+                if (c_rwlock)
+                    rw_wunlock(c_rwlock);
+                if (c_mtx)
+                    mtx_unlock(c_mtx);
+            }
+        }
+
+        _running = nullptr;
+        _in_handler = false;
+        _drained.wake_all();
+    }
+
+    void wheel::do_work(void)
+    {
+        WITH_LOCK(_mtx) {
+            while (true) {
+                u64 now = uptime_ticks();
+                while (_now <= now) {
+                    // Skip over the ticks with nothing to run or cascade
+                    u64 next = next_expiry();
+                    if (next > now) {
+                        _now = now + 1;
+                        break;
+                    }
+                    _now = next;
+                    run_tick();
+                }
+
+                //////////////////////
+                // Wait for timeout //
+                //////////////////////
+
+                _wakeup = next_expiry();
+                u64 wakeup = _wakeup;
+                trace_callout_thread_waiting(_cpu->id, wakeup);
+
+                sched::timer t(*sched::thread::current());
+                if (wakeup != never) {
+                    t.set(osv::clock::uptime::time_point(ticks2ns(wakeup) * 1_ns));
+                }
+                sched::thread::wait_until(_mtx, [&] {
+                    return t.expired() || _wakeup != wakeup;
+                });
+            }
         }
     }
 }
@@ -215,81 +393,56 @@ int callout_reset_on(struct callout *c, u64 to_ticks, void (*fn)(void *),
     void *arg, int ignore_cpu)
 {
     auto cur = osv::clock::uptime::now();
-    int cur_ticks = ns2ticks(
+    u64 cur_ticks = ns2ticks(
             std::chrono::duration_cast<std::chrono::nanoseconds>
                 (cur.time_since_epoch()).count());
     int result = 0;
-    bool queued_first = false;
 
-    callouts::lock();
+    auto w = callouts::lock_callout(c);
 
-    trace_callout_reset(c, to_ticks, (void*)fn, arg);
+    result = w->stop(c, false);
 
-    result = _callout_stop_safe_locked(c, 0);
+    // An idle callout moves to this CPU's wheel; one whose handler is
+    // being dispatched stays, so its dispatcher learns it was re-armed.
+    auto here = callouts::current_wheel();
+    if (here != w && !w->running(c)) {
+        trace_callout_migrate(c, w->cpu_id(), here->cpu_id());
+        __atomic_store_n(&c->c_wheel, here, __ATOMIC_RELEASE);
+        w->_mtx.unlock();
+        w = callouts::lock_callout(c);
+        // Somebody may have armed it in the window
+        w->stop(c, false);
+    }
+
+    trace_callout_reset(c, to_ticks, (void*)fn, arg, w->cpu_id());
 
     // Reset the callout
     c->c_ticks = to_ticks;
-    c->c_time = cur_ticks + to_ticks;           // for freebsd compatibility
-    c->c_to_ns = cur + ticks2ns(to_ticks) * 1_ns;      // this is what we use
+    c->c_time = cur_ticks + to_ticks;           // the wheel works in ticks
+    c->c_to_ns = cur + ticks2ns(to_ticks) * 1_ns;      // for fire latency
     c->c_fn = fn;
     c->c_arg = arg;
     c->c_flags |= (CALLOUT_PENDING | CALLOUT_ACTIVE);
 
-    callouts::add_callout(c);
-    if (c == callouts::get_one()) {
-        callouts::mark_have_work();
-        queued_first = true;
-    }
+    w->arm(c);
 
-    callouts::unlock();
-
-    if (queued_first)
-        callouts::wake_dispatcher();
+    w->_mtx.unlock();
 
     return result;
 }
 
 // callout_stop() and callout_drain()
-int _callout_stop_safe_locked(struct callout *c, int is_drain)
-{
-    int result = 0;
-
-    trace_callout_stop(c, c->c_flags, is_drain);
-
-    if ((is_drain) &&
-        (sched::thread::current() != callouts::_callout_dispatcher) &&
-            (callout_pending(c) ||
-             (callout_active(c) && !callout_completed(c))) ) {
-
-        // Wait for callout
-        callout_set_waiter(c, sched::thread::current());
-        callouts::mark_have_work();
-        callouts::wake_dispatcher();
-
-        trace_callout_stop_wait(c);
-
-        sched::thread::wait_until(callouts::_callout_mutex, [&] {
-            return (c->c_flags & CALLOUT_COMPLETED);
-        });
-
-        result = 1;
-    }
-
-    callouts::remove_callout(c);
-
-    // Clear flags
-    c->c_flags &= ~(CALLOUT_ACTIVE | CALLOUT_PENDING | CALLOUT_COMPLETED);
-
-    return (result);
-}
-
 int _callout_stop_safe(struct callout *c, int is_drain)
 {
-    int result = 0;
+    if (!__atomic_load_n(&c->c_wheel, __ATOMIC_ACQUIRE)) {
+        // Never armed
+        c->c_flags &= ~(CALLOUT_ACTIVE | CALLOUT_PENDING | CALLOUT_COMPLETED);
+        return 0;
+    }
 
-    callouts::lock();
-    result = _callout_stop_safe_locked(c, is_drain);
-    callouts::unlock();
+    auto w = callouts::lock_callout(c);
+    int result = w->stop(c, is_drain);
+    w->_mtx.unlock();
 
     return (result);
 }
@@ -322,9 +475,11 @@ void callout_init_mtx(struct callout *c, struct mtx *mtx, int flags)
 
 void init_callouts(void)
 {
-    // Start the callout thread
-    callouts::_callout_dispatcher = sched::thread::make(_callout_thread,
-            sched::thread::attr().name("callout"));
-    callouts::_callout_dispatcher->start();
+    // A timing wheel and dispatcher thread per CPU
+    for (auto cpu : sched::cpus) {
+        callouts::_wheels.push_back(new callouts::wheel(cpu));
+    }
+    for (auto w : callouts::_wheels) {
+        w->start();
+    }
 }
-
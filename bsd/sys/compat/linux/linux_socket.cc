@@ -514,8 +514,9 @@ linux_set_socket_flags(int s, int flags)
 	return (0);
 }
 
+/* Sends on fp if it isn't NULL, on descriptor s otherwise. */
 static int
-linux_sendit(int s, struct msghdr *mp, int flags,
+linux_sendit(int s, struct file *fp, struct msghdr *mp, int flags,
     struct mbuf *control, ssize_t *bytes)
 {
 	struct bsd_sockaddr *to;
@@ -530,7 +531,10 @@ linux_sendit(int s, struct msghdr *mp, int flags,
 		to = NULL;
 
 	bsd_flags = linux_to_bsd_msg_flags(flags);
-	error = kern_sendit(s, mp, bsd_flags, control, bytes);
+	if (fp)
+		error = kern_sendit_file(fp, mp, bsd_flags, control, bytes);
+	else
+		error = kern_sendit(s, mp, bsd_flags, control, bytes);
 
 	if (to)
 		free(to);
@@ -592,7 +596,7 @@ linux_sendto_hdrincl(int s, void *buf, int len, int flags, void *to,
 	bsd_msg.msg_flags = 0;
 	aiov[0].iov_base = (char *)packet;
 	aiov[0].iov_len = len;
-	error = linux_sendit(s, &bsd_msg, flags, NULL, bytes);
+	error = linux_sendit(s, NULL, &bsd_msg, flags, NULL, bytes);
 
 	return (error);
 }
@@ -721,8 +725,9 @@ linux_listen(int s, int backlog)
 	return (sys_listen(s, backlog));
 }
 
+/* Accepts on fp if it isn't NULL, on descriptor s otherwise. */
 static int
-linux_accept_common(int s, struct bsd_sockaddr * name,
+linux_accept_common(int s, struct file *fp, struct bsd_sockaddr * name,
 	socklen_t * namelen, int *out_fd, int flags)
 {
 	int error;
@@ -730,7 +735,10 @@ linux_accept_common(int s, struct bsd_sockaddr * name,
 	if (flags & ~(LINUX_SOCK_CLOEXEC | LINUX_SOCK_NONBLOCK))
 		return (EINVAL);
 
-	error = sys_accept(s, name, namelen, out_fd);
+	if (fp)
+		error = kern_accept_file(fp, name, namelen, NULL, out_fd);
+	else
+		error = sys_accept(s, name, namelen, out_fd);
 	bsd_to_linux_sockaddr(name);
 	if (error) {
 		if (error == EFAULT && *namelen != sizeof(struct bsd_sockaddr_in))
@@ -764,7 +772,7 @@ int linux_accept(int s, struct bsd_sockaddr * name,
 	socklen_t * namelen, int *out_fd)
 {
 
-	return (linux_accept_common(s, name, namelen, out_fd, 0));
+	return (linux_accept_common(s, NULL, name, namelen, out_fd, 0));
 }
 
 int
@@ -772,7 +780,15 @@ linux_accept4(int s, struct bsd_sockaddr * name,
 	socklen_t * namelen, int *out_fd, int flags)
 {
 
-	return (linux_accept_common(s, name, namelen, out_fd, flags));
+	return (linux_accept_common(s, NULL, name, namelen, out_fd, flags));
+}
+
+int
+linux_accept4_file(struct file *fp, struct bsd_sockaddr * name,
+	socklen_t * namelen, int *out_fd, int flags)
+{
+
+	return (linux_accept_common(-1, fp, name, namelen, out_fd, flags));
 }
 
 int
@@ -886,7 +902,7 @@ linux_sendto(int s, void* buf, int len, int flags,
 	msg.msg_flags = 0;
 	aiov.iov_base = buf;
 	aiov.iov_len = len;
-	error = linux_sendit(s, &msg, flags, NULL, bytes);
+	error = linux_sendit(s, NULL, &msg, flags, NULL, bytes);
 	return (error);
 }
 
@@ -912,8 +928,9 @@ linux_recvfrom(int s, void* buf, size_t len, int flags,
 	return (0);
 }
 
-int
-linux_sendmsg(int s, struct msghdr* msg, int flags, ssize_t* bytes)
+static int
+linux_sendmsg_common(int s, struct file *fp, struct msghdr* msg, int flags,
+    ssize_t* bytes)
 {
 #if 0
 	struct cmsghdr *cmsg;
@@ -1026,7 +1043,7 @@ linux_sendmsg(int s, struct msghdr* msg, int flags, ssize_t* bytes)
 	}
 #endif
 
-	error = linux_sendit(s, msg, flags, NULL, bytes);
+	error = linux_sendit(s, fp, msg, flags, NULL, bytes);
 
 #if 0
 bad:
@@ -1037,6 +1054,21 @@ bad:
 	return (error);
 }
 
+int
+linux_sendmsg(int s, struct msghdr* msg, int flags, ssize_t* bytes)
+{
+
+	return (linux_sendmsg_common(s, NULL, msg, flags, bytes));
+}
+
+int
+linux_sendmsg_file(struct file *fp, struct msghdr* msg, int flags,
+    ssize_t* bytes)
+{
+
+	return (linux_sendmsg_common(-1, fp, msg, flags, bytes));
+}
+
 struct linux_recvmsg_args {
 	int s;
 	l_uintptr_t msg;
@@ -1045,8 +1077,9 @@ struct linux_recvmsg_args {
 
 /* FIXME: OSv - flags are ignored, the flags
  * inside the msghdr are used instead */
-int
-linux_recvmsg(int s, struct msghdr *msg, int flags, ssize_t* bytes)
+static int
+linux_recvmsg_common(int s, struct file *fp, struct msghdr *msg, int flags,
+    ssize_t* bytes)
 {
 #if 0
 	socklen_t datalen, outlen;
@@ -1070,7 +1103,10 @@ linux_recvmsg(int s, struct msghdr *msg, int flags, ssize_t* bytes)
 
 	assert(msg->msg_control == NULL);
 
-	error = kern_recvit(s, msg, NULL, bytes);
+	if (fp)
+		error = kern_recvit_file(fp, msg, NULL, bytes);
+	else
+		error = kern_recvit(s, msg, NULL, bytes);
 	if (error)
 		goto bad;
 
@@ -1200,6 +1236,21 @@ bad:
 	return (error);
 }
 
+int
+linux_recvmsg(int s, struct msghdr *msg, int flags, ssize_t* bytes)
+{
+
+	return (linux_recvmsg_common(s, NULL, msg, flags, bytes));
+}
+
+int
+linux_recvmsg_file(struct file *fp, struct msghdr *msg, int flags,
+    ssize_t* bytes)
+{
+
+	return (linux_recvmsg_common(-1, fp, msg, flags, bytes));
+}
+
 int
 linux_shutdown(int s, int how)
 {
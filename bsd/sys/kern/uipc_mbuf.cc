@@ -38,6 +38,7 @@
 #include <osv/mmu.hh>
 #include <bsd/sys/sys/socket.h>
 #include <osv/zcopy.hh>
+#include <boost/lockfree/stack.hpp>
 
 int	max_linkhdr;
 int	max_protohdr;
@@ -140,22 +141,136 @@ m_getm2(struct mbuf *m, int len, int how, short type, int flags)
 	return (m);
 }
 
-static void
-ztx_release(void *arg1, void *arg2)
+/* Upper bound on the number of idle ztx_handles kept for reuse. */
+#define	ZTX_HANDLE_CACHE	1024
+#define	ZTX_RING_RESERVE	64
+
+static boost::lockfree::stack<ztx_handle *,
+    boost::lockfree::fixed_sized<true>> ztx_handle_cache(ZTX_HANDLE_CACHE);
+
+ztx_handle *
+ztx_handle_alloc(void)
+{
+	ztx_handle *zh;
+
+	if (!ztx_handle_cache.pop(zh))
+		return (new ztx_handle());
+	zh->zh_remained = 0;
+	zh->zh_ring = nullptr;
+	zh->zh_seq = 0;
+	zh->zh_fd = -1;
+	zh->zh_done = nullptr;
+	zh->zh_arg = nullptr;
+	return (zh);
+}
+
+void
+ztx_handle_free(ztx_handle *zh)
 {
-	auto zm = reinterpret_cast<struct zmsghdr *>(arg1);
-	auto len = reinterpret_cast<size_t>(arg2);
-        KASSERT(zm->zm_txhandle, ("zm->zm_txhandle == null"));
-	auto zh = reinterpret_cast<ztx_handle *>(zm->zm_txhandle);
-	auto remained = zh->zh_remained.fetch_sub(len);
-        remained -= len;
-
-	if (remained == 0 && zm->zm_txfd) {
-		zm->zm_txhandle = nullptr;
+	if (!ztx_handle_cache.bounded_push(zh))
 		delete zh;
+}
+
+zcopy_txring::zcopy_txring(int fd)
+    : zr_refs(1), zr_next(0), zr_fd(fd)
+{
+	zr_ranges.reserve(ZTX_RING_RESERVE);
+}
+
+zcopy_txring::~zcopy_txring()
+{
+	close(zr_fd);
+}
+
+void
+zcopy_txring_put(zcopy_txring *zr)
+{
+	if (zr->zr_refs.fetch_sub(1) == 1)
+		delete zr;
+}
+
+/*
+ * Add 'seq' to the ranges, merging it with any range it borders, and
+ * merging the two ranges it may join. Completed sends are thus kept as
+ * one range per gap left by sends still in flight, however long the
+ * application goes without reaping them.
+ */
+static void
+zcopy_range_add(std::vector<zcopy_range>& ranges, uint32_t seq)
+{
+	/* Completions come nearly in order: look at the latest ranges first */
+	for (auto r = ranges.rbegin(); r != ranges.rend(); ++r) {
+		if (r->zr_hi + 1 == seq)
+			r->zr_hi = seq;
+		else if (seq + 1 == r->zr_lo)
+			r->zr_lo = seq;
+		else
+			continue;
+		for (auto o = ranges.begin(); o != ranges.end(); ++o) {
+			if (&*o == &*r)
+				continue;
+			if (o->zr_lo == r->zr_hi + 1) {
+				r->zr_hi = o->zr_hi;
+				ranges.erase(o);
+				break;
+			}
+			if (o->zr_hi + 1 == r->zr_lo) {
+				r->zr_lo = o->zr_lo;
+				ranges.erase(o);
+				break;
+			}
+		}
+		return;
+	}
+	ranges.push_back({seq, seq});
+}
+
+/*
+ * Record the completion of send 'seq'. The eventfd is written only when
+ * the ring was empty: the application drains the ring completely after
+ * every wakeup.
+ */
+void
+zcopy_txring_complete(zcopy_txring *zr, uint32_t seq)
+{
+	bool notify = false;
+
+	WITH_LOCK(zr->zr_mtx) {
+		notify = zr->zr_ranges.empty();
+		zcopy_range_add(zr->zr_ranges, seq);
+	}
+	if (notify) {
+		uint64_t v = 1;
+		write(zr->zr_fd, &v, sizeof(v));
+	}
+	zcopy_txring_put(zr);
+}
+
+/*
+ * Drop 'len' bytes from the handle; the send is complete once all the
+ * mbufs referencing user memory are gone.
+ */
+void
+ztx_handle_release(ztx_handle *zh, size_t len)
+{
+	if (zh->zh_remained.fetch_sub(len) != len)
+		return;
+	if (zh->zh_done) {
+		zh->zh_done(zh->zh_arg);
+	} else if (zh->zh_ring) {
+		zcopy_txring_complete(zh->zh_ring, zh->zh_seq);
+	} else {
 		uint64_t v = 1;
-		write(zm->zm_txfd, &v, sizeof(v));
+		write(zh->zh_fd, &v, sizeof(v));
 	}
+	ztx_handle_free(zh);
+}
+
+static void
+ztx_release(void *arg1, void *arg2)
+{
+	ztx_handle_release(reinterpret_cast<ztx_handle *>(arg1),
+	    reinterpret_cast<size_t>(arg2));
 }
 
 struct mbuf *
@@ -227,7 +342,7 @@ m_getm2_zcopy(struct mbuf *m, struct uio *uio, int len, int how, short type,
 			return (NULL);
 		}
 
-		MEXTADD(mb, iov->iov_base, cnt, ztx_release, reinterpret_cast<void *>(zm), reinterpret_cast<void*>(cnt), 0, EXT_MOD_TYPE);
+		MEXTADD(mb, iov->iov_base, cnt, ztx_release, zm->zm_txhandle, reinterpret_cast<void*>(cnt), 0, EXT_MOD_TYPE);
 
 		iov->iov_base = (char *)iov->iov_base + cnt;
 		iov->iov_len -= cnt;
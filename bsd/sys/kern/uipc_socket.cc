@@ -273,6 +273,10 @@ sodealloc(struct socket *so)
     so->so_rcv.sb_hiwat = 0;
     so->so_snd.sb_hiwat = 0;
 
+	/* Pending zero-copy sends keep the ring alive until they complete */
+	if (so->so_ztx != nullptr)
+		zcopy_txring_put(so->so_ztx);
+
 #ifdef INET
 	/* FIXME: OSv - should this be supported? */
 # if 0
@@ -1276,6 +1280,93 @@ out_unlocked:
 	return (error);
 }
 
+/*
+ * Zero-copy counterpart of sosend_dgram(): the datagram is built out of
+ * external mbufs pointing into the caller's iovecs, so the whole datagram
+ * must fit in a single send and the buffers must not be touched until the
+ * send completes.
+ */
+int
+zsend_dgram(struct socket *so, struct bsd_sockaddr *addr, struct uio *uio,
+    struct zmsghdr *zm, int flags)
+{
+	long space;
+	ssize_t resid;
+	int error, dontroute;
+	struct mbuf *top = NULL;
+
+	KASSERT(so->so_type == SOCK_DGRAM, ("zsend_dgram: !SOCK_DGRAM"));
+	KASSERT(so->so_proto->pr_flags & PR_ATOMIC,
+	    ("zsend_dgram: !PR_ATOMIC"));
+	KASSERT(uio->uio_iov, ("iov is null on MSG_ZCOPY"));
+
+	resid = uio->uio_resid;
+	if (resid < 0) {
+		error = EINVAL;
+		goto out;
+	}
+
+	dontroute =
+	    (flags & MSG_DONTROUTE) && (so->so_options & SO_DONTROUTE) == 0;
+
+	SOCK_LOCK(so);
+	if (so->so_snd.sb_state & SBS_CANTSENDMORE) {
+		SOCK_UNLOCK(so);
+		error = EPIPE;
+		goto out;
+	}
+	if (so->so_error) {
+		error = so->so_error;
+		so->so_error = 0;
+		SOCK_UNLOCK(so);
+		goto out;
+	}
+	if ((so->so_state & SS_ISCONNECTED) == 0 && addr == NULL) {
+		if (so->so_proto->pr_flags & PR_CONNREQUIRED)
+			error = ENOTCONN;
+		else
+			error = EDESTADDRREQ;
+		SOCK_UNLOCK(so);
+		goto out;
+	}
+	space = sbspace(&so->so_snd);
+	SOCK_UNLOCK(so);
+	if (resid > space) {
+		error = EMSGSIZE;
+		goto out;
+	}
+	/*
+	 * No room is reserved in front of the data for protocol headers:
+	 * the user memory can't be written to, so udp_output() prepends
+	 * a header mbuf instead.
+	 */
+	top = m_uiotombuf_zcopy(uio, M_WAITOK, space, 0, 1,
+	    (M_PKTHDR | ((flags & MSG_EOR) ? M_EOR : 0)), zm);
+	if (top == NULL) {
+		error = EFAULT;	/* only possible error */
+		goto out;
+	}
+	KASSERT(uio->uio_resid == 0, ("zsend_dgram: resid != 0"));
+	if (dontroute) {
+		SOCK_LOCK(so);
+		so->so_options |= SO_DONTROUTE;
+		SOCK_UNLOCK(so);
+	}
+	VNET_SO_ASSERT(so);
+	error = (*so->so_proto->pr_usrreqs->pru_send)(so, 0, top, addr,
+	    NULL, NULL);
+	if (dontroute) {
+		SOCK_LOCK(so);
+		so->so_options &= ~SO_DONTROUTE;
+		SOCK_UNLOCK(so);
+	}
+	top = NULL;
+out:
+	if (top != NULL)
+		m_freem(top);
+	return (error);
+}
+
 int
 sosend(struct socket *so, struct bsd_sockaddr *addr, struct uio *uio,
     struct mbuf *top, struct mbuf *control, int flags, struct thread *td)
@@ -2164,6 +2255,119 @@ out:
 }
 
 
+/*
+ * Zero-copy counterpart of soreceive_dgram(): a single datagram is taken
+ * off the socket buffer and its data mbufs are loaned to the caller, one
+ * iovec per mbuf, until zcopy_rxgc() hands them back.  A datagram made
+ * of more mbufs than the caller supplied iovecs is truncated and
+ * MSG_TRUNC is reported.  Control messages are not passed up.
+ */
+int
+zreceive_dgram(struct socket *so, struct bsd_sockaddr **psa,
+    struct zmsghdr *zm, int *flagsp, ssize_t *bytes)
+{
+	struct mbuf *m, *m2, *last = NULL;
+	int flags, error, i, iovlen;
+	struct protosw *pr = so->so_proto;
+	struct mbuf *nextrecord;
+
+	KASSERT(zm->zm_msg.msg_iov, ("zreceive_dgram: msg_iov is null"));
+	KASSERT(zm->zm_msg.msg_iovlen, ("zreceive_dgram: msg_iovlen is 0"));
+	KASSERT(pr->pr_flags & PR_ATOMIC, ("zreceive_dgram: !atomic"));
+
+	zm->zm_rxhandle = nullptr;
+	iovlen = zm->zm_msg.msg_iovlen;
+	zm->zm_msg.msg_iovlen = 0;
+	*bytes = 0;
+	if (psa != NULL)
+		*psa = NULL;
+	if (flagsp != NULL)
+		flags = *flagsp &~ MSG_EOR;
+	else
+		flags = 0;
+
+	SOCK_LOCK(so);
+	while ((m = so->so_rcv.sb_mb) == NULL) {
+		KASSERT(so->so_rcv.sb_cc == 0,
+		    ("zreceive_dgram: sb_mb NULL but sb_cc %u",
+		    so->so_rcv.sb_cc));
+		if (so->so_error) {
+			error = so->so_error;
+			so->so_error = 0;
+			SOCK_UNLOCK(so);
+			return (error);
+		}
+		if (so->so_rcv.sb_state & SBS_CANTRCVMORE) {
+			SOCK_UNLOCK(so);
+			return (0);
+		}
+		if ((so->so_state & SS_NBIO) ||
+		    (flags & (MSG_DONTWAIT|MSG_NBIO))) {
+			SOCK_UNLOCK(so);
+			return (EWOULDBLOCK);
+		}
+		SBLASTRECORDCHK(&so->so_rcv);
+		SBLASTMBUFCHK(&so->so_rcv);
+		error = sbwait(so, &so->so_rcv);
+		if (error) {
+			SOCK_UNLOCK(so);
+			return (error);
+		}
+	}
+	SOCK_LOCK_ASSERT(so);
+
+	SBLASTRECORDCHK(&so->so_rcv);
+	SBLASTMBUFCHK(&so->so_rcv);
+	nextrecord = m->m_hdr.mh_nextpkt;
+	if (nextrecord == NULL) {
+		KASSERT(so->so_rcv.sb_lastrecord == m,
+		    ("zreceive_dgram: lastrecord != m"));
+	}
+
+	/*
+	 * Pull 'm' and its chain off the front of the packet queue.
+	 */
+	so->so_rcv.sb_mb = NULL;
+	sockbuf_pushsync(so, &so->so_rcv, nextrecord);
+	for (m2 = m; m2 != NULL; m2 = m2->m_hdr.mh_next)
+		sbfree(&so->so_rcv, m2);
+	SBLASTRECORDCHK(&so->so_rcv);
+	SBLASTMBUFCHK(&so->so_rcv);
+	SOCK_UNLOCK(so);
+
+	if (pr->pr_flags & PR_ADDR) {
+		KASSERT(m->m_hdr.mh_type == MT_SONAME,
+		    ("m->m_hdr.mh_type == %d", m->m_hdr.mh_type));
+		if (psa != NULL)
+			*psa = sodupbsd_sockaddr(mtod(m, struct bsd_sockaddr *),
+			    M_NOWAIT);
+		m = m_free(m);
+	}
+	while (m != NULL && m->m_hdr.mh_type == MT_CONTROL)
+		m = m_free(m);
+	if (m == NULL)
+		return (0);
+	KASSERT(m->m_hdr.mh_type == MT_DATA, ("zreceive_dgram: !data"));
+
+	zm->zm_rxhandle = m;
+	for (i = 0, m2 = m; m2 != NULL && i < iovlen;
+	    i++, m2 = m2->m_hdr.mh_next) {
+		zm->zm_msg.msg_iov[i].iov_base = mtod(m2, void *);
+		zm->zm_msg.msg_iov[i].iov_len = m2->m_hdr.mh_len;
+		*bytes += m2->m_hdr.mh_len;
+		last = m2;
+	}
+	zm->zm_msg.msg_iovlen = i;
+	if (m2 != NULL) {
+		flags |= MSG_TRUNC;
+		last->m_hdr.mh_next = NULL;
+		m_freem(m2);
+	}
+	if (flagsp != NULL)
+		*flagsp |= flags;
+	return (0);
+}
+
 /*
  * Optimized version of soreceive() for stream (TCP) sockets.
  */
@@ -53,11 +53,12 @@
 #include <bsd/sys/sys/socketvar.h>
 #include <osv/uio.h>
 #include <bsd/sys/net/vnet.h>
+#include <bsd/sys/compat/linux/linux_socket.h>
 
 #include <memory>
+#include <algorithm>
 #include <fs/fs.hh>
 
-#include <osv/defer.hh>
 #include <osv/mempool.hh>
 #include <osv/pagealloc.hh>
 #include <osv/zcopy.hh>
@@ -209,7 +210,25 @@ int
 kern_accept(int s, struct bsd_sockaddr *name,
     socklen_t *namelen, struct file **out_fp, int *out_fd)
 {
-	struct file *headfp, *nfp = NULL;
+	struct file *headfp;
+	int error;
+
+	error = getsock_cap(s, &headfp, NULL);
+	if (error)
+		return (error);
+	error = kern_accept_file(headfp, name, namelen, out_fp, out_fd);
+	fdrop(headfp);
+	return (error);
+}
+
+/*
+ * As kern_accept(), on a socket file the caller holds a reference on.
+ */
+int
+kern_accept_file(struct file *headfp, struct bsd_sockaddr *name,
+    socklen_t *namelen, struct file **out_fp, int *out_fd)
+{
+	struct file *nfp = NULL;
 	struct bsd_sockaddr *sa = NULL;
 	int error;
 	struct socket *head, *so;
@@ -221,9 +240,9 @@ kern_accept(int s, struct bsd_sockaddr *name,
 			return (EINVAL);
 	}
 
-	error = getsock_cap(s, &headfp, &fflag);
-	if (error)
-		return (error);
+	if (file_type(headfp) != DTYPE_SOCKET)
+		return (ENOTSOCK);
+	fflag = file_flags(headfp);
 	head = (socket*)file_data(headfp);
 	if ((head->so_options & SO_ACCEPTCONN) == 0) {
 		error = EINVAL;
@@ -331,7 +350,6 @@ done:
 	}
 	if (nfp != NULL)
 		fdrop(nfp);
-	fdrop(headfp);
 	return (error);
 }
 
@@ -481,6 +499,26 @@ kern_sendit(int s,
             ssize_t *bytes)
 {
 	struct file *fp;
+	int error;
+
+	error = getsock_cap(s, &fp, NULL);
+	if (error)
+		return (error);
+	error = kern_sendit_file(fp, mp, flags, control, bytes);
+	fdrop(fp);
+	return (error);
+}
+
+/*
+ * As kern_sendit(), on a socket file the caller holds a reference on.
+ */
+int
+kern_sendit_file(struct file *fp,
+                 struct msghdr *mp,
+                 int flags,
+                 struct mbuf *control,
+                 ssize_t *bytes)
+{
 	struct uio auio = {};
 	struct iovec *iov;
 	struct socket *so;
@@ -488,9 +526,8 @@ kern_sendit(int s,
 	int i, error;
 	ssize_t len;
 
-	error = getsock_cap(s, &fp, NULL);
-	if (error)
-		return (error);
+	if (file_type(fp) != DTYPE_SOCKET)
+		return (ENOTSOCK);
 	so = (struct socket *)file_data(fp);
 
 	// Create a local copy of the user's iovec - sosend() is going to change it!
@@ -531,7 +568,6 @@ kern_sendit(int s,
 	if (error == 0)
 	    *bytes = len - auio.uio_resid;
 bad:
-	fdrop(fp);
 	return (error);
 }
 
@@ -566,6 +602,27 @@ sys_sendmsg(int s, struct msghdr* msg, int flags, ssize_t* bytes)
 
 int
 kern_recvit(int s, struct msghdr *mp, struct mbuf **controlp, ssize_t* bytes)
+{
+	struct file *fp;
+	int error;
+
+	if (controlp != NULL)
+		*controlp = NULL;
+
+	error = getsock_cap(s, &fp, NULL);
+	if (error)
+		return (error);
+	error = kern_recvit_file(fp, mp, controlp, bytes);
+	fdrop(fp);
+	return (error);
+}
+
+/*
+ * As kern_recvit(), on a socket file the caller holds a reference on.
+ */
+int
+kern_recvit_file(struct file *fp, struct msghdr *mp, struct mbuf **controlp,
+    ssize_t* bytes)
 {
 	struct uio auio;
 	struct iovec *iov;
@@ -574,16 +631,14 @@ kern_recvit(int s, struct msghdr *mp, struct mbuf **controlp, ssize_t* bytes)
 	int error;
 	struct mbuf *m, *control = 0;
 	caddr_t ctlbuf;
-	struct file *fp;
 	struct socket *so;
 	struct bsd_sockaddr *fromsa = 0;
 
 	if (controlp != NULL)
 		*controlp = NULL;
 
-	error = getsock_cap(s, &fp, NULL);
-	if (error)
-		return (error);
+	if (file_type(fp) != DTYPE_SOCKET)
+		return (ENOTSOCK);
 	so = (socket*)file_data(fp);
 
 	// Create a local copy of the user's iovec - sorecieve() is going to change it!
@@ -598,10 +653,8 @@ kern_recvit(int s, struct msghdr *mp, struct mbuf **controlp, ssize_t* bytes)
 	auio.uio_resid = 0;
 	iov = mp->msg_iov;
 	for (i = 0; i < mp->msg_iovlen; i++, iov++) {
-		if ((auio.uio_resid += iov->iov_len) < 0) {
-			fdrop(fp);
+		if ((auio.uio_resid += iov->iov_len) < 0)
 			return (EINVAL);
-		}
 	}
 	len = auio.uio_resid;
 	error = soreceive(so, &fromsa, &auio, (struct mbuf **)0,
@@ -653,7 +706,6 @@ kern_recvit(int s, struct msghdr *mp, struct mbuf **controlp, ssize_t* bytes)
 		mp->msg_controllen = ctlbuf - (caddr_t)mp->msg_control;
 	}
 out:
-	fdrop(fp);
 	if (fromsa)
 		free(fromsa);
 
@@ -1015,6 +1067,47 @@ sockargs(struct mbuf **mp, caddr_t buf, int buflen, int type)
 	return (error);
 }
 
+/*
+ * Addresses in a zmsghdr use the Linux layout (16-bit family, no length
+ * byte): applications call the zcopy functions directly, not through the
+ * Linux compatibility layer.
+ */
+static int
+zcopy_getsockaddr(const struct msghdr *mp, struct bsd_sockaddr_storage *ss)
+{
+	struct bsd_sockaddr *sa = (struct bsd_sockaddr *)ss;
+
+	if (mp->msg_namelen < sizeof(u_short) || mp->msg_namelen > sizeof(*ss))
+		return (EINVAL);
+	memcpy(ss, mp->msg_name, mp->msg_namelen);
+	switch (*(const u_short *)mp->msg_name) {
+	case LINUX_AF_INET:
+		sa->sa_family = AF_INET;
+		break;
+	case LINUX_AF_INET6:
+		sa->sa_family = AF_INET6;
+		break;
+	default:
+		return (EAFNOSUPPORT);
+	}
+	sa->sa_len = mp->msg_namelen;
+	return (0);
+}
+
+static void
+zcopy_putsockaddr(struct msghdr *mp, struct bsd_sockaddr *sa)
+{
+	socklen_t len = 0;
+
+	if (sa != NULL && mp->msg_namelen >= sizeof(u_short)) {
+		len = MIN(mp->msg_namelen, sa->sa_len);
+		bcopy(sa, mp->msg_name, len);
+		*(u_short *)mp->msg_name = (sa->sa_family == AF_INET6) ?
+		    LINUX_AF_INET6 : sa->sa_family;
+	}
+	mp->msg_namelen = len;
+}
+
 ssize_t
 zcopy_tx(int s, struct zmsghdr *zm)
 {
@@ -1022,25 +1115,39 @@ zcopy_tx(int s, struct zmsghdr *zm)
 	struct uio auio = {};
 	struct iovec *iov;
 	struct socket *so;
-	int i, error, efd;
+	struct zcopy_txring *zr;
+	struct ztx_handle *zh;
+	struct bsd_sockaddr_storage ss;
+	struct bsd_sockaddr *to = NULL;
+	int i, error, efd = -1;
 	ssize_t len;
 	ssize_t bytes = 0;
 	auto mp = &zm->zm_msg;
-	struct ztx_handle *zh = new ztx_handle();
-
-	zm->zm_txhandle = zh;
-	efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
-	if (efd < 0)
-		return (efd);
-	auto close_efd = defer([efd] { close(efd); });
-	zm->zm_txfd = efd;
 
 	error = getsock_cap(s, &fp, NULL);
 	if (error)
 		return (error);
 	so = (struct socket *)file_data(fp);
-	if (so->so_type != SOCK_STREAM)
+	if (so->so_type != SOCK_STREAM && so->so_type != SOCK_DGRAM) {
+		fdrop(fp);
 		return (EINVAL);
+	}
+	if (so->so_type == SOCK_DGRAM && mp->msg_name != NULL) {
+		error = zcopy_getsockaddr(mp, &ss);
+		if (error) {
+			fdrop(fp);
+			return (error);
+		}
+		to = (struct bsd_sockaddr *)&ss;
+	}
+	zr = so->so_ztx;
+	if (zr == nullptr) {
+		efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (efd < 0) {
+			fdrop(fp);
+			return (efd);
+		}
+	}
 	// Create a local copy of the user's iovec - sosend() is going to change it!
 	assert(mp->msg_iovlen <= UIO_MAXIOV);
 	struct iovec uio_iov[mp->msg_iovlen];
@@ -1059,28 +1166,202 @@ zcopy_tx(int s, struct zmsghdr *zm)
 		}
 	}
 	len = auio.uio_resid;
-	zh->zh_remained = len;
-	error = zsend(so, &auio, zm, MSG_DONTWAIT);
-	if (error) {
-		if (auio.uio_resid != len && (error == ERESTART ||
-		    error == EINTR || error == EWOULDBLOCK))
-			error = 0;
-		bytes = error;
+
+	/*
+	 * The extra byte keeps the send from completing while zsend() is
+	 * still attaching user memory to mbufs; it is dropped below together
+	 * with whatever could not be sent.
+	 */
+	zh = ztx_handle_alloc();
+	zh->zh_remained = len + 1;
+	if (zr) {
+		zr->zr_refs++;
+		zh->zh_ring = zr;
+		/*
+		 * The sequence number must be in place before zsend(): an
+		 * mbuf may be freed, and complete the send, before it returns.
+		 */
+		zm->zm_txseq = zh->zh_seq = zr->zr_next++;
+	} else {
+		zh->zh_fd = efd;
+	}
+	zm->zm_txhandle = zh;
+	zm->zm_txfd = efd;
+	if (so->so_type == SOCK_DGRAM)
+		error = zsend_dgram(so, to, &auio, zm, MSG_DONTWAIT);
+	else
+		error = zsend(so, &auio, zm, MSG_DONTWAIT);
+	if (error && auio.uio_resid != len && (error == ERESTART ||
+	    error == EINTR || error == EWOULDBLOCK))
+		error = 0;
+	bytes = error ? error : len - auio.uio_resid;
+	if (error == 0 || auio.uio_resid != len) {
+		/*
+		 * Queued mbufs reference the handle, even if the send failed
+		 * part way: drop only our own reference and let the last mbuf
+		 * complete it.
+		 */
+		efd = -1;
+		ztx_handle_release(zh, auio.uio_resid + 1);
+	} else {
+		zm->zm_txhandle = nullptr;
+		zm->zm_txfd = -1;
+		/*
+		 * Later sends may already hold the following numbers, so this
+		 * one is reported as completed; that also drops its ring ref.
+		 */
+		if (zr)
+			zcopy_txring_complete(zr, zh->zh_seq);
+		ztx_handle_free(zh);
 	}
-	if (error == 0)
-	    bytes = len - auio.uio_resid;
 bad:
 	fdrop(fp);
-	if (bytes >= 0) {
-		close_efd.cancel();
-	}
+	if (efd >= 0)
+		close(efd);
 	return (bytes);
 }
 
 void
 zcopy_txclose(struct zmsghdr *zm)
 {
-	close(zm->zm_txfd);
+	/* Sends on a socket with a completion ring have no eventfd of their own */
+	if (zm->zm_txfd >= 0)
+		close(zm->zm_txfd);
+}
+
+int
+zcopy_txring_open(int s)
+{
+	struct file *fp;
+	struct socket *so;
+	int error, efd;
+
+	error = getsock_cap(s, &fp, NULL);
+	if (error) {
+		errno = error;
+		return (-1);
+	}
+	so = (struct socket *)file_data(fp);
+	if (so->so_type != SOCK_STREAM && so->so_type != SOCK_DGRAM) {
+		fdrop(fp);
+		errno = EINVAL;
+		return (-1);
+	}
+	efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (efd < 0) {
+		fdrop(fp);
+		return (-1);
+	}
+	SOCK_LOCK(so);
+	if (so->so_ztx == nullptr) {
+		so->so_ztx = new zcopy_txring(efd);
+		efd = -1;
+	}
+	error = so->so_ztx->zr_fd;
+	SOCK_UNLOCK(so);
+	fdrop(fp);
+	if (efd >= 0)
+		close(efd);
+	return (error);
+}
+
+ssize_t
+zcopy_txreap(int s, struct zcopy_range *ranges, size_t nranges)
+{
+	struct file *fp;
+	struct socket *so;
+	struct zcopy_txring *zr;
+	int error;
+	size_t n = 0;
+
+	error = getsock_cap(s, &fp, NULL);
+	if (error) {
+		errno = error;
+		return (-1);
+	}
+	so = (struct socket *)file_data(fp);
+	zr = so->so_ztx;
+	if (zr == nullptr) {
+		fdrop(fp);
+		errno = EINVAL;
+		return (-1);
+	}
+	WITH_LOCK(zr->zr_mtx) {
+		n = std::min(nranges, zr->zr_ranges.size());
+		std::copy_n(zr->zr_ranges.begin(), n, ranges);
+		zr->zr_ranges.erase(zr->zr_ranges.begin(),
+		    zr->zr_ranges.begin() + n);
+	}
+	fdrop(fp);
+	return (n);
+}
+
+ssize_t
+zcopy_sendpages(int s, void *base, size_t len, void (*done)(void *),
+    void *arg)
+{
+	struct file *fp;
+	ssize_t ret;
+	int error;
+
+	error = getsock_cap(s, &fp, NULL);
+	if (error) {
+		done(arg);
+		errno = error;
+		return (-1);
+	}
+	ret = zcopy_sendpages_file(fp, base, len, done, arg);
+	fdrop(fp);
+	return (ret);
+}
+
+ssize_t
+zcopy_sendpages_file(struct file *fp, void *base, size_t len,
+    void (*done)(void *), void *arg)
+{
+	struct socket *so;
+	struct ztx_handle *zh;
+	struct zmsghdr zm = {};
+	struct iovec iov = { base, len };
+	struct uio auio = {};
+	int error;
+
+	if (file_type(fp) != DTYPE_SOCKET) {
+		done(arg);
+		errno = ENOTSOCK;
+		return (-1);
+	}
+	so = (struct socket *)file_data(fp);
+	if (so->so_type != SOCK_STREAM) {
+		done(arg);
+		errno = EOPNOTSUPP;
+		return (-1);
+	}
+
+	auio.uio_iov = &iov;
+	auio.uio_iovcnt = 1;
+	auio.uio_rw = UIO_WRITE;
+	auio.uio_offset = 0;
+	auio.uio_resid = len;
+
+	/* Same bias as in zcopy_tx(): done() can't run before zsend() returns */
+	zh = ztx_handle_alloc();
+	zh->zh_remained = len + 1;
+	zh->zh_done = done;
+	zh->zh_arg = arg;
+	zm.zm_txhandle = zh;
+	zm.zm_txfd = -1;
+	error = zsend(so, &auio, &zm, 0);
+	if (error && auio.uio_resid != (ssize_t)len && (error == ERESTART ||
+	    error == EINTR || error == EWOULDBLOCK))
+		error = 0;
+	len -= auio.uio_resid;
+	ztx_handle_release(zh, auio.uio_resid + 1);
+	if (error) {
+		errno = error;
+		return (-1);
+	}
+	return (len);
 }
 
 ssize_t
@@ -1097,11 +1378,19 @@ zcopy_rx(int s, struct zmsghdr *zm)
 	if (error)
 		return (error);
 	so = (socket*)file_data(fp);
-	if (so->so_type != SOCK_STREAM)
-		return (EINVAL);
-
-	error = zreceive(so, &fromsa, zm, &flags, &bytes);
+	if (so->so_type == SOCK_DGRAM) {
+		error = zreceive_dgram(so, &fromsa, zm, &flags, &bytes);
+	} else if (so->so_type == SOCK_STREAM) {
+		error = zreceive(so, &fromsa, zm, &flags, &bytes);
+	} else {
+		error = EINVAL;
+	}
 	fdrop(fp);
+	if (error == 0 && zm->zm_msg.msg_name != NULL)
+		zcopy_putsockaddr(&zm->zm_msg, fromsa);
+	zm->zm_msg.msg_flags = ((flags & MSG_TRUNC) ? LINUX_MSG_TRUNC : 0) |
+	    ((flags & MSG_EOR) ? LINUX_MSG_EOR : 0) |
+	    ((flags & MSG_OOB) ? LINUX_MSG_OOB : 0);
 	if (fromsa)
 		free(fromsa);
 	if (error) {
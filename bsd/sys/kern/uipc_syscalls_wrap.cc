@@ -6,12 +6,54 @@
 #include <bsd/uipc_syscalls.h>
 #include <osv/debug.h>
 #include <osv/export.h>
+#include <osv/socket.hh>
 #include "libc/af_local.h"
 
 #include "libc/internal/libc.h"
 
 #define sock_d(...)		tprintf_d("socket-api", __VA_ARGS__);
 
+// AF_LOCAL sockets (af_local.cc) aren't BSD sockets: calls which set them
+// up try them first, while calls on the data path go to the network stack
+// first, and to af_local.cc only when it says the fd is not a socket.
+// The network stack rewrites a destination address in place, so a send to
+// an AF_LOCAL address goes straight to af_local.cc.
+static bool is_af_local_addr(const void *addr, socklen_t len)
+{
+	return addr && len >= sizeof(sa_family_t) &&
+		*(const sa_family_t *)addr == AF_LOCAL;
+}
+
+static int recvfrom_af_local(int fd, void *buf, size_t len, int flags,
+		void *addr, socklen_t *alen, ssize_t *bytes)
+{
+	struct iovec iov = { buf, len };
+	struct msghdr msg = {};
+	int error;
+
+	msg.msg_name = addr;
+	msg.msg_namelen = (addr && alen) ? *alen : 0;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	error = recvmsg_af_local(fd, &msg, flags, bytes);
+	if (!error && addr && alen)
+		*alen = msg.msg_namelen;
+	return error;
+}
+
+static int sendto_af_local(int fd, const void *buf, size_t len, int flags,
+		const void *addr, socklen_t alen, ssize_t *bytes)
+{
+	struct iovec iov = { (void *)buf, len };
+	struct msghdr msg = {};
+
+	msg.msg_name = (void *)addr;
+	msg.msg_namelen = alen;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	return sendmsg_af_local(fd, &msg, flags, bytes);
+}
+
 extern "C" OSV_LIBC_API
 int socketpair(int domain, int type, int protocol, int sv[2])
 {
@@ -40,7 +82,9 @@ int getsockname(int sockfd, struct bsd_sockaddr *addr, socklen_t *addrlen)
 
 	sock_d("getsockname(sockfd=%d, ...)", sockfd);
 
-	error = linux_getsockname(sockfd, addr, addrlen);
+	error = getsockname_af_local(sockfd, addr, addrlen);
+	if (error == ENOTSOCK)
+		error = linux_getsockname(sockfd, addr, addrlen);
 	if (error) {
 		sock_d("getsockname() failed, errno=%d", error);
 		errno = error;
@@ -57,7 +101,9 @@ int getpeername(int sockfd, struct bsd_sockaddr *addr, socklen_t *addrlen)
 
 	sock_d("getpeername(sockfd=%d, ...)", sockfd);
 
-	error = linux_getpeername(sockfd, addr, addrlen);
+	error = getpeername_af_local(sockfd, addr, addrlen);
+	if (error == ENOTSOCK)
+		error = linux_getpeername(sockfd, addr, addrlen);
 	if (error) {
 		sock_d("getpeername() failed, errno=%d", error);
 		errno = error;
@@ -74,7 +120,9 @@ int accept4(int fd, struct bsd_sockaddr *__restrict addr, socklen_t *__restrict
 
 	sock_d("accept4(fd=%d, ..., flg=%d)", fd, flg);
 
-	error = linux_accept4(fd, addr, len, &fd2, flg);
+	error = accept_af_local(fd, addr, len, flg, &fd2);
+	if (error == ENOTSOCK)
+		error = linux_accept4(fd, addr, len, &fd2, flg);
 	if (error) {
 		sock_d("accept4() failed, errno=%d", error);
 		errno = error;
@@ -91,7 +139,9 @@ int accept(int fd, struct bsd_sockaddr *__restrict addr, socklen_t *__restrict l
 
 	sock_d("accept(fd=%d, ...)", fd);
 
-	error = linux_accept(fd, addr, len, &fd2);
+	error = accept_af_local(fd, addr, len, 0, &fd2);
+	if (error == ENOTSOCK)
+		error = linux_accept(fd, addr, len, &fd2);
 	if (error) {
 		sock_d("accept() failed, errno=%d", error);
 		errno = error;
@@ -108,7 +158,9 @@ int bind(int fd, const struct bsd_sockaddr *addr, socklen_t len)
 
 	sock_d("bind(fd=%d, ...)", fd);
 
-	error = linux_bind(fd, (void *)addr, len);
+	error = bind_af_local(fd, addr, len);
+	if (error == ENOTSOCK)
+		error = linux_bind(fd, (void *)addr, len);
 	if (error) {
 		sock_d("bind() failed, errno=%d", error);
 		errno = error;
@@ -125,7 +177,9 @@ int connect(int fd, const struct bsd_sockaddr *addr, socklen_t len)
 
 	sock_d("connect(fd=%d, ...)", fd);
 
-	error = linux_connect(fd, (void *)addr, len);
+	error = connect_af_local(fd, addr, len);
+	if (error == ENOTSOCK)
+		error = linux_connect(fd, (void *)addr, len);
 	if (error) {
 		sock_d("connect() failed, errno=%d", error);
 		errno = error;
@@ -142,7 +196,9 @@ int listen(int fd, int backlog)
 
 	sock_d("listen(fd=%d, backlog=%d)", fd, backlog);
 
-	error = linux_listen(fd, backlog);
+	error = listen_af_local(fd, backlog);
+	if (error == ENOTSOCK)
+		error = linux_listen(fd, backlog);
 	if (error) {
 		sock_d("listen() failed, errno=%d", error);
 		errno = error;
@@ -163,6 +219,8 @@ ssize_t recvfrom(int fd, void *__restrict buf, size_t len, int flags,
 		len, flags);
 
 	error = linux_recvfrom(fd, (caddr_t)buf, len, flags, addr, alen, &bytes);
+	if (error == ENOTSOCK)
+		error = recvfrom_af_local(fd, buf, len, flags, addr, alen, &bytes);
 	if (error) {
 		sock_d("recvfrom() failed, errno=%d", error);
 		errno = error;
@@ -181,6 +239,8 @@ ssize_t recv(int fd, void *buf, size_t len, int flags)
 	sock_d("recv(fd=%d, buf=<uninit>, len=%d, flags=0x%x)", fd, len, flags);
 
 	error = linux_recv(fd, (caddr_t)buf, len, flags, &bytes);
+	if (error == ENOTSOCK)
+		error = recvfrom_af_local(fd, buf, len, flags, NULL, NULL, &bytes);
 	if (error) {
 		sock_d("recv() failed, errno=%d", error);
 		errno = error;
@@ -199,6 +259,8 @@ ssize_t recvmsg(int fd, struct msghdr *msg, int flags)
 	sock_d("recvmsg(fd=%d, msg=..., flags=0x%x)", fd, flags);
 
 	error = linux_recvmsg(fd, msg, flags, &bytes);
+	if (error == ENOTSOCK)
+		error = recvmsg_af_local(fd, msg, flags, &bytes);
 	if (error) {
 		sock_d("recvmsg() failed, errno=%d", error);
 		errno = error;
@@ -217,8 +279,13 @@ ssize_t sendto(int fd, const void *buf, size_t len, int flags,
 
 	sock_d("sendto(fd=%d, buf=..., len=%d, flags=0x%x, ...", fd, len, flags);
 
-	error = linux_sendto(fd, (caddr_t)buf, len, flags, (caddr_t)addr,
-			   alen, &bytes);
+	if (is_af_local_addr(addr, alen))
+		error = sendto_af_local(fd, buf, len, flags, addr, alen, &bytes);
+	else
+		error = linux_sendto(fd, (caddr_t)buf, len, flags, (caddr_t)addr,
+				   alen, &bytes);
+	if (error == ENOTSOCK)
+		error = sendto_af_local(fd, buf, len, flags, addr, alen, &bytes);
 	if (error) {
 		sock_d("sendto() failed, errno=%d", error);
 		errno = error;
@@ -237,6 +304,8 @@ ssize_t send(int fd, const void *buf, size_t len, int flags)
 	sock_d("send(fd=%d, buf=..., len=%d, flags=0x%x)", fd, len, flags)
 
 	error = linux_send(fd, (caddr_t)buf, len, flags, &bytes);
+	if (error == ENOTSOCK)
+		error = sendto_af_local(fd, buf, len, flags, NULL, 0, &bytes);
 	if (error) {
 		sock_d("send() failed, errno=%d", error);
 		errno = error;
@@ -254,7 +323,12 @@ ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
 
 	sock_d("sendmsg(fd=%d, msg=..., flags=0x%x)", fd, flags)
 
-	error = linux_sendmsg(fd, (struct msghdr *)msg, flags, &bytes);
+	if (is_af_local_addr(msg->msg_name, msg->msg_namelen))
+		error = sendmsg_af_local(fd, msg, flags, &bytes);
+	else
+		error = linux_sendmsg(fd, (struct msghdr *)msg, flags, &bytes);
+	if (error == ENOTSOCK)
+		error = sendmsg_af_local(fd, msg, flags, &bytes);
 	if (error) {
 		sock_d("sendmsg() failed, errno=%d", error);
 		errno = error;
@@ -273,6 +347,8 @@ int getsockopt(int fd, int level, int optname, void *__restrict optval,
 	sock_d("getsockopt(fd=%d, level=%d, optname=%d)", fd, level, optname);
 
 	error = linux_getsockopt(fd, level, optname, optval, optlen);
+	if (error == ENOTSOCK)
+		error = getsockopt_af_local(fd, level, optname, optval, optlen);
 	if (error) {
 		sock_d("getsockopt() failed, errno=%d", error);
 		errno = error;
@@ -291,6 +367,8 @@ int setsockopt(int fd, int level, int optname, const void *optval, socklen_t opt
 		fd, level, optname, *(int *)optval, optlen);
 
 	error = linux_setsockopt(fd, level, optname, (caddr_t)optval, optlen);
+	if (error == ENOTSOCK)
+		error = setsockopt_af_local(fd, level, optname, optval, optlen);
 	if (error) {
 		sock_d("setsockopt() failed, errno=%d", error);
 		errno = error;
@@ -330,7 +408,10 @@ int socket(int domain, int type, int protocol)
 
 	sock_d("socket(domain=%d, type=%d, protocol=%d)", domain, type, protocol);
 
-	error = linux_socket(domain, type, protocol, &s);
+	if (domain == AF_LOCAL)
+		error = socket_af_local(type, protocol, &s);
+	else
+		error = linux_socket(domain, type, protocol, &s);
 	if (error) {
 		sock_d("socket() failed, errno=%d", error);
 		errno = error;
@@ -339,3 +420,39 @@ int socket(int domain, int type, int protocol)
 
 	return s;
 }
+
+int sendmsg_file(struct file *fp, const struct msghdr *msg, int flags,
+    ssize_t *bytes)
+{
+	int error;
+
+	if (is_af_local_addr(msg->msg_name, msg->msg_namelen))
+		return sendmsg_af_local_file(fp, msg, flags, bytes);
+	error = linux_sendmsg_file(fp, (struct msghdr *)msg, flags, bytes);
+	if (error == ENOTSOCK)
+		error = sendmsg_af_local_file(fp, msg, flags, bytes);
+	return error;
+}
+
+int recvmsg_file(struct file *fp, struct msghdr *msg, int flags,
+    ssize_t *bytes)
+{
+	int error;
+
+	error = linux_recvmsg_file(fp, msg, flags, bytes);
+	if (error == ENOTSOCK)
+		error = recvmsg_af_local_file(fp, msg, flags, bytes);
+	return error;
+}
+
+int accept4_file(struct file *fp, void *addr, socklen_t *len, int flags,
+    int *out_fd)
+{
+	int error;
+
+	error = accept_af_local_file(fp, addr, len, flags, out_fd);
+	if (error == ENOTSOCK)
+		error = linux_accept4_file(fp, (struct bsd_sockaddr *)addr, len,
+		    out_fd, flags);
+	return error;
+}
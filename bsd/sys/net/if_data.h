@@ -82,5 +82,21 @@ static inline void if_update_wakeup_stats(wakeup_stats& stats,
     stats.packets_256 += (wakeup_packets >= 256);
 }
 
+/**
+ * Accumulate the wakeup_stats of one queue into the interface totals
+ * @param sum wakeup_stats struct to update
+ * @param stats wakeup_stats of a single queue
+ */
+static inline void if_add_wakeup_stats(wakeup_stats& sum,
+                                       const wakeup_stats& stats)
+{
+    sum.packets_8   += stats.packets_8;
+    sum.packets_16  += stats.packets_16;
+    sum.packets_32  += stats.packets_32;
+    sum.packets_64  += stats.packets_64;
+    sum.packets_128 += stats.packets_128;
+    sum.packets_256 += stats.packets_256;
+}
+
 
 #endif /* _NET_IF_DATA_H */
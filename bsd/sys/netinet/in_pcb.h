@@ -366,7 +366,7 @@ LIST_HEAD(inpcblbgrouphead, inpcblbgroup);
 #define INP_LOCK_INIT(inp, d, t)
 #define INP_LOCK_DESTROY(inp, d, t)
 #define INP_LOCK(inp)		mutex_lock(&(inp)->inp_lock)
-#define INP_TRY_LOCK(inp)	mutex_try_lock(&(inp)->inp_lock)
+#define INP_TRY_LOCK(inp)	mutex_trylock(&(inp)->inp_lock)
 #define INP_UNLOCK(inp)		mutex_unlock(&(inp)->inp_lock)
 #define	INP_LOCKED(inp)		mutex_owned(&(inp)->inp_lock)
 #define	INP_LOCK_ASSERT(inp)	assert(mutex_owned(&(inp)->inp_lock))
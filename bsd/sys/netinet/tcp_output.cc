@@ -481,6 +481,13 @@ after_sack_rexmit:
 		}
 	}
 
+	/*
+	 * A connection paired with its loopback peer hands its data over
+	 * directly (see tcp_loop_xfer()); only control segments go out.
+	 */
+	if (tp->t_loop != NULL)
+		len = 0;
+
 	/* len will be >= 0 after this point. */
 	KASSERT(len >= 0, ("[%s:%d]: len < 0", __func__, __LINE__));
 
@@ -755,7 +762,8 @@ dontupdate:
 	 * if window is nonzero, transmit what we can,
 	 * otherwise force out a byte.
 	 */
-	if (so->so_snd.sb_cc && !tcp_timer_active(tp, TT_REXMT) &&
+	if (so->so_snd.sb_cc && tp->t_loop == NULL &&
+	    !tcp_timer_active(tp, TT_REXMT) &&
 	    !tcp_timer_active(tp, TT_PERSIST)) {
 		tp->t_rxtshift = 0;
 		tcp_setpersist(tp);
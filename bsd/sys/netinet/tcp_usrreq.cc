@@ -713,6 +713,297 @@ out:
 	return (error);
 }
 
+/*
+ * Loopback short-circuit.  Once both ends of a connection over the loopback
+ * interface are established and idle, they are paired: data written to one
+ * end is moved straight from its send buffer to the receive buffer of the
+ * other, instead of being cut into segments, checksummed and run through
+ * ip_output(), the netisr and tcp_input().  The sequence numbers of both
+ * ends stay frozen while paired, so control segments (window updates,
+ * keepalives, FIN, RST) still go through the stack and remain valid, and
+ * unpairing simply resumes normal transmission of whatever is left in the
+ * send buffer.  The peer's receive buffer limits each transfer, and the
+ * reader pulls more in pru_rcvd(), so SO_RCVBUF and blocking writers work
+ * as before; a FIN is withheld by tcp_output() until the send buffer has
+ * drained.
+ */
+static int	tcp_loop_bypass = 1;
+SYSCTL_INT(_net_inet_tcp, OID_AUTO, loop_bypass, CTLFLAG_RW,
+    &tcp_loop_bypass, 0,
+    "Move data directly between the two ends of loopback connections");
+
+TRACEPOINT(trace_tcp_loop_pair, "inp=%p, peer=%p", struct inpcb *,
+    struct inpcb *);
+TRACEPOINT(trace_tcp_loop_unpair, "inp=%p, peer=%p", struct inpcb *,
+    struct inpcb *);
+TRACEPOINT(trace_tcp_loop_xfer, "inp=%p, peer=%p, len=%ld", struct inpcb *,
+    struct inpcb *, long);
+
+/*
+ * Whether a connection may be paired: established IPv4, with nothing in
+ * flight in either direction and nothing waiting to be sent.
+ */
+static bool
+tcp_loop_idle(struct tcpcb *tp)
+{
+	struct inpcb *inp = tp->t_inpcb;
+	struct socket *so = inp->inp_socket;
+
+	return (!(inp->inp_flags & (INP_TIMEWAIT | INP_DROPPED)) &&
+	    (inp->inp_vflag & INP_IPV6) == 0 &&
+	    so != NULL && !(so->so_state & SS_NOFDREF) &&
+	    tp->get_state() == TCPS_ESTABLISHED &&
+	    tp->t_loop == NULL && tp->nc == NULL &&
+	    tp->snd_una == tp->snd_max && tp->t_segqlen == 0 &&
+	    so->so_snd.sb_cc == 0 && so->so_oobmark == 0);
+}
+
+/*
+ * Whether a paired peer still has a connection to transfer data on.
+ */
+static bool
+tcp_loop_alive(struct inpcb *peer)
+{
+
+	return (!(peer->inp_flags & (INP_TIMEWAIT | INP_DROPPED)) &&
+	    intotcpcb(peer) != NULL && peer->inp_socket != NULL);
+}
+
+/*
+ * Lock the peer of a locked connection.  Locks are taken in address order,
+ * so our own lock may have to be dropped meanwhile; returns false, with
+ * only our own lock held, if we were dropped or the pairing changed while
+ * it was.
+ */
+static bool
+tcp_loop_lock(struct tcpcb *tp, struct inpcb *peer)
+{
+	struct inpcb *inp = tp->t_inpcb;
+
+	if (inp < peer) {
+		INP_LOCK(peer);
+		return (true);
+	}
+	if (INP_TRY_LOCK(peer))
+		return (true);
+	in_pcbref(peer);
+	INP_UNLOCK(inp);
+	INP_LOCK(peer);
+	INP_LOCK(inp);
+	if (in_pcbrele_locked(peer))
+		return (false);
+	if ((inp->inp_flags & INP_DROPPED) || tp->t_loop != peer) {
+		INP_UNLOCK(peer);
+		return (false);
+	}
+	return (true);
+}
+
+/*
+ * Forget the peer without locking it; its reference is dropped later.
+ */
+static void
+tcp_loop_forget(struct tcpcb *tp)
+{
+	struct inpcb *peer = tp->t_loop;
+
+	tp->t_loop = NULL;
+	trace_tcp_loop_unpair(tp->t_inpcb, peer);
+	async::run_later([peer] {
+		INP_LOCK(peer);
+		if (!in_pcbrele_locked(peer))
+			INP_UNLOCK(peer);
+	});
+}
+
+/*
+ * Break up a pair, with both ends locked; unlocks the peer.  Each end goes
+ * back to sending whatever its send buffer holds in segments; the caller
+ * takes care of its own end.
+ */
+static void
+tcp_loop_unpair(struct tcpcb *tp, struct inpcb *peer)
+{
+	struct inpcb *inp = tp->t_inpcb;
+	struct tcpcb *ptp = intotcpcb(peer);
+
+	trace_tcp_loop_unpair(inp, peer);
+	tp->t_loop = NULL;
+	if (ptp != NULL && ptp->t_loop == inp) {
+		ptp->t_loop = NULL;
+		/* Our socket holds another reference, so this can't free. */
+		in_pcbrele_locked(inp);
+		if (tcp_loop_alive(peer))
+			tcp_output(ptp);
+	}
+	if (!in_pcbrele_locked(peer))
+		INP_UNLOCK(peer);
+}
+
+/*
+ * Move as much of tp's send buffer as fits into the receive buffer of its
+ * peer, both locked.  Data sent after the peer shut down reading is
+ * dropped, as tcp_input() would.
+ */
+static void
+tcp_loop_xfer(struct tcpcb *tp, struct inpcb *peer)
+{
+	struct socket *so = tp->t_inpcb->inp_socket;
+	struct socket *pso = peer->inp_socket;
+	long len = so->so_snd.sb_cc;
+	struct mbuf *m = NULL;
+
+	if (!(pso->so_rcv.sb_state & SBS_CANTRCVMORE)) {
+		len = lmin(len, sbspace(&pso->so_rcv));
+		if (len > 0)
+			m = m_copy(so->so_snd.sb_mb, 0, len);
+		if (m == NULL)
+			len = 0;
+	}
+	if (len > 0) {
+		trace_tcp_loop_xfer(tp->t_inpcb, peer, len);
+		if (m != NULL) {
+			sbappendstream_locked(pso, &pso->so_rcv, m);
+			sorwakeup_locked(pso);
+		}
+		sbdrop_locked(so, &so->so_snd, len);
+		sowwakeup_locked(so);
+	}
+	/* Send the FIN tcp_output() held back until the data was gone. */
+	if (so->so_snd.sb_cc == 0 && (so->so_snd.sb_state & SBS_CANTSENDMORE) &&
+	    !(tp->t_flags & TF_SENTFIN))
+		tcp_output(tp);
+}
+
+/*
+ * Look for the other end of a new loopback connection and pair the two if
+ * both are idle.  Drops and retakes our own lock; the caller must check
+ * for INP_DROPPED afterwards.
+ */
+static void
+tcp_loop_pair(struct tcpcb *tp)
+{
+	struct inpcb *inp = tp->t_inpcb;
+	struct inpcb *peer, *first, *second;
+	struct tcpcb *ptp;
+
+	INP_UNLOCK(inp);
+	peer = in_pcblookup(&V_tcbinfo, inp->inp_laddr, inp->inp_lport,
+	    inp->inp_faddr, inp->inp_fport, INPLOOKUP_LOCKPCB, NULL);
+	if (peer == NULL || peer == inp) {
+		if (peer == NULL)
+			INP_LOCK(inp);
+		tp->t_flags |= TF_LOOPCHECKED;
+		return;
+	}
+	in_pcbref(peer);
+	INP_UNLOCK(peer);
+	first = inp < peer ? inp : peer;
+	second = inp < peer ? peer : inp;
+	INP_LOCK(first);
+	INP_LOCK(second);
+	if (in_pcbrele_locked(peer)) {
+		tp->t_flags |= TF_LOOPCHECKED;
+		return;
+	}
+	ptp = intotcpcb(peer);
+	if (!(inp->inp_flags & INP_DROPPED) && tcp_loop_alive(peer) &&
+	    tcp_loop_idle(tp) && tcp_loop_idle(ptp)) {
+		in_pcbref(peer);
+		in_pcbref(inp);
+		tp->t_loop = peer;
+		ptp->t_loop = inp;
+		tp->t_flags |= TF_LOOPCHECKED;
+		ptp->t_flags |= TF_LOOPCHECKED;
+		trace_tcp_loop_pair(inp, peer);
+	}
+	INP_UNLOCK(peer);
+}
+
+/*
+ * Break up the pair a connection is in, e.g. before sending urgent data or
+ * when its socket is closed, so that both ends send what they have left in
+ * segments.  May drop our lock; returns false if we were dropped meanwhile.
+ */
+static bool
+tcp_loop_stop(struct tcpcb *tp)
+{
+	struct inpcb *peer = tp->t_loop;
+
+	if (tcp_loop_lock(tp, peer))
+		tcp_loop_unpair(tp, peer);
+	else if (tp->t_loop == peer)
+		tcp_loop_forget(tp);
+	return (!(tp->t_inpcb->inp_flags & INP_DROPPED));
+}
+
+/*
+ * Hand newly sent data to the peer.  Data for a peer whose socket was
+ * closed goes in segments, for the peer to reset the connection.
+ */
+static int
+tcp_loop_output(struct tcpcb *tp)
+{
+	struct inpcb *peer = tp->t_loop;
+
+	if (!tcp_loop_lock(tp, peer)) {
+		if (tp->t_inpcb->inp_flags & INP_DROPPED)
+			return (ECONNRESET);
+		if (tp->t_loop == peer)
+			tcp_loop_forget(tp);
+		return (tcp_output(tp));
+	}
+	if (!tcp_loop_alive(peer) ||
+	    (peer->inp_socket->so_state & SS_NOFDREF) ||
+	    intotcpcb(peer)->t_loop != tp->t_inpcb) {
+		tcp_loop_unpair(tp, peer);
+		return (tcp_output(tp));
+	}
+	tcp_loop_xfer(tp, peer);
+	INP_UNLOCK(peer);
+	return (0);
+}
+
+/*
+ * After a read made room in our receive buffer, pull in what the peer has
+ * waiting to be sent.
+ */
+static void
+tcp_loop_input(struct tcpcb *tp)
+{
+	struct inpcb *inp = tp->t_inpcb;
+	struct inpcb *peer = tp->t_loop;
+
+	if (!tcp_loop_lock(tp, peer)) {
+		if (inp->inp_flags & INP_DROPPED)
+			return;
+		if (tp->t_loop == peer)
+			tcp_loop_forget(tp);
+		tcp_output(tp);
+		return;
+	}
+	if (!tcp_loop_alive(peer) || intotcpcb(peer)->t_loop != inp) {
+		tcp_loop_unpair(tp, peer);
+		tcp_output(tp);
+		return;
+	}
+	tcp_loop_xfer(intotcpcb(peer), inp);
+	INP_UNLOCK(peer);
+}
+
+/*
+ * Called when a tcpcb is discarded.  The peer is not locked here, so only
+ * our reference on it is dropped; the peer notices it is alone the next
+ * time it sends or reads.
+ */
+void
+tcp_loop_discard(struct tcpcb *tp)
+{
+
+	if (tp->t_loop != NULL)
+		tcp_loop_forget(tp);
+}
+
 /*
  * After a receive, possibly send window update to peer.
  */
@@ -733,7 +1024,10 @@ tcp_usr_rcvd(struct socket *so, int flags)
 	}
 	tp = intotcpcb(inp);
 	TCPDEBUG1();
-	tcp_output(tp);
+	if (tp->t_loop != NULL)
+		tcp_loop_input(tp);
+	else
+		tcp_output(tp);
 
 out:
 	TCPDEBUG2(PRU_RCVD);
@@ -794,6 +1088,20 @@ tcp_usr_send(struct socket *so, int flags, struct mbuf *m,
 		m_freem(control);	/* empty control, just free it */
 	}
 	if (!(flags & PRUS_OOB)) {
+		/*
+		 * Not with PRUS_EOF: pairing drops our lock, and the lookup
+		 * needs the pcbinfo lock we hold then.
+		 */
+		if (tcp_loop_bypass && !(tp->t_flags & TF_LOOPCHECKED) &&
+		    !(flags & PRUS_EOF) && tcp_loop_idle(tp)) {
+			tcp_loop_pair(tp);
+			if (inp->inp_flags & INP_DROPPED) {
+				if (m)
+					m_freem(m);
+				error = ECONNRESET;
+				goto out;
+			}
+		}
 		sbappendstream(so, &so->so_snd, m);
 		if (nam && tp->get_state() < TCPS_SYN_SENT) {
 			/*
@@ -827,6 +1135,10 @@ tcp_usr_send(struct socket *so, int flags, struct mbuf *m,
 			tcp_usrclosed(tp);
 		}
 		if (!(inp->inp_flags & INP_DROPPED)) {
+			if (tp->t_loop != NULL) {
+				error = tcp_loop_output(tp);
+				goto out;
+			}
 			if (flags & PRUS_MORETOCOME)
 				tp->t_flags |= TF_MORETOCOME;
 			error = tcp_output(tp);
@@ -837,6 +1149,12 @@ tcp_usr_send(struct socket *so, int flags, struct mbuf *m,
 		/*
 		 * XXXRW: PRUS_EOF not implemented with PRUS_OOB?
 		 */
+		/* Urgent data goes in segments, so stop bypassing. */
+		if (tp->t_loop != NULL && !tcp_loop_stop(tp)) {
+			m_freem(m);
+			error = ECONNRESET;
+			goto out;
+		}
 		if (sbspace(&so->so_snd) < -512) {
 			SOCK_UNLOCK(so);
 			m_freem(m);
@@ -946,6 +1264,9 @@ tcp_usr_close(struct socket *so)
 	 * If we still have full TCP state, and we're not dropped, initiate
 	 * a disconnect.
 	 */
+	if (!(inp->inp_flags & INP_TIMEWAIT) &&
+	    !(inp->inp_flags & INP_DROPPED) && intotcpcb(inp)->t_loop != NULL)
+		tcp_loop_stop(intotcpcb(inp));
 	if (!(inp->inp_flags & INP_TIMEWAIT) &&
 	    !(inp->inp_flags & INP_DROPPED)) {
 		tp = intotcpcb(inp);
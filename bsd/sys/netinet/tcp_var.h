@@ -224,6 +224,8 @@ public:
 	net_channel* nc;
 	struct ifnet* nc_intf;
 
+	struct inpcb *t_loop;		/* paired loopback peer, if any */
+
 	uint32_t t_ispare[8];		/* 5 UTO, 3 TBD */
 	void	*t_pspare2[4];		/* 4 TBD */
 	uint64_t _pad[6];		/* 6 TBD (1-2 CC/RTT?) */
@@ -273,6 +275,7 @@ public:
 #define	TF_ECN_SND_ECE	0x10000000	/* ECN ECE in queue */
 #define	TF_CONGRECOVERY	0x20000000	/* congestion recovery mode */
 #define	TF_WASCRECOVERY	0x40000000	/* was in congestion recovery */
+#define	TF_LOOPCHECKED	0x80000000	/* looked for a loopback peer */
 
 #define	IN_FASTRECOVERY(t_flags)	(t_flags & TF_FASTRECOVERY)
 #define	ENTER_FASTRECOVERY(t_flags)	t_flags |= TF_FASTRECOVERY
@@ -702,6 +705,7 @@ void	 tcp_flush_net_channel(tcpcb* tp);
 void	 tcp_setup_net_channel(tcpcb* tp, struct ifnet* intf);
 void	 tcp_teardown_net_channel(tcpcb* tp);
 void	 tcp_free_net_channel(tcpcb* tp);
+void	 tcp_loop_discard(struct tcpcb *);
 u_long	 tcp_maxmtu(struct in_conninfo *, int *);
 u_long	 tcp_maxmtu6(struct in_conninfo *, int *);
 void	 tcp_mss_update(struct tcpcb *, int, int, struct hc_metrics_lite *,
@@ -125,6 +125,8 @@ struct socket {
 	// a net channel only supports one consumer, so let others wait on a waitqueue instead
 	bool so_nc_busy = false;
 	waitqueue so_nc_wq;
+	/* completion ring for zero-copy sends, see zcopy_txring_open() */
+	struct zcopy_txring* so_ztx = nullptr;
 	/* FIXME: this is done for poll,
 	 * make sure there's only 1 ref to a fp */
 	struct file* fp;
@@ -358,6 +360,8 @@ int	soreceive_generic(struct socket *so, struct bsd_sockaddr **paddr,
 	    int *flagsp);
 int	zreceive(struct socket *so, struct bsd_sockaddr **paddr,
 	    struct zmsghdr *zm, int *flagsp, ssize_t *bytes);
+int	zreceive_dgram(struct socket *so, struct bsd_sockaddr **paddr,
+	    struct zmsghdr *zm, int *flagsp, ssize_t *bytes);
 int	soreserve(struct socket *so, u_long sndcc, u_long rcvcc);
 int	soreserve_internal(struct socket *so, u_long sndcc, u_long rcvcc);
 void	sorflush(struct socket *so);
@@ -372,6 +376,8 @@ int	sosend_generic(struct socket *so, struct bsd_sockaddr *addr,
 	    int flags, struct thread *td);
 int	zsend(struct socket *so, struct uio *uio, struct zmsghdr *zm,
 	    int flags);
+int	zsend_dgram(struct socket *so, struct bsd_sockaddr *addr,
+	    struct uio *uio, struct zmsghdr *zm, int flags);
 int	soshutdown(struct socket *so, int how);
 void	sotoxsocket(struct socket *so, struct xsocket *xso);
 void	soupcall_clear(struct socket *so, int which);
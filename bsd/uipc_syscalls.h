@@ -23,6 +23,12 @@ int kern_connect(int fd, struct bsd_sockaddr *sa);
 int kern_sendit(int s, struct msghdr *mp, int flags,
     struct mbuf *control, ssize_t *bytes);
 int kern_recvit(int s, struct msghdr *mp, struct mbuf **controlp, ssize_t* bytes);
+int kern_accept_file(struct file *headfp, struct bsd_sockaddr *name,
+    socklen_t *namelen, struct file **fp, int *out_fd);
+int kern_sendit_file(struct file *fp, struct msghdr *mp, int flags,
+    struct mbuf *control, ssize_t *bytes);
+int kern_recvit_file(struct file *fp, struct msghdr *mp,
+    struct mbuf **controlp, ssize_t* bytes);
 int kern_setsockopt(int s, int level, int name, void *val, socklen_t valsize);
 int kern_getsockopt(int s, int level, int name, void *val, socklen_t *valsize);
 int kern_socketpair(int domain, int type, int protocol, int *rsv);
@@ -69,6 +75,12 @@ int linux_getsockopt(int s, int level, int name, void *val, socklen_t *valsize);
 int linux_socketpair(int domain, int type, int protocol, int* rsv);
 int linux_getsockname(int s, struct bsd_sockaddr *addr, socklen_t *addrlen);
 int linux_getpeername(int s, struct bsd_sockaddr *addr, socklen_t *addrlen);
+int linux_accept4_file(struct file *fp, struct bsd_sockaddr *name,
+    socklen_t *namelen, int *out_fd, int flags);
+int linux_sendmsg_file(struct file *fp, struct msghdr* msg, int flags,
+    ssize_t* bytes);
+int linux_recvmsg_file(struct file *fp, struct msghdr *msg, int flags,
+    ssize_t* bytes);
 
 __END_DECLS
 
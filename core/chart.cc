@@ -4,6 +4,7 @@
 #include "drivers/clock.hh"
 #include <osv/barrier.hh>
 #include <osv/boot.hh>
+#include <string.h>
 
 double boot_time_chart::to_msec(u64 time)
 {
@@ -33,6 +34,9 @@ void boot_time_chart::event(int event_idx, const char *str)
 
 void boot_time_chart::event(int event_idx, const char *str, u64 stamp)
 {
+    if (event_idx >= max_events) {
+        return;
+    }
     arrays[event_idx].str = str;
     arrays[event_idx].stamp = stamp;
 }
@@ -43,15 +47,36 @@ void boot_time_chart::print_chart()
         debug("Skipping bootchart: please run this with a clocksource that can do ticks/nanoseconds conversion.\n");
         return;
     }
-    int events = _event;
+    int events = _event < max_events ? _event : max_events;
     for (auto i = 1; i < events; ++i) {
         print_one_time(i);
     }
+    int drivers = _driver_events.load();
+    if (drivers > max_driver_events) {
+        drivers = max_driver_events;
+    }
+    auto initial = arrays[0].stamp;
+    for (auto i = 0; i < drivers; ++i) {
+        auto& d = driver_arrays[i];
+        printf("\t\tdriver %s: %.2fms, (took %.2fms)\n", d.name,
+               to_msec(d.start - initial), to_msec(d.end - d.start));
+    }
+}
+
+void boot_time_chart::driver_event(const char *name, u64 start, u64 end)
+{
+    auto i = _driver_events.fetch_add(1, std::memory_order_relaxed);
+    if (i >= max_driver_events) {
+        return;
+    }
+    strlcpy(driver_arrays[i].name, name, sizeof(driver_arrays[i].name));
+    driver_arrays[i].start = start;
+    driver_arrays[i].end = end;
 }
 
 void boot_time_chart::print_total_time()
 {
-    auto last = arrays[_event - 1].stamp;
+    auto last = arrays[(_event < max_events ? _event : max_events) - 1].stamp;
     auto initial = arrays[0].stamp;
     printf("Booted up in %.2f ms\n", to_msec(last - initial));
 }
@@ -66,6 +66,13 @@ void dhcp_start(bool wait)
     net_dhcp_worker.start(wait);
 }
 
+// Wait for an IP after dhcp_start(false), so the boot can do other work
+// (e.g., mount the root filesystem) while the DHCP exchange goes on.
+void dhcp_wait()
+{
+    net_dhcp_worker.wait();
+}
+
 // Send DHCP release, for example at shutdown.
 void dhcp_release()
 {
@@ -786,25 +793,42 @@ namespace dhcp {
             }
 
             if (wait) {
-                dhcp_i("Waiting for IP...");
-                _waiter = sched::thread::current();
-
-                sched::timer t(*sched::thread::current());
-                using namespace osv::clock::literals;
-                t.set(3_s);
-
-                sched::thread::wait_until([&]{ return _have_ip || t.expired(); });
-                _waiter = nullptr;
+                _wait_for_ip();
             }
         } while (!_have_ip && wait);
     }
 
+    // Wait a few seconds for an IP, and return whether we got one.
+    bool dhcp_worker::_wait_for_ip()
+    {
+        dhcp_i("Waiting for IP...");
+        _waiter = sched::thread::current();
+
+        sched::timer t(*sched::thread::current());
+        using namespace osv::clock::literals;
+        t.set(3_s);
+
+        sched::thread::wait_until([&]{ return _have_ip || t.expired(); });
+        _waiter = nullptr;
+        return _have_ip;
+    }
+
     void dhcp_worker::start(bool wait)
     {
         // FIXME: clear routing table (use case run dhclient 2nd time)
         _send_and_wait(wait, &dhcp_interface_state::discover);
     }
 
+    void dhcp_worker::wait()
+    {
+        // Like start(true): if no answer comes, discover again.
+        while (!_wait_for_ip()) {
+            for (auto &it: _universe) {
+                it.second->discover();
+            }
+        }
+    }
+
     void dhcp_worker::release()
     {
         for (auto &it: _universe) {
@@ -17,12 +17,12 @@
 #include <osv/file.h>
 #include <osv/poll.h>
 #include <fs/fs.hh>
-#include <boost/lockfree/queue.hpp>
-#include <boost/lockfree/policies.hpp>
+#include <boost/intrusive/set.hpp>
+#include <boost/intrusive/list.hpp>
 
 #include <osv/debug.hh>
 #include <osv/export.h>
-#include <unordered_map>
+#include <osv/rcu.hh>
 #include <boost/range/algorithm/find.hpp>
 #include <algorithm>
 
@@ -57,31 +57,102 @@ inline uint32_t events_poll_to_epoll(uint32_t e)
     return e;
 }
 
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1U << 28)
+#endif
+// The only flags allowed along with EPOLLEXCLUSIVE, as in Linux
+constexpr uint32_t EXCLUSIVE_OK = EPOLLIN | EPOLLOUT | EPOLLRDNORM | EPOLLRDBAND |
+        EPOLLWRNORM | EPOLLWRBAND | EPOLLERR | EPOLLHUP | EPOLLET | EPOLLEXCLUSIVE;
+
+// One registration of a file in an epoll. It is linked into the epoll's
+// registration set for its lifetime, and into the epoll's ready list while
+// it may have events to report, so a wakeup never allocates and
+// epoll_wait() only looks at the files which did something.
+struct epoll_item {
+    epoll_item(epoll_key k, const epoll_event& e)
+        : key(k), event(e), exclusive(e.events & EPOLLEXCLUSIVE) {}
+    const epoll_key key;
+    // protected by the epoll's f_lock:
+    epoll_event event;
+    boost::intrusive::set_member_hook<> registered_link;
+    const bool exclusive;
+    // protected by the epoll's _activity_lock:
+    boost::intrusive::list_member_hook<
+        boost::intrusive::link_mode<boost::intrusive::auto_unlink>> ready_link;
+    enum class state : uint8_t {
+        idle,       // not on the ready list
+        ready,      // on the ready list
+        taken,      // being reported by epoll_wait()
+        rewoken,    // taken, and woken again meanwhile
+    } ready_state = state::idle;
+    bool dead = false;
+    // wakeups from rcu context, see epoll_file::wake_in_rcu()
+    std::atomic<bool> queued = { false };
+    epoll_item* next_queued = nullptr;
+};
+
+struct epoll_item_less {
+    static bool less(const epoll_key& a, const epoll_key& b) {
+        return a._file < b._file || (a._file == b._file && a._fd < b._fd);
+    }
+    bool operator()(const epoll_item& a, const epoll_item& b) const {
+        return less(a.key, b.key);
+    }
+    bool operator()(const epoll_key& a, const epoll_item& b) const {
+        return less(a, b.key);
+    }
+    bool operator()(const epoll_item& a, const epoll_key& b) const {
+        return less(a.key, b);
+    }
+};
+
 class epoll_file final : public special_file {
 
     // lock ordering (fp == some file being polled):
     //    f_lock > fp->f_lock
     //    fp->f_lock > _activity_lock
-    // we never hold both f_lock and activity_lock.
+    //    f_lock > _activity_lock
+
+    using registration_set = boost::intrusive::set<epoll_item,
+        boost::intrusive::member_hook<epoll_item, boost::intrusive::set_member_hook<>,
+                                      &epoll_item::registered_link>,
+        boost::intrusive::compare<epoll_item_less>>;
+    using ready_list = boost::intrusive::list<epoll_item,
+        boost::intrusive::member_hook<epoll_item,
+            boost::intrusive::list_member_hook<
+                boost::intrusive::link_mode<boost::intrusive::auto_unlink>>,
+            &epoll_item::ready_link>,
+        boost::intrusive::constant_time_size<false>>;
+    using state = epoll_item::state;
 
     // protected by f_lock:
-    std::unordered_map<epoll_key, epoll_event> map;
+    registration_set _registered;
     mutex _activity_lock;
     // below, all protected by _activity_lock:
-    std::unordered_set<epoll_key> _activity;
+    ready_list _ready;
     waitqueue _waiters;
-    boost::lockfree::queue<epoll_key, boost::lockfree::fixed_sized<true>> _activity_ring{512};
-    std::atomic<bool> _activity_ring_overflow = { false };
+    // Items woken from rcu context, which cannot take _activity_lock, are
+    // pushed here lock-free and moved to _ready by the waiter. An item is
+    // pushed at most once until then, so the stack cannot overflow.
+    std::atomic<epoll_item*> _queued = { nullptr };
     sched::thread_handle _activity_ring_owner;
+    // threads in wait(), for choosing whom an EPOLLEXCLUSIVE event goes to
+    std::atomic<unsigned> _waiting = { 0 };
 public:
     epoll_file()
         : special_file(0, DTYPE_UNSPEC)
     {
     }
+    virtual ~epoll_file() {
+        // Pushes racing with close() are over by now
+        flush_queued();
+    }
     virtual int close() override {
         WITH_LOCK(f_lock) {
-            for (auto& e : map) {
-                e.first._file->epoll_del({ this, e.first });
+            while (!_registered.empty()) {
+                auto& item = *_registered.begin();
+                item.key._file->epoll_del({ this, item.key, &item });
+                remove(item);
             }
         }
         return 0;
@@ -89,15 +160,20 @@ public:
     int add(epoll_key key, struct epoll_event *event)
     {
         auto fp = key._file;
+        if ((event->events & EPOLLEXCLUSIVE) &&
+            ((event->events & ~EXCLUSIVE_OK) || dynamic_cast<epoll_file*>(fp))) {
+            return EINVAL;
+        }
         WITH_LOCK(f_lock) {
-            if (map.count(key)) {
+            if (_registered.find(key, epoll_item_less()) != _registered.end()) {
                 return EEXIST;
             }
-            map.emplace(key, *event);
-            fp->epoll_add({ this, key});
-        }
-        if (fp->poll(events_epoll_to_poll(event->events))) {
-            wake(key);
+            auto item = new epoll_item(key, *event);
+            _registered.insert(*item);
+            fp->epoll_add({ this, key, item });
+            if (fp->poll(events_epoll_to_poll(event->events))) {
+                wake(item);
+            }
         }
         return 0;
     }
@@ -105,29 +181,49 @@ public:
     {
         auto fp = key._file;
         WITH_LOCK(f_lock) {
-            try {
-                map.at(key) = *event;
-            } catch (std::out_of_range &e) {
+            auto i = _registered.find(key, epoll_item_less());
+            if (i == _registered.end()) {
                 return ENOENT;
             }
-            fp->epoll_add({ this, key });
-        }
-        if (fp->poll(events_epoll_to_poll(event->events))) {
-            wake(key);
+            if (i->exclusive || (event->events & EPOLLEXCLUSIVE)) {
+                return EINVAL;
+            }
+            i->event = *event;
+            fp->epoll_add({ this, key, &*i });
+            if (fp->poll(events_epoll_to_poll(event->events))) {
+                wake(&*i);
+            }
         }
         return 0;
     }
     int del(epoll_key key)
     {
         WITH_LOCK(f_lock) {
-            if (map.erase(key)) {
-                key._file->epoll_del({ this, key });
-                return 0;
-            } else {
+            auto i = _registered.find(key, epoll_item_less());
+            if (i == _registered.end()) {
                 return ENOENT;
             }
+            key._file->epoll_del({ this, key, &*i });
+            remove(*i);
+            return 0;
+        }
+    }
+    // Called with f_lock held, once the file no longer wakes the item
+    void remove(epoll_item& item)
+    {
+        _registered.erase(_registered.iterator_to(item));
+        WITH_LOCK(_activity_lock) {
+            item.ready_link.unlink();
+            item.dead = true;
+            // An item still on _queued is freed by whoever pops it
+            if (!item.queued.exchange(true, std::memory_order_acq_rel)) {
+                osv::rcu_dispose(&item);
+            }
         }
     }
+    bool has_waiters() const {
+        return _waiting.load(std::memory_order_relaxed) != 0;
+    }
     int wait(struct epoll_event *events, int maxevents, int timeout_ms)
     {
         auto tmo = parse_poll_timeout(timeout_ms);
@@ -140,32 +236,36 @@ public:
             while (!tmr.expired() && nr == 0) {
                 if (tmo) {
                     _activity_ring_owner.reset(*sched::thread::current());
+                    _waiting.fetch_add(1, std::memory_order_relaxed);
                     sched::thread::wait_for(_activity_lock,
                             _waiters,
                             tmr,
-                            [&] { return !_activity.empty(); },
-                            [&] { return !_activity_ring.empty(); },
-                            [&] { return _activity_ring_overflow.load(std::memory_order_relaxed); }
+                            [&] { return !_ready.empty(); },
+                            [&] { return _queued.load(std::memory_order_relaxed) != nullptr; }
                     );
+                    _waiting.fetch_sub(1, std::memory_order_relaxed);
                     _activity_ring_owner.clear();
                 }
 
-                flush_activity_ring();
-                // We need to drop _activity_lock and take f_lock in process_activity(),
-                // so move _activity to local storage for processing.
-                auto activity = std::move(_activity);
-                assert(_activity.empty());
-                DROP_LOCK(_activity_lock) {
-                    nr = process_activity(activity, events, maxevents);
-                }
-                // move back !EPOLLET back to main storage
-                if (_activity.empty()) {
-                    // nothing happened, move entire set back in
-                    _activity = std::move(activity);
-                } else {
-                    // move item by item (realistically a copy)
-                    std::move(activity.begin(), activity.end(),
-                            std::inserter(_activity, _activity.begin()));
+                flush_queued();
+                // events pushed from rcu context only wake up one waiter, so
+                // wake up all the rest now. we need to do this even if no
+                // events were received, since if we exit, then
+                // _activity_ring_owner will remain unset.
+                _waiters.wake_all(_activity_lock);
+
+                // We need to drop _activity_lock and take f_lock in
+                // process_activity(), so take the ready items out; wakeups
+                // meanwhile mark them rewoken instead of queueing them again.
+                if (!_ready.empty()) {
+                    ready_list activity;
+                    for (auto& item : _ready) {
+                        item.ready_state = state::taken;
+                    }
+                    activity.splice(activity.end(), _ready);
+                    DROP_LOCK(_activity_lock) {
+                        nr = process_activity(activity, events, maxevents);
+                    }
                 }
                 if (!tmo) {
                     break;
@@ -174,76 +274,106 @@ public:
         }
         return nr;
     }
-    int process_activity(std::unordered_set<epoll_key>& activity,
-                         epoll_event* events, int maxevents) {
+    int process_activity(ready_list& activity, epoll_event* events, int maxevents) {
         int nr = 0;
+        ready_list again, done;
         WITH_LOCK(f_lock) {
-            auto i = activity.begin();
-            while (i != activity.end() && nr < maxevents) {
-                epoll_key key = *i;
-                auto found = map.find(key);
-                auto cur = i++;
-                if (found == map.end()) {
-                    activity.erase(cur);
-                    continue; // raced
-                }
-                epoll_event& evt = found->second;
+            // items del()eted meanwhile have unlinked themselves
+            while (!activity.empty() && nr < maxevents) {
+                auto& item = activity.front();
+                activity.pop_front();
+                epoll_event& evt = item.event;
                 int active = 0;
                 if (evt.events) {
-                    active = key._file->poll(events_epoll_to_poll(evt.events));
+                    active = item.key._file->poll(events_epoll_to_poll(evt.events));
                 }
                 active = events_poll_to_epoll(active);
-                if (!active || (evt.events & EPOLLET)) {
-                    activity.erase(cur);
+                if (!active || (evt.events & (EPOLLET | EPOLLONESHOT))) {
+                    done.push_back(item);
                 } else {
-                    key._file->epoll_add({ this, key });
+                    // level triggered: report it again until it is drained
+                    again.push_back(item);
+                    item.key._file->epoll_add({ this, item.key, &item });
                 }
                 if (!active) {
                     continue;
                 }
                 if (evt.events & EPOLLONESHOT) {
                     evt.events = 0;
-                    key._file->epoll_del({ this, key });
+                    item.key._file->epoll_del({ this, item.key, &item });
                 }
-                trace_epoll_ready(key._fd, key._file, active);
+                trace_epoll_ready(item.key._fd, item.key._file, active);
                 events[nr].data = evt.data;
                 events[nr].events = active;
                 ++nr;
             }
+            WITH_LOCK(_activity_lock) {
+                // What didn't fit in events[] stays first in line, and what
+                // was reported goes to the back, so busy files don't starve
+                // the others.
+                for (auto& item : activity) {
+                    item.ready_state = state::ready;
+                }
+                _ready.splice(_ready.begin(), activity);
+                for (auto& item : again) {
+                    item.ready_state = state::ready;
+                }
+                _ready.splice(_ready.end(), again);
+                while (!done.empty()) {
+                    auto& item = done.front();
+                    done.pop_front();
+                    if (item.ready_state == state::rewoken) {
+                        item.ready_state = state::ready;
+                        _ready.push_back(item);
+                    } else {
+                        item.ready_state = state::idle;
+                    }
+                }
+            }
         }
         return nr;
     }
-    void flush_activity_ring() {
-        epoll_key ep;
-        while (_activity_ring.pop(ep)) {
-            _activity.insert(ep);
+    // Called with _activity_lock held; returns whether the item became ready
+    bool make_ready(epoll_item* item) {
+        switch (item->ready_state) {
+        case state::idle:
+            item->ready_state = state::ready;
+            _ready.push_back(*item);
+            return true;
+        case state::taken:
+            item->ready_state = state::rewoken;
+            return false;
+        default:
+            return false;
         }
-        if (_activity_ring_overflow.load(std::memory_order_relaxed)) {
-            _activity_ring_overflow.store(false, std::memory_order_relaxed);
-            for (auto&& x : map) {
-                _activity.insert(x.first);
+    }
+    void flush_queued() {
+        auto item = _queued.exchange(nullptr, std::memory_order_acquire);
+        while (item) {
+            auto next = item->next_queued;
+            if (item->dead) {
+                osv::rcu_dispose(item);
+            } else {
+                item->queued.store(false, std::memory_order_release);
+                make_ready(item);
             }
+            item = next;
         }
-        // events on _activity_ring only wake up one waiter, so wake up all the rest  now.
-        // we need to do this even if no events were received, since if we exit, then
-        // _activity_ring_owner will remain unset.
-        _waiters.wake_all(_activity_lock);
     }
-    void wake(epoll_key key) {
-        if (_activity_ring.push(key)) {
-            _activity_ring_owner.wake();
-            return;
-        }
+    void wake(epoll_item* item) {
         WITH_LOCK(_activity_lock) {
-            auto ins = _activity.insert(key);
-            if (ins.second) {
+            if (!item->dead && make_ready(item)) {
                 _waiters.wake_all(_activity_lock);
             }
         }
     }
-    void wake_in_rcu(epoll_key key) {
-        if (!_activity_ring.push(key)) {
-            _activity_ring_overflow.store(true, std::memory_order_relaxed);
+    void wake_in_rcu(epoll_item* item) {
+        if (!item->queued.exchange(true, std::memory_order_acq_rel)) {
+            auto head = _queued.load(std::memory_order_relaxed);
+            do {
+                item->next_queued = head;
+            } while (!_queued.compare_exchange_weak(head, item,
+                        std::memory_order_release, std::memory_order_relaxed));
         }
         _activity_ring_owner.wake_from_kernel_or_with_irq_disabled();
     }
@@ -362,10 +492,28 @@ void epoll_file_closed(epoll_ptr ptr)
 
 void epoll_wake(const epoll_ptr& ep)
 {
-    ep.epoll->wake(ep.key);
+    ep.epoll->wake(ep.item);
 }
 
 void epoll_wake_in_rcu(const epoll_ptr& ep)
 {
-    ep.epoll->wake_in_rcu(ep.key);
+    ep.epoll->wake_in_rcu(ep.item);
+}
+
+void epoll_wake_all(const std::vector<epoll_ptr>& eps)
+{
+    // Of the epolls registered with EPOLLEXCLUSIVE, only one is woken,
+    // preferably one with a thread waiting for it.
+    const epoll_ptr* exclusive = nullptr;
+    for (auto&& ep : eps) {
+        if (!ep.item->exclusive) {
+            epoll_wake(ep);
+        } else if (!exclusive ||
+                   (!exclusive->epoll->has_waiters() && ep.epoll->has_waiters())) {
+            exclusive = &ep;
+        }
+    }
+    if (exclusive) {
+        epoll_wake(*exclusive);
+    }
 }
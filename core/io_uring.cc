@@ -0,0 +1,1085 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Linux io_uring: submission and completion queues in memory shared with
+// the application, which maps them from the ring's file descriptor.
+//
+// Submission queue entries are copied out of the ring when consumed, by
+// io_uring_enter() or, with IORING_SETUP_SQPOLL, by a kernel thread which
+// watches the queue so the application does not need to enter at all.
+// Each request is then dispatched by what it operates on:
+//
+//  - sockets, pipes and other pollable files are tried without blocking.
+//    Requests which would block are handed to the ring's poller thread,
+//    which installs a poll request on the file and retries them when the
+//    file becomes ready. Timeouts are kept by the same thread;
+//  - sector-aligned reads and writes of block devices go straight to the
+//    device's strategy routine as bios;
+//  - anything else (files on ZFS, ROFS etc., fsync) runs the synchronous
+//    VFS calls on a small pool of worker threads.
+//
+// Completions are posted to the completion queue as they happen, kept on
+// an overflow list while it is full, and optionally signal an eventfd.
+
+#include <osv/io_uring.h>
+
+#include <osv/file.h>
+#include <osv/poll.h>
+#include <osv/vnode.h>
+#include <osv/dentry.h>
+#include <osv/device.h>
+#include <osv/bio.h>
+#include <osv/mmu.hh>
+#include <osv/mutex.h>
+#include <osv/condvar.h>
+#include <osv/sched.hh>
+#include <osv/clock.hh>
+#include <osv/rcu.hh>
+#include <osv/ilog2.hh>
+#include <osv/trace.hh>
+#include <osv/async.hh>
+#include <osv/contiguous_alloc.hh>
+#include <osv/debug.hh>
+#include <osv/socket.hh>
+#include <fs/vfs/vfs.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <string.h>
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+TRACEPOINT(trace_io_uring_setup, "fd=%d entries=%u cq_entries=%u flags=0x%x", int, unsigned, unsigned, unsigned);
+TRACEPOINT(trace_io_uring_submit, "ring=%p op=%d fd=%d user_data=0x%lx", void*, int, int, uint64_t);
+TRACEPOINT(trace_io_uring_complete, "ring=%p user_data=0x%lx res=%d", void*, uint64_t, int);
+
+namespace {
+
+const unsigned max_entries = 32768;
+const unsigned default_sq_idle_ms = 1000;
+
+// The part of the shared memory at IORING_OFF_SQ_RING (and, since we
+// offer IORING_FEAT_SINGLE_MMAP, at IORING_OFF_CQ_RING too). The
+// submission queue's index array follows the completion queue entries.
+struct io_rings {
+    std::atomic<uint32_t> sq_head;
+    std::atomic<uint32_t> sq_tail;
+    uint32_t sq_ring_mask;
+    uint32_t sq_ring_entries;
+    std::atomic<uint32_t> sq_flags;
+    uint32_t sq_dropped;
+    std::atomic<uint32_t> cq_head CACHELINE_ALIGNED;
+    std::atomic<uint32_t> cq_tail;
+    uint32_t cq_ring_mask;
+    uint32_t cq_ring_entries;
+    uint32_t cq_overflow;
+    uint32_t cq_flags;
+    io_uring_cqe cqes[0] CACHELINE_ALIGNED;
+};
+
+class io_uring_file;
+
+struct io_uring_req {
+    io_uring_file* ring;
+    // Copied at submission, so the application may reuse the slot at once
+    io_uring_sqe sqe;
+    fileref fp;
+    std::vector<iovec> iov;
+    // Events to wait for when the request would block
+    int events = 0;
+    std::unique_ptr<pollreq> preq;
+    // For IORING_OP_TIMEOUT: the expiry, and the number of completions
+    // after which it completes early (0 for none)
+    osv::clock::uptime::time_point deadline;
+    uint64_t target = 0;
+    // bios not yet completed, for requests sent to a block device
+    std::atomic<unsigned> bios {0};
+    std::atomic<bool> bio_error {false};
+    size_t bytes = 0;
+};
+
+bool is_write(uint8_t op)
+{
+    return op == IORING_OP_WRITE || op == IORING_OP_WRITEV || op == IORING_OP_SEND;
+}
+
+class io_uring_file final : public special_file {
+public:
+    io_uring_file(unsigned entries, unsigned cq_entries, io_uring_params* p);
+    virtual ~io_uring_file();
+    virtual int close() override;
+    virtual int stat(struct stat* buf) override;
+    virtual int poll(int events) override;
+    virtual std::unique_ptr<mmu::file_vma> mmap(addr_range range, unsigned flags, unsigned perm, off_t offset) override;
+    virtual bool map_page(uintptr_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pte, bool write, bool shared) override;
+    virtual bool map_page(uintptr_t offset, mmu::hw_ptep<1> ptep, mmu::pt_element<1> pte, bool write, bool shared) override;
+    virtual bool put_page(void *addr, uintptr_t offset, mmu::hw_ptep<0> ptep) override;
+    virtual bool put_page(void *addr, uintptr_t offset, mmu::hw_ptep<1> ptep) override;
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+    int set_eventfd(fileref fp);
+    void complete(io_uring_req* req, int res);
+    void complete_bio(io_uring_req* req, int res);
+private:
+    unsigned submit(unsigned to_submit);
+    void submit_one(const io_uring_sqe& sqe);
+    void dispatch(io_uring_req* req);
+    void post(uint64_t user_data, int res, bool counted = true);
+    fileref post_cqe(uint64_t user_data, int res, bool counted);
+    void signal(const fileref& eventfd);
+    void release(io_uring_req* req);
+    void flush_overflow();
+    unsigned cq_ready();
+    void park(io_uring_req* req);
+    void poller();
+    void sq_poll();
+    void* page(uintptr_t offset);
+
+    unsigned _sq_entries;
+    unsigned _cq_entries;
+    size_t _rings_size;
+    size_t _sqes_size;
+    io_rings* _rings;
+    uint32_t* _sq_array;
+    io_uring_sqe* _sqes;
+
+    // Serializes consumers of the submission queue
+    mutex _sq_lock;
+    // Our copy of the head, the shared one is only written
+    uint32_t _sq_head = 0;
+    std::unique_ptr<sched::thread> _sq_thread;
+    condvar _sq_cond;
+    std::chrono::milliseconds _sq_idle;
+    bool _sq_kicked = false;
+    bool _sq_stop = false;
+
+    mutex _cq_lock;
+    condvar _cq_cond;
+    // Completions which did not fit in the completion queue
+    std::deque<io_uring_cqe> _overflow;
+    fileref _eventfd;
+    // Requests submitted and not yet completed
+    unsigned _pending = 0;
+    // Completions posted, not counting timeouts
+    std::atomic<uint64_t> _completions {0};
+
+    mutex _poll_lock;
+    std::unique_ptr<sched::thread> _poller;
+    // Handed to the poller and not yet picked up by it
+    std::vector<io_uring_req*> _incoming;
+    std::atomic<unsigned> _count_timeouts {0};
+    bool _poll_kick = false;
+    bool _poll_stop = false;
+};
+
+// Reads and writes of pollable files, sends, receives, accepts and polls.
+// Returns false if the request would block.
+bool try_nonblock(io_uring_req* req, int& res)
+{
+    auto& sqe = req->sqe;
+    auto fp = req->fp.get();
+    if (sqe.opcode == IORING_OP_POLL_ADD) {
+        res = fp->poll(req->events);
+        return res != 0;
+    }
+    bool socket_io = sqe.opcode == IORING_OP_SEND || sqe.opcode == IORING_OP_RECV ||
+                     (fp->f_type == DTYPE_SOCKET && sqe.opcode != IORING_OP_ACCEPT);
+    if (socket_io) {
+        struct msghdr msg = {};
+        msg.msg_iov = req->iov.data();
+        msg.msg_iovlen = req->iov.size();
+        int flags = MSG_DONTWAIT;
+        if (sqe.opcode == IORING_OP_SEND || sqe.opcode == IORING_OP_RECV) {
+            flags |= sqe.msg_flags;
+        }
+        // Through the file we hold, the descriptor may have been closed
+        // or reused since the request was submitted. The network stack
+        // takes the receive flags from the msghdr.
+        ssize_t n = 0;
+        int error;
+        if (is_write(sqe.opcode)) {
+            error = sendmsg_file(fp, &msg, flags | MSG_NOSIGNAL, &n);
+        } else {
+            msg.msg_flags = flags;
+            error = recvmsg_file(fp, &msg, flags, &n);
+        }
+        if (error == EAGAIN || error == EWOULDBLOCK) {
+            return false;
+        }
+        res = error ? -error : n;
+        return true;
+    }
+    // Files we cannot ask not to block are only called once they poll
+    // ready, so they block only if another reader or writer raced us
+    if (!fp->poll(req->events)) {
+        return false;
+    }
+    if (sqe.opcode == IORING_OP_ACCEPT) {
+        int fd;
+        int error = accept4_file(fp, reinterpret_cast<void*>(sqe.addr),
+                                 reinterpret_cast<socklen_t*>(sqe.addr2),
+                                 sqe.accept_flags, &fd);
+        res = error ? -error : fd;
+        return true;
+    }
+    size_t count = 0;
+    int error = is_write(sqe.opcode) ?
+            sys_write(fp, req->iov.data(), req->iov.size(), -1, &count) :
+            sys_read(fp, req->iov.data(), req->iov.size(), -1, &count);
+    res = (error && !count) ? -error : count;
+    return true;
+}
+
+// The synchronous VFS path
+int execute(io_uring_req* req)
+{
+    // -1 is the file's current position, like Linux's RW_CUR_POS
+    off_t offset = req->sqe.off;
+    size_t count = 0;
+    int error;
+    switch (req->sqe.opcode) {
+    case IORING_OP_READ:
+    case IORING_OP_READV:
+        error = sys_read(req->fp.get(), req->iov.data(), req->iov.size(), offset, &count);
+        break;
+    case IORING_OP_WRITE:
+    case IORING_OP_WRITEV:
+        error = sys_write(req->fp.get(), req->iov.data(), req->iov.size(), offset, &count);
+        break;
+    case IORING_OP_FSYNC:
+        error = sys_fsync(req->fp.get());
+        break;
+    default:
+        error = EINVAL;
+        break;
+    }
+    return (error && !count) ? -error : count;
+}
+
+class io_uring_workers {
+public:
+    void queue(io_uring_req* req) {
+        WITH_LOCK(_lock) {
+            if (_threads.empty()) {
+                start();
+            }
+            _queue.push_back(req);
+            _cond.wake_one();
+        }
+    }
+private:
+    void start() {
+        unsigned n = std::min<unsigned>(sched::cpus.size(), 8);
+        for (unsigned i = 0; i < n; i++) {
+            _threads.emplace_back(sched::thread::make([this] { work(); },
+                sched::thread::attr().name("io_uring-wq" + std::to_string(i))));
+            _threads.back()->start();
+        }
+    }
+    void work() {
+        for (;;) {
+            io_uring_req* req;
+            WITH_LOCK(_lock) {
+                _cond.wait_until(_lock, [&] { return !_queue.empty(); });
+                req = _queue.front();
+                _queue.pop_front();
+            }
+            req->ring->complete(req, execute(req));
+        }
+    }
+    mutex _lock;
+    condvar _cond;
+    std::deque<io_uring_req*> _queue;
+    std::vector<std::unique_ptr<sched::thread>> _threads;
+};
+
+// Never destroyed, its threads run until shutdown
+io_uring_workers* workers = new io_uring_workers;
+
+void io_uring_bio_done(struct bio* bio)
+{
+    auto req = static_cast<io_uring_req*>(bio->bio_caller1);
+    if (bio->bio_flags & BIO_ERROR) {
+        req->bio_error.store(true, std::memory_order_relaxed);
+    }
+    destroy_bio(bio);
+    if (req->bios.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        req->ring->complete_bio(req, req->bio_error.load(std::memory_order_relaxed) ? -EIO : req->bytes);
+    }
+}
+
+const size_t sector_size = 512;
+
+// Returns the device if the request can go straight to it as bios: a read
+// or write of whole sectors, at a given offset, within the device
+struct device* block_device(io_uring_req* req)
+{
+    struct dentry* dp = file_dentry(req->fp.get());
+    if (!dp || !dp->d_vnode || dp->d_vnode->v_type != VBLK) {
+        return nullptr;
+    }
+    auto dev = static_cast<struct device*>(dp->d_vnode->v_data);
+    off_t offset = req->sqe.off;
+    if (offset < 0 || offset % sector_size) {
+        return nullptr;
+    }
+    size_t bytes = 0;
+    for (auto& v : req->iov) {
+        if (v.iov_len % sector_size) {
+            return nullptr;
+        }
+        bytes += v.iov_len;
+    }
+    if (offset + (off_t)bytes > dev->size) {
+        return nullptr;
+    }
+    req->bytes = bytes;
+    return dev;
+}
+
+void start_bios(io_uring_req* req, struct device* dev)
+{
+    std::vector<struct bio*> bios;
+    off_t offset = req->sqe.off;
+    for (auto& v : req->iov) {
+        if (!v.iov_len) {
+            continue;
+        }
+        struct bio* bio = alloc_bio();
+        bio->bio_cmd = is_write(req->sqe.opcode) ? BIO_WRITE : BIO_READ;
+        bio->bio_dev = dev;
+        bio->bio_data = v.iov_base;
+        bio->bio_offset = offset;
+        bio->bio_bcount = v.iov_len;
+        bio->bio_caller1 = req;
+        bio->bio_done = io_uring_bio_done;
+        bios.push_back(bio);
+        offset += v.iov_len;
+    }
+    if (bios.empty()) {
+        req->ring->complete(req, 0);
+        return;
+    }
+    // All counted before the first one can complete
+    req->bios.store(bios.size(), std::memory_order_relaxed);
+    for (auto bio : bios) {
+        dev->driver->devops->strategy(bio);
+    }
+}
+
+io_uring_file::io_uring_file(unsigned entries, unsigned cq_entries, io_uring_params* p)
+    : special_file(FREAD | FWRITE, DTYPE_UNSPEC)
+    , _sq_entries(entries)
+    , _cq_entries(cq_entries)
+    , _sq_idle(p->sq_thread_idle ? p->sq_thread_idle : default_sq_idle_ms)
+{
+    size_t array_off = offsetof(io_rings, cqes) + cq_entries * sizeof(io_uring_cqe);
+    _rings_size = align_up(array_off + entries * sizeof(uint32_t), mmu::page_size);
+    _sqes_size = align_up(entries * sizeof(io_uring_sqe), mmu::page_size);
+    void* rings = memory::alloc_phys_contiguous_aligned(_rings_size, mmu::page_size);
+    memset(rings, 0, _rings_size);
+    _rings = new (rings) io_rings;
+    _sq_array = reinterpret_cast<uint32_t*>(static_cast<char*>(rings) + array_off);
+    _sqes = static_cast<io_uring_sqe*>(
+            memory::alloc_phys_contiguous_aligned(_sqes_size, mmu::page_size));
+    memset(_sqes, 0, _sqes_size);
+
+    _rings->sq_ring_mask = entries - 1;
+    _rings->sq_ring_entries = entries;
+    _rings->cq_ring_mask = cq_entries - 1;
+    _rings->cq_ring_entries = cq_entries;
+
+    p->sq_entries = entries;
+    p->cq_entries = cq_entries;
+    p->features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+                  IORING_FEAT_SUBMIT_STABLE | IORING_FEAT_RW_CUR_POS |
+                  IORING_FEAT_POLL_32BITS;
+    memset(&p->sq_off, 0, sizeof(p->sq_off));
+    p->sq_off.head = offsetof(io_rings, sq_head);
+    p->sq_off.tail = offsetof(io_rings, sq_tail);
+    p->sq_off.ring_mask = offsetof(io_rings, sq_ring_mask);
+    p->sq_off.ring_entries = offsetof(io_rings, sq_ring_entries);
+    p->sq_off.flags = offsetof(io_rings, sq_flags);
+    p->sq_off.dropped = offsetof(io_rings, sq_dropped);
+    p->sq_off.array = array_off;
+    memset(&p->cq_off, 0, sizeof(p->cq_off));
+    p->cq_off.head = offsetof(io_rings, cq_head);
+    p->cq_off.tail = offsetof(io_rings, cq_tail);
+    p->cq_off.ring_mask = offsetof(io_rings, cq_ring_mask);
+    p->cq_off.ring_entries = offsetof(io_rings, cq_ring_entries);
+    p->cq_off.overflow = offsetof(io_rings, cq_overflow);
+    p->cq_off.cqes = offsetof(io_rings, cqes);
+    p->cq_off.flags = offsetof(io_rings, cq_flags);
+
+    if (p->flags & IORING_SETUP_SQPOLL) {
+        auto attr = sched::thread::attr().name("io_uring-sq");
+        if (p->flags & IORING_SETUP_SQ_AFF) {
+            attr.pin(sched::cpus[p->sq_thread_cpu]);
+        }
+        _sq_thread.reset(sched::thread::make([this] { sq_poll(); }, attr));
+        _sq_thread->start();
+    }
+}
+
+io_uring_file::~io_uring_file()
+{
+    memory::free_phys_contiguous_aligned(_sqes);
+    memory::free_phys_contiguous_aligned(_rings);
+}
+
+int io_uring_file::close()
+{
+    if (_sq_thread) {
+        WITH_LOCK(_sq_lock) {
+            _sq_stop = true;
+            _sq_cond.wake_one();
+        }
+        _sq_thread->join();
+    }
+    // Requests waiting to be polled or timing out are cancelled
+    WITH_LOCK(_poll_lock) {
+        _poll_stop = true;
+        if (_poller) {
+            _poller->wake();
+        }
+    }
+    if (_poller) {
+        _poller->join();
+    }
+    // The others can't be called back, wait for them
+    WITH_LOCK(_cq_lock) {
+        while (_pending) {
+            _cq_cond.wait(&_cq_lock);
+        }
+        _eventfd.reset();
+    }
+    return 0;
+}
+
+int io_uring_file::stat(struct stat* buf)
+{
+    buf->st_size = IORING_OFF_SQES + _sqes_size;
+    return 0;
+}
+
+int io_uring_file::poll(int events)
+{
+    int revents = 0;
+    WITH_LOCK(_cq_lock) {
+        if (cq_ready() || !_overflow.empty()) {
+            revents |= POLLIN | POLLRDNORM;
+        }
+    }
+    if (_rings->sq_tail.load(std::memory_order_acquire) -
+            _rings->sq_head.load(std::memory_order_relaxed) < _sq_entries) {
+        revents |= POLLOUT | POLLWRNORM;
+    }
+    return revents & events;
+}
+
+std::unique_ptr<mmu::file_vma> io_uring_file::mmap(addr_range range, unsigned flags, unsigned perm, off_t offset)
+{
+    size_t size;
+    switch (offset) {
+    case IORING_OFF_SQ_RING:
+    case IORING_OFF_CQ_RING:
+        size = _rings_size;
+        break;
+    case IORING_OFF_SQES:
+        size = _sqes_size;
+        break;
+    default:
+        throw make_error(EINVAL);
+    }
+    if (range.end() - range.start() > size) {
+        throw make_error(EINVAL);
+    }
+    return mmu::map_file_mmap(this, range, flags, perm, offset);
+}
+
+void* io_uring_file::page(uintptr_t offset)
+{
+    if (offset >= IORING_OFF_SQES) {
+        return reinterpret_cast<char*>(_sqes) + offset - IORING_OFF_SQES;
+    }
+    if (offset >= IORING_OFF_CQ_RING) {
+        offset -= IORING_OFF_CQ_RING;
+    }
+    return reinterpret_cast<char*>(_rings) + offset;
+}
+
+bool io_uring_file::map_page(uintptr_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pte, bool write, bool shared)
+{
+    return mmu::write_pte(page(offset), ptep, pte);
+}
+
+bool io_uring_file::map_page(uintptr_t offset, mmu::hw_ptep<1> ptep, mmu::pt_element<1> pte, bool write, bool shared)
+{
+    // file_vma maps small pages only
+    abort("io_uring: huge page mapping of the rings\n");
+}
+
+bool io_uring_file::put_page(void *addr, uintptr_t offset, mmu::hw_ptep<0> ptep) {return false;}
+bool io_uring_file::put_page(void *addr, uintptr_t offset, mmu::hw_ptep<1> ptep) {return false;}
+
+unsigned io_uring_file::cq_ready()
+{
+    return _rings->cq_tail.load(std::memory_order_relaxed) -
+           _rings->cq_head.load(std::memory_order_acquire);
+}
+
+// Moves completions which overflowed into the queue as it has room.
+// Called with _cq_lock held.
+void io_uring_file::flush_overflow()
+{
+    auto tail = _rings->cq_tail.load(std::memory_order_relaxed);
+    while (!_overflow.empty() && cq_ready() < _cq_entries) {
+        _rings->cqes[tail & (_cq_entries - 1)] = _overflow.front();
+        _overflow.pop_front();
+        _rings->cq_tail.store(++tail, std::memory_order_release);
+    }
+    if (_overflow.empty()) {
+        _rings->sq_flags.fetch_and(~IORING_SQ_CQ_OVERFLOW, std::memory_order_relaxed);
+    }
+}
+
+void io_uring_file::post(uint64_t user_data, int res, bool counted)
+{
+    signal(post_cqe(user_data, res, counted));
+}
+
+// Queues a completion, returning the eventfd to signal for it if any
+fileref io_uring_file::post_cqe(uint64_t user_data, int res, bool counted)
+{
+    fileref eventfd;
+    WITH_LOCK(_cq_lock) {
+        io_uring_cqe cqe{user_data, res, 0};
+        if (_overflow.empty() && cq_ready() < _cq_entries) {
+            auto tail = _rings->cq_tail.load(std::memory_order_relaxed);
+            _rings->cqes[tail & (_cq_entries - 1)] = cqe;
+            _rings->cq_tail.store(tail + 1, std::memory_order_release);
+        } else {
+            _overflow.push_back(cqe);
+            _rings->sq_flags.fetch_or(IORING_SQ_CQ_OVERFLOW, std::memory_order_relaxed);
+        }
+        _cq_cond.wake_all();
+        eventfd = _eventfd;
+    }
+    if (counted) {
+        _completions.fetch_add(1, std::memory_order_relaxed);
+        // Timeouts waiting for a number of completions are checked by the poller
+        if (_count_timeouts.load(std::memory_order_relaxed)) {
+            WITH_LOCK(_poll_lock) {
+                _poll_kick = true;
+                _poller->wake();
+            }
+        }
+    }
+    return eventfd;
+}
+
+void io_uring_file::signal(const fileref& eventfd)
+{
+    if (eventfd) {
+        uint64_t one = 1;
+        iovec iov{&one, sizeof(one)};
+        size_t count;
+        sys_write(eventfd.get(), &iov, 1, -1, &count);
+    }
+    poll_wake(this, POLLIN | POLLRDNORM);
+}
+
+void io_uring_file::complete(io_uring_req* req, int res)
+{
+    trace_io_uring_complete(this, req->sqe.user_data, res);
+    post(req->sqe.user_data, res, req->sqe.opcode != IORING_OP_TIMEOUT);
+    release(req);
+}
+
+// For bios, completed from the driver's completion path: only the entry
+// is posted there, while signalling the eventfd and dropping the request's
+// file, which may sleep or run a file's close, are left to an async worker.
+// The request stays pending until then, so the ring outlives it.
+void io_uring_file::complete_bio(io_uring_req* req, int res)
+{
+    trace_io_uring_complete(this, req->sqe.user_data, res);
+    auto eventfd = post_cqe(req->sqe.user_data, res, true);
+    async::run_later([this, req, eventfd] {
+        signal(eventfd);
+        release(req);
+    });
+}
+
+void io_uring_file::release(io_uring_req* req)
+{
+    delete req;
+    WITH_LOCK(_cq_lock) {
+        if (--_pending == 0) {
+            _cq_cond.wake_all();
+        }
+    }
+}
+
+int io_uring_file::set_eventfd(fileref fp)
+{
+    WITH_LOCK(_cq_lock) {
+        if (fp && _eventfd) {
+            return EBUSY;
+        }
+        if (!fp && !_eventfd) {
+            return ENXIO;
+        }
+        _eventfd = fp;
+    }
+    return 0;
+}
+
+// Consumes up to to_submit entries of the submission queue. Called with
+// _sq_lock held.
+unsigned io_uring_file::submit(unsigned to_submit)
+{
+    auto tail = _rings->sq_tail.load(std::memory_order_acquire);
+    unsigned n = 0;
+    while (n < to_submit && _sq_head != tail) {
+        auto index = _sq_array[_sq_head & (_sq_entries - 1)];
+        _sq_head++;
+        if (index >= _sq_entries) {
+            _rings->sq_dropped++;
+            continue;
+        }
+        io_uring_sqe sqe = _sqes[index];
+        _rings->sq_head.store(_sq_head, std::memory_order_release);
+        submit_one(sqe);
+        n++;
+    }
+    _rings->sq_head.store(_sq_head, std::memory_order_release);
+    return n;
+}
+
+void io_uring_file::submit_one(const io_uring_sqe& sqe)
+{
+    trace_io_uring_submit(this, sqe.opcode, sqe.fd, sqe.user_data);
+
+    // Links, drains and registered files are not supported
+    if (sqe.flags & ~IOSQE_ASYNC) {
+        post(sqe.user_data, -EINVAL);
+        return;
+    }
+    std::unique_ptr<io_uring_req> req(new io_uring_req);
+    req->ring = this;
+    req->sqe = sqe;
+
+    switch (sqe.opcode) {
+    case IORING_OP_NOP:
+        post(sqe.user_data, 0);
+        return;
+    case IORING_OP_TIMEOUT: {
+        if (sqe.len != 1 || (sqe.timeout_flags & ~IORING_TIMEOUT_ABS)) {
+            post(sqe.user_data, -EINVAL);
+            return;
+        }
+        auto ts = reinterpret_cast<const struct timespec*>(sqe.addr);
+        auto t = std::chrono::seconds(ts->tv_sec) + std::chrono::nanoseconds(ts->tv_nsec);
+        if (sqe.timeout_flags & IORING_TIMEOUT_ABS) {
+            req->deadline = osv::clock::uptime::time_point(t);
+        } else {
+            req->deadline = osv::clock::uptime::now() + t;
+        }
+        if (sqe.off) {
+            req->target = _completions.load(std::memory_order_relaxed) + sqe.off;
+        }
+        WITH_LOCK(_cq_lock) {
+            _pending++;
+        }
+        park(req.release());
+        return;
+    }
+    case IORING_OP_READ:
+    case IORING_OP_WRITE:
+    case IORING_OP_SEND:
+    case IORING_OP_RECV:
+        req->iov.push_back({reinterpret_cast<void*>(sqe.addr), sqe.len});
+        break;
+    case IORING_OP_READV:
+    case IORING_OP_WRITEV: {
+        auto iov = reinterpret_cast<const iovec*>(sqe.addr);
+        req->iov.assign(iov, iov + sqe.len);
+        break;
+    }
+    case IORING_OP_POLL_ADD:
+        // The events which can't be requested are always reported
+        req->events = sqe.poll32_events | POLLERR | POLLHUP | POLLNVAL;
+        break;
+    case IORING_OP_FSYNC:
+    case IORING_OP_ACCEPT:
+        break;
+    default:
+        post(sqe.user_data, -EINVAL);
+        return;
+    }
+    if (sqe.opcode != IORING_OP_POLL_ADD) {
+        req->events = is_write(sqe.opcode) ? POLLOUT : POLLIN;
+    }
+
+    struct file* fp;
+    if (fget(sqe.fd, &fp)) {
+        post(sqe.user_data, -EBADF);
+        return;
+    }
+    req->fp = fileref(fp, false);
+    WITH_LOCK(_cq_lock) {
+        _pending++;
+    }
+    dispatch(req.release());
+}
+
+void io_uring_file::dispatch(io_uring_req* req)
+{
+    auto op = req->sqe.opcode;
+    if (op == IORING_OP_FSYNC) {
+        workers->queue(req);
+    } else if (op == IORING_OP_POLL_ADD || req->fp->f_type != DTYPE_VNODE) {
+        int res;
+        if (try_nonblock(req, res)) {
+            complete(req, res);
+        } else {
+            park(req);
+        }
+    } else if (op == IORING_OP_ACCEPT || op == IORING_OP_SEND || op == IORING_OP_RECV) {
+        complete(req, -ENOTSOCK);
+    } else if (auto dev = block_device(req)) {
+        start_bios(req, dev);
+    } else {
+        workers->queue(req);
+    }
+}
+
+void io_uring_file::park(io_uring_req* req)
+{
+    WITH_LOCK(_poll_lock) {
+        if (!_poller) {
+            _poller.reset(sched::thread::make([this] { poller(); },
+                sched::thread::attr().name("io_uring-poll")));
+            _poller->start();
+        }
+        if (req->target) {
+            _count_timeouts.fetch_add(1, std::memory_order_relaxed);
+        }
+        _incoming.push_back(req);
+        _poller->wake();
+    }
+}
+
+// Waits for parked requests' files to become ready and for timeouts.
+// Poll requests are installed from here, so poll_wake() wakes this thread.
+void io_uring_file::poller()
+{
+    sched::timer tmr(*sched::thread::current());
+    std::vector<io_uring_req*> parked;
+    std::multimap<osv::clock::uptime::time_point, io_uring_req*> timeouts;
+    auto awake = [&] {
+        return std::any_of(parked.begin(), parked.end(), [] (io_uring_req* req) {
+            return req->preq->_awake.load(std::memory_order_relaxed);
+        });
+    };
+    auto unpark = [&] (io_uring_req* req) {
+        ::poll_uninstall(req->preq.get());
+        req->preq->_poll_thread.clear();
+        osv::rcu_dispose(req->preq.release());
+    };
+
+    for (;;) {
+        std::vector<io_uring_req*> incoming;
+        WITH_LOCK(_poll_lock) {
+            sched::thread::wait_until(_poll_lock, [&] {
+                return _poll_stop || _poll_kick || !_incoming.empty() ||
+                       tmr.expired() || awake();
+            });
+            if (_poll_stop) {
+                break;
+            }
+            _poll_kick = false;
+            incoming.swap(_incoming);
+        }
+
+        for (auto req : incoming) {
+            if (req->sqe.opcode == IORING_OP_TIMEOUT) {
+                timeouts.emplace(req->deadline, req);
+                continue;
+            }
+            req->preq.reset(new pollreq);
+            req->preq->_nfds = 1;
+            req->preq->_pfd.emplace_back(req->fp, req->events);
+            // Sets _awake if the file became ready in the meantime
+            ::poll_install(req->preq.get());
+            parked.push_back(req);
+        }
+
+        auto it = parked.begin();
+        while (it != parked.end()) {
+            auto req = *it;
+            int res;
+            if (req->preq->_awake.exchange(false, std::memory_order_relaxed) &&
+                    try_nonblock(req, res)) {
+                unpark(req);
+                it = parked.erase(it);
+                complete(req, res);
+            } else {
+                ++it;
+            }
+        }
+
+        auto now = osv::clock::uptime::now();
+        auto done = _completions.load(std::memory_order_relaxed);
+        for (auto t = timeouts.begin(); t != timeouts.end();) {
+            auto req = t->second;
+            if (t->first <= now || (req->target && done >= req->target)) {
+                if (req->target) {
+                    _count_timeouts.fetch_sub(1, std::memory_order_relaxed);
+                }
+                t = timeouts.erase(t);
+                complete(req, req->target && done >= req->target ? 0 : -ETIME);
+            } else {
+                ++t;
+            }
+        }
+        if (timeouts.empty()) {
+            tmr.cancel();
+        } else {
+            tmr.reset(timeouts.begin()->first);
+        }
+    }
+
+    _count_timeouts.store(0, std::memory_order_relaxed);
+    for (auto req : parked) {
+        unpark(req);
+        complete(req, -ECANCELED);
+    }
+    for (auto& t : timeouts) {
+        complete(t.second, -ECANCELED);
+    }
+    std::vector<io_uring_req*> incoming;
+    WITH_LOCK(_poll_lock) {
+        incoming.swap(_incoming);
+    }
+    for (auto req : incoming) {
+        complete(req, -ECANCELED);
+    }
+}
+
+// The IORING_SETUP_SQPOLL thread: consumes the submission queue as the
+// application fills it, and after _sq_idle without any work sets
+// IORING_SQ_NEED_WAKEUP and sleeps until io_uring_enter() wakes it.
+void io_uring_file::sq_poll()
+{
+    auto last_work = osv::clock::uptime::now();
+    WITH_LOCK(_sq_lock) {
+        while (!_sq_stop) {
+            if (submit(_sq_entries)) {
+                last_work = osv::clock::uptime::now();
+                continue;
+            }
+            if (osv::clock::uptime::now() - last_work < _sq_idle) {
+                DROP_LOCK(_sq_lock) {
+                    sched::thread::yield();
+                }
+                continue;
+            }
+            _rings->sq_flags.fetch_or(IORING_SQ_NEED_WAKEUP);
+            // The application checks the flag after updating the tail, so
+            // recheck it now that the flag is visible
+            if (_rings->sq_tail.load() == _sq_head) {
+                while (!_sq_kicked && !_sq_stop) {
+                    _sq_cond.wait(&_sq_lock);
+                }
+            }
+            _sq_kicked = false;
+            _rings->sq_flags.fetch_and(~IORING_SQ_NEED_WAKEUP);
+            last_work = osv::clock::uptime::now();
+        }
+    }
+}
+
+int io_uring_file::enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    int submitted = 0;
+    if (_sq_thread) {
+        if (flags & IORING_ENTER_SQ_WAKEUP) {
+            WITH_LOCK(_sq_lock) {
+                _sq_kicked = true;
+                _sq_cond.wake_one();
+            }
+        }
+        submitted = to_submit;
+    } else if (to_submit) {
+        WITH_LOCK(_sq_lock) {
+            submitted = submit(to_submit);
+        }
+    }
+    WITH_LOCK(_cq_lock) {
+        flush_overflow();
+        if (flags & IORING_ENTER_GETEVENTS) {
+            min_complete = std::min(min_complete, _cq_entries);
+            while (cq_ready() < min_complete) {
+                _cq_cond.wait(&_cq_lock);
+                flush_overflow();
+            }
+        }
+    }
+    return submitted;
+}
+
+}
+
+int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    if (!p) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (!entries || (p->flags & ~(IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF |
+                                  IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP))) {
+        errno = EINVAL;
+        return -1;
+    }
+    bool clamp = p->flags & IORING_SETUP_CLAMP;
+    if (entries > max_entries) {
+        if (!clamp) {
+            errno = EINVAL;
+            return -1;
+        }
+        entries = max_entries;
+    }
+    entries = 1u << ilog2_roundup(entries);
+    unsigned cq_entries = 2 * entries;
+    if (p->flags & IORING_SETUP_CQSIZE) {
+        cq_entries = p->cq_entries;
+        if (cq_entries > 2 * max_entries) {
+            if (!clamp) {
+                errno = EINVAL;
+                return -1;
+            }
+            cq_entries = 2 * max_entries;
+        }
+        cq_entries = 1u << ilog2_roundup(cq_entries);
+        if (cq_entries < entries) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    if ((p->flags & IORING_SETUP_SQ_AFF) &&
+        (!(p->flags & IORING_SETUP_SQPOLL) || p->sq_thread_cpu >= sched::cpus.size())) {
+        errno = EINVAL;
+        return -1;
+    }
+    try {
+        fileref f = make_file<io_uring_file>(entries, cq_entries, p);
+        fdesc fd(f);
+        trace_io_uring_setup(fd.get(), entries, cq_entries, p->flags);
+        return fd.release();
+    } catch (int error) {
+        errno = error;
+        return -1;
+    }
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                   unsigned flags, const sigset_t *sig, size_t sigsz)
+{
+    fileref f(fileref_from_fd(fd));
+    if (!f) {
+        errno = EBADF;
+        return -1;
+    }
+    auto ring = dynamic_cast<io_uring_file*>(f.get());
+    if (!ring) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    sigset_t origmask;
+    if (sig) {
+        sigprocmask(SIG_SETMASK, sig, &origmask);
+    }
+    int ret = ring->enter(to_submit, min_complete, flags);
+    if (sig) {
+        sigprocmask(SIG_SETMASK, &origmask, nullptr);
+    }
+    return ret;
+}
+
+int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    fileref f(fileref_from_fd(fd));
+    if (!f) {
+        errno = EBADF;
+        return -1;
+    }
+    auto ring = dynamic_cast<io_uring_file*>(f.get());
+    if (!ring) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    int error;
+    switch (opcode) {
+    case IORING_REGISTER_EVENTFD: {
+        if (!arg || nr_args != 1) {
+            error = EINVAL;
+            break;
+        }
+        fileref efd(fileref_from_fd(*static_cast<int*>(arg)));
+        error = efd ? ring->set_eventfd(efd) : EBADF;
+        break;
+    }
+    case IORING_UNREGISTER_EVENTFD:
+        error = (arg || nr_args) ? EINVAL : ring->set_eventfd(nullptr);
+        break;
+    case IORING_REGISTER_PROBE: {
+        auto probe = static_cast<io_uring_probe*>(arg);
+        if (!probe || nr_args > 256) {
+            error = EINVAL;
+            break;
+        }
+        memset(probe, 0, sizeof(*probe) + nr_args * sizeof(probe->ops[0]));
+        probe->last_op = IORING_OP_LAST - 1;
+        probe->ops_len = std::min<unsigned>(nr_args, IORING_OP_LAST);
+        for (unsigned op = 0; op < probe->ops_len; op++) {
+            probe->ops[op].op = op;
+            switch (op) {
+            case IORING_OP_NOP:
+            case IORING_OP_READV:
+            case IORING_OP_WRITEV:
+            case IORING_OP_FSYNC:
+            case IORING_OP_POLL_ADD:
+            case IORING_OP_TIMEOUT:
+            case IORING_OP_ACCEPT:
+            case IORING_OP_READ:
+            case IORING_OP_WRITE:
+            case IORING_OP_SEND:
+            case IORING_OP_RECV:
+                probe->ops[op].flags = IO_URING_OP_SUPPORTED;
+                break;
+            }
+        }
+        error = 0;
+        break;
+    }
+    default:
+        error = EINVAL;
+        break;
+    }
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
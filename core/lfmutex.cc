@@ -20,6 +20,26 @@ TRACEPOINT(trace_mutex_try_lock, "%p, success=%d", mutex *, bool);
 TRACEPOINT(trace_mutex_unlock, "%p", mutex *);
 TRACEPOINT(trace_mutex_send_lock, "%p, wr=%p", mutex *, wait_record *);
 TRACEPOINT(trace_mutex_receive_lock, "%p", mutex *);
+TRACEPOINT(trace_mutex_spin_acquired, "%p, spins=%u", mutex *, unsigned);
+TRACEPOINT(trace_mutex_spin_failed, "%p, spins=%u", mutex *, unsigned);
+
+// How long lock() may spin for a holder running on another CPU before
+// going to sleep anyway, and how often it checks that it still runs.
+static constexpr unsigned max_spins = 4096;
+static constexpr unsigned holder_check_interval = 16;
+
+// Whether the lock holder is running on some CPU (not ours - we are running
+// there). The holder may unlock and exit at any moment, so we can't look at
+// its thread; instead we look for it among what the CPUs are running.
+static bool holder_running(sched::thread *holder)
+{
+    for (auto c : sched::cpus) {
+        if (c->running_thread.load(std::memory_order_relaxed) == holder) {
+            return true;
+        }
+    }
+    return false;
+}
 
 void mutex::lock()
 {
@@ -47,6 +67,40 @@ void mutex::lock()
     }
 
     // If we're here still here the lock is owned by a different thread.
+    // Critical sections are usually short, so while the holder is running
+    // on another CPU, spin for a while rather than pay for going to sleep
+    // and being woken. We already incremented count, so the holder's
+    // unlock() will find us: with nobody on waitqueue, it leaves a handoff,
+    // which we take to get the lock - just like try_lock() does. When
+    // there are sleeping waiters, unlock() wakes one of them instead, so
+    // there is no point in spinning (and we would not overtake them).
+    if (sched::cpus.size() > 1) {
+        unsigned spins;
+        for (spins = 0; spins < max_spins; spins++) {
+            auto old_handoff = handoff.load();
+            if (old_handoff &&
+                    handoff.compare_exchange_strong(old_handoff, 0U)) {
+                owner.store(current, std::memory_order_relaxed);
+                depth = 1;
+                trace_mutex_spin_acquired(this, spins);
+                return;
+            }
+            if (!waitqueue.empty()) {
+                break;
+            }
+            // A null owner means the lock is changing hands, so wait a bit
+            // for the new one.
+            if (spins % holder_check_interval == 0) {
+                auto holder = owner.load(std::memory_order_relaxed);
+                if (holder && !holder_running(holder)) {
+                    break;
+                }
+            }
+            arch::pause();
+        }
+        trace_mutex_spin_failed(this, spins);
+    }
+
     // Put this thread in a waiting queue, so it will eventually be woken
     // when another thread releases the lock.
     // Note "waiter" is on the stack, so we must not return before making sure
@@ -7,26 +7,429 @@
 
 // This is the Linux-specific asynchronous I/O API / ABI from libaio.
 // Note that this API is different the Posix AIO API.
+//
+// Reads and writes on block devices are turned into bios handed to the
+// device's strategy routine, so io_submit() returns as soon as they are
+// queued to the device and they complete from the driver's completion
+// path. Everything else (files on ZFS, ROFS etc., unaligned block device
+// I/O, fsync) goes through the synchronous VFS calls on a small pool of
+// worker threads. Completions are queued in the context's ring, which
+// io_getevents() reaps, and optionally signal an eventfd; for bios that
+// and releasing the request's files is left to an async worker.
 
 #include <api/libaio.h>
 
-#include <osv/stubbing.hh>
+#include <osv/file.h>
+#include <osv/vnode.h>
+#include <osv/dentry.h>
+#include <osv/device.h>
+#include <osv/bio.h>
+#include <osv/mutex.h>
+#include <osv/condvar.h>
+#include <osv/sched.hh>
+#include <osv/clock.hh>
+#include <osv/trace.hh>
+#include <osv/async.hh>
 #include <osv/export.h>
+#include <fs/vfs/vfs.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+TRACEPOINT(trace_aio_submit, "ctx=%p iocb=%p op=%d fd=%d", void*, void*, int, int);
+TRACEPOINT(trace_aio_complete, "ctx=%p iocb=%p res=%ld", void*, void*, long);
+
+struct io_context {
+    explicit io_context(unsigned nr_events)
+        : max_events(nr_events), ring(nr_events) {}
+    mutex lock;
+    condvar completed;
+    unsigned max_events;
+    // Submitted and not yet reaped, so always <= max_events
+    unsigned reserved = 0;
+    // Submitted and not yet completed
+    unsigned pending = 0;
+    // Completions not yet reaped by io_getevents()
+    std::vector<io_event> ring;
+    unsigned head = 0;
+    unsigned count = 0;
+};
+
+namespace {
+
+struct aio_request {
+    io_context* ctx;
+    struct iocb* iocb;
+    struct file* fp;
+    // eventfd to signal on completion, or nullptr
+    struct file* resfp = nullptr;
+    std::vector<iovec> iov;
+    off_t offset;
+    // bios not yet completed, for requests sent to a block device
+    std::atomic<unsigned> bios {0};
+    std::atomic<bool> bio_error {false};
+    size_t bytes = 0;
+};
+
+// Queues the completion in the context's ring
+void aio_post(aio_request* req, long res)
+{
+    io_context* ctx = req->ctx;
+    trace_aio_complete(ctx, req->iocb, res);
+    WITH_LOCK(ctx->lock) {
+        ctx->ring[(ctx->head + ctx->count) % ctx->max_events] =
+            io_event{req->iocb->data, req->iocb, (unsigned long)res, 0};
+        ctx->count++;
+        ctx->pending--;
+        ctx->completed.wake_all();
+    }
+}
+
+// Signals the eventfd and drops the request's files. This may sleep, or
+// run a file's close, so is kept out of the drivers' completion path.
+void aio_release(aio_request* req)
+{
+    if (req->resfp) {
+        uint64_t one = 1;
+        iovec iov{&one, sizeof(one)};
+        size_t count;
+        sys_write(req->resfp, &iov, 1, -1, &count);
+        fdrop(req->resfp);
+    }
+    fdrop(req->fp);
+    delete req;
+}
+
+void aio_complete(aio_request* req, long res)
+{
+    aio_post(req, res);
+    aio_release(req);
+}
+
+// The synchronous VFS path
+void aio_execute(aio_request* req)
+{
+    size_t count = 0;
+    int error;
+    switch (req->iocb->aio_lio_opcode) {
+    case IO_CMD_PREAD:
+    case IO_CMD_PREADV:
+        error = sys_read(req->fp, req->iov.data(), req->iov.size(), req->offset, &count);
+        break;
+    case IO_CMD_PWRITE:
+    case IO_CMD_PWRITEV:
+        error = sys_write(req->fp, req->iov.data(), req->iov.size(), req->offset, &count);
+        break;
+    case IO_CMD_FSYNC:
+    case IO_CMD_FDSYNC:
+        error = sys_fsync(req->fp);
+        break;
+    default:
+        error = 0;
+        break;
+    }
+    // Like the synchronous calls, report a partial transfer rather than
+    // the error which cut it short
+    aio_complete(req, (error && !count) ? -error : count);
+}
+
+class aio_workers {
+public:
+    void queue(aio_request* req) {
+        WITH_LOCK(_lock) {
+            if (_threads.empty()) {
+                start();
+            }
+            _queue.push_back(req);
+            _cond.wake_one();
+        }
+    }
+    // Takes a request off the queue if no worker picked it up yet
+    bool cancel(io_context* ctx, struct iocb* iocb, aio_request** req) {
+        WITH_LOCK(_lock) {
+            auto it = std::find_if(_queue.begin(), _queue.end(), [=] (aio_request* r) {
+                return r->ctx == ctx && r->iocb == iocb;
+            });
+            if (it == _queue.end()) {
+                return false;
+            }
+            *req = *it;
+            _queue.erase(it);
+            return true;
+        }
+    }
+private:
+    void start() {
+        unsigned n = std::min<unsigned>(sched::cpus.size(), 8);
+        for (unsigned i = 0; i < n; i++) {
+            _threads.emplace_back(sched::thread::make([this] { work(); },
+                sched::thread::attr().name("aio-worker" + std::to_string(i))));
+            _threads.back()->start();
+        }
+    }
+    void work() {
+        for (;;) {
+            aio_request* req;
+            WITH_LOCK(_lock) {
+                _cond.wait_until(_lock, [&] { return !_queue.empty(); });
+                req = _queue.front();
+                _queue.pop_front();
+            }
+            aio_execute(req);
+        }
+    }
+    mutex _lock;
+    condvar _cond;
+    std::deque<aio_request*> _queue;
+    std::vector<std::unique_ptr<sched::thread>> _threads;
+};
+
+// Never destroyed, its threads run until shutdown
+aio_workers* workers = new aio_workers;
+
+void aio_bio_done(struct bio* bio)
+{
+    auto req = static_cast<aio_request*>(bio->bio_caller1);
+    if (bio->bio_flags & BIO_ERROR) {
+        req->bio_error.store(true, std::memory_order_relaxed);
+    }
+    destroy_bio(bio);
+    if (req->bios.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        aio_post(req, req->bio_error.load(std::memory_order_relaxed) ? -EIO : req->bytes);
+        async::run_later([req] { aio_release(req); });
+    }
+}
+
+const size_t sector_size = 512;
+
+// Returns the device if the request can go straight to it as bios: a read
+// or write of whole sectors within the device
+struct device* aio_block_device(aio_request* req)
+{
+    auto op = req->iocb->aio_lio_opcode;
+    if (op != IO_CMD_PREAD && op != IO_CMD_PWRITE &&
+        op != IO_CMD_PREADV && op != IO_CMD_PWRITEV) {
+        return nullptr;
+    }
+    struct dentry* dp = file_dentry(req->fp);
+    if (!dp || !dp->d_vnode || dp->d_vnode->v_type != VBLK) {
+        return nullptr;
+    }
+    auto dev = static_cast<struct device*>(dp->d_vnode->v_data);
+    if (req->offset < 0 || req->offset % sector_size) {
+        return nullptr;
+    }
+    size_t bytes = 0;
+    for (auto& v : req->iov) {
+        if (v.iov_len % sector_size) {
+            return nullptr;
+        }
+        bytes += v.iov_len;
+    }
+    if (req->offset + (off_t)bytes > dev->size) {
+        return nullptr;
+    }
+    req->bytes = bytes;
+    return dev;
+}
+
+void aio_start_bios(aio_request* req, struct device* dev)
+{
+    bool write = req->iocb->aio_lio_opcode == IO_CMD_PWRITE ||
+                 req->iocb->aio_lio_opcode == IO_CMD_PWRITEV;
+    std::vector<struct bio*> bios;
+    off_t offset = req->offset;
+    for (auto& v : req->iov) {
+        if (!v.iov_len) {
+            continue;
+        }
+        struct bio* bio = alloc_bio();
+        bio->bio_cmd = write ? BIO_WRITE : BIO_READ;
+        bio->bio_dev = dev;
+        bio->bio_data = v.iov_base;
+        bio->bio_offset = offset;
+        bio->bio_bcount = v.iov_len;
+        bio->bio_caller1 = req;
+        bio->bio_done = aio_bio_done;
+        bios.push_back(bio);
+        offset += v.iov_len;
+    }
+    if (bios.empty()) {
+        aio_complete(req, 0);
+        return;
+    }
+    // All counted before the first one can complete
+    req->bios.store(bios.size(), std::memory_order_relaxed);
+    for (auto bio : bios) {
+        dev->driver->devops->strategy(bio);
+    }
+}
+
+int aio_submit_one(io_context* ctx, struct iocb* iocb)
+{
+    trace_aio_submit(ctx, iocb, iocb->aio_lio_opcode, iocb->aio_fildes);
+
+    std::unique_ptr<aio_request> req(new aio_request);
+    req->ctx = ctx;
+    req->iocb = iocb;
+
+    switch (iocb->aio_lio_opcode) {
+    case IO_CMD_PREAD:
+    case IO_CMD_PWRITE:
+        req->iov.push_back({iocb->u.c.buf, iocb->u.c.nbytes});
+        req->offset = iocb->u.c.offset;
+        break;
+    case IO_CMD_PREADV:
+    case IO_CMD_PWRITEV:
+        if (iocb->u.v.nr < 0) {
+            return -EINVAL;
+        }
+        req->iov.assign(iocb->u.v.vec, iocb->u.v.vec + iocb->u.v.nr);
+        req->offset = iocb->u.v.offset;
+        break;
+    case IO_CMD_FSYNC:
+    case IO_CMD_FDSYNC:
+    case IO_CMD_NOOP:
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    if (fget(iocb->aio_fildes, &req->fp)) {
+        return -EBADF;
+    }
+    if (iocb->u.c.flags & IOCB_FLAG_RESFD) {
+        if (fget(iocb->u.c.resfd, &req->resfp)) {
+            fdrop(req->fp);
+            return -EBADF;
+        }
+    }
+
+    WITH_LOCK(ctx->lock) {
+        if (ctx->reserved == ctx->max_events) {
+            if (req->resfp) {
+                fdrop(req->resfp);
+            }
+            fdrop(req->fp);
+            return -EAGAIN;
+        }
+        ctx->reserved++;
+        ctx->pending++;
+    }
+
+    auto r = req.release();
+    if (iocb->aio_lio_opcode == IO_CMD_NOOP) {
+        aio_complete(r, 0);
+    } else if (auto dev = aio_block_device(r)) {
+        aio_start_bios(r, dev);
+    } else {
+        workers->queue(r);
+    }
+    return 0;
+}
+
+}
 
 OSV_LIBAIO_API
-int io_setup(int nr_events, io_context_t *ctxp_idp) {
-    // This is a stub that doesn't actually do anything. If the caller tries
-    // to follow the io_setup() call with any other libaio call, those will
-    // fail.
-    WARN_STUBBED();
-    if (nr_events < 0) {
+int io_setup(int nr_events, io_context_t *ctxp_idp)
+{
+    if (nr_events <= 0 || !ctxp_idp || *ctxp_idp) {
         return -EINVAL;
     }
+    *ctxp_idp = new io_context(nr_events);
     return 0;
 }
 
-UNIMPL(OSV_LIBAIO_API int io_submit(io_context_t ctx, long nr, struct iocb *ios[]))
-UNIMPL(OSV_LIBAIO_API int io_getevents(io_context_t ctx_id, long min_nr, long nr,
-        struct io_event *events, struct timespec *timeout))
-UNIMPL(OSV_LIBAIO_API int io_destroy(io_context_t ctx))
-UNIMPL(OSV_LIBAIO_API int io_cancel(io_context_t ctx, struct iocb *iocb, struct io_event *evt))
+OSV_LIBAIO_API
+int io_submit(io_context_t ctx, long nr, struct iocb *ios[])
+{
+    if (!ctx || nr < 0) {
+        return -EINVAL;
+    }
+    long i;
+    for (i = 0; i < nr; i++) {
+        int error = aio_submit_one(ctx, ios[i]);
+        if (error) {
+            return i ? i : error;
+        }
+    }
+    return i;
+}
+
+OSV_LIBAIO_API
+int io_getevents(io_context_t ctx, long min_nr, long nr,
+        struct io_event *events, struct timespec *timeout)
+{
+    if (!ctx || min_nr < 0 || nr < 0 || min_nr > nr) {
+        return -EINVAL;
+    }
+    auto deadline = osv::clock::uptime::now();
+    if (timeout) {
+        deadline += std::chrono::seconds(timeout->tv_sec) +
+                    std::chrono::nanoseconds(timeout->tv_nsec);
+    }
+    WITH_LOCK(ctx->lock) {
+        while (ctx->count < (unsigned long)min_nr) {
+            if (timeout) {
+                if (ctx->completed.wait(&ctx->lock, deadline)) {
+                    break;
+                }
+            } else {
+                ctx->completed.wait(&ctx->lock);
+            }
+        }
+        long n = std::min<long>(nr, ctx->count);
+        for (long i = 0; i < n; i++) {
+            events[i] = ctx->ring[ctx->head];
+            ctx->head = (ctx->head + 1) % ctx->max_events;
+        }
+        ctx->count -= n;
+        ctx->reserved -= n;
+        return n;
+    }
+}
+
+OSV_LIBAIO_API
+int io_destroy(io_context_t ctx)
+{
+    if (!ctx) {
+        return -EINVAL;
+    }
+    // Requests already queued can't be called back, wait for them
+    WITH_LOCK(ctx->lock) {
+        while (ctx->pending) {
+            ctx->completed.wait(&ctx->lock);
+        }
+    }
+    delete ctx;
+    return 0;
+}
+
+OSV_LIBAIO_API
+int io_cancel(io_context_t ctx, struct iocb *iocb, struct io_event *evt)
+{
+    if (!ctx || !iocb || !evt) {
+        return -EINVAL;
+    }
+    // Only requests still waiting for a worker can be cancelled, requests
+    // sent to a device or being executed run to completion
+    aio_request* req;
+    if (!workers->cancel(ctx, iocb, &req)) {
+        return -EAGAIN;
+    }
+    *evt = io_event{iocb->data, iocb, (unsigned long)-ECANCELED, 0};
+    WITH_LOCK(ctx->lock) {
+        ctx->pending--;
+        ctx->reserved--;
+        ctx->completed.wake_all();
+    }
+    if (req->resfp) {
+        fdrop(req->resfp);
+    }
+    fdrop(req->fp);
+    delete req;
+    return 0;
+}
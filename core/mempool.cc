@@ -35,6 +35,7 @@
 #include <boost/lockfree/stack.hpp>
 #include <boost/lockfree/policies.hpp>
 #include <osv/migration-lock.hh>
+#include <osv/numa.hh>
 #include <osv/export.h>
 
 TRACEPOINT(trace_memory_malloc, "buf=%p, len=%d, align=%d", void *, size_t,
@@ -137,12 +138,19 @@ public:
 
 static garbage_sink ***pcpu_free_list;
 
+// Set by pool::reap() for the garbage collector of each cpu
+static std::atomic<bool> reap_requested[sched::max_cpus];
+
 void pool::collect_garbage()
 {
     assert(!sched::preemptable());
 
     unsigned cpu_id = mempool_cpuid();
 
+    if (reap_requested[cpu_id].exchange(false, std::memory_order_relaxed)) {
+        drain_all();
+    }
+
     for (unsigned i = 0; i < sched::cpus.size(); i++) {
         auto sink = pcpu_free_list[cpu_id][i];
         free_object* obj;
@@ -190,6 +198,8 @@ static void garbage_collector_fn()
 
 pool::pool(unsigned size)
     : _size(size)
+    // keep a magazine within two pages worth of objects
+    , _mag_rounds(std::max(4UL, std::min(64UL, 2 * page_size / size)))
     , _free()
 {
     assert(size + sizeof(page_header) <= page_size);
@@ -212,6 +222,9 @@ TRACEPOINT(trace_pool_alloc, "this=%p, obj=%p", void*, void*);
 TRACEPOINT(trace_pool_free, "this=%p, obj=%p", void*, void*);
 TRACEPOINT(trace_pool_free_same_cpu, "this=%p, obj=%p", void*, void*);
 TRACEPOINT(trace_pool_free_different_cpu, "this=%p, obj=%p, obj_cpu=%d", void*, void*, unsigned);
+TRACEPOINT(trace_pool_depot_get, "this=%p", void*);
+TRACEPOINT(trace_pool_depot_put, "this=%p", void*);
+TRACEPOINT(trace_pool_flush, "this=%p, rounds=%d", void*, unsigned);
 
 void* pool::alloc()
 {
@@ -224,31 +237,57 @@ void* pool::alloc()
 #endif
     WITH_LOCK(preempt_lock) {
 
-        // We enable preemption because add_page() may take a Mutex.
-        // this loop ensures we have at least one free page that we can
-        // allocate from, in from the context of the current cpu
-        while (_free->empty()) {
-            DROP_LOCK(preempt_lock) {
-                add_page();
+        // Try the magazines first: the loaded one, then the previous one,
+        // then a full one from the depot.
+        auto c = &*_cache;
+        if (!c->loaded.rounds) {
+            if (c->previous.rounds) {
+                std::swap(c->loaded, c->previous);
+            } else if (_depot.pop(c->loaded)) {
+                trace_pool_depot_get(this);
+                c->depot_gets++;
             }
         }
-
-        // We have a free page, get one object and return it to the user
-        auto it = _free->begin();
-        page_header *header = &(*it);
-        free_object* obj = header->local_free;
-        ++header->nalloc;
-        header->local_free = obj->next;
-        if (!header->local_free) {
-            _free->erase(it);
+        if (c->loaded.rounds) {
+            free_object* obj = c->loaded.head;
+            c->loaded.head = obj->next;
+            c->loaded.rounds--;
+            c->alloc_hits++;
+            ret = obj;
+        } else {
+            c->alloc_misses++;
+            ret = alloc_from_pages();
         }
-        ret = obj;
     }
 
     trace_pool_alloc(this, ret);
     return ret;
 }
 
+// should get called with the preemption lock taken
+void* pool::alloc_from_pages()
+{
+    // We enable preemption because add_page() may take a Mutex.
+    // this loop ensures we have at least one free page that we can
+    // allocate from, in from the context of the current cpu
+    while (_free->empty()) {
+        DROP_LOCK(preempt_lock) {
+            add_page();
+        }
+    }
+
+    // We have a free page, get one object and return it to the user
+    auto it = _free->begin();
+    page_header *header = &(*it);
+    free_object* obj = header->local_free;
+    ++header->nalloc;
+    header->local_free = obj->next;
+    if (!header->local_free) {
+        _free->erase(it);
+    }
+    return obj;
+}
+
 unsigned pool::get_size()
 {
     return _size;
@@ -342,8 +381,45 @@ void pool::free(void* object)
     WITH_LOCK(preempt_lock) {
 
         free_object* obj = static_cast<free_object*>(object);
-        page_header* header = to_header(obj);
-        unsigned obj_cpu = header->cpu_id;
+        magazine overflow {};
+
+        // Objects of any cpu go into this cpu's magazines. When both are
+        // full, the previous one goes to the depot; if the depot is full
+        // too, the loaded one is given back to the pages below.
+        auto c = &*_cache;
+        if (c->loaded.rounds == _mag_rounds) {
+            if (!c->previous.rounds) {
+                std::swap(c->loaded, c->previous);
+            } else if (_depot.bounded_push(c->previous)) {
+                trace_pool_depot_put(this);
+                c->depot_puts++;
+                c->previous = c->loaded;
+                c->loaded = {};
+            } else {
+                c->flushes++;
+                overflow = c->loaded;
+                c->loaded = {};
+            }
+        }
+        obj->next = c->loaded.head;
+        c->loaded.head = obj;
+        c->loaded.rounds++;
+
+        if (overflow.rounds) {
+            free_to_pages(overflow);
+        }
+    }
+}
+
+// should get called with the preemption lock taken
+void pool::free_to_pages(magazine mag)
+{
+    trace_pool_flush(this, mag.rounds);
+    while (free_object* obj = mag.head) {
+        mag.head = obj->next;
+        // free_same_cpu() may drop the preemption lock, so the current
+        // cpu has to be looked up again for every object
+        unsigned obj_cpu = to_header(obj)->cpu_id;
         unsigned cur_cpu = mempool_cpuid();
 
         if (obj_cpu == cur_cpu) {
@@ -353,11 +429,49 @@ void pool::free(void* object)
             // free from a different CPU. we try to hand the buffer
             // to the proper worker item that is pinned to the CPU that this buffer
             // was allocated from, so it'll free it.
+            _cache->remote_frees++;
             free_different_cpu(obj, obj_cpu, cur_cpu);
         }
     }
 }
 
+// should get called with the preemption lock taken
+void pool::drain()
+{
+    // free_to_pages() may drop the preemption lock, so the magazines are
+    // taken off the cpu before any of them is flushed
+    auto c = &*_cache;
+    magazine mags[] = { c->loaded, c->previous };
+    c->loaded = {};
+    c->previous = {};
+    for (auto& mag : mags) {
+        if (mag.rounds) {
+            _cache->flushes++;
+            free_to_pages(mag);
+        }
+    }
+    magazine mag;
+    while (_depot.pop(mag)) {
+        _cache->flushes++;
+        free_to_pages(mag);
+    }
+}
+
+void pool::get_stats(stats::magazine_stats& stats)
+{
+    stats = {};
+    stats._size = _size;
+    for (auto cpu : sched::cpus) {
+        auto c = _cache.for_cpu(cpu);
+        stats._alloc_hits += c->alloc_hits;
+        stats._alloc_misses += c->alloc_misses;
+        stats._depot_gets += c->depot_gets;
+        stats._depot_puts += c->depot_puts;
+        stats._flushes += c->flushes;
+        stats._remote_frees += c->remote_frees;
+    }
+}
+
 pool* pool::from_object(void* object)
 {
     auto header = to_header(static_cast<free_object*>(object));
@@ -402,6 +516,27 @@ malloc_pool::malloc_pool()
 {
 }
 
+// should get called with the preemption lock taken
+void pool::drain_all()
+{
+    for (auto& p : malloc_pools) {
+        p.drain();
+    }
+}
+
+// The magazines of a cpu can only be touched by that cpu, so it's its
+// garbage collector, which runs even on an idle cpu, that drains them.
+void pool::reap()
+{
+    if (!smp_allocator) {
+        return;
+    }
+    for (auto cpu : sched::cpus) {
+        reap_requested[cpu->id].store(true, std::memory_order_relaxed);
+        garbage_collector.signal(cpu);
+    }
+}
+
 size_t malloc_pool::compute_object_size(unsigned pos)
 {
     size_t size = 1 << pos;
@@ -562,6 +697,12 @@ void reclaimer::wait_for_memory(size_t mem)
     _oom_blocked.wait(mem);
 }
 
+// Free page ranges are kept on separate lists for every NUMA node, and a
+// range never spans two nodes: ranges are split at node boundaries and
+// neighbours from different nodes are not merged. Allocations take memory
+// from the requested node first, then from the others in distance order.
+// The bitmap (one bit per page marking the first and last page of each free
+// range) and the lock (free_page_ranges_lock) are shared by all nodes.
 class page_range_allocator {
 public:
     static constexpr unsigned max_order = page_ranges_max_order;
@@ -569,75 +710,91 @@ public:
     page_range_allocator() : _deferred_free(nullptr) { }
 
     template<bool UseBitmap = true>
-    page_range* alloc(size_t size, bool contiguous = true);
+    page_range* alloc(size_t size, bool contiguous = true, unsigned node = 0);
     page_range* alloc_aligned(size_t size, size_t offset, size_t alignment,
-                              bool fill = false);
+                              bool fill = false, unsigned node = 0);
     void free(page_range* pr);
 
     void initial_add(page_range* pr);
+    void split_nodes();
 
     template<typename Func>
-    void for_each(unsigned min_order, Func f);
+    void for_each(unsigned min_order, unsigned node, Func f);
     template<typename Func>
     void for_each(Func f) {
-        for_each<Func>(0, f);
+        for_each<Func>(0, 0, f);
     }
 
     bool empty() const {
-        return _not_empty.none();
+        for (auto& n : _nodes) {
+            if (n.not_empty.any()) {
+                return false;
+            }
+        }
+        return true;
     }
     size_t size() const {
-        size_t size = _free_huge.size();
-        for (auto&& list : _free) {
-            size += list.size();
+        size_t size = 0;
+        for (auto& n : _nodes) {
+            size += n.free_huge.size();
+            for (auto&& list : n.free) {
+                size += list.size();
+            }
         }
         return size;
     }
 
     void stats(stats::page_ranges_stats& stats) const {
-        stats.order[max_order].ranges_num = _free_huge.size();
-        stats.order[max_order].bytes = 0;
-        for (auto& pr : _free_huge) {
-            stats.order[max_order].bytes += pr.size;
-        }
+        stats = {};
+        for (auto& n : _nodes) {
+            stats.order[max_order].ranges_num += n.free_huge.size();
+            for (auto& pr : n.free_huge) {
+                stats.order[max_order].bytes += pr.size;
+            }
 
-        for (auto order = max_order; order--;) {
-            stats.order[order].ranges_num = _free[order].size();
-            stats.order[order].bytes = 0;
-            for (auto& pr : _free[order]) {
-                stats.order[order].bytes += pr.size;
+            for (auto order = max_order; order--;) {
+                stats.order[order].ranges_num += n.free[order].size();
+                for (auto& pr : n.free[order]) {
+                    stats.order[order].bytes += pr.size;
+                }
             }
         }
     }
 
 private:
+    unsigned node_of(const page_range& pr) const {
+        return numa::phys_node(get_phys(pr));
+    }
     template<bool UseBitmap = true>
     void insert(page_range& pr) {
         auto addr = static_cast<void*>(&pr);
         auto pr_end = static_cast<page_range**>(addr + pr.size - sizeof(page_range**));
         *pr_end = &pr;
+        auto& n = _nodes[node_of(pr)];
         auto order = ilog2(pr.size / page_size);
         if (order >= max_order) {
-            _free_huge.insert(pr);
-            _not_empty[max_order] = true;
+            n.free_huge.insert(pr);
+            n.not_empty[max_order] = true;
         } else {
-            _free[order].push_front(pr);
-            _not_empty[order] = true;
+            n.free[order].push_front(pr);
+            n.not_empty[order] = true;
         }
         if (UseBitmap) {
             set_bits(pr, true);
         }
     }
     void remove_huge(page_range& pr) {
-        _free_huge.erase(_free_huge.iterator_to(pr));
-        if (_free_huge.empty()) {
-            _not_empty[max_order] = false;
+        auto& n = _nodes[node_of(pr)];
+        n.free_huge.erase(n.free_huge.iterator_to(pr));
+        if (n.free_huge.empty()) {
+            n.not_empty[max_order] = false;
         }
     }
     void remove_list(unsigned order, page_range& pr) {
-        _free[order].erase(_free[order].iterator_to(pr));
-        if (_free[order].empty()) {
-            _not_empty[order] = false;
+        auto& n = _nodes[node_of(pr)];
+        n.free[order].erase(n.free[order].iterator_to(pr));
+        if (n.free[order].empty()) {
+            n.not_empty[order] = false;
         }
     }
     void remove(page_range& pr) {
@@ -648,7 +805,12 @@ private:
             remove_list(order, pr);
         }
     }
+    template<bool UseBitmap>
+    page_range* alloc_from_node(unsigned node, size_t size, bool contiguous);
 
+    u64 get_phys(const page_range& pr) const {
+        return reinterpret_cast<uintptr_t>(&pr) - reinterpret_cast<uintptr_t>(mmu::phys_mem);
+    }
     unsigned get_bitmap_idx(page_range& pr) const {
         auto idx = reinterpret_cast<uintptr_t>(&pr);
         idx -= reinterpret_cast<uintptr_t>(mmu::phys_mem);
@@ -666,18 +828,21 @@ private:
         }
     }
 
-    bi::multiset<page_range,
+    struct node_free_lists {
+        bi::multiset<page_range,
+                     bi::member_hook<page_range,
+                                     bi::set_member_hook<>,
+                                     &page_range::set_hook>,
+                     bi::constant_time_size<false>> free_huge;
+        bi::list<page_range,
                  bi::member_hook<page_range,
-                                 bi::set_member_hook<>,
-                                 &page_range::set_hook>,
-                 bi::constant_time_size<false>> _free_huge;
-    bi::list<page_range,
-             bi::member_hook<page_range,
-                             bi::list_member_hook<>,
-                             &page_range::list_hook>,
-             bi::constant_time_size<false>> _free[max_order];
+                                 bi::list_member_hook<>,
+                                 &page_range::list_hook>,
+                 bi::constant_time_size<false>> free[max_order];
 
-    std::bitset<max_order + 1> _not_empty;
+        std::bitset<max_order + 1> not_empty;
+    };
+    node_free_lists _nodes[numa::max_nodes];
 
     template<typename T>
     class bitmap_allocator {
@@ -717,13 +882,26 @@ void page_range_allocator::bitmap_allocator<T>::deallocate(T* p, size_t n)
 }
 
 template<bool UseBitmap>
-page_range* page_range_allocator::alloc(size_t size, bool contiguous)
+page_range* page_range_allocator::alloc(size_t size, bool contiguous, unsigned node)
+{
+    auto nodes = numa::fallback_order(node);
+    for (unsigned i = 0; i < numa::nr_nodes(); i++) {
+        if (auto pr = alloc_from_node<UseBitmap>(nodes[i], size, contiguous)) {
+            return pr;
+        }
+    }
+    return nullptr;
+}
+
+template<bool UseBitmap>
+page_range* page_range_allocator::alloc_from_node(unsigned node, size_t size, bool contiguous)
 {
+    auto& n = _nodes[node];
     auto exact_order = ilog2_roundup(size / page_size);
     if (exact_order > max_order) {
         exact_order = max_order;
     }
-    auto bitset = _not_empty.to_ulong();
+    auto bitset = n.not_empty.to_ulong();
     if (exact_order) {
         bitset &= ~((1 << exact_order) - 1);
     }
@@ -731,13 +909,13 @@ page_range* page_range_allocator::alloc(size_t size, bool contiguous)
 
     page_range* range = nullptr;
     if (!bitset) {
-        if (!contiguous || !exact_order || _free[exact_order - 1].empty()) {
+        if (!contiguous || !exact_order || n.free[exact_order - 1].empty()) {
             return nullptr;
         }
         // This linear search makes worst case complexity of the allocator
         // O(n). Unfortunately we do not have choice for contiguous allocation
         // so let us hope there is large enough range.
-        for (auto&& pr : _free[exact_order - 1]) {
+        for (auto&& pr : n.free[exact_order - 1]) {
             if (pr.size >= size) {
                 range = &pr;
                 remove_list(exact_order - 1, *range);
@@ -748,13 +926,13 @@ page_range* page_range_allocator::alloc(size_t size, bool contiguous)
             return nullptr;
         }
     } else if (order == max_order) {
-        range = &*_free_huge.rbegin();
+        range = &*n.free_huge.rbegin();
         if (range->size < size) {
             return nullptr;
         }
         remove_huge(*range);
     } else {
-        range = &_free[order].front();
+        range = &n.free[order].front();
         remove_list(order, *range);
     }
 
@@ -772,10 +950,11 @@ page_range* page_range_allocator::alloc(size_t size, bool contiguous)
 }
 
 page_range* page_range_allocator::alloc_aligned(size_t size, size_t offset,
-                                                size_t alignment, bool fill)
+                                                size_t alignment, bool fill,
+                                                unsigned node)
 {
     page_range* ret_header = nullptr;
-    for_each(std::max(ilog2(size / page_size), 1u) - 1, [&] (page_range& header) {
+    for_each(std::max(ilog2(size / page_size), 1u) - 1, node, [&] (page_range& header) {
         char* v = reinterpret_cast<char*>(&header);
         auto expected_ret = v + header.size - size + offset;
         auto alignment_shift = expected_ret - align_down(expected_ret, alignment);
@@ -804,17 +983,22 @@ page_range* page_range_allocator::alloc_aligned(size_t size, size_t offset,
 void page_range_allocator::free(page_range* pr)
 {
     auto idx = get_bitmap_idx(*pr);
+    auto node = node_of(*pr);
     if (idx && _bitmap[idx - 1]) {
         auto pr2 = *(reinterpret_cast<page_range**>(pr) - 1);
-        remove(*pr2);
-        pr2->size += pr->size;
-        pr = pr2;
+        if (node_of(*pr2) == node) {
+            remove(*pr2);
+            pr2->size += pr->size;
+            pr = pr2;
+        }
     }
     auto next_idx = get_bitmap_idx(*pr) + pr->size / page_size;
     if (next_idx < _bitmap.size() && _bitmap[next_idx]) {
         auto pr2 = static_cast<page_range*>(static_cast<void*>(pr) + pr->size);
-        remove(*pr2);
-        pr->size += pr2->size;
+        if (node_of(*pr2) == node) {
+            remove(*pr2);
+            pr->size += pr2->size;
+        }
     }
     insert(*pr);
 }
@@ -824,7 +1008,8 @@ void page_range_allocator::initial_add(page_range* pr)
     auto idx = get_bitmap_idx(*pr) + pr->size / page_size;
     if (idx > _bitmap.size()) {
         auto prev_idx = get_bitmap_idx(*pr) - 1;
-        if (_bitmap.size() > prev_idx && _bitmap[prev_idx]) {
+        if (_bitmap.size() > prev_idx && _bitmap[prev_idx] &&
+            node_of(**(reinterpret_cast<page_range**>(pr) - 1)) == node_of(*pr)) {
             auto pr2 = *(reinterpret_cast<page_range**>(pr) - 1);
             remove(*pr2);
             pr2->size += pr->size;
@@ -845,19 +1030,85 @@ void page_range_allocator::initial_add(page_range* pr)
 }
 
 template<typename Func>
-void page_range_allocator::for_each(unsigned min_order, Func f)
+void page_range_allocator::for_each(unsigned min_order, unsigned node, Func f)
 {
-    for (auto& pr : _free_huge) {
-        if (!f(pr)) {
-            return;
-        }
-    }
-    for (auto order = max_order; order-- > min_order;) {
-        for (auto& pr : _free[order]) {
+    auto nodes = numa::fallback_order(node);
+    for (unsigned i = 0; i < numa::nr_nodes(); i++) {
+        auto& n = _nodes[nodes[i]];
+        for (auto& pr : n.free_huge) {
             if (!f(pr)) {
                 return;
             }
         }
+        for (auto order = max_order; order-- > min_order;) {
+            for (auto& pr : n.free[order]) {
+                if (!f(pr)) {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+// Called once the NUMA topology is known: memory was handed to the
+// allocator before that and sits on node 0's lists, so take every free
+// range off them and re-file it under its node, splitting the ones that
+// cross a node boundary.
+void page_range_allocator::split_nodes()
+{
+    // We can't allocate here, so chain the ranges through their list hook
+    bi::list<page_range,
+             bi::member_hook<page_range,
+                             bi::list_member_hook<>,
+                             &page_range::list_hook>,
+             bi::constant_time_size<false>> ranges;
+    for (auto& n : _nodes) {
+        while (!n.free_huge.empty()) {
+            auto& pr = *n.free_huge.begin();
+            remove_huge(pr);
+            ranges.push_back(pr);
+        }
+        for (auto order = max_order; order--;) {
+            while (!n.free[order].empty()) {
+                auto& pr = n.free[order].front();
+                remove_list(order, pr);
+                ranges.push_back(pr);
+            }
+        }
+    }
+
+    numa::setup_done();
+
+    while (!ranges.empty()) {
+        auto pr = &ranges.front();
+        ranges.pop_front();
+        while (true) {
+            auto start = get_phys(*pr);
+            auto boundary = numa::next_node_boundary(start);
+            if (boundary >= start + pr->size ||
+                align_up(boundary - start, page_size) >= pr->size) {
+                insert(*pr);
+                break;
+            }
+            auto head = align_up(boundary - start, page_size);
+            auto next = new (static_cast<void*>(pr) + head) page_range(pr->size - head);
+            pr->size = head;
+            insert(*pr);
+            pr = next;
+        }
+    }
+}
+
+// NUMA node of the calling cpu, where its allocations should come from
+static inline unsigned local_node()
+{
+    return smp_allocator ? numa::cpu_node(sched::cpu::current()->id) : 0;
+}
+
+void setup_numa_nodes()
+{
+    WITH_LOCK(free_page_ranges_lock) {
+        free_page_ranges.split_nodes();
     }
 }
 
@@ -911,9 +1162,10 @@ static void* malloc_large(size_t size, size_t alignment, bool block = true, bool
             reclaimer_thread.wait_for_minimum_memory();
             page_range* ret_header;
             if (alignment > page_size) {
-                ret_header = free_page_ranges.alloc_aligned(size, page_size, alignment);
+                ret_header = free_page_ranges.alloc_aligned(size, page_size, alignment,
+                                                             false, local_node());
             } else {
-                ret_header = free_page_ranges.alloc(size, contiguous);
+                ret_header = free_page_ranges.alloc(size, contiguous, local_node());
             }
             if (ret_header) {
                 on_alloc(size);
@@ -1108,6 +1360,10 @@ void reclaimer::_do_reclaim()
             }
         }
 
+        // The objects cached in the pools' magazines pin their pages;
+        // give them back before asking the shrinkers for memory.
+        pool::reap();
+
         _shrinker_loop(target, [this] { return _oom_blocked.has_waiters(); });
 
         WITH_LOCK(free_page_ranges_lock) {
@@ -1188,6 +1444,7 @@ struct l1 {
             sched::thread::attr().pin(cpu).name(osv::sprintf("page_pool_l1_%d", cpu->id))))
     {
         cpu_id = cpu->id;
+        node = numa::cpu_node(cpu_id);
         _fill_thread->start();
     }
 
@@ -1232,6 +1489,7 @@ struct l1 {
     static constexpr size_t watermark_hi = max * 3 / 4;
     size_t nr = 0;
     unsigned int cpu_id;
+    unsigned int node;
 
 private:
     std::unique_ptr<sched::thread> _fill_thread;
@@ -1244,7 +1502,7 @@ struct page_batch {
     void* pages[nr_pages];
 };
 
-// L2-pool (Global page buffer pool)
+// L2-pool (Per NUMA node page buffer pool)
 //
 // if nr < max * 1 / 4
 //    refill
@@ -1256,18 +1514,21 @@ struct page_batch {
 // L2-pool.
 //
 // When L2-pool needs refill or unfill, it moves a batch of pages from or to
-// global free page list.
+// global free page list, preferring the memory of its own node.
 //
-// Single thread is created to help filling the L2-pool.
+// A thread per node is created to help filling the L2-pools. L1-pools
+// refill from the pool of their cpu's node.
 class l2 {
 public:
-    l2()
-        : _max(sched::cpus.size() * (l1::max / page_batch::nr_pages))
+    explicit l2(unsigned node)
+        : _node(node)
+        , _max(node_cpus(node) * (l1::max / page_batch::nr_pages))
         , _nr(0)
         , _watermark_lo(_max * 1 / 4)
         , _watermark_hi(_max * 3 / 4)
         , _stack(_max)
-        , _fill_thread(sched::thread::make([=] { fill_thread(); }, sched::thread::attr().name("page_pool_l2")))
+        , _fill_thread(sched::thread::make([=] { fill_thread(); }, sched::thread::attr().name(
+            numa::nr_nodes() == 1 ? std::string("page_pool_l2") : osv::sprintf("page_pool_l2_%d", node))))
     {
        _fill_thread->start();
     }
@@ -1344,6 +1605,17 @@ public:
     void dec_nr() { _nr.fetch_sub(1, std::memory_order_relaxed); }
 
 private:
+    static size_t node_cpus(unsigned node)
+    {
+        size_t n = 0;
+        for (auto cpu : sched::cpus) {
+            n += numa::cpu_node(cpu->id) == node;
+        }
+        // a node may have memory but no cpus, give it a small pool anyway
+        return std::max(n, size_t(1));
+    }
+
+    unsigned _node;
     size_t _max;
     std::atomic<size_t> _nr;
     size_t _watermark_lo;
@@ -1352,6 +1624,15 @@ private:
     std::unique_ptr<sched::thread> _fill_thread;
 };
 
+// N per-cpu threads for L1 page pool, one thread per node for L2 page pools.
+// Switch to smp_allocator only when all of them are ready
+static void page_pool_thread_ready()
+{
+    if (smp_allocator_cnt++ == sched::cpus.size() + numa::nr_nodes() - 1) {
+        smp_allocator = true;
+    }
+}
+
 std::atomic<unsigned int> l1_initialized_cnt{};
 PERCPU(l1*, percpu_l1);
 static sched::cpu::notifier _notifier([] () {
@@ -1359,18 +1640,33 @@ static sched::cpu::notifier _notifier([] () {
     if (++l1_initialized_cnt == sched::cpus.size()) {
         l1_pool_stats.resize(sched::cpus.size());
     }
-    // N per-cpu threads for L1 page pool, 1 thread for L2 page pool
-    // Switch to smp_allocator only when all the N + 1 threads are ready
-    if (smp_allocator_cnt++ == sched::cpus.size()) {
-        smp_allocator = true;
-    }
+    page_pool_thread_ready();
 });
 static inline l1& get_l1()
 {
     return **percpu_l1;
 }
 
-class l2 global_l2;
+static struct l2_pools {
+    l2_pools()
+    {
+        for (unsigned node = 0; node < numa::nr_nodes(); node++) {
+            pools[node] = new l2(node);
+        }
+    }
+    l2* pools[numa::max_nodes] = {};
+} node_l2;
+
+static inline l2& get_l2(unsigned node)
+{
+    return *node_l2.pools[node];
+}
+
+// Pages are handed back to the pool of the node they belong to
+static inline l2& get_l2(void* page)
+{
+    return get_l2(numa::phys_node(mmu::virt_to_phys(page)));
+}
 
 // Percpu thread for L1 page pool
 void l1::fill_thread()
@@ -1410,7 +1706,8 @@ void l1::refill()
     SCOPE_LOCK(preempt_lock);
     auto& pbuf = get_l1();
     if (pbuf.nr + page_batch::nr_pages < pbuf.max / 2) {
-        auto* pb = global_l2.alloc_page_batch();
+        auto& pool = get_l2(pbuf.node);
+        auto* pb = pool.alloc_page_batch();
         if (pb) {
             // Other threads might have filled the array while we waited for
             // the page batch.  Make sure there is enough room to add the pages
@@ -1420,7 +1717,7 @@ void l1::refill()
                     pbuf.push(page);
                 }
             } else {
-                global_l2.free_page_batch(pb);
+                pool.free_page_batch(pb);
             }
         }
     }
@@ -1441,7 +1738,7 @@ void l1::unfill()
         for (size_t i = 0 ; i < page_batch::nr_pages; i++) {
             pb->pages[i] = pbuf.pop();
         }
-        global_l2.free_page_batch(pb);
+        get_l2(pb).free_page_batch(pb);
     }
 }
 
@@ -1487,9 +1784,7 @@ bool l1::free_page_local(void* v)
 // Global thread for L2 page pool
 void l2::fill_thread()
 {
-    if (smp_allocator_cnt++ == sched::cpus.size()) {
-        smp_allocator = true;
-    }
+    page_pool_thread_ready();
 
     sched::thread::wait_until([] {return smp_allocator;});
     for (;;) {
@@ -1523,7 +1818,7 @@ void l2::refill()
             }
             auto total_size = 0;
             for (size_t i = 0 ; i < page_batch::nr_pages; i++) {
-                batch.pages[i] = free_page_ranges.alloc(page_size);
+                batch.pages[i] = free_page_ranges.alloc(page_size, true, _node);
                 total_size += page_size;
             }
             on_alloc(total_size);
@@ -1570,9 +1865,18 @@ void l2::free_batch(page_batch& batch)
 }
 
 namespace stats {
+    // Sum of the L2 pools of all nodes
     void get_global_l2_stats(pool_stats &stats)
     {
-        page_pool::global_l2.stats(stats);
+        stats = {};
+        for (unsigned node = 0; node < numa::nr_nodes(); node++) {
+            pool_stats node_stats;
+            page_pool::get_l2(node).stats(node_stats);
+            stats._max += node_stats._max;
+            stats._nr += node_stats._nr;
+            stats._watermark_lo += node_stats._watermark_lo;
+            stats._watermark_hi += node_stats._watermark_hi;
+        }
     }
 
     void get_l1_stats(unsigned int cpu_id, pool_stats &stats)
@@ -1582,6 +1886,20 @@ namespace stats {
         stats._watermark_lo = page_pool::l1::watermark_lo;
         stats._watermark_hi = page_pool::l1::watermark_hi;
     }
+
+    void get_malloc_pools_stats(std::vector<magazine_stats> &stats)
+    {
+        stats.clear();
+        // the pools past max_object_size are never used
+        for (unsigned i = 0; i < sizeof(malloc_pools) / sizeof(malloc_pools[0]); i++) {
+            auto& pool = malloc_pools[i];
+            if (pool.get_size() < pool::min_object_size || pool.get_size() != 1U << i) {
+                continue;
+            }
+            stats.emplace_back();
+            pool.get_stats(stats.back());
+        }
+    }
 }
 
 static void* early_alloc_page()
@@ -1763,7 +2081,7 @@ void free_page(void* v)
 void* alloc_huge_page(size_t N)
 {
     WITH_LOCK(free_page_ranges_lock) {
-        auto pr = free_page_ranges.alloc_aligned(N, 0, N, true);
+        auto pr = free_page_ranges.alloc_aligned(N, 0, N, true, local_node());
         if (pr) {
             on_alloc(N);
             return static_cast<void*>(pr);
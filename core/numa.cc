@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include <osv/numa.hh>
+#include <osv/sched.hh>
+#include <osv/debug.h>
+#include <algorithm>
+
+// The tables are filled from the ACPI tables very early during boot, while
+// memory is still handed out by the early allocator, so everything here is
+// statically sized.
+namespace numa {
+
+static constexpr unsigned max_memory_ranges = 64;
+static constexpr unsigned max_apics = 256;
+static constexpr u8 local_distance = 10;
+static constexpr u8 remote_distance = 20;
+
+struct memory_range {
+    u64 start;
+    u64 end;
+    unsigned node;
+};
+
+static u32 node_domains[max_nodes];
+static unsigned nodes_count;
+
+static memory_range memory_ranges[max_memory_ranges];
+static unsigned memory_ranges_count;
+
+static struct {
+    u32 apic_id;
+    unsigned node;
+} apic_nodes[max_apics];
+static unsigned apic_nodes_count;
+
+static u8 distances[max_nodes][max_nodes];
+static unsigned fallback[max_nodes][max_nodes] = {};
+static bool ready;
+
+static int find_node(u32 domain)
+{
+    for (unsigned i = 0; i < nodes_count; i++) {
+        if (node_domains[i] == domain) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int domain_to_node(u32 domain)
+{
+    auto node = find_node(domain);
+    if (node >= 0) {
+        return node;
+    }
+    if (nodes_count == max_nodes) {
+        debug_early_u64("numa: too many proximity domains, ignoring ", domain);
+        return -1;
+    }
+    node_domains[nodes_count] = domain;
+    return nodes_count++;
+}
+
+unsigned nr_nodes()
+{
+    return ready ? std::max(nodes_count, 1U) : 1;
+}
+
+unsigned phys_node(u64 paddr)
+{
+    if (!ready) {
+        return 0;
+    }
+    for (unsigned i = 0; i < memory_ranges_count; i++) {
+        auto& r = memory_ranges[i];
+        if (paddr >= r.start && paddr < r.end) {
+            return r.node;
+        }
+    }
+    return 0;
+}
+
+u64 next_node_boundary(u64 paddr)
+{
+    u64 next = ~0ULL;
+    if (!ready) {
+        return next;
+    }
+    for (unsigned i = 0; i < memory_ranges_count; i++) {
+        auto& r = memory_ranges[i];
+        if (r.start > paddr) {
+            next = std::min(next, r.start);
+        }
+        if (r.end > paddr) {
+            next = std::min(next, r.end);
+        }
+    }
+    return next;
+}
+
+unsigned cpu_node(unsigned cpu_id)
+{
+#ifdef __x86_64__
+    if (ready && apic_nodes_count && cpu_id < sched::cpus.size()) {
+        auto apic_id = sched::cpus[cpu_id]->arch.apic_id;
+        for (unsigned i = 0; i < apic_nodes_count; i++) {
+            if (apic_nodes[i].apic_id == apic_id) {
+                return apic_nodes[i].node;
+            }
+        }
+    }
+#endif
+    return 0;
+}
+
+const unsigned* fallback_order(unsigned node)
+{
+    return fallback[node];
+}
+
+void add_memory(u32 domain, u64 base, u64 length)
+{
+    auto node = domain_to_node(domain);
+    if (node < 0 || memory_ranges_count == max_memory_ranges) {
+        return;
+    }
+    memory_ranges[memory_ranges_count++] = { base, base + length, unsigned(node) };
+}
+
+void add_cpu(u32 domain, u32 apic_id)
+{
+    auto node = domain_to_node(domain);
+    if (node < 0 || apic_nodes_count == max_apics) {
+        return;
+    }
+    apic_nodes[apic_nodes_count].apic_id = apic_id;
+    apic_nodes[apic_nodes_count].node = node;
+    apic_nodes_count++;
+}
+
+void set_distance(u32 from_domain, u32 to_domain, u8 distance)
+{
+    // only domains with memory or cpus in the SRAT become nodes
+    auto from = find_node(from_domain);
+    auto to = find_node(to_domain);
+    if (from >= 0 && to >= 0) {
+        distances[from][to] = distance;
+    }
+}
+
+// Compute the fallback order of every node. Distances missing from the SLIT
+// (or all of them, without one) default to the ACPI local/remote values.
+void setup_done()
+{
+    if (nodes_count < 2) {
+        return;
+    }
+    auto n = nr_nodes();
+    for (unsigned i = 0; i < n; i++) {
+        for (unsigned j = 0; j < n; j++) {
+            if (!distances[i][j]) {
+                distances[i][j] = i == j ? local_distance : remote_distance;
+            }
+            fallback[i][j] = j;
+        }
+        std::stable_sort(fallback[i], fallback[i] + n, [i] (unsigned a, unsigned b) {
+            if (a == i || b == i) {
+                return a == i && b != i;
+            }
+            return distances[i][a] < distances[i][b];
+        });
+    }
+    ready = true;
+}
+
+}
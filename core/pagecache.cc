@@ -18,6 +18,7 @@
 #include <fs/vfs/vfs_id.h>
 #include <osv/trace.hh>
 #include <osv/prio.hh>
+#include <osv/rcu-hashtable.hh>
 #include <chrono>
 
 //These four function pointers will be set dynamically in INIT function of
@@ -175,12 +176,41 @@ protected:
         return boost::apply_visitor(mr, _ptes);
     }
 
+    // Pages of the read caches are found by page faults under RCU, without
+    // the cache lock. Their ptes are then protected by the page's own lock,
+    // and a page erased from its cache is marked dead and freed once the
+    // last reference to it is dropped.
+    mutex _lock;
+    bool _dead = false;
+    std::atomic<unsigned> _refs = {1};
+
 public:
     cached_page(hashkey key, void* page) : _key(key), _page(page) {
     }
     virtual ~cached_page() {
     }
 
+    void lock() { _lock.lock(); }
+    void unlock() { _lock.unlock(); }
+    bool dead() const { return _dead; }
+    void get_ref() {
+        _refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    void put_ref() {
+        if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+    // Called with the cache lock and the page lock held, as the page is
+    // erased from its cache.
+    virtual void kill() {
+        _dead = true;
+    }
+    // Drops the cache's reference once no lookup can find the page anymore.
+    void retire() {
+        osv::rcu_defer([] (cached_page* cp) { cp->put_ref(); }, this);
+    }
+
     void map(mmu::hw_ptep<0> ptep) {
         ptep_add add(_ptes, ptep);
         boost::apply_visitor(add, _ptes);
@@ -284,7 +314,14 @@ private:
 
 public:
     cached_page_arc(hashkey key, void* page, arc_buf_t* ab) : cached_page(key, page), _ab(ref(ab, this)) {}
+    // A page which never made it into the cache was never killed
     virtual ~cached_page_arc() {
+        if (!dead()) {
+            unref(_ab, this);
+        }
+    }
+    virtual void kill() override {
+        cached_page::kill();
         if (!_removed && unref(_ab, this)) {
             (*arc_unshare_buf_fun)(_ab);
         }
@@ -313,28 +350,69 @@ static bool operator==(const cached_page_arc::arc_map::value_type& l, const cach
 }
 
 std::unordered_multimap<arc_buf_t*, cached_page_arc*> cached_page_arc::arc_cache_map;
+
+// The page caches are RCU hash tables so that page faults can look pages up
+// without taking the cache locks, which are only needed to modify them.
+template<typename T>
+struct cache_entry {
+    hashkey key;
+    T* page;
+};
+
+struct cache_entry_hash {
+    template<typename T>
+    size_t operator()(const cache_entry<T>& e) const noexcept {
+        return std::hash<hashkey>()(e.key);
+    }
+};
+
+struct cache_entry_compare {
+    template<typename T>
+    bool operator()(const hashkey& key, const cache_entry<T>& e) const noexcept {
+        return key == e.key;
+    }
+};
+
+template<typename T>
+using cache_map = osv::rcu_hashtable<cache_entry<T>, cache_entry_hash>;
+
 //Map used to store read cache pages for ZFS filesystem interacting with ARC
-static std::unordered_map<hashkey, cached_page_arc*> arc_read_cache;
+static cache_map<cached_page_arc> arc_read_cache;
 //Map used to store read cache pages for non-ZFS filesystems
-static std::unordered_map<hashkey, cached_page*> read_cache;
-static std::unordered_map<hashkey, cached_page_write*> write_cache;
+static cache_map<cached_page> read_cache;
+static cache_map<cached_page_write> write_cache;
 static std::deque<cached_page_write*> write_lru;
-static mutex arc_read_lock; // protects against parallel access to the ARC read cache
-static mutex read_lock; // protects against parallel access to the read cache
+static mutex arc_read_lock; // protects against parallel modification of the ARC read cache
+static mutex read_lock; // protects against parallel modification of the read cache
 static mutex write_lock; // protect against parallel access to the write cache
 
+// Must be called with the cache's lock held
 template<typename T>
-static T find_in_cache(std::unordered_map<hashkey, T>& cache, hashkey& key)
+static T* find_in_cache(cache_map<T>& cache, const hashkey& key)
 {
-    auto cpi = cache.find(key);
+    auto i = cache.owner_find(key, std::hash<hashkey>(), cache_entry_compare());
+    return i ? i->page : nullptr;
+}
 
-    if (cpi == cache.end()) {
-        return nullptr;
-    } else {
-        return cpi->second;
+template<typename T>
+static void erase_from_cache(cache_map<T>& cache, const hashkey& key)
+{
+    auto i = cache.owner_find(key, std::hash<hashkey>(), cache_entry_compare());
+    if (i) {
+        cache.erase(i);
     }
 }
 
+template<typename T>
+static bool insert_into_cache(cache_map<T>& cache, T* cp)
+{
+    if (find_in_cache(cache, cp->key())) {
+        return false;
+    }
+    cache.insert(cache_entry<T>{cp->key(), cp});
+    return true;
+}
+
 static void add_read_mapping(cached_page *cp, mmu::hw_ptep<0> ptep)
 {
     cp->map(ptep);
@@ -348,11 +426,18 @@ static void add_arc_read_mapping(cached_page_arc *cp, mmu::hw_ptep<0> ptep)
 }
 
 template<typename T>
-static void remove_read_mapping(std::unordered_map<hashkey, T>& cache, cached_page* cp, mmu::hw_ptep<0> ptep)
+static void remove_read_mapping(cache_map<T>& cache, T* cp, mmu::hw_ptep<0> ptep)
 {
-    if (cp->unmap(ptep) == 0) {
-        cache.erase(cp->key());
-        delete cp;
+    bool last;
+    WITH_LOCK(*cp) {
+        last = cp->unmap(ptep) == 0;
+        if (last) {
+            erase_from_cache(cache, cp->key());
+            cp->kill();
+        }
+    }
+    if (last) {
+        cp->retire();
     }
 }
 
@@ -401,16 +486,20 @@ void remove_arc_read_mapping(hashkey& key, mmu::hw_ptep<0> ptep)
 }
 
 template<typename T>
-static unsigned drop_read_cached_page(std::unordered_map<hashkey, T>& cache, cached_page* cp, bool flush)
+static unsigned drop_read_cached_page(cache_map<T>& cache, T* cp, bool flush)
 {
-    int flushed = cp->flush();
-    cache.erase(cp->key());
+    int flushed;
+    WITH_LOCK(*cp) {
+        flushed = cp->flush();
+        erase_from_cache(cache, cp->key());
+        cp->kill();
+    }
 
     if (flush && flushed > 1) { // if there was only one pte it is the one we are faulting on; no need to flush.
         mmu::flush_tlb_all();
     }
 
-    delete cp;
+    cp->retire();
 
     return flushed;
 }
@@ -454,7 +543,12 @@ void map_arc_buf(hashkey *key, arc_buf_t* ab, void *page)
     trace_map_arc_buf(ab, page);
     SCOPE_LOCK(arc_read_lock);
     cached_page_arc* pc = new cached_page_arc(*key, page, ab);
-    arc_read_cache.emplace(*key, pc);
+    // As with the std::unordered_map this used to be, a page that is
+    // already cached is not replaced.
+    if (!insert_into_cache(arc_read_cache, pc)) {
+        delete pc;
+        return;
+    }
     (*arc_share_buf_fun)(ab);
 }
 
@@ -462,7 +556,10 @@ void map_read_cached_page(hashkey *key, void *page)
 {
     SCOPE_LOCK(read_lock);
     cached_page* pc = new cached_page(*key, page);
-    read_cache.emplace(*key, pc);
+    if (!insert_into_cache(read_cache, pc)) {
+        // Two faults raced to read the same page in
+        delete pc;
+    }
 }
 
 static int create_read_cached_page(vfs_file* fp, hashkey& key)
@@ -483,7 +580,7 @@ static std::unique_ptr<cached_page_write> create_write_cached_page(vfs_file* fp,
 TRACEPOINT(trace_drop_write_cached_page, "addr=%p", void*);
 static void insert(cached_page_write* cp) {
     static cached_page_write* tofree[max_lru_free_count];
-    write_cache.emplace(cp->key(), cp);
+    insert_into_cache(write_cache, cp);
     write_lru.push_front(cp);
 
     if (write_lru.size() > lru_max_length) {
@@ -491,7 +588,7 @@ static void insert(cached_page_write* cp) {
             cached_page_write *p = write_lru.back();
             write_lru.pop_back();
             trace_drop_write_cached_page(p->addr());
-            write_cache.erase(p->key());
+            erase_from_cache(write_cache, p->key());
             if (p->flush_check_dirty()) {
                 p->mark_dirty();
             }
@@ -506,11 +603,58 @@ static void insert(cached_page_write* cp) {
 
 #define IS_ZFS(st_dev) ((st_dev & (0xffULL<<56)) == ZFS_ID)
 
+// Read fault on a page that is already in a read cache, and not in the
+// write cache: map it without taking any of the cache locks, so that such
+// faults proceed in parallel. Returns false, having done nothing, if the
+// fault must take the slow path.
+template<typename T>
+static bool map_read_cached_page_fast(cache_map<T>& cache, void (*add_mapping)(T*, mmu::hw_ptep<0>),
+                                      const hashkey& key, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pte, bool& ret)
+{
+    T* cp = nullptr;
+    WITH_LOCK(osv::rcu_read_lock) {
+        if (write_cache.reader_find(key, std::hash<hashkey>(), cache_entry_compare())) {
+            return false;
+        }
+        auto i = cache.reader_find(key, std::hash<hashkey>(), cache_entry_compare());
+        if (!i) {
+            return false;
+        }
+        cp = i->page;
+        cp->get_ref();
+    }
+    // If the page was dropped after we found it (e.g., it moved to the write
+    // cache), the slow path will sort it out; otherwise whoever drops it
+    // later will see our mapping.
+    bool mapped = false;
+    WITH_LOCK(*cp) {
+        if (!cp->dead()) {
+            add_mapping(cp, ptep);
+            ret = mmu::write_pte(cp->addr(), ptep, mmu::pte_mark_cow(pte, true));
+            mapped = true;
+        }
+    }
+    cp->put_ref();
+    return mapped;
+}
+
 bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pte, bool write, bool shared)
 {
     struct stat st;
     fp->stat(&st);
     hashkey key {st.st_dev, st.st_ino, offset};
+
+    if (!write) {
+        bool ret;
+        if (IS_ZFS(st.st_dev)) {
+            if (map_read_cached_page_fast(arc_read_cache, add_arc_read_mapping, key, ptep, pte, ret)) {
+                return ret;
+            }
+        } else if (map_read_cached_page_fast(read_cache, add_read_mapping, key, ptep, pte, ret)) {
+            return ret;
+        }
+    }
+
     SCOPE_LOCK(write_lock);
     cached_page_write* wcp = find_in_cache(write_cache, key);
 
@@ -554,6 +698,7 @@ bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pt
                 WITH_LOCK(arc_read_lock) {
                     cached_page_arc* cp = find_in_cache(arc_read_cache, key);
                     if (cp) {
+                        SCOPE_LOCK(*cp);
                         add_arc_read_mapping(cp, ptep);
                         return mmu::write_pte(cp->addr(), ptep, mmu::pte_mark_cow(pte, true));
                     }
@@ -564,6 +709,7 @@ bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pt
                 WITH_LOCK(read_lock) {
                     cached_page* cp = find_in_cache(read_cache, key);
                     if (cp) {
+                        SCOPE_LOCK(*cp);
                         add_read_mapping(cp, ptep);
                         return mmu::write_pte(cp->addr(), ptep, mmu::pte_mark_cow(pte, true));
                     }
@@ -722,7 +868,11 @@ private:
                             [&accessed, &scanned, &cleared](cached_page_arc::arc_map::value_type& p) {
                         auto arcbuf = p.first;
                         auto cp = p.second;
-                        if (cp->clear_accessed()) {
+                        bool accessed_bit;
+                        WITH_LOCK(*cp) {
+                            accessed_bit = cp->clear_accessed();
+                        }
+                        if (accessed_bit) {
                             arc_hashkey arc_hashkey;
                             (*arc_buf_get_hashkey_fun)(arcbuf, arc_hashkey.key);
                             accessed.emplace(arc_hashkey);
@@ -27,6 +27,7 @@
 #include <osv/app.hh>
 #include <osv/symbols.hh>
 #include <osv/stubbing.hh>
+#include <osv/numa.hh>
 
 MAKE_SYMBOL(sched::thread::current);
 MAKE_SYMBOL(sched::cpu::current);
@@ -52,6 +53,9 @@ TRACEPOINT(trace_sched_wait, "");
 TRACEPOINT(trace_sched_wait_ret, "");
 TRACEPOINT(trace_sched_wake, "wake %p", thread*);
 TRACEPOINT(trace_sched_migrate, "thread=%p cpu=%d", thread*, unsigned);
+TRACEPOINT(trace_sched_steal_request, "cpu %d victim %d load=%d", unsigned, unsigned, unsigned);
+TRACEPOINT(trace_sched_steal, "thread=%p from %d to %d", thread*, unsigned, unsigned);
+TRACEPOINT(trace_sched_wake_forward, "thread=%p cpu %d", thread*, unsigned);
 TRACEPOINT(trace_sched_queue, "thread=%p", thread*);
 TRACEPOINT(trace_sched_load, "load=%d", size_t);
 TRACEPOINT(trace_sched_preempt, "");
@@ -261,6 +265,9 @@ void cpu::reschedule_from_interrupt(bool called_from_yield,
     assert(sched::exception_depth <= 1);
     need_reschedule = false;
     handle_incoming_wakeups();
+    if (steal_requests) {
+        handle_steal_requests();
+    }
 
     auto now = osv::clock::uptime::now();
     auto interval = now - running_since;
@@ -368,6 +375,7 @@ void cpu::reschedule_from_interrupt(bool called_from_yield,
     trace_sched_load(runqueue.size());
 
     n->_detached_state->st.store(thread::status::running);
+    running_thread.store(n, std::memory_order_relaxed);
     n->_runtime.hysteresis_run_start();
 
     assert(n!=p);
@@ -467,9 +475,10 @@ void cpu::do_idle()
     do {
         idle_poll_lock_type idle_poll_lock{*this};
         WITH_LOCK(idle_poll_lock) {
-            // spin for a bit before halting
+            // Ask a loaded neighbour for work, then spin for a bit before
+            // halting: its threads arrive through incoming_wakeups.
+            steal_work();
             for (unsigned ctr = 0; ctr < 10000; ++ctr) {
-                // FIXME: can we pull threads from loaded cpus?
                 handle_incoming_wakeups();
                 if (!runqueue.empty()) {
                     return;
@@ -522,6 +531,11 @@ void cpu::handle_incoming_wakeups()
     if (!queues_with_wakes) {
         return;
     }
+    // While a thread runs here, a woken thread would have to wait for it or
+    // preempt it; if a cpu sharing our cache is idle, run it there instead.
+    auto p = thread::current();
+    bool busy = p != idle_thread &&
+        p->_detached_state->st.load(std::memory_order_relaxed) == thread::status::running;
     for (auto i : queues_with_wakes) {
         irq_save_lock_type irq_lock;
         WITH_LOCK(irq_lock) {
@@ -536,6 +550,8 @@ void cpu::handle_incoming_wakeups()
                 } else if (t.tcpu() != this) {
                     // Thread was woken on the wrong cpu. Can be a side-effect
                     // of sched::thread::pin(thread*, cpu*). Do nothing.
+                } else if (busy && !t._migration_lock_counter && forward_wakeup(t)) {
+                    // Now queued on an idle sibling
                 } else {
                     t._detached_state->st.store(thread::status::queued);
                     // Make sure the CPU-local runtime measure is suitably
@@ -553,6 +569,29 @@ void cpu::handle_incoming_wakeups()
     trace_sched_load(runqueue.size());
 }
 
+// Hand a thread woken on this cpu over to an idle sibling, which will
+// finish the wakeup. Called with interrupts disabled.
+bool cpu::forward_wakeup(thread& t)
+{
+    auto target = idle_sibling();
+    if (!target) {
+        return false;
+    }
+    trace_sched_wake_forward(&t, target->id);
+    trace_sched_migrate(&t, target->id);
+    t.suspend_timers();
+    t._runtime.export_runtime();
+    t._detached_state->_cpu = target;
+    t.remote_thread_local_var(::percpu_base) = target->percpu_base;
+    t.remote_thread_local_var(current_cpu) = target;
+    t.stat_migrations.incr();
+    target->incoming_wakeups[id].push_back(t);
+    target->incoming_wakeups_mask.set(id);
+    target->send_wakeup_ipi();
+    steals.wake_forwards++;
+    return true;
+}
+
 void cpu::enqueue(thread& t)
 {
     trace_sched_queue(&t);
@@ -599,9 +638,9 @@ void thread::pin(cpu *target_cpu)
     }
     // We want to wake this thread on the target CPU, but can't do this while
     // it is still running on this CPU. So we need a different thread to
-    // complete the wakeup. We could re-used an existing thread (e.g., the
-    // load balancer thread) but a "good-enough" dirty solution is to
-    // temporarily create a new ad-hoc thread, "wakeme".
+    // complete the wakeup. We could re-used an existing per-cpu thread, but
+    // a "good-enough" dirty solution is to temporarily create a new ad-hoc
+    // thread, "wakeme".
     bool do_wakeme = false;
     thread_unique_ptr wakeme(thread::make_unique([&] () {
         wait_until([&] { return do_wakeme; });
@@ -643,7 +682,7 @@ void thread::pin(thread *t, cpu *target_cpu)
     // To work on the target thread, we need to run code on the same CPU on
     // where the target thread is currently running. We start here a new
     // helper thread to follow the target thread's CPU. We could have also
-    // re-used an existing thread (e.g., the load balancer thread).
+    // re-used an existing per-cpu thread.
     thread_unique_ptr helper(thread::make_unique([&] {
 #if CONF_lazy_stack_invariant
         assert(!thread::current()->is_app());
@@ -787,12 +826,172 @@ void thread::unpin()
     helper->join();
 }
 
+// How long idle cpus leave alone a cpu that had nothing to give them
+static constexpr auto steal_backoff = 1_ms;
+// Period of the fallback balancer, for uneven but busy cpus
+static constexpr auto balance_period = 500_ms;
+
+// Called by the idle thread before it halts. Only the owning cpu may touch
+// a runqueue, so we can't take threads from a loaded cpu ourselves: we ask
+// it to push us some in handle_steal_requests(), and send it an IPI so that
+// it does so right away rather than on its next context switch.
+bool cpu::steal_work()
+{
+    for (auto& level : domains) {
+        cpu* victim = nullptr;
+        // A busy cpu's runqueue also holds its idle thread, so a load of
+        // one means there is nothing to steal.
+        unsigned max_load = 1;
+        auto now = osv::clock::uptime::now().time_since_epoch().count();
+        for (auto c : level) {
+            auto l = c->load();
+            // Skip a cpu whose queued threads recently turned out to be
+            // all pinned: asking again would only wake it up for nothing.
+            if (l > max_load &&
+                c->steal_backoff_until.load(std::memory_order_relaxed) <= now) {
+                victim = c;
+                max_load = l;
+            }
+        }
+        if (victim) {
+            if (!victim->steal_requests.test_and_set(id)) {
+                trace_sched_steal_request(id, victim->id, max_load);
+                steals.requests++;
+                wakeup_ipi.send(victim);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Called from reschedule_from_interrupt(), with interrupts disabled and
+// before the current thread is requeued, for every idle cpu that asked us
+// for work. We give away up to half of our queued threads, starting from
+// the back of the runqueue (the ones least likely to run here soon), and
+// skip pinned threads or those holding a migration lock.
+void cpu::handle_steal_requests()
+{
+    cpu_set thieves{steal_requests.fetch_clear()};
+    thread* p = thread::current();
+    // If the current thread is going to sleep, keep one thread to run here.
+    unsigned keep = (p != idle_thread &&
+        p->_detached_state->st.load(std::memory_order_relaxed) == thread::status::running) ? 0 : 1;
+    for (auto i : thieves) {
+        auto thief = cpus[i];
+        unsigned queued = runqueue.size() - (p != idle_thread ? 1 : 0);
+        if (queued <= keep) {
+            break;
+        }
+        unsigned n = std::max(1u, (queued - keep) / 2);
+        unsigned pushed = 0;
+        auto it = runqueue.end();
+        while (n && it != runqueue.begin()) {
+            auto& mig = *--it;
+            if (mig._migration_lock_counter) {
+                continue;
+            }
+            it = runqueue.erase(it);
+            n--;
+            trace_sched_steal(&mig, id, thief->id);
+            trace_sched_migrate(&mig, thief->id);
+            // we won't race with wake(), since we're not thread::waiting
+            assert(mig._detached_state->st.load() == thread::status::queued);
+            mig._detached_state->st.store(thread::status::waking);
+            mig.suspend_timers();
+            mig._detached_state->_cpu = thief;
+            // Convert the CPU-local runtime measure to a globally meaningful
+            // measure
+            mig._runtime.export_runtime();
+            mig.remote_thread_local_var(::percpu_base) = thief->percpu_base;
+            mig.remote_thread_local_var(current_cpu) = thief;
+            mig.stat_migrations.incr();
+            thief->incoming_wakeups[id].push_back(mig);
+            thief->incoming_wakeups_mask.set(id);
+            pushed++;
+            steals.pushed++;
+            thief->steals.stolen.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (!pushed) {
+            // Everything queued here is pinned or holds a migration lock;
+            // keep idle cpus from asking again for a while.
+            auto until = osv::clock::uptime::now() + steal_backoff;
+            steal_backoff_until.store(until.time_since_epoch().count(),
+                                      std::memory_order_relaxed);
+            break;
+        }
+        thief->send_wakeup_ipi();
+    }
+}
+
+domain cpu::domain_of(const cpu* other) const
+{
+    if (other->arch.core_id == arch.core_id) {
+        return domain::smt;
+    } else if (other->arch.llc_id == arch.llc_id) {
+        return domain::llc;
+    } else if (numa::cpu_node(other->id) == numa::cpu_node(id)) {
+        return domain::node;
+    }
+    return domain::system;
+}
+
+void cpu::init_domains()
+{
+    std::array<std::vector<cpu*>, nr_domains> d;
+    for (auto c : cpus) {
+        if (c != this) {
+            d[unsigned(domain_of(c))].push_back(c);
+        }
+    }
+    // The idle thread walks the domains, and can only run when we aren't.
+    WITH_LOCK(irq_lock) {
+        domains.swap(d);
+    }
+}
+
+// An idle cpu sharing a cache with this one, to run a thread woken here
+// while we are busy. A cpu is idle if its idle thread runs and nothing is
+// queued or on its way to it.
+cpu* cpu::idle_sibling()
+{
+    for (auto level : { domain::smt, domain::llc }) {
+        for (auto c : domains[unsigned(level)]) {
+            if (c->load() == 0 && !c->incoming_wakeups_mask && c->idle_thread &&
+                    c->idle_thread->_detached_state->st.load(std::memory_order_relaxed) == thread::status::running) {
+                return c;
+            }
+        }
+    }
+    return nullptr;
+}
+
+std::vector<cpu*> cpus_by_topology()
+{
+    std::vector<cpu*> ret(cpus);
+    std::stable_sort(ret.begin(), ret.end(), [] (cpu* a, cpu* b) {
+        auto na = numa::cpu_node(a->id), nb = numa::cpu_node(b->id);
+        if (na != nb) {
+            return na < nb;
+        } else if (a->arch.llc_id != b->arch.llc_id) {
+            return a->arch.llc_id < b->arch.llc_id;
+        }
+        return a->arch.core_id < b->arch.core_id;
+    });
+    return ret;
+}
+
+// Runs on each cpu once it is up and its idle thread started.
+// Work stealing only kicks in when a cpu goes idle, so two busy cpus with
+// uneven runqueues would never even out. Every balance_period this moves
+// one thread to the least loaded cpu when the difference is large enough.
 void cpu::load_balance()
 {
+    init_domains();
     notifier::fire();
     timer tmr(*thread::current());
     while (true) {
-        tmr.set(osv::clock::uptime::now() + 100_ms);
+        tmr.set(osv::clock::uptime::now() + balance_period);
         thread::wait_until([&] { return tmr.expired(); });
         if (runqueue.empty()) {
             continue;
@@ -832,8 +1031,6 @@ void cpu::load_balance()
             mig.stat_migrations.incr();
             min->incoming_wakeups[id].push_back(mig);
             min->incoming_wakeups_mask.set(id);
-            // FIXME: avoid if the cpu is alive and if the priority does not
-            // FIXME: warrant an interruption
             min->send_wakeup_ipi();
         }
     }
@@ -33,6 +33,8 @@ extern "C" {
 #include <osv/interrupt.hh>
 
 #include <osv/prio.hh>
+#include <osv/mempool.hh>
+#include <osv/numa.hh>
 #include "acpi.hh"
 
 #define acpi_tag "acpi"
@@ -555,6 +557,73 @@ bool is_enabled() {
     return enabled;
 }
 
+// Feed the NUMA topology from the SRAT (cpu and memory affinity) and the
+// SLIT (node distances) to the numa module, then let the page allocator
+// split its free memory per node. Without an SRAT there is a single node.
+static void parse_numa_tables()
+{
+    char srat_sig[] = ACPI_SIG_SRAT;
+    ACPI_TABLE_HEADER* srat_header;
+    if (ACPI_FAILURE(AcpiGetTable(srat_sig, 0, &srat_header))) {
+        return;
+    }
+    void* subtable = reinterpret_cast<ACPI_TABLE_SRAT*>(srat_header) + 1;
+    void* srat_end = static_cast<void*>(srat_header) + srat_header->Length;
+    while (subtable < srat_end) {
+        auto s = static_cast<ACPI_SUBTABLE_HEADER*>(subtable);
+        if (!s->Length) {
+            break;
+        }
+        switch (s->Type) {
+        case ACPI_SRAT_TYPE_CPU_AFFINITY: {
+            auto cpu = static_cast<ACPI_SRAT_CPU_AFFINITY*>(subtable);
+            if (cpu->Flags & ACPI_SRAT_CPU_USE_AFFINITY) {
+                u32 domain = cpu->ProximityDomainLo |
+                    (cpu->ProximityDomainHi[0] << 8) |
+                    (cpu->ProximityDomainHi[1] << 16) |
+                    (cpu->ProximityDomainHi[2] << 24);
+                numa::add_cpu(domain, cpu->ApicId);
+            }
+            break;
+        }
+        case ACPI_SRAT_TYPE_X2APIC_CPU_AFFINITY: {
+            auto cpu = static_cast<ACPI_SRAT_X2APIC_CPU_AFFINITY*>(subtable);
+            if (cpu->Flags & ACPI_SRAT_CPU_USE_AFFINITY) {
+                numa::add_cpu(cpu->ProximityDomain, cpu->ApicId);
+            }
+            break;
+        }
+        case ACPI_SRAT_TYPE_MEMORY_AFFINITY: {
+            auto mem = static_cast<ACPI_SRAT_MEM_AFFINITY*>(subtable);
+            if ((mem->Flags & ACPI_SRAT_MEM_ENABLED) && mem->Length) {
+                numa::add_memory(mem->ProximityDomain, mem->BaseAddress, mem->Length);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        subtable += s->Length;
+    }
+
+    char slit_sig[] = ACPI_SIG_SLIT;
+    ACPI_TABLE_HEADER* slit_header;
+    if (ACPI_SUCCESS(AcpiGetTable(slit_sig, 0, &slit_header))) {
+        auto slit = reinterpret_cast<ACPI_TABLE_SLIT*>(slit_header);
+        auto n = slit->LocalityCount;
+        for (u64 i = 0; i < n; i++) {
+            for (u64 j = 0; j < n; j++) {
+                numa::set_distance(i, j, slit->Entry[i * n + j]);
+            }
+        }
+    }
+
+    memory::setup_numa_nodes();
+    if (numa::nr_nodes() > 1) {
+        acpi_i("%d NUMA nodes\n", numa::nr_nodes());
+    }
+}
+
 void early_init()
 {
     if (!acpi::pvh_rsdp_paddr) {
@@ -596,6 +665,8 @@ void early_init()
     }
 
     enabled = true;
+
+    parse_numa_tables();
 }
 
 UINT32 acpi_poweroff(void *unused)
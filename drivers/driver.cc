@@ -8,8 +8,16 @@
 #include "drivers/driver.hh"
 #include <osv/pci.hh>
 #include <osv/debug.hh>
+#include <osv/sched.hh>
+#include <osv/mmu-defs.hh>
+#include <osv/boot.hh>
+#include <memory>
+#include <map>
 
 #include "driver.hh"
+#include "drivers/virtio.hh"
+
+extern boot_time_chart boot_time;
 
 using namespace pci;
 
@@ -32,18 +40,78 @@ namespace hw {
         _probes.push_back(probe);
     }
 
+    // Devices of the same kind are probed one after another, in order, so
+    // that their driver numbers its instances (eth0, eth1...) as it always
+    // did. virtio-blk and virtio-scsi share the vblkN disk names, so they
+    // count as one kind.
+    static u32 probe_group(hw_device* dev)
+    {
+        auto id = dev->get_id();
+        if (id == hw_device_id(virtio::VIRTIO_VENDOR_ID, virtio::VIRTIO_ID_SCSI)) {
+            id = hw_device_id(virtio::VIRTIO_VENDOR_ID, virtio::VIRTIO_ID_BLOCK);
+        }
+        return id.make32();
+    }
+
+    hw_driver* driver_manager::probe(hw_device* dev)
+    {
+        auto start = processor::ticks();
+        for (auto probe : _probes) {
+            if (auto drv = probe(dev)) {
+                dev->set_attached();
+                boot_time.driver_event(drv->get_name().c_str(), start,
+                                       processor::ticks());
+                return drv;
+            }
+        }
+        return nullptr;
+    }
+
+    // Different kinds of devices are independent, so with more than one
+    // CPU each kind is probed by its own thread. Driver initialization
+    // mostly waits for the device (resets, feature negotiation, reading
+    // the partition table), so this shortens the boot even when there are
+    // more kinds than CPUs.
     void driver_manager::load_all()
     {
         auto dm = device_manager::instance();
-        dm->for_each_device([this] (hw_device* dev) {
-            for (auto probe : _probes) {
-                if (auto drv = probe(dev)) {
-                    dev->set_attached();
-                    _drivers.push_back(drv);
-                    break;
-                }
-            }
+        std::vector<hw_device*> devices;
+        std::map<u32, std::vector<size_t>> groups;
+        dm->for_each_device([&] (hw_device* dev) {
+            groups[probe_group(dev)].push_back(devices.size());
+            devices.push_back(dev);
         });
+
+        std::vector<hw_driver*> drivers(devices.size());
+        auto probe_group_devices = [&] (const std::vector<size_t>& group) {
+            for (auto i : group) {
+                drivers[i] = probe(devices[i]);
+            }
+        };
+        if (sched::cpus.size() > 1 && groups.size() > 1) {
+            std::vector<std::unique_ptr<sched::thread>> threads;
+            for (auto& g : groups) {
+                auto& group = g.second;
+                threads.emplace_back(sched::thread::make(
+                    [&probe_group_devices, &group] { probe_group_devices(group); },
+                    sched::thread::attr().name("probe").stack(64 * mmu::page_size)));
+                threads.back()->start();
+            }
+            for (auto& t : threads) {
+                t->join();
+            }
+        } else {
+            for (auto& g : groups) {
+                probe_group_devices(g.second);
+            }
+        }
+
+        // Keep the drivers in device order, like a serial probe would.
+        for (auto drv : drivers) {
+            if (drv) {
+                _drivers.push_back(drv);
+            }
+        }
     }
 
     void driver_manager::unload_all()
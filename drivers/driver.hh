@@ -48,6 +48,8 @@ namespace hw {
         void list_drivers();
 
     private:
+        hw_driver* probe(hw_device* dev);
+
         static driver_manager* _instance;
         std::vector<std::function<hw_driver* (hw_device*)>> _probes;
         std::vector<hw_driver*> _drivers;
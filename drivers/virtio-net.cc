@@ -23,6 +23,7 @@
 #include <osv/debug.h>
 
 #include <osv/sched.hh>
+#include <osv/clock.hh>
 #include <osv/trace.hh>
 #include <osv/net_trace.hh>
 
@@ -41,6 +42,7 @@
 
 TRACEPOINT(trace_virtio_net_rx_packet, "if=%d, len=%d", int, int);
 TRACEPOINT(trace_virtio_net_rx_wake, "");
+TRACEPOINT(trace_virtio_net_rx_lro_flush, "if=%d, merged=%d", int, int);
 TRACEPOINT(trace_virtio_net_fill_rx_ring, "if=%d", int);
 TRACEPOINT(trace_virtio_net_fill_rx_ring_added, "if=%d, added=%d", int, int);
 TRACEPOINT(trace_virtio_net_tx_packet, "if=%d, len=%d", int, int);
@@ -50,6 +52,7 @@ TRACEPOINT(trace_virtio_net_tx_no_space_calling_gc, "if=%d", int);
 TRACEPOINT(trace_virtio_net_tx_packet_size, "vring %p vec_sz %d", void*, int);
 TRACEPOINT(trace_virtio_net_tx_xmit_one_failed_to_post, "vring %p vec_sz %d",
            void*, int);
+TRACEPOINT(trace_virtio_net_ctrl_cmd, "if=%d, class=%d, cmd=%d, ack=%d", int, u8, u8, u8);
 
 using namespace memory;
 
@@ -60,6 +63,7 @@ using namespace memory;
 
 extern bool opt_maxnic;
 extern int maxnic;
+extern int net_rx_loan_limit;
 
 namespace virtio {
 
@@ -94,6 +98,16 @@ static int if_ioctl(struct ifnet* ifp, u_long command, caddr_t data)
     case SIOCDELMULTI:
         net_d("SIOCDELMULTI");
         break;
+    case SIOCSIFCAP: {
+        // ifioctl() already refused anything not in if_capabilities
+        auto ifr = reinterpret_cast<struct bsd_ifreq*>(data);
+        int mask = ifr->ifr_reqcap ^ ifp->if_capenable;
+        net_d("SIOCSIFCAP %x", mask);
+        if (mask & IFCAP_LRO) {
+            ifp->if_capenable ^= IFCAP_LRO;
+        }
+        break;
+    }
     default:
         net_d("redirecting to ether_ioctl()...");
         error = ether_ioctl(ifp, command, data);
@@ -135,11 +149,18 @@ static int if_transmit(struct ifnet* ifp, struct mbuf* m_head)
 
 inline int net::xmit(struct mbuf* buff)
 {
+    if (_txqs.size() == 1) {
+        return _txqs[0]->xmit(buff);
+    }
+
     //
-    // We currently have only a single TX queue. Select a proper TXq here when
-    // we implement a multi-queue.
+    // Transmit on the queue of the current CPU. Its xmitter only has per-CPU
+    // queues for its own CPUs, so we must not migrate until it's done with
+    // the packet.
     //
-    return _txq.xmit(buff);
+    WITH_LOCK(migration_lock) {
+        return _txqs[sched::cpu::current()->id % _txqs.size()]->xmit(buff);
+    }
 }
 
 inline int net::txq::xmit(mbuf* buff)
@@ -186,9 +207,13 @@ static void if_getinfo(struct ifnet* ifp, struct if_data* out_data)
 
 void net::fill_stats(struct if_data* out_data) const
 {
-    // We currently support only a single Tx/Rx queue so no iteration so far
-    fill_qstats(_rxq, out_data);
-    fill_qstats(_txq, out_data);
+    assert(!out_data->ifi_oerrors && !out_data->ifi_obytes && !out_data->ifi_opackets);
+    for (auto&& rxq : _rxqs) {
+        fill_qstats(*rxq, out_data);
+    }
+    for (auto&& txq : _txqs) {
+        fill_qstats(*txq, out_data);
+    }
 }
 
 void net::fill_qstats(const struct rxq& rxq, struct if_data* out_data) const
@@ -197,22 +222,21 @@ void net::fill_qstats(const struct rxq& rxq, struct if_data* out_data) const
     out_data->ifi_ibytes     += rxq.stats.rx_bytes;
     out_data->ifi_iqdrops    += rxq.stats.rx_drops;
     out_data->ifi_ierrors    += rxq.stats.rx_csum_err;
-    out_data->ifi_ibh_wakeups = rxq.stats.rx_bh_wakeups;
-    out_data->ifi_iwakeup_stats = rxq.stats.rx_wakeup_stats;
+    out_data->ifi_ibh_wakeups += rxq.stats.rx_bh_wakeups;
+    if_add_wakeup_stats(out_data->ifi_iwakeup_stats, rxq.stats.rx_wakeup_stats);
 }
 
 void net::fill_qstats(const struct txq& txq, struct if_data* out_data) const
 {
-    assert(!out_data->ifi_oerrors && !out_data->ifi_obytes && !out_data->ifi_opackets);
-    out_data->ifi_opackets       += txq.stats.tx_packets;
-    out_data->ifi_obytes         += txq.stats.tx_bytes;
-    out_data->ifi_oerrors        += txq.stats.tx_err + txq.stats.tx_drops;
-    out_data->ifi_oworker_kicks   = txq.stats.tx_worker_kicks;
-    out_data->ifi_oworker_wakeups = txq.stats.tx_worker_wakeups;
-    out_data->ifi_oworker_packets = txq.stats.tx_worker_packets;
-    out_data->ifi_okicks          = txq.stats.tx_kicks;
-    out_data->ifi_oqueue_is_full  = txq.stats.tx_hw_queue_is_full;
-    out_data->ifi_owakeup_stats   = txq.stats.tx_wakeup_stats;
+    out_data->ifi_opackets        += txq.stats.tx_packets;
+    out_data->ifi_obytes          += txq.stats.tx_bytes;
+    out_data->ifi_oerrors         += txq.stats.tx_err + txq.stats.tx_drops;
+    out_data->ifi_oworker_kicks   += txq.stats.tx_worker_kicks;
+    out_data->ifi_oworker_wakeups += txq.stats.tx_worker_wakeups;
+    out_data->ifi_oworker_packets += txq.stats.tx_worker_packets;
+    out_data->ifi_okicks          += txq.stats.tx_kicks;
+    out_data->ifi_oqueue_is_full  += txq.stats.tx_hw_queue_is_full;
+    if_add_wakeup_stats(out_data->ifi_owakeup_stats, txq.stats.tx_wakeup_stats);
 }
 
 bool net::ack_irq()
@@ -220,7 +244,9 @@ bool net::ack_irq()
     auto isr = _dev.read_and_ack_isr();
 
     if (isr) {
-        _rxq.vqueue->disable_interrupts();
+        for (auto&& rxq : _rxqs) {
+            rxq->vqueue->disable_interrupts();
+        }
         return true;
     } else {
         return false;
@@ -239,17 +265,28 @@ void net::init()
 
 net::net(virtio_device& dev)
     : virtio_driver(dev),
-    _pre_init(this),
-    _rxq(get_virt_queue(0), [this] { this->receiver(); }),
-    _txq(this, get_virt_queue(1))
+    _pre_init(this)
 {
     _driver_name = "virtio-net";
     virtio_i("VIRTIO NET INSTANCE");
     _id = _instance++;
 
-    sched::thread* poll_task = _rxq.poll_task.get();
+    //
+    // With VIRTIO_NET_F_MQ use a queue pair per CPU, as many as the device
+    // offers. The control queue follows the last pair the device has; if it
+    // didn't fit into our virtqueue table, stay with a single pair.
+    //
+    unsigned pairs = 1;
+    if (_mq && _ctrl_vq) {
+        _ctrl_queue = get_virt_queue(2 * _config.max_virtqueue_pairs);
+        if (_ctrl_queue) {
+            pairs = std::min<unsigned>(_config.max_virtqueue_pairs, sched::cpus.size());
+        }
+    } else if (_ctrl_vq) {
+        _ctrl_queue = get_virt_queue(2);
+    }
 
-    poll_task->set_priority(sched::thread::priority_infinity);
+    create_queues(pairs);
 
     // Please look at the section 5.1.6.1 of virtio specification for explanation
     if (_dev.is_modern()) {
@@ -277,7 +314,7 @@ net::net(virtio_device& dev)
     _ifn->if_qflush = if_qflush;
     _ifn->if_init = if_init;
     _ifn->if_getinfo = if_getinfo;
-    IFQ_SET_MAXLEN(&_ifn->if_snd, _txq.vqueue->size());
+    IFQ_SET_MAXLEN(&_ifn->if_snd, _txqs[0]->vqueue->size());
 
     _ifn->if_capabilities = 0;
 
@@ -289,61 +326,141 @@ net::net(virtio_device& dev)
         }
     }
 
+    // LRO is done in software on the segments of each Rx batch, and relies
+    // on the host having validated their checksums. It is off until turned
+    // on with SIOCSIFCAP, as merged segments delay the ACKs of a flow.
     if (_guest_csum) {
-        _ifn->if_capabilities |= IFCAP_RXCSUM;
-        if (_guest_tso4)
-            _ifn->if_capabilities |= IFCAP_LRO;
+        _ifn->if_capabilities |= IFCAP_RXCSUM | IFCAP_LRO;
     }
 
-    _ifn->if_capenable = _ifn->if_capabilities | IFCAP_HWSTATS;
+    _ifn->if_capenable = (_ifn->if_capabilities & ~IFCAP_LRO) | IFCAP_HWSTATS;
 
-    //Start the polling thread before attaching it to the Rx interrupt
-    poll_task->start();
-    _txq.start();
-
-    ether_ifattach(_ifn, _config.mac);
+    auto wake_receivers = [this] {
+        for (auto&& rxq : _rxqs) {
+            rxq->poll_task->wake_with_irq_disabled();
+        }
+    };
 
     interrupt_factory int_factory;
 #if CONF_drivers_pci
-    int_factory.register_msi_bindings = [this,poll_task](interrupt_manager &msi) {
-       msi.easy_register({
-           { 0, [&] { this->_rxq.vqueue->disable_interrupts(); }, poll_task },
-           { 1, [&] { this->_txq.vqueue->disable_interrupts(); }, nullptr }
-       });
+    int_factory.register_msi_bindings = [this](interrupt_manager &msi) {
+        //
+        // Entry i belongs to virtqueue i. Binding the Rx thread makes the
+        // vector follow it, so with a queue pair per CPU each Rx interrupt
+        // is delivered to the CPU that processes the queue. The control
+        // queue is polled and needs none. If the device has too few
+        // vectors, drop queue pairs until they fit; the queues' threads
+        // aren't started yet.
+        //
+        for (unsigned n = _rxqs.size(); n > 0; n--) {
+            std::vector<msix_binding> bindings;
+            for (unsigned i = 0; i < n; i++) {
+                vring* rx_vq = _rxqs[i]->vqueue;
+                vring* tx_vq = _txqs[i]->vqueue;
+                bindings.push_back({ rx_vq->index(), [rx_vq] { rx_vq->disable_interrupts(); },
+                                     _rxqs[i]->poll_task.get() });
+                bindings.push_back({ tx_vq->index(), [tx_vq] { tx_vq->disable_interrupts(); }, nullptr });
+            }
+            if (msi.easy_register(bindings)) {
+                if (n < _rxqs.size()) {
+                    net_w("Not enough MSI-X vectors, falling back to %d queue pairs", n);
+                    create_queues(n);
+                }
+                return;
+            }
+        }
+        net_e("Failed to register MSI-X vectors");
     };
 
-    int_factory.create_pci_interrupt = [this,poll_task](pci::device &pci_dev) {
+    int_factory.create_pci_interrupt = [this,wake_receivers](pci::device &pci_dev) {
         return new pci_interrupt(
             pci_dev,
             [=] { return this->ack_irq(); },
-            [=] { poll_task->wake_with_irq_disabled(); });
+            wake_receivers);
     };
 #endif
 
 #ifdef __aarch64__
-    int_factory.create_spi_edge_interrupt = [this,poll_task]() {
+    int_factory.create_spi_edge_interrupt = [this,wake_receivers]() {
         return new spi_interrupt(
             gic::irq_type::IRQ_TYPE_EDGE,
             _dev.get_irq(),
             [=] { return this->ack_irq(); },
-            [=] { poll_task->wake_with_irq_disabled(); });
+            wake_receivers);
     };
 #else
 #if CONF_drivers_mmio
-    int_factory.create_gsi_edge_interrupt = [this,poll_task]() {
+    int_factory.create_gsi_edge_interrupt = [this,wake_receivers]() {
         return new gsi_edge_interrupt(
             _dev.get_irq(),
-            [=] { if (this->ack_irq()) poll_task->wake_with_irq_disabled(); });
+            [=] { if (this->ack_irq()) wake_receivers(); });
     };
 #endif
 #endif
 
     _dev.register_interrupt(int_factory);
+    pairs = _rxqs.size();
 
-    fill_rx_ring();
+    for (auto&& rxq : _rxqs) {
+        rxq->lro.ifp = _ifn;
+    }
+
+    // The loan limit is shared evenly by the Rx queues
+    if (net_rx_loan_limit > 0) {
+        _rx_loan_limit = std::max(1u, net_rx_loan_limit / pairs);
+    }
+
+    // No interrupt can come before the Rx rings are filled
+    for (auto&& rxq : _rxqs) {
+        rxq->poll_task->start();
+    }
+    for (auto&& txq : _txqs) {
+        txq->start();
+    }
+
+    ether_ifattach(_ifn, _config.mac);
+
+    for (auto&& rxq : _rxqs) {
+        fill_rx_ring(*rxq);
+    }
 
     // Step 8
     add_dev_status(VIRTIO_CONFIG_S_DRIVER_OK);
+
+    //
+    // The device only uses the first pair until told otherwise, which can
+    // only be done once it is live.
+    //
+    if (pairs > 1) {
+        net_ctrl_mq mq = { static_cast<u16>(pairs) };
+        if (!ctrl_cmd(VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET, &mq, sizeof(mq))) {
+            net_e("Failed to enable %d queue pairs", pairs);
+        }
+    }
+    net_i("Using %d Rx/Tx queue pairs", pairs);
+}
+
+void net::create_queues(unsigned pairs)
+{
+    _rxqs.clear();
+    _txqs.clear();
+    for (unsigned i = 0; i < pairs; i++) {
+        auto attr = sched::thread::attr().name("virtio-net-rx");
+        if (pairs > 1) {
+            attr.name("virtio-net-rx" + std::to_string(i)).pin(sched::cpus[i]);
+        }
+        _rxqs.emplace_back(aligned_new<rxq>(get_virt_queue(2 * i),
+                                            [this, i] { this->receiver(*_rxqs[i]); }, attr));
+        _rxqs.back()->poll_task->set_priority(sched::thread::priority_infinity);
+
+        std::vector<sched::cpu*> cpus;
+        for (auto c : sched::cpus) {
+            if (c->id % pairs == i) {
+                cpus.push_back(c);
+            }
+        }
+        _txqs.emplace_back(aligned_new<txq>(this, get_virt_queue(2 * i + 1), cpus));
+    }
 }
 
 net::~net()
@@ -383,11 +500,21 @@ void net::read_config()
     _guest_tso4 = get_guest_feature_bit(VIRTIO_NET_F_GUEST_TSO4);
     _host_tso4 = get_guest_feature_bit(VIRTIO_NET_F_HOST_TSO4);
     _guest_ufo = get_guest_feature_bit(VIRTIO_NET_F_GUEST_UFO);
+    _ctrl_vq = get_guest_feature_bit(VIRTIO_NET_F_CTRL_VQ);
+    _mq = get_guest_feature_bit(VIRTIO_NET_F_MQ);
+
+    if (_mq) {
+        virtio_conf_read(offsetof(net_config, max_virtqueue_pairs),
+                         &_config.max_virtqueue_pairs, sizeof(_config.max_virtqueue_pairs));
+    } else {
+        _config.max_virtqueue_pairs = 1;
+    }
 
     net_i("Features: %s=%d,%s=%d", "Status", _status, "TSO_ECN", _tso_ecn);
     net_i("Features: %s=%d,%s=%d", "Host TSO ECN", _host_tso_ecn, "CSUM", _csum);
     net_i("Features: %s=%d,%s=%d", "Guest_csum", _guest_csum, "guest tso4", _guest_tso4);
     net_i("Features: %s=%d,%s=%d", "host tso4", _host_tso4, "MRG_RX_BUF", _mergeable_bufs);
+    net_i("Features: %s=%d,%s=%d", "MQ", _mq, "max queue pairs", _config.max_virtqueue_pairs);
 
     // If VIRTIO_NET_F_MRG_RXBUF is not negotiated and VIRTIO_NET_F_GUEST_TSO4
     // or VIRTIO_NET_F_GUEST_UFO are, the VirtIO spec mandates the guest to use
@@ -459,13 +586,16 @@ bool net::bad_rx_csum(struct mbuf* m, struct net_hdr* hdr)
     return false;
 }
 
-void net::receiver()
+void net::receiver(rxq& rxq)
 {
-    vring* vq = _rxq.vqueue;
+    vring* vq = rxq.vqueue;
     std::vector<iovec> packet;
     u64 rx_drops = 0, rx_packets = 0, csum_ok = 0;
     u64 csum_err = 0, rx_bytes = 0;
     static const u16 refill_thresh = 16;
+    // Packets passed up the stack at once: TCP segments of the same flow
+    // within a batch are coalesced by LRO
+    static const unsigned rx_batch = 64;
 
     while (1) {
 
@@ -473,33 +603,36 @@ void net::receiver()
         virtio_driver::wait_for_queue(vq, &vring::used_ring_not_empty);
         trace_virtio_net_rx_wake();
 
-        _rxq.stats.rx_bh_wakeups++;
-        _rxq.update_wakeup_stats(rx_packets);
+        rxq.stats.rx_bh_wakeups++;
+        rxq.update_wakeup_stats(rx_packets);
 
         u32 len;
         int nbufs;
+        unsigned batched = 0;
         rx_drops = rx_packets = csum_ok = 0;
         csum_err = rx_bytes = 0;
 
-        // use local header that we copy out of the mbuf since we're
-        // truncating it.
+        // use local header that we copy out of the Rx buffer since the
+        // buffer may be recycled before we're done with the packet.
         net_hdr_mrg_rxbuf* mhdr;
+        net_hdr hdr;
 
         while (void* buffer = vq->get_buf_elem(&len)) {
 
             vq->get_buf_finalize();
 
             if (vq->effective_avail_ring_count() >= refill_thresh)
-                fill_rx_ring();
+                fill_rx_ring(rxq);
 
             // Bad packet/buffer - discard and continue to the next one
             if (len < _hdr_size + ETHER_HDR_LEN) {
                 rx_drops++;
-                free_buffer(buffer);
+                put_buffer(rxq, buffer);
                 continue;
             }
 
             mhdr = static_cast<net_hdr_mrg_rxbuf*>(buffer);
+            hdr = mhdr->hdr;
 
             if (!_mergeable_bufs) {
                 nbufs = 1;
@@ -515,60 +648,136 @@ void net::receiver()
                 if (!buffer) {
                     rx_drops++;
                     for (auto&& v : packet) {
-                        free_buffer(v);
+                        put_buffer(rxq, v.iov_base);
                     }
+                    packet.clear();
                     break;
                 }
                 packet.push_back({buffer, len});
                 vq->get_buf_finalize();
             }
 
-            auto m_head = packet_to_mbuf(packet);
+            if (packet.empty()) {
+                continue;
+            }
+
+            // Hand the Rx buffers themselves up the stack unless too many
+            // of them are already held by sockets and zero-copy readers:
+            // then copy the packet so the buffers can go back to the ring.
+            mbuf* m_head = nullptr;
+            if (_rx_loan_limit &&
+                rxq.loaned.load(std::memory_order_relaxed) + packet.size() > _rx_loan_limit) {
+                m_head = copy_packet(rxq, packet);
+            }
+            if (m_head) {
+                rxq.stats.rx_loan_copies++;
+            } else {
+                m_head = packet_to_mbuf(rxq, packet);
+            }
             packet.clear();
 
             if ((_ifn->if_capenable & IFCAP_RXCSUM) &&
-                (mhdr->hdr.flags &
+                (hdr.flags &
                  net_hdr::VIRTIO_NET_HDR_F_NEEDS_CSUM)) {
-                if (bad_rx_csum(m_head, &mhdr->hdr))
+                if (bad_rx_csum(m_head, &hdr))
                     csum_err++;
                 else
                     csum_ok++;
 
+            } else if ((_ifn->if_capenable & IFCAP_RXCSUM) &&
+                       (hdr.flags & net_hdr::VIRTIO_NET_HDR_F_DATA_VALID)) {
+                m_head->M_dat.MH.MH_pkthdr.csum_flags |= CSUM_DATA_VALID | CSUM_PSEUDO_HDR;
+                m_head->M_dat.MH.MH_pkthdr.csum_data = 0xFFFF;
+                csum_ok++;
             }
 
             rx_packets++;
             rx_bytes += m_head->M_dat.MH.MH_pkthdr.len;
 
-            bool fast_path = _ifn->if_classifier.post_packet(m_head);
-            if (!fast_path) {
-                (*_ifn->if_input)(_ifn, m_head);
-            }
+            rx_deliver(rxq, m_head);
 
             trace_virtio_net_rx_packet(_ifn->if_index, rx_bytes);
 
+            if (++batched == rx_batch) {
+                rx_lro_flush(rxq);
+                batched = 0;
+            }
+
             // The interface may have been stopped while we were
             // passing the packet up the network stack.
             if ((_ifn->if_drv_flags & IFF_DRV_RUNNING) == 0)
                 break;
         }
 
+        rx_lro_flush(rxq);
+
         // Update the stats
-        _rxq.stats.rx_drops      += rx_drops;
-        _rxq.stats.rx_packets    += rx_packets;
-        _rxq.stats.rx_csum       += csum_ok;
-        _rxq.stats.rx_csum_err   += csum_err;
-        _rxq.stats.rx_bytes      += rx_bytes;
+        rxq.stats.rx_drops      += rx_drops;
+        rxq.stats.rx_packets    += rx_packets;
+        rxq.stats.rx_csum       += csum_ok;
+        rxq.stats.rx_csum_err   += csum_err;
+        rxq.stats.rx_bytes      += rx_bytes;
     }
 }
 
-mbuf* net::packet_to_mbuf(const std::vector<iovec>& packet)
+// The Ethernet, IP and TCP headers (with the timestamp option) LRO expects
+// to find in the first mbuf
+static const int lro_hdr_len = ETHER_HDR_LEN + sizeof(struct ip) +
+                               sizeof(struct tcphdr) + TCPOLEN_TSTAMP_APPA;
+
+void net::rx_deliver(rxq& rxq, mbuf* m)
 {
+    if (_ifn->if_classifier.post_packet(m)) {
+        return;
+    }
+
+    // Only segments whose checksum was validated may be merged, as the
+    // merged packet's checksum is not checked again
+    if ((_ifn->if_capenable & IFCAP_LRO) && rxq.lro.lro_cnt &&
+        (m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_DATA_VALID) &&
+        m->m_hdr.mh_len >= lro_hdr_len) {
+        if (tcp_lro_rx(&rxq.lro, m, 0) == 0) {
+            return;
+        }
+    }
+
+    // The packet bypasses LRO, and may belong to a flow being coalesced
+    // (e.g., a segment with FIN set, or one too short to be looked at):
+    // what was merged so far must go up first
+    rx_lro_flush(rxq);
+    (*_ifn->if_input)(_ifn, m);
+}
+
+void net::rx_lro_flush(rxq& rxq)
+{
+    struct lro_ctrl* lro = &rxq.lro;
+    if (SLIST_EMPTY(&lro->lro_active)) {
+        return;
+    }
+
+    int queued = lro->lro_queued;
+    int flushed = lro->lro_flushed;
+    while (!SLIST_EMPTY(&lro->lro_active)) {
+        struct lro_entry* le = SLIST_FIRST(&lro->lro_active);
+        SLIST_REMOVE_HEAD(&lro->lro_active, next);
+        tcp_lro_flush(lro, le);
+    }
+
+    int merged = (lro->lro_queued - queued) - (lro->lro_flushed - flushed);
+    rxq.stats.rx_lro_merged += merged;
+    trace_virtio_net_rx_lro_flush(_ifn->if_index, merged);
+}
+
+mbuf* net::packet_to_mbuf(rxq& rxq, const std::vector<iovec>& packet)
+{
+    rxq.loaned.fetch_add(packet.size(), std::memory_order_relaxed);
+
     auto m = m_gethdr(M_DONTWAIT, MT_DATA);
-    auto refcnt = new unsigned;
-    m->M_dat.MH.MH_dat.MH_ext.ref_cnt = refcnt;
+    auto ref = new rx_buf_ref{0, this, &rxq};
+    m->M_dat.MH.MH_dat.MH_ext.ref_cnt = &ref->refcnt;
     m_extadd(m, static_cast<char*>(packet[0].iov_base), packet[0].iov_len,
-            _use_large_buffers ? &net::free_large_buffer_and_refcnt : &net::free_buffer_and_refcnt,
-            packet[0].iov_base, refcnt, M_PKTHDR, EXT_EXTREF);
+            &net::free_rx_buffer_and_ref, packet[0].iov_base, ref,
+            M_PKTHDR, EXT_EXTREF);
     m->M_dat.MH.MH_pkthdr.len = packet[0].iov_len;
     m->M_dat.MH.MH_pkthdr.rcvif = _ifn;
     m->M_dat.MH.MH_pkthdr.csum_flags = 0;
@@ -580,11 +789,10 @@ mbuf* net::packet_to_mbuf(const std::vector<iovec>& packet)
     for (size_t idx = 1; idx != packet.size(); ++idx) {
         auto&& iov = packet[idx];
         auto m = m_get(M_DONTWAIT, MT_DATA);
-        refcnt = new unsigned;
-        m->M_dat.MH.MH_dat.MH_ext.ref_cnt = refcnt;
+        ref = new rx_buf_ref{0, this, &rxq};
+        m->M_dat.MH.MH_dat.MH_ext.ref_cnt = &ref->refcnt;
         m_extadd(m, static_cast<char*>(iov.iov_base), iov.iov_len,
-                _use_large_buffers ? &net::free_large_buffer_and_refcnt : &net::free_buffer_and_refcnt,
-                iov.iov_base, refcnt, 0, EXT_EXTREF);
+                &net::free_rx_buffer_and_ref, iov.iov_base, ref, 0, EXT_EXTREF);
         m->m_hdr.mh_len = iov.iov_len;
         m->m_hdr.mh_next = nullptr;
         m_tail->m_hdr.mh_next = m;
@@ -594,17 +802,57 @@ mbuf* net::packet_to_mbuf(const std::vector<iovec>& packet)
     return m_head;
 }
 
-// hook for EXT_EXTREF mbuf cleanup
-void net::free_buffer_and_refcnt(void* buffer, void* refcnt)
+// Copy a packet into a single cluster and give its Rx buffers straight
+// back to the driver. Returns nullptr if the packet doesn't fit a cluster
+// (or none could be allocated); the caller then loans the buffers anyway.
+mbuf* net::copy_packet(rxq& rxq, const std::vector<iovec>& packet)
 {
-    do_free_buffer(buffer);
-    delete static_cast<unsigned*>(refcnt);
+    size_t len = 0;
+    for (auto&& iov : packet) {
+        len += iov.iov_len;
+    }
+
+    int size;
+    if (len <= MCLBYTES) {
+        size = MCLBYTES;
+    } else if (len <= MJUMPAGESIZE) {
+        size = MJUMPAGESIZE;
+    } else if (len <= MJUM9BYTES) {
+        size = MJUM9BYTES;
+    } else if (len <= MJUM16BYTES) {
+        size = MJUM16BYTES;
+    } else {
+        return nullptr;
+    }
+
+    auto m = m_getjcl(M_DONTWAIT, MT_DATA, M_PKTHDR, size);
+    if (!m) {
+        return nullptr;
+    }
+
+    auto p = mtod(m, char*);
+    for (auto&& iov : packet) {
+        memcpy(p, iov.iov_base, iov.iov_len);
+        p += iov.iov_len;
+        put_buffer(rxq, iov.iov_base);
+    }
+    m->M_dat.MH.MH_pkthdr.len = len;
+    m->M_dat.MH.MH_pkthdr.rcvif = _ifn;
+    m->M_dat.MH.MH_pkthdr.csum_flags = 0;
+    m->m_hdr.mh_len = len;
+    return m;
 }
 
-void net::free_large_buffer_and_refcnt(void* buffer, void* refcnt)
+// hook for EXT_EXTREF mbuf cleanup: called when the stack, or a zcopy_rx()
+// caller through zcopy_rxgc(), drops the last reference to an Rx buffer.
+void net::free_rx_buffer_and_ref(void* buffer, void* ref)
 {
-    do_free_large_buffer(buffer);
-    delete static_cast<unsigned*>(refcnt);
+    auto r = static_cast<rx_buf_ref*>(ref);
+    auto owner = r->owner;
+    auto& rxq = *r->queue;
+    delete r;
+    rxq.loaned.fetch_sub(1, std::memory_order_relaxed);
+    owner->put_buffer(rxq, buffer);
 }
 
 void net::do_free_buffer(void* buffer)
@@ -619,16 +867,18 @@ void net::do_free_large_buffer(void* buffer)
     memory::free_phys_contiguous_aligned(buffer);
 }
 
-void net::fill_rx_ring()
+void net::fill_rx_ring(rxq& rxq)
 {
     trace_virtio_net_fill_rx_ring(_ifn->if_index);
     int added = 0;
-    vring* vq = _rxq.vqueue;
+    vring* vq = rxq.vqueue;
 
     int size_in_pages = _use_large_buffers ? LARGE_BUFFER_SIZE_IN_PAGES : 1;
     while (vq->avail_ring_not_empty()) {
         void *buffer;
-        if (_use_large_buffers) {
+        if (rxq.free_bufs.pop(buffer)) {
+            // recycled buffer released by the stack
+        } else if (_use_large_buffers) {
             buffer = memory::alloc_phys_contiguous_aligned(size_in_pages * memory::page_size, memory::page_size);
         } else {
             buffer = memory::alloc_page();
@@ -637,7 +887,7 @@ void net::fill_rx_ring()
         vq->init_sg();
         vq->add_in_sg(buffer, size_in_pages * memory::page_size);
         if (!vq->add_buf(buffer)) {
-            free_buffer(buffer);
+            put_buffer(rxq, buffer);
             break;
         }
         added++;
@@ -649,6 +899,56 @@ void net::fill_rx_ring()
         vq->kick();
 }
 
+bool net::ctrl_cmd(u8 cls, u8 cmd, const void* data, size_t len)
+{
+    vring* vq = _ctrl_queue;
+    if (!vq) {
+        return false;
+    }
+
+    // header, command data and the ack the device writes back
+    size_t size = sizeof(net_ctrl_hdr) + len + sizeof(net_ctrl_ack);
+    std::unique_ptr<u8[]> req(new u8[size]);
+    auto hdr = reinterpret_cast<net_ctrl_hdr*>(req.get());
+    auto ack = reinterpret_cast<net_ctrl_ack*>(req.get() + sizeof(*hdr) + len);
+    hdr->class_t = cls;
+    hdr->cmd = cmd;
+    memcpy(req.get() + sizeof(*hdr), data, len);
+    *ack = VIRTIO_NET_ERR;
+
+    vq->init_sg();
+    vq->add_out_sg(hdr, sizeof(*hdr));
+    vq->add_out_sg(req.get() + sizeof(*hdr), len);
+    vq->add_in_sg(ack, sizeof(*ack));
+    if (!vq->add_buf(req.get())) {
+        return false;
+    }
+    vq->kick();
+
+    //
+    // Commands are only issued during initialization - just poll for the
+    // ack. A device which doesn't answer may still write it later, so the
+    // request is left to it and the control queue isn't used again.
+    //
+    auto deadline = osv::clock::uptime::now() + std::chrono::seconds(1);
+    while (!vq->used_ring_not_empty()) {
+        if (osv::clock::uptime::now() >= deadline) {
+            net_e("Control command %d/%d timed out", cls, cmd);
+            req.release();
+            _ctrl_queue = nullptr;
+            return false;
+        }
+        sched::thread::sleep(std::chrono::microseconds(100));
+    }
+    u32 used_len;
+    vq->get_buf_elem(&used_len);
+    vq->get_buf_finalize();
+    vq->get_buf_gc();
+
+    trace_virtio_net_ctrl_cmd(_ifn->if_index, cls, cmd, *ack);
+    return *ack == VIRTIO_NET_OK;
+}
+
 inline int net::txq::try_xmit_one_locked(void* _req)
 {
     net_req* req = static_cast<net_req*>(_req);
@@ -918,6 +1218,8 @@ u64 net::get_driver_features()
                  | (1 << VIRTIO_NET_F_HOST_TSO4)  \
                  | (1 << VIRTIO_NET_F_GUEST_ECN)
                  | (1 << VIRTIO_NET_F_GUEST_UFO)
+                 | (1 << VIRTIO_NET_F_CTRL_VQ)
+                 | (1 << VIRTIO_NET_F_MQ)
             );
 }
 
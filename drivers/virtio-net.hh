@@ -12,10 +12,19 @@
 #include <bsd/sys/net/if_var.h>
 #include <bsd/sys/net/if.h>
 #include <bsd/sys/sys/mbuf.h>
+#include <bsd/sys/netinet/in.h>
+#include <bsd/sys/netinet/ip.h>
+#include <bsd/sys/netinet/tcp.h>
+#include <bsd/sys/netinet/tcp_lro.h>
 
 #include <osv/percpu_xmit.hh>
 #include <osv/contiguous_alloc.hh>
 
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <boost/lockfree/stack.hpp>
+
 #include "drivers/virtio.hh"
 #include "drivers/pci-device.hh"
 
@@ -220,12 +229,7 @@ public:
 
     void wait_for_queue(vring* queue);
     bool bad_rx_csum(struct mbuf* m, struct net_hdr* hdr);
-    void receiver();
-    void fill_rx_ring();
-    mbuf* packet_to_mbuf(const std::vector<iovec>& iovec);
-    static void free_buffer_and_refcnt(void* buffer, void* refcnt);
-    static void free_large_buffer_and_refcnt(void* buffer, void* refcnt);
-    static void free_buffer(iovec iov) { do_free_buffer(iov.iov_base); }
+    static void free_rx_buffer_and_ref(void* buffer, void* ref);
     static void do_free_buffer(void* buffer);
     static void do_free_large_buffer(void* buffer);
 
@@ -275,6 +279,8 @@ private:
     bool _host_tso4 = false;
     bool _guest_ufo = false;
     bool _use_large_buffers = false;
+    bool _mq = false;
+    bool _ctrl_vq = false;
 
     u32 _hdr_size;
 
@@ -285,6 +291,8 @@ private:
         u64 rx_csum;    /* number of packets with correct csum */
         u64 rx_csum_err;/* number of packets with a bad checksum */
         u64 rx_bh_wakeups;
+        u64 rx_loan_copies; /* packets copied because of the loan limit */
+        u64 rx_lro_merged;  /* packets merged into a preceding one by LRO */
 
         wakeup_stats rx_wakeup_stats;
     };
@@ -312,14 +320,41 @@ private:
         }
     } _pre_init;
 
+    struct rxq;
+
+    /**
+     * Reference count of an Rx buffer attached to an mbuf. The buffer is
+     * loaned to the stack (and possibly to a zcopy_rx() caller) until the
+     * last mbuf referencing it is freed, at which point it goes back to
+     * its owner queue to be posted to the ring again.
+     */
+    struct rx_buf_ref {
+        unsigned refcnt;
+        net* owner;
+        struct rxq* queue;
+    };
+
     /* Single Rx queue object */
     struct rxq {
-        rxq(vring* vq, std::function<void ()> poll_func)
-            : vqueue(vq), poll_task(sched::thread::make(poll_func, sched::thread::attr().
-                                    name("virtio-net-rx"))) {};
+        rxq(vring* vq, std::function<void ()> poll_func, sched::thread::attr attr)
+            : vqueue(vq), poll_task(sched::thread::make(poll_func, attr)),
+              free_bufs(vq->size()) {
+            if (tcp_lro_init(&lro)) {
+                lro.lro_cnt = 0;
+            }
+        }
+        ~rxq() {
+            tcp_lro_free(&lro);
+        }
         vring* vqueue;
         std::unique_ptr<sched::thread> poll_task;
         struct rxq_stats stats = { 0 };
+        // Rx buffers currently attached to mbufs outside the driver
+        std::atomic<unsigned> loaned {0};
+        // Released Rx buffers waiting to be posted to the ring again
+        boost::lockfree::stack<void*, boost::lockfree::fixed_sized<true>> free_bufs;
+        // TCP segments of a batch being coalesced before going up the stack
+        struct lro_ctrl lro;
 
         void update_wakeup_stats(const u64 wakeup_packets) {
             if_update_wakeup_stats(stats.rx_wakeup_stats, wakeup_packets);
@@ -335,13 +370,13 @@ private:
     struct txq {
         friend osv::xmitter_functor<txq>;
 
-        txq(net* parent, vring* vq) :
+        txq(net* parent, vring* vq, const std::vector<sched::cpu*>& cpus) :
             vqueue(vq), _parent(parent), _xmit_it(this),
             _kick_thresh(vqueue->size()),
             _xmitter(this,
                      // TODO: implement a proper StopPred when we fix a SP code
                      [] { return false; },
-                     _xmit_it, "virtio-tx")
+                     _xmit_it, "virtio-tx", cpus)
         {
             //
             // Kick at least every full ring of packets (see _kick_thresh
@@ -473,6 +508,31 @@ private:
 
     };
 
+    /**
+     * (Re)create the Rx/Tx queue objects for the given number of pairs.
+     * Their threads must not have been started.
+     */
+    void create_queues(unsigned pairs);
+
+    void receiver(rxq& rxq);
+    void rx_deliver(rxq& rxq, mbuf* m);
+    void rx_lro_flush(rxq& rxq);
+    void fill_rx_ring(rxq& rxq);
+    mbuf* packet_to_mbuf(rxq& rxq, const std::vector<iovec>& iovec);
+    mbuf* copy_packet(rxq& rxq, const std::vector<iovec>& iovec);
+
+    /**
+     * Send a command on the control virtqueue and wait for the device to
+     * acknowledge it.
+     * @param cls command class (VIRTIO_NET_CTRL_*)
+     * @param cmd command
+     * @param data command specific data
+     * @param len length of data
+     *
+     * @return true if the device executed the command successfully
+     */
+    bool ctrl_cmd(u8 cls, u8 cmd, const void* data, size_t len);
+
     /**
      * Fill the Rx queue statistics in the general info struct
      * @param rxq Rx queue handle
@@ -496,9 +556,33 @@ private:
         }
     }
 
-    /* We currently support only a single Rx+Tx queue */
-    struct rxq _rxq;
-    struct txq _txq;
+    /**
+     * Return an Rx buffer to the driver: it is kept for the next ring
+     * refill, or freed if enough buffers are already cached.
+     * @param buffer any address inside the buffer's first page
+     */
+    void put_buffer(rxq& rxq, void *buffer)
+    {
+        buffer = align_down(buffer, memory::page_size);
+        if (!rxq.free_bufs.bounded_push(buffer)) {
+            free_buffer(buffer);
+        }
+    }
+
+    /*
+     * Max Rx buffers loaned out per Rx queue before packets are copied
+     * (0 - no limit)
+     */
+    unsigned _rx_loan_limit = 0;
+
+    /*
+     * Rx/Tx queue pairs. Pair i uses virtqueues 2*i and 2*i+1; with more
+     * than one pair the Rx thread of pair i runs on CPU i (and so does its
+     * MSI-X vector) and CPU c transmits on pair c % pairs.
+     */
+    std::vector<std::unique_ptr<rxq>> _rxqs;
+    std::vector<std::unique_ptr<txq>> _txqs;
+    vring* _ctrl_queue = nullptr;
 
     //maintains the virtio instance number for multiple drives
     static int _instance;
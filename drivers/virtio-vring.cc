@@ -42,23 +42,61 @@ namespace virtio {
     {
         _driver = driver;
         _q_index = q_index;
+        _packed = driver->get_packed_ring_cap();
         // Alloc enough pages for the vring...
         size_t alignment = driver->get_vring_alignment();
-        size_t sz = VIRTIO_ALIGN(vring::get_size(num, alignment), alignment);
+        size_t sz = _packed ? get_size_packed(num) :
+                              VIRTIO_ALIGN(vring::get_size(num, alignment), alignment);
         _vring_ptr = memory::alloc_phys_contiguous_aligned(sz, 4096);
         memset(_vring_ptr, 0, sz);
         
         // Set up pointers        
         assert(is_power_of_two(num));
         _num = num;
-        _desc = (vring_desc*)_vring_ptr;
-        _avail = (vring_avail*)(_vring_ptr + num * sizeof(vring_desc));
-        _used = (vring_used*)(((unsigned long)&_avail->_ring[num] +
-                sizeof(u16) + alignment - 1) & ~(alignment - 1));
-
-        // initialize the next pointer within the available ring
-        for (int i = 0; i < num; i++) _desc[i]._next = i + 1;
-        _desc[num-1]._next = 0;
+        if (_packed) {
+            _desc = nullptr;
+            _avail = nullptr;
+            _used = nullptr;
+            _avail_event = nullptr;
+            _used_event = nullptr;
+
+            _packed_desc = (vring_packed_desc*)_vring_ptr;
+            _driver_event = (vring_packed_event*)(_vring_ptr + num * sizeof(vring_packed_desc));
+            _device_event = _driver_event + 1;
+            // Both wrap counters start at 1, while the zeroed descriptors
+            // are neither available nor used
+            _avail_wrap = true;
+            _used_wrap = true;
+            _used_pos = 0;
+
+            _id_next = new u16[num];
+            for (int i = 0; i < num; i++) _id_next[i] = i + 1;
+            _free_id = 0;
+            _id_desc_count = new u16[num];
+            _id_indirect = new void*[num]();
+            _used_ids = new u16[num];
+            _last_used_id = 0;
+        } else {
+            _desc = (vring_desc*)_vring_ptr;
+            _avail = (vring_avail*)(_vring_ptr + num * sizeof(vring_desc));
+            _used = (vring_used*)(((unsigned long)&_avail->_ring[num] +
+                    sizeof(u16) + alignment - 1) & ~(alignment - 1));
+
+            // initialize the next pointer within the available ring
+            for (int i = 0; i < num; i++) _desc[i]._next = i + 1;
+            _desc[num-1]._next = 0;
+
+            _avail_event = reinterpret_cast<std::atomic<u16>*>(&_used->_used_elements[_num]);
+            _used_event = reinterpret_cast<std::atomic<u16>*>(&_avail->_ring[_num]);
+
+            _packed_desc = nullptr;
+            _driver_event = nullptr;
+            _device_event = nullptr;
+            _id_next = nullptr;
+            _id_desc_count = nullptr;
+            _id_indirect = nullptr;
+            _used_ids = nullptr;
+        }
 
         _cookie = new void*[num];
 
@@ -68,9 +106,6 @@ namespace virtio {
         _avail_added_since_kick = 0;
         _avail_count = num;
 
-        _avail_event = reinterpret_cast<std::atomic<u16>*>(&_used->_used_elements[_num]);
-        _used_event = reinterpret_cast<std::atomic<u16>*>(&_avail->_ring[_num]);
-
         _sg_vec.reserve(max_sgs);
 
         _use_indirect = false;
@@ -80,6 +115,17 @@ namespace virtio {
     {
         memory::free_phys_contiguous_aligned(_vring_ptr);
         delete [] _cookie;
+        if (_packed) {
+            for (unsigned i = 0; i < _num; i++) {
+                if (_id_indirect[i]) {
+                    free_phys_contiguous_aligned(_id_indirect[i]);
+                }
+            }
+        }
+        delete [] _id_next;
+        delete [] _id_desc_count;
+        delete [] _id_indirect;
+        delete [] _used_ids;
     }
 
     u64 vring::get_paddr()
@@ -87,19 +133,21 @@ namespace virtio {
         return mmu::virt_to_phys(_vring_ptr);
     }
 
+    // For a packed ring the device's "driver area" and "device area" are the
+    // two event suppression structures
     u64 vring::get_desc_addr()
     {
-        return mmu::virt_to_phys(_desc);
+        return _packed ? mmu::virt_to_phys(_packed_desc) : mmu::virt_to_phys(_desc);
     }
 
     u64 vring::get_avail_addr()
     {
-        return mmu::virt_to_phys(_avail);
+        return _packed ? mmu::virt_to_phys(_driver_event) : mmu::virt_to_phys(_avail);
     }
 
     u64 vring::get_used_addr()
     {
-        return mmu::virt_to_phys(_used);
+        return _packed ? mmu::virt_to_phys(_device_event) : mmu::virt_to_phys(_used);
     }
 
     unsigned vring::get_size(unsigned int num, unsigned long align)
@@ -109,9 +157,19 @@ namespace virtio {
                 + sizeof(u16) * 3 + sizeof(vring_used_elem) * num);
     }
 
+    unsigned vring::get_size_packed(unsigned int num)
+    {
+        return sizeof(vring_packed_desc) * num + sizeof(vring_packed_event) * 2;
+    }
+
     void vring::disable_interrupts()
     {
         trace_virtio_disable_interrupts(this);
+        if (_packed) {
+            _driver_event->_flags.store(vring_packed_event::VRING_PACKED_EVENT_FLAG_DISABLE,
+                                        std::memory_order_relaxed);
+            return;
+        }
         _avail->disable_interrupt();
     }
 
@@ -130,6 +188,10 @@ namespace virtio {
     void vring::enable_interrupts()
     {
         trace_virtio_enable_interrupts(this);
+        if (_packed) {
+            enable_interrupts_packed();
+            return;
+        }
         _avail->enable_interrupt();
         set_used_event(_used_ring_host_head, std::memory_order_relaxed);
         std::atomic_thread_fence(std::memory_order_seq_cst);
@@ -138,6 +200,10 @@ namespace virtio {
     bool
     vring::add_buf(void* cookie) {
 
+            if (_packed) {
+                return add_buf_packed(cookie);
+            }
+
             get_buf_gc();
 
             trace_virtio_add_buf(this, _q_index, _avail_count);
@@ -204,6 +270,11 @@ namespace virtio {
     void
     vring::get_buf_gc()
     {
+            if (_packed) {
+                get_buf_gc_packed();
+                return;
+            }
+
             vring_used_elem elem;
 
             trace_vring_get_buf_gc(this, _used_ring_guest_head,
@@ -240,6 +311,10 @@ namespace virtio {
     void*
     vring::get_buf_elem(u32* len)
     {
+            if (_packed) {
+                return get_buf_elem_packed(len);
+            }
+
             vring_used_elem elem;
             void* cookie = nullptr;
 
@@ -279,11 +354,19 @@ namespace virtio {
 
     bool vring::used_ring_not_empty() const
     {
+        if (_packed) {
+            return used_ring_not_empty_packed();
+        }
         return _used_ring_host_head != _used->_idx.load(std::memory_order_relaxed);
     }
 
     bool vring::used_ring_is_half_empty() const
     {
+        // A packed ring doesn't keep a count of used buffers, so only tell
+        // whether there are any
+        if (_packed) {
+            return used_ring_not_empty_packed();
+        }
         return _used->_idx.load(std::memory_order_relaxed) - _used_ring_host_head > (u16)(_num / 2);
     }
 
@@ -294,6 +377,10 @@ namespace virtio {
 
     bool
     vring::kick() {
+        if (_packed) {
+            return kick_packed();
+        }
+
         bool kicked = true;
 
         if (_driver->get_event_idx_cap()) {
@@ -334,6 +421,236 @@ namespace virtio {
         return false;
     }
 
+    static inline bool packed_desc_used(u16 flags, bool wrap)
+    {
+        bool avail = flags & vring_packed_desc::VRING_PACKED_DESC_F_AVAIL;
+        bool used = flags & vring_packed_desc::VRING_PACKED_DESC_F_USED;
+        return avail == used && used == wrap;
+    }
+
+    //
+    // A buffer takes a buffer id and as many consecutive ring descriptors as
+    // it has sg entries (or one pointing to an indirect table). The flags of
+    // its first descriptor are written last, which makes the whole chain
+    // available to the device at once.
+    //
+    bool
+    vring::add_buf_packed(void* cookie)
+    {
+        get_buf_gc_packed();
+
+        trace_virtio_add_buf(this, _q_index, _avail_count);
+
+        unsigned sg_count = _sg_vec.size();
+        int desc_needed = sg_count;
+        bool indirect = false;
+        if (use_indirect(desc_needed)) {
+            desc_needed = 1;
+            indirect = true;
+        }
+
+        if (_avail_count < desc_needed) {
+            kick();
+            return false;
+        }
+
+        vring_packed_desc* table = nullptr;
+        if (indirect) {
+            table = reinterpret_cast<vring_packed_desc*>(alloc_phys_contiguous_aligned(sg_count * sizeof(vring_packed_desc), 16));
+            if (!table)
+                return false;
+            for (unsigned i = 0; i < sg_count; i++) {
+                table[i]._paddr = _sg_vec[i]._paddr;
+                table[i]._len = _sg_vec[i]._len;
+                table[i]._id = 0;
+                table[i]._flags.store(_sg_vec[i]._flags, std::memory_order_relaxed);
+            }
+        }
+
+        u16 id = _free_id;
+        _free_id = _id_next[id];
+        _cookie[id] = cookie;
+        _id_desc_count[id] = desc_needed;
+        _id_indirect[id] = table;
+
+        u16 head = _avail_head;
+        u16 head_flags = 0;
+        u16 pos = _avail_head;
+        bool wrap = _avail_wrap;
+        for (int i = 0; i < desc_needed; i++) {
+            vring_packed_desc& desc = _packed_desc[pos];
+            u16 flags = packed_avail_flags(wrap);
+            if (indirect) {
+                desc._paddr = mmu::virt_to_phys(table);
+                desc._len = sg_count * sizeof(vring_packed_desc);
+                flags |= vring_desc::VRING_DESC_F_INDIRECT;
+            } else {
+                desc._paddr = _sg_vec[i]._paddr;
+                desc._len = _sg_vec[i]._len;
+                flags |= _sg_vec[i]._flags;
+                if (i + 1 < desc_needed) {
+                    flags |= vring_desc::VRING_DESC_F_NEXT;
+                }
+            }
+            desc._id = id;
+            if (i == 0) {
+                head_flags = flags;
+            } else {
+                desc._flags.store(flags, std::memory_order_relaxed);
+            }
+            if (++pos == _num) {
+                pos = 0;
+                wrap = !wrap;
+            }
+        }
+        _packed_desc[head]._flags.store(head_flags, std::memory_order_release);
+
+        _avail_head = pos;
+        _avail_wrap = wrap;
+        _avail_count -= desc_needed;
+        // counted in descriptors, as the device's event offset is
+        _avail_added_since_kick += desc_needed;
+
+        return true;
+    }
+
+    void*
+    vring::get_buf_elem_packed(u32* len)
+    {
+        vring_packed_desc& desc = _packed_desc[_used_pos];
+        u16 flags = desc._flags.load(std::memory_order_acquire);
+
+        trace_vring_get_buf_elem(this, _used_ring_host_head, _used_pos);
+
+        if (!packed_desc_used(flags, _used_wrap)) {
+            return nullptr;
+        }
+
+        _last_used_id = desc._id;
+        *len = desc._len;
+
+        void* cookie = _cookie[_last_used_id];
+        _cookie[_last_used_id] = nullptr;
+
+        return cookie;
+    }
+
+    // Called by get_buf_finalize(): step over the descriptors of the buffer
+    // returned by get_buf_elem() and queue its id for get_buf_gc()
+    void
+    vring::consume_used_packed()
+    {
+        _used_ids[_used_ring_host_head & (_num - 1)] = _last_used_id;
+        _used_pos += _id_desc_count[_last_used_id];
+        if (_used_pos >= _num) {
+            _used_pos -= _num;
+            _used_wrap = !_used_wrap;
+        }
+        // get_buf_gc() must see the id before the new _used_ring_host_head
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void
+    vring::get_buf_gc_packed()
+    {
+        trace_vring_get_buf_gc(this, _used_ring_guest_head,
+                               _used_ring_host_head);
+
+        while (_used_ring_guest_head != _used_ring_host_head) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            u16 id = _used_ids[_used_ring_guest_head & (_num - 1)];
+
+            if (_id_indirect[id]) {
+                free_phys_contiguous_aligned(_id_indirect[id]);
+                _id_indirect[id] = nullptr;
+            }
+            _avail_count += _id_desc_count[id];
+            _id_next[id] = _free_id;
+            _free_id = id;
+            _used_ring_guest_head++;
+        }
+
+        trace_vring_get_buf_ret(this, _avail_count);
+    }
+
+    bool vring::used_ring_not_empty_packed() const
+    {
+        return packed_desc_used(_packed_desc[_used_pos]._flags.load(std::memory_order_relaxed),
+                                _used_wrap);
+    }
+
+    static inline u16 vring_packed_off_wrap(u16 pos, bool wrap)
+    {
+        return pos | (wrap << vring_packed_event::VRING_PACKED_EVENT_F_WRAP_CTR);
+    }
+
+    void vring::update_used_event_packed()
+    {
+        // only let the host know about our used position in case irq are enabled
+        if (_driver->get_event_idx_cap() &&
+            _driver_event->_flags.load(std::memory_order_relaxed) ==
+                vring_packed_event::VRING_PACKED_EVENT_FLAG_DESC) {
+            trace_vring_update_used_event(this, _used_ring_host_head);
+            _driver_event->_off_wrap.store(vring_packed_off_wrap(_used_pos, _used_wrap),
+                                           std::memory_order_release);
+        }
+    }
+
+    void vring::enable_interrupts_packed()
+    {
+        if (_driver->get_event_idx_cap()) {
+            _driver_event->_off_wrap.store(vring_packed_off_wrap(_used_pos, _used_wrap),
+                                           std::memory_order_relaxed);
+            _driver_event->_flags.store(vring_packed_event::VRING_PACKED_EVENT_FLAG_DESC,
+                                        std::memory_order_relaxed);
+        } else {
+            _driver_event->_flags.store(vring_packed_event::VRING_PACKED_EVENT_FLAG_ENABLE,
+                                        std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    bool
+    vring::kick_packed()
+    {
+        bool kicked;
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        u16 flags = _device_event->_flags.load(std::memory_order_relaxed);
+        if (flags == vring_packed_event::VRING_PACKED_EVENT_FLAG_DESC &&
+            _driver->get_event_idx_cap()) {
+            u16 off_wrap = _device_event->_off_wrap.load(std::memory_order_relaxed);
+            u16 event = off_wrap & ~(1 << vring_packed_event::VRING_PACKED_EVENT_F_WRAP_CTR);
+            bool wrap = off_wrap >> vring_packed_event::VRING_PACKED_EVENT_F_WRAP_CTR;
+            u16 new_pos = _avail_head;
+            u16 old_pos = new_pos - _avail_added_since_kick;
+            // An event offset in the previous lap is "negative"
+            if (wrap != _avail_wrap) {
+                event -= _num;
+            }
+
+            kicked = (u16)(new_pos - event - 1) < (u16)(new_pos - old_pos);
+
+            trace_virtio_kicked_event_idx(this, kicked, _q_index,
+                    new_pos, event, _avail_added_since_kick);
+        } else {
+            kicked = (flags != vring_packed_event::VRING_PACKED_EVENT_FLAG_DISABLE);
+        }
+
+        //
+        // The event offset can only be compared within a single lap of the
+        // ring, so kick at least once per lap.
+        //
+        if (kicked || _avail_added_since_kick >= _num) {
+            _driver->kick(_q_index);
+            _avail_added_since_kick = 0;
+            return true;
+        }
+
+        return false;
+    }
+
     void
     vring::add_buf_wait(void* cookie)
     {
@@ -119,6 +119,41 @@ class virtio_driver;
         //std::atomic<u16> avail_event;
     };
 
+    // Packed ring (virtio 1.1) descriptor. The same ring carries the
+    // available descriptors posted by the driver and the used ones written
+    // back by the device, told apart by the AVAIL/USED flags compared with
+    // the wrap counter of the side that reads them.
+    class vring_packed_desc {
+    public:
+        enum flags {
+            VRING_PACKED_DESC_F_AVAIL = 1 << 7,
+            VRING_PACKED_DESC_F_USED = 1 << 15,
+        };
+
+        u64 _paddr;
+        u32 _len;
+        // Buffer id, returned by the device in the used descriptor
+        u16 _id;
+        // Written last, it hands the descriptor over to the other side
+        std::atomic<u16> _flags;
+    };
+
+    // Packed ring event suppression structure, one for each direction
+    class vring_packed_event {
+    public:
+        enum {
+            VRING_PACKED_EVENT_FLAG_ENABLE = 0,
+            VRING_PACKED_EVENT_FLAG_DISABLE = 1,
+            // Notify when the descriptor at _off_wrap is reached (EVENT_IDX)
+            VRING_PACKED_EVENT_FLAG_DESC = 2,
+            VRING_PACKED_EVENT_F_WRAP_CTR = 15,
+        };
+
+        // Descriptor ring offset and wrap counter (bit 15)
+        std::atomic<u16> _off_wrap;
+        std::atomic<u16> _flags;
+    };
+
     class vring {
     public:
 
@@ -149,6 +184,9 @@ class virtio_driver;
          */
         __attribute__((always_inline)) inline // Necessary because of issue #1029
         void get_buf_finalize(bool update_host = true) {
+            if (_packed) {
+                consume_used_packed();
+            }
             _used_ring_host_head++;
 
             trace_vring_get_buf_finalize(this, _used_ring_host_head);
@@ -160,6 +198,10 @@ class virtio_driver;
 
         __attribute__((always_inline)) inline // Necessary because of issue #1029
         void update_used_event() {
+            if (_packed) {
+                update_used_event_packed();
+                return;
+            }
             // only let the host know about our used idx in case irq are enabled
             if (_avail->interrupt_on()) {
                 trace_vring_update_used_event(this, _used_ring_host_head);
@@ -188,6 +230,7 @@ class virtio_driver;
         bool kick();
         // Total number of descriptors in ring
         int size() {return _num;}
+        bool is_packed() const {return _packed;}
 
         u16 index() {return _q_index; }
 
@@ -246,6 +289,22 @@ class virtio_driver;
         u16 avail_head() const {return _avail_head;};
 
     private:
+        static unsigned get_size_packed(unsigned int num);
+
+        // The packed ring counterparts of the public ring operations
+        bool add_buf_packed(void* cookie);
+        void* get_buf_elem_packed(u32* len);
+        void consume_used_packed();
+        void update_used_event_packed();
+        void get_buf_gc_packed();
+        bool used_ring_not_empty_packed() const;
+        bool kick_packed();
+        void enable_interrupts_packed();
+
+        u16 packed_avail_flags(bool wrap) const {
+            return wrap ? vring_packed_desc::VRING_PACKED_DESC_F_AVAIL
+                        : vring_packed_desc::VRING_PACKED_DESC_F_USED;
+        }
 
         // Up pointer
         virtio_driver* _driver;
@@ -283,6 +342,30 @@ class virtio_driver;
         std::atomic<u16>* _used_event;
         // A flag set by driver to turn on/off indirect descriptor
         bool _use_indirect;
+
+        // Packed ring layout (VIRTIO_F_RING_PACKED) instead of the above
+        bool _packed;
+        vring_packed_desc* _packed_desc;
+        // Driver -> device and device -> driver event suppression
+        vring_packed_event* _driver_event;
+        vring_packed_event* _device_event;
+        // Wrap counters of the next descriptor we post and the next used
+        // one we expect; _avail_head is the position of the former
+        bool _avail_wrap;
+        bool _used_wrap;
+        u16 _used_pos;
+        // Buffer ids not in use, linked through _id_next
+        u16 _free_id;
+        u16* _id_next;
+        // Number of ring descriptors taken by each buffer id
+        u16* _id_desc_count;
+        // Indirect descriptor table of each buffer id, if any
+        void** _id_indirect;
+        // Ids of used buffers between _used_ring_guest_head and
+        // _used_ring_host_head, waiting for get_buf_gc()
+        u16* _used_ids;
+        // Id returned by the last get_buf_elem()
+        u16 _last_used_id;
     };
 
 
@@ -53,10 +53,19 @@ void virtio_driver::setup_features()
 
     u64 subset = dev_features & drv_features;
 
+    // The packed ring only exists in virtio 1.1 devices
+    if (subset & ((u64)1 << VIRTIO_F_RING_PACKED)) {
+        if (_dev.is_modern() && (dev_features & ((u64)1 << VIRTIO_F_VERSION_1))) {
+            subset |= (u64)1 << VIRTIO_F_VERSION_1;
+        } else {
+            subset &= ~((u64)1 << VIRTIO_F_RING_PACKED);
+        }
+    }
+
     //notify the host about the features in used according
     //to the virtio spec
     for (int i = 0; i < 64; i++)
-        if (subset & (1 << i))
+        if (subset & ((u64)1 << i))
             virtio_d("%s: found feature intersec of bit %d\n", __FUNCTION__,  i);
 
     if (subset & (1 << VIRTIO_RING_F_INDIRECT_DESC))
@@ -65,6 +74,11 @@ void virtio_driver::setup_features()
     if (subset & (1 << VIRTIO_RING_F_EVENT_IDX))
         set_event_idx_cap(true);
 
+    if (subset & ((u64)1 << VIRTIO_F_RING_PACKED)) {
+        virtio_i("Using packed virtqueues");
+        set_packed_ring_cap(true);
+    }
+
     set_guest_features(subset);
 
     if (_dev.is_modern()) {
@@ -86,7 +100,7 @@ void virtio_driver::dump_config()
     virtio_d("    virtio features: ");
 
     for (int i = 0; i < 64; i++) {
-        virtio_d(" %d ", 0 != (device_features & (1 << i)));
+        virtio_d(" %d ", 0 != (device_features & ((u64)1 << i)));
     }
 #endif
 }
@@ -190,7 +204,7 @@ void virtio_driver::set_guest_features(u64 features)
 
 bool virtio_driver::get_guest_feature_bit(int bit)
 {
-    return (_enabled_features & (1 << bit)) != 0;
+    return (_enabled_features & ((u64)1 << bit)) != 0;
 }
 
 u8 virtio_driver::get_dev_status()
@@ -42,6 +42,8 @@ enum VIRTIO_CONFIG {
     VIRTIO_RING_F_EVENT_IDX = 29,
     /* Version bit that can be used to detect legacy vs modern devices */
     VIRTIO_F_VERSION_1 = 32,
+    /* The device and driver use the packed virtqueue layout (virtio 1.1) */
+    VIRTIO_F_RING_PACKED = 34,
     /* Do we get callbacks when the ring is completely used, even if we've
      * suppressed them? */
     VIRTIO_F_NOTIFY_ON_EMPTY = 24,
@@ -100,12 +102,18 @@ public:
     void set_indirect_buf_cap(bool on) {_cap_indirect_buf = on;}
     bool get_event_idx_cap() {return _cap_event_idx;}
     void set_event_idx_cap(bool on) {_cap_event_idx = on;}
+    bool get_packed_ring_cap() {return _cap_packed_ring;}
+    void set_packed_ring_cap(bool on) {_cap_packed_ring = on;}
 
     size_t get_vring_alignment() { return _dev.get_vring_alignment();}
 
 protected:
     // Actual drivers should implement this on top of the basic ring features
-    virtual u64 get_driver_features() { return 1 << VIRTIO_RING_F_INDIRECT_DESC | 1 << VIRTIO_RING_F_EVENT_IDX; }
+    // The packed ring is used whenever the device offers it (e.g. QEMU's packed=on)
+    virtual u64 get_driver_features() {
+        return (u64)1 << VIRTIO_RING_F_INDIRECT_DESC | (u64)1 << VIRTIO_RING_F_EVENT_IDX |
+               (u64)1 << VIRTIO_F_RING_PACKED;
+    }
     void setup_features();
 protected:
     virtio_device& _dev;
@@ -113,6 +121,7 @@ protected:
     u32 _num_queues;
     bool _cap_indirect_buf;
     bool _cap_event_idx = false;
+    bool _cap_packed_ring = false;
     static int _disk_idx;
     u64 _enabled_features;
 };
@@ -133,6 +133,8 @@ namespace rofs {
 }
 
 int rofs_read_blocks(struct device *device, uint64_t starting_block, uint64_t blocks_count, void* buf);
+// Issue the read without waiting for it; the caller bio_wait()s and destroy_bio()s the result
+struct bio *rofs_start_read_blocks(struct device *device, uint64_t starting_block, uint64_t blocks_count, void* buf);
 void rofs_set_vnode(struct vnode* vnode, struct rofs_inode *inode);
 
 #endif
@@ -13,6 +13,7 @@
 #include <include/osv/contiguous_alloc.hh>
 #include <osv/debug.h>
 #include <osv/sched.hh>
+#include <osv/bio.h>
 #include <sys/mman.h>
 
 /*
@@ -25,10 +26,22 @@
 #define CACHE_SEGMENT_SIZE_IN_BLOCKS 64  // 32K
 #define CACHE_SEGMENT_INDEX(offset) (offset >> 15)
 
+/*
+ * Readahead: a read that starts in the segment where the previous one ended
+ * (or in the one right after it) is considered sequential and keeps a window
+ * of following segments in flight. The window starts at the minimum and
+ * doubles every time a read is served by a segment brought in by readahead;
+ * a non-sequential read drops it to zero.
+ **/
+#define CACHE_READAHEAD_MIN_SEGMENTS 2   // 64K
+#define CACHE_READAHEAD_MAX_SEGMENTS 32  // 1M
+
 #if defined(ROFS_DIAGNOSTICS_ENABLED)
 extern std::atomic<long> rofs_block_allocated;
 extern std::atomic<long> rofs_cache_reads;
 extern std::atomic<long> rofs_cache_misses;
+extern std::atomic<long> rofs_readahead_segments;
+extern std::atomic<long> rofs_readahead_hits;
 #endif
 
 namespace rofs {
@@ -38,6 +51,8 @@ struct file_cache {
     std::unordered_map<uint64_t, struct file_cache_segment *> segments_by_index;
     struct rofs_inode *inode;
     struct rofs_super_block *sb;
+    uint64_t next_segment_index; // Segment a sequential read would start at
+    uint64_t readahead_window;   // Number of segments to read ahead, 0 if access is not sequential
 };
 
 //
@@ -74,6 +89,8 @@ private:
     uint64_t starting_block;  // This is relative to the 512-block of the inode itself
     uint64_t block_count;     // Length of data in 512 blocks
     bool data_ready;          // Has data been fully read from disk?
+    struct bio *pending;      // Read issued by readahead that has not been waited for yet
+    bool readahead;           // Brought in by readahead and not accessed since
 
 public:
     file_cache_segment(struct file_cache *_cache, uint64_t _starting_block, uint64_t _block_count) {
@@ -81,6 +98,8 @@ public:
         this->starting_block = _starting_block;
         this->block_count = _block_count;
         this->data_ready = false;   // Data has to be loaded from disk
+        this->pending = nullptr;
+        this->readahead = false;
         auto size = _cache->sb->block_size * _block_count;
         // Only allocate contiguous page-aligned memory if size greater or equal a page
         // to make sure page-cache mapping works properly
@@ -95,6 +114,10 @@ public:
     }
 
     ~file_cache_segment() {
+        if (this->pending) {
+            bio_wait(this->pending);
+            destroy_bio(this->pending);
+        }
         auto size = this->cache->sb->block_size * this->block_count;
         if (size >= mmu::page_size) {
             memory::free_phys_contiguous_aligned(this->data);
@@ -115,6 +138,18 @@ public:
         return this->data_ready;
     }
 
+    bool is_cached() {
+        return this->data_ready || this->pending;
+    }
+
+    //
+    // Returns true the first time a segment brought in by readahead is accessed
+    bool consume_readahead() {
+        auto ret = this->readahead;
+        this->readahead = false;
+        return ret;
+    }
+
     //
     // Read data from memory per uio
     int read(struct uio *uio, uint64_t offset_in_segment, uint64_t bytes_to_read) {
@@ -125,24 +160,57 @@ public:
     }
 
     //
-    // Read all segment data from disk and copy to memory
+    // Read all segment data from disk and copy to memory. If readahead has
+    // already issued the read, only wait for it to complete.
     int read_from_disk(struct device *device) {
-        auto block = cache->inode->data_offset + starting_block;
-        auto bytes_remaining = cache->inode->file_size - starting_block * cache->sb->block_size;
-        auto blocks_remaining = bytes_remaining / cache->sb->block_size;
-        if (bytes_remaining % cache->sb->block_size > 0) {
-            blocks_remaining++;
+        if (this->pending) {
+            return wait_for_disk();
         }
-        auto block_count_to_read = std::min(block_count, blocks_remaining);
+        auto block_count_to_read = blocks_to_read();
+        auto block = cache->inode->data_offset + starting_block;
         print("[rofs] [%d] -> file_cache_segment::read_from_disk() i-node: %d, starting block %d, reading [%d] blocks at disk offset [%d]\n",
               sched::thread::current()->id(), cache->inode->inode_no, starting_block, block_count_to_read, block);
-        auto error = rofs_read_blocks(device, block, block_count_to_read, data);
+        return complete_read(rofs_read_blocks(device, block, block_count_to_read, data));
+    }
+
+    //
+    // Issue the read of all segment data without waiting for it
+    void start_read_from_disk(struct device *device) {
+        auto block_count_to_read = blocks_to_read();
+        auto block = cache->inode->data_offset + starting_block;
+        print("[rofs] [%d] -> file_cache_segment::start_read_from_disk() i-node: %d, starting block %d, reading [%d] blocks at disk offset [%d]\n",
+              sched::thread::current()->id(), cache->inode->inode_no, starting_block, block_count_to_read, block);
+        this->pending = rofs_start_read_blocks(device, block, block_count_to_read, data);
+        this->readahead = (this->pending != nullptr);
+    }
+
+private:
+    uint64_t bytes_remaining() {
+        return cache->inode->file_size - starting_block * cache->sb->block_size;
+    }
+
+    uint64_t blocks_to_read() {
+        auto blocks_remaining = bytes_remaining() / cache->sb->block_size;
+        if (bytes_remaining() % cache->sb->block_size > 0) {
+            blocks_remaining++;
+        }
+        return std::min(block_count, blocks_remaining);
+    }
+
+    int wait_for_disk() {
+        auto error = bio_wait(this->pending);
+        destroy_bio(this->pending);
+        this->pending = nullptr;
+        return complete_read(error);
+    }
+
+    int complete_read(int error) {
         this->data_ready = (error == 0);
         if (error) {
             printf("!!!!! Error reading from disk\n");
         } else {
-            if (bytes_remaining < this->length()) {
-                memset(data + bytes_remaining, 0, this->length() - bytes_remaining);
+            if (bytes_remaining() < this->length()) {
+                memset(data + bytes_remaining(), 0, this->length() - bytes_remaining());
             }
         }
         return error;
@@ -262,6 +330,65 @@ plan_cache_transactions(struct file_cache *cache, struct uio *uio) {
     return transactions;
 }
 
+//
+// Called after a read of the segments first_index to last_index has been served.
+// Tracks whether the file is read sequentially and if so issues reads of up to
+// readahead_window segments past last_index that are not in the cache yet. These
+// reads are left in flight and waited for when the segments are accessed.
+static void
+readahead(struct file_cache *cache, struct device *device, uint64_t first_index, uint64_t last_index, bool hit) {
+    auto segment_bytes = CACHE_SEGMENT_SIZE_IN_BLOCKS * cache->sb->block_size;
+    auto segments_count = (cache->inode->file_size + segment_bytes - 1) / segment_bytes;
+    bool sequential = first_index == cache->next_segment_index || first_index + 1 == cache->next_segment_index;
+    cache->next_segment_index = last_index + 1;
+    if (!sequential || segments_count <= 1) {
+        cache->readahead_window = 0;
+        return;
+    }
+
+    if (!cache->readahead_window) {
+        cache->readahead_window = CACHE_READAHEAD_MIN_SEGMENTS;
+    } else if (hit) {
+        cache->readahead_window = std::min<uint64_t>(cache->readahead_window * 2, CACHE_READAHEAD_MAX_SEGMENTS);
+    }
+
+    auto end_index = std::min(last_index + 1 + cache->readahead_window, segments_count);
+    for (auto index = last_index + 1; index < end_index; index++) {
+        auto cache_segment = cache->segments_by_index.find(index);
+        file_cache_segment *segment;
+        if (cache_segment == cache->segments_by_index.end()) {
+            segment = new file_cache_segment(cache, index * CACHE_SEGMENT_SIZE_IN_BLOCKS,
+                                             CACHE_SEGMENT_SIZE_IN_BLOCKS);
+            cache->segments_by_index.emplace(index, segment);
+        } else {
+            segment = cache_segment->second;
+            if (segment->is_cached()) {
+                continue;
+            }
+        }
+        print("[rofs] [%d] -> readahead i-node: %d, segment %d, window %d\n",
+              sched::thread::current()->id(), cache->inode->inode_no, index, cache->readahead_window);
+        segment->start_read_from_disk(device);
+#if defined(ROFS_DIAGNOSTICS_ENABLED)
+        rofs_readahead_segments += 1;
+#endif
+    }
+}
+
+static bool
+consume_readahead(const std::vector<struct cache_segment_transaction> &transactions) {
+    bool hit = false;
+    for (auto &transaction : transactions) {
+        hit |= transaction.segment->consume_readahead();
+    }
+#if defined(ROFS_DIAGNOSTICS_ENABLED)
+    if (hit) {
+        rofs_readahead_hits += 1;
+    }
+#endif
+    return hit;
+}
+
 //
 // This function calls plan_cache_transactions first to identify what part of uio can be
 // read from memory and what needs to be read from disk
@@ -283,6 +410,12 @@ cache_read(struct rofs_inode *inode, struct device *device, struct rofs_super_bl
           sched::thread::current()->id(), inode->inode_no, uio->uio_offset, segment_transactions.size());
 
     int error = 0;
+    if (segment_transactions.empty()) {
+        return error;
+    }
+    auto first_index = CACHE_SEGMENT_INDEX(uio->uio_offset);
+    auto last_index = first_index + segment_transactions.size() - 1;
+    auto hit = consume_readahead(segment_transactions);
 
     // Iterate over the list of cache operation and either copy from memory
     // or read from disk into cache memory and then copy into memory
@@ -316,6 +449,10 @@ cache_read(struct rofs_inode *inode, struct device *device, struct rofs_super_bl
         }
     }
 
+    if (!error) {
+        readahead(cache, device, first_index, last_index, hit);
+    }
+
     print("[rofs] [%d] rofs_cache_read completed for i-node [%d]\n", sched::thread::current()->id(),
           inode->inode_no);
     return error;
@@ -340,6 +477,7 @@ cache_get_page_address(struct rofs_inode *inode, struct device *device, struct r
 
     assert(segment_transactions.size() == 1);
     auto transaction = segment_transactions[0];
+    auto hit = consume_readahead(segment_transactions);
 #if defined(ROFS_DIAGNOSTICS_ENABLED)
     rofs_cache_reads += 1;
 #endif
@@ -352,9 +490,11 @@ cache_get_page_address(struct rofs_inode *inode, struct device *device, struct r
 #endif
    }
 
-   if( !error)
+   if( !error) {
        *addr = transaction.segment->memory_address(transaction.segment_offset);
-   else
+       auto index = CACHE_SEGMENT_INDEX(uio->uio_offset);
+       readahead(cache, device, index, index, hit);
+   } else
        *addr = nullptr;
 
    return error;
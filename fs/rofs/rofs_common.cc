@@ -57,13 +57,12 @@ void rofs_set_vnode(struct vnode *vnode, struct rofs_inode *inode)
     vnode->v_size = size;
 }
 
-int
-rofs_read_blocks(struct device *device, uint64_t starting_block, uint64_t blocks_count, void *buf)
+struct bio *
+rofs_start_read_blocks(struct device *device, uint64_t starting_block, uint64_t blocks_count, void *buf)
 {
-    ROFS_STOPWATCH_START
     struct bio *bio = alloc_bio();
     if (!bio)
-        return ENOMEM;
+        return nullptr;
 
     bio->bio_cmd = BIO_READ;
     bio->bio_dev = device;
@@ -72,13 +71,25 @@ rofs_read_blocks(struct device *device, uint64_t starting_block, uint64_t blocks
     bio->bio_bcount = blocks_count * BSIZE;
 
     bio->bio_dev->driver->devops->strategy(bio);
-    int error = bio_wait(bio);
-
-    destroy_bio(bio);
 
 #if defined(ROFS_DIAGNOSTICS_ENABLED)
     rofs_block_read_count += blocks_count;
 #endif
+    return bio;
+}
+
+int
+rofs_read_blocks(struct device *device, uint64_t starting_block, uint64_t blocks_count, void *buf)
+{
+    ROFS_STOPWATCH_START
+    struct bio *bio = rofs_start_read_blocks(device, starting_block, blocks_count, buf);
+    if (!bio)
+        return ENOMEM;
+
+    int error = bio_wait(bio);
+
+    destroy_bio(bio);
+
     ROFS_STOPWATCH_END(rofs_block_read_ms)
 
     return error;
@@ -43,6 +43,8 @@ std::atomic<long> rofs_block_read_count(0);
 std::atomic<long> rofs_block_allocated(0);
 std::atomic<long> rofs_cache_reads(0);
 std::atomic<long> rofs_cache_misses(0);
+std::atomic<long> rofs_readahead_segments(0);
+std::atomic<long> rofs_readahead_hits(0);
 #endif
 
 std::atomic<long> rofs_mounts(0);
@@ -228,6 +230,7 @@ rofs_unmount(struct mount *mp, int flags)
     long total_cache_reads = rofs_cache_reads.load();
     double hit_ratio = total_cache_reads > 0 ? (rofs_cache_reads.load() - rofs_cache_misses.load()) / ((double)total_cache_reads) : 0;
     debugf("ROFS: hit ratio is %.2f%%\n", hit_ratio * 100);
+    debugf("ROFS: read ahead %ld segments, %ld of them used\n", rofs_readahead_segments.load(), rofs_readahead_hits.load());
 #endif
     return error;
 }
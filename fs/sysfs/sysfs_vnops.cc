@@ -70,6 +70,26 @@ static string sysfs_memory_pools()
             cpu->id, stats._max, stats._watermark_lo, stats._watermark_hi, stats._nr);
     }
 
+    std::vector<stats::magazine_stats> mstats;
+    stats::get_malloc_pools_stats(mstats);
+    for (auto& ms : mstats) {
+        osv::fprintf(os, "malloc %04zu magazines %zu %zu %zu %zu %zu %zu\n",
+            ms._size, ms._alloc_hits, ms._alloc_misses, ms._depot_gets,
+            ms._depot_puts, ms._flushes, ms._remote_frees);
+    }
+
+    return os.str();
+}
+
+static string sysfs_sched_steal()
+{
+    std::ostringstream os;
+    for (auto cpu : sched::cpus) {
+        osv::fprintf(os, "cpu %d steal %ld %ld %ld %ld\n", cpu->id,
+            cpu->steals.requests, cpu->steals.stolen.load(std::memory_order_relaxed),
+            cpu->steals.pushed, cpu->steals.wake_forwards);
+    }
+
     return os.str();
 }
 
@@ -105,8 +125,12 @@ sysfs_mount(mount* mp, const char *dev, int flags, const void* data)
     memory->add("pools", inode_count++, sysfs_memory_pools);
     memory->add("linear_maps", inode_count++, mmu::sysfs_linear_maps);
 
+    auto sched_dir = make_shared<pseudo_dir_node>(inode_count++);
+    sched_dir->add("steal", inode_count++, sysfs_sched_steal);
+
     auto osv_extension = make_shared<pseudo_dir_node>(inode_count++);
     osv_extension->add("memory", memory);
+    osv_extension->add("sched", sched_dir);
 
     auto* root = new pseudo_dir_node(vp->v_ino);
     root->add("devices", devices);
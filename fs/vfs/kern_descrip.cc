@@ -9,13 +9,18 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/select.h>
 #include <osv/file.h>
 #include <osv/poll.h>
 #include <osv/debug.h>
 #include <osv/mutex.h>
 #include <osv/rcu.hh>
+#include <osv/percpu.hh>
+#include <osv/sched.hh>
 #include <osv/export.h>
 #include <boost/range/algorithm/find.hpp>
+#include <algorithm>
+#include <atomic>
 
 #include <bsd/sys/sys/queue.h>
 
@@ -26,40 +31,135 @@ using namespace osv;
  * descriptors are maintained globally.
  */
 rcu_ptr<file> gfdt[FDMAX] = {};
-mutex_t gfdt_lock = MUTEX_INITIALIZER;
 
 /*
- * Allocate a file descriptor and assign fd to it atomically.
- *
- * Grabs a reference on fp if successful.
+ * Bitmap of the descriptors in use. A descriptor is allocated by setting
+ * its bit with a compare-and-swap on the bitmap word, after which the
+ * allocator owns the gfdt entry and installs the file without a lock.
+ * fdset() may still install into any descriptor, so installing is itself
+ * a compare-and-swap and a bit may stay set for an entry lost to fdset().
  */
-int _fdalloc(struct file *fp, int *newfd, int min_fd)
-{
-    int fd;
+static constexpr int fdmap_bits = 64;
+static constexpr int fdmap_words = FDMAX / fdmap_bits;
+static std::atomic<u64> fdmap[fdmap_words];
 
-    fhold(fp);
+/*
+ * POSIX wants the lowest free descriptor, so every search starts at the
+ * bottom of the bitmap. To not rescan the same full words on every open,
+ * each CPU remembers the first word it did not find full; everything below
+ * it was full when the CPU last looked, and freeing a descriptor lowers the
+ * hint of every CPU that may skip it. An allocation only moves its CPU's
+ * hint up if no descriptor was freed below it during the search.
+ */
+static PERCPU(std::atomic<int>, fd_hint);
 
-    for (fd = min_fd; fd < FDMAX; fd++) {
-        if (gfdt[fd])
-            continue;
+/*
+ * With --fast-fdalloc, fdalloc() only promises a free descriptor: each CPU
+ * searches from its own start word, so CPUs opening and closing sockets
+ * concurrently keep to different bitmap words instead of all fighting over
+ * the lowest. The start words stay at or above FD_SETSIZE, so descriptors
+ * select() can take, and the stdio ones, are only handed out by the POSIX
+ * search, once everything above is in use. A start word of 0 means the CPU
+ * has no history yet.
+ */
+extern bool opt_fast_fdalloc;
+static PERCPU(int, fd_fast_start);
+static constexpr int fast_words_min = FD_SETSIZE / fdmap_bits;
+
+static int fast_start_word(void)
+{
+    int word = *fd_fast_start;
+    if (word == 0) {
+        // Spread the CPUs over the table until they have a history
+        word = fast_words_min + sched::cpu::current()->id *
+            (fdmap_words - fast_words_min) / sched::cpus.size();
+    }
+    return word;
+}
 
-        WITH_LOCK(gfdt_lock) {
-            /* Now that we hold the lock,
-             * make sure the entry is still available */
-            if (gfdt[fd].read_by_owner()) {
-                continue;
+static int fdmap_claim(int from, int to)
+{
+    for (int fd = from; fd < to; fd = (fd / fdmap_bits + 1) * fdmap_bits) {
+        auto& word = fdmap[fd / fdmap_bits];
+        u64 mask = ~u64(0) << (fd % fdmap_bits);
+        u64 bits = word.load(std::memory_order_relaxed);
+        u64 free;
+        while ((free = ~bits & mask) != 0) {
+            int bit = __builtin_ctzll(free);
+            if (fd / fdmap_bits * fdmap_bits + bit >= to) {
+                return -1;
+            }
+            if (word.compare_exchange_weak(bits, bits | (u64(1) << bit),
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+                return fd / fdmap_bits * fdmap_bits + bit;
             }
+        }
+    }
+    return -1;
+}
 
-            /* Install */
-            gfdt[fd].assign(fp);
-            *newfd = fd;
+static void fdmap_mark(int fd)
+{
+    fdmap[fd / fdmap_bits].fetch_or(u64(1) << (fd % fdmap_bits),
+                                    std::memory_order_relaxed);
+}
+
+static void fdmap_release(int fd)
+{
+    int word = fd / fdmap_bits;
+    fdmap[word].fetch_and(~(u64(1) << (fd % fdmap_bits)),
+                          std::memory_order_release);
+    if (opt_fast_fdalloc && word >= fast_words_min) {
+        *fd_fast_start = word;
+    }
+    for (auto c : sched::cpus) {
+        auto& hint = *fd_hint.for_cpu(c);
+        int h = hint.load(std::memory_order_relaxed);
+        while (h > word && !hint.compare_exchange_weak(h, word,
+                std::memory_order_release, std::memory_order_relaxed)) {
         }
+    }
+}
 
-        return 0;
+static int fdalloc_from(struct file *fp, int min_fd)
+{
+    auto& hint = *fd_hint;
+    int h = hint.load(std::memory_order_acquire);
+    int start = std::max(min_fd, h * fdmap_bits);
+    bool from_hint = start == h * fdmap_bits;
+    while (true) {
+        int fd = fdmap_claim(start, FDMAX);
+        if (fd < 0) {
+            return -1;
+        }
+        /* Install, unless fdset() got here first */
+        if (gfdt[fd].compare_exchange(nullptr, fp)) {
+            if (from_hint && fd / fdmap_bits > h) {
+                hint.compare_exchange_strong(h, fd / fdmap_bits,
+                                             std::memory_order_relaxed);
+            }
+            return fd;
+        }
+        start = fd + 1;
     }
+}
 
-    fdrop(fp);
-    return EMFILE;
+/*
+ * Allocate a file descriptor and assign fd to it atomically.
+ *
+ * Grabs a reference on fp if successful.
+ */
+int _fdalloc(struct file *fp, int *newfd, int min_fd)
+{
+    fhold(fp);
+
+    int fd = fdalloc_from(fp, min_fd);
+    if (fd < 0) {
+        fdrop(fp);
+        return EMFILE;
+    }
+    *newfd = fd;
+    return 0;
 }
 
 extern "C" OSV_LIBC_API
@@ -75,22 +175,47 @@ int getdtablesize(void)
  */
 int fdalloc(struct file *fp, int *newfd)
 {
-    return (_fdalloc(fp, newfd, 0));
+    if (!opt_fast_fdalloc) {
+        return (_fdalloc(fp, newfd, 0));
+    }
+
+    fhold(fp);
+
+    int start = fast_start_word() * fdmap_bits;
+    int lo = fast_words_min * fdmap_bits;
+    while (true) {
+        int fd = fdmap_claim(start, FDMAX);
+        if (fd < 0) {
+            fd = fdmap_claim(lo, start);
+        }
+        if (fd < 0) {
+            fd = fdalloc_from(fp, 0);
+            if (fd < 0) {
+                fdrop(fp);
+                return EMFILE;
+            }
+            *newfd = fd;
+            return 0;
+        }
+        /* Install, unless fdset() got here first */
+        if (gfdt[fd].compare_exchange(nullptr, fp)) {
+            *fd_fast_start = fd / fdmap_bits;
+            *newfd = fd;
+            return 0;
+        }
+        start = fd + 1 < FDMAX ? fd + 1 : lo;
+    }
 }
 
 int fdclose(int fd)
 {
     struct file* fp;
 
-    WITH_LOCK(gfdt_lock) {
-
-        fp = gfdt[fd].read_by_owner();
-        if (fp == nullptr) {
-            return EBADF;
-        }
-
-        gfdt[fd].assign(nullptr);
+    fp = gfdt[fd].exchange(nullptr);
+    if (fp == nullptr) {
+        return EBADF;
     }
+    fdmap_release(fd);
 
     fdrop(fp);
 
@@ -110,11 +235,9 @@ int fdset(int fd, struct file *fp)
 
     fhold(fp);
 
-    WITH_LOCK(gfdt_lock) {
-        orig = gfdt[fd].read_by_owner();
-        /* Install new file structure in place */
-        gfdt[fd].assign(fp);
-    }
+    fdmap_mark(fd);
+    /* Install new file structure in place */
+    orig = gfdt[fd].exchange(fp);
 
     if (orig)
         fdrop(orig);
@@ -180,9 +303,7 @@ void file::wake_epoll(int events)
         if (!f_epolls) {
             return;
         }
-        for (auto&& ep : *f_epolls) {
-            epoll_wake(ep);
-        }
+        epoll_wake_all(*f_epolls);
     }
 }
 
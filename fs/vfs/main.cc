@@ -77,11 +77,14 @@
 
 #include "fs/fs.hh"
 #include "libc/libc.hh"
+#include "libc/pipe.hh"
 
 #include <mntent.h>
 #include <sys/mman.h>
 
 #include <osv/clock.hh>
+#include <osv/async.hh>
+#include <osv/zcopy.hh>
 #include <api/utime.h>
 #include <chrono>
 
@@ -1717,6 +1720,19 @@ int fcntl(int fd, int cmd, int arg)
     case F_SETOWN:
         WARN_ONCE("fcntl(F_SETOWN) stubbed\n");
         break;
+    case F_SETPIPE_SZ:
+    case F_GETPIPE_SZ: {
+        auto pipe = dynamic_cast<pipe_file*>(fp);
+        if (!pipe) {
+            error = EINVAL;
+            break;
+        }
+        if (cmd == F_SETPIPE_SZ) {
+            error = pipe->set_pipe_size(arg);
+        }
+        ret = pipe->pipe_size();
+        break;
+    }
     default:
         kprintf("unsupported fcntl cmd 0x%x\n", cmd);
         error = EINVAL;
@@ -2212,6 +2228,41 @@ int lchown(const char *path, uid_t owner, gid_t group)
 }
 
 
+struct sendfile_mapping {
+    void *addr;
+    size_t len;
+};
+
+// Called when the last mbuf referencing the mapping is freed, possibly from
+// the network stack with socket locks held, so unmap from a worker thread.
+static void sendfile_unmap(void *arg)
+{
+    auto sm = static_cast<sendfile_mapping*>(arg);
+    async::run_later([sm] {
+        munmap(sm->addr, sm->len);
+        delete sm;
+    });
+}
+
+// Send the file pages themselves on a stream socket: the mbufs point into
+// the page cache (or the mapping's pages) and the mapping lives until the
+// socket is done with them, or the send failed. The mbufs are built from
+// the pages' physical addresses, so they are mapped in up front. Returns
+// -1/EOPNOTSUPP for other sockets.
+static ssize_t sendfile_zcopy(int out_fd, int in_fd, off_t offset, size_t count)
+{
+    size_t bytes_to_mmap = count + (offset % mmu::page_size);
+    off_t offset_for_mmap =  align_down(offset, (off_t)mmu::page_size);
+    char *src = static_cast<char *>(mmap(nullptr, bytes_to_mmap, PROT_READ,
+        MAP_SHARED | MAP_POPULATE, in_fd, offset_for_mmap));
+    if (src == MAP_FAILED) {
+        return -1;
+    }
+    auto sm = new sendfile_mapping{src, bytes_to_mmap};
+    return zcopy_sendpages(out_fd, src + (offset % PAGE_SIZE), count,
+                           sendfile_unmap, sm);
+}
+
 OSV_LIBC_API
 ssize_t sendfile(int out_fd, int in_fd, off_t *_offset, size_t count)
 {
@@ -2267,10 +2318,25 @@ ssize_t sendfile(int out_fd, int in_fd, off_t *_offset, size_t count)
         }
     }
 
+    // Sockets get the pages without a copy
+    if (out_fp->f_type == DTYPE_SOCKET) {
+        auto ret = sendfile_zcopy(out_fd, in_fd, offset, count);
+        if (ret >= 0 || errno != EOPNOTSUPP) {
+            if (ret < 0) {
+                return -1;
+            } else if (_offset == nullptr) {
+                lseek(in_fd, ret, SEEK_CUR);
+            } else {
+                *_offset += ret;
+            }
+            return ret;
+        }
+    }
+
     size_t bytes_to_mmap = count + (offset % mmu::page_size);
     off_t offset_for_mmap =  align_down(offset, (off_t)mmu::page_size);
-
-    char *src = static_cast<char *>(mmap(nullptr, bytes_to_mmap, PROT_READ, MAP_SHARED, in_fd, offset_for_mmap));
+    char *src = static_cast<char *>(mmap(nullptr, bytes_to_mmap, PROT_READ,
+        MAP_SHARED, in_fd, offset_for_mmap));
 
     if (src == MAP_FAILED) {
         return -1;
@@ -40,31 +40,88 @@
 
 #include <osv/dentry.h>
 #include <osv/vnode.h>
+#include <osv/rcu.hh>
+#include <osv/rcu-hashtable.hh>
 #include "vfs.h"
 
-#define DENTRY_BUCKETS 32
-
-static LIST_HEAD(dentry_hash_head, dentry) dentry_hash_table[DENTRY_BUCKETS];
-static LIST_HEAD(fake, dentry) fake;
-static mutex dentry_hash_lock;
-
 /*
  * Get the hash value from the mount point and path name.
- * XXX: replace with a better hash for 64-bit pointers.
  */
-static u_int
+static size_t
 dentry_hash(struct mount *mp, const char *path)
 {
-    u_int val = 0;
+    size_t val = 0;
 
     if (path) {
         while (*path) {
             val = ((val << 5) + val) + *path++;
         }
     }
-    return (val ^ (unsigned long) mp) & (DENTRY_BUCKETS - 1);
+    return val ^ ((uintptr_t)mp >> 4);
+}
+
+struct dentry_key {
+    struct mount *mp;
+    const char *path;
+};
+
+struct dentry_key_hash {
+    size_t operator()(const dentry_key& k) const {
+        return dentry_hash(k.mp, k.path);
+    }
+};
+
+struct dentry_hasher {
+    size_t operator()(struct dentry *dp) const {
+        return dentry_hash(dp->d_mount, dp->d_path);
+    }
+};
+
+/*
+ * A dentry whose reference count dropped to zero is on its way out of the
+ * table and is skipped, so that a live duplicate can be found (or created).
+ */
+struct dentry_key_compare {
+    bool operator()(const dentry_key& k, struct dentry *dp) const {
+        return dp->d_mount == k.mp &&
+            __atomic_load_n(&dp->d_refcnt, __ATOMIC_RELAXED) > 0 &&
+            !strncmp(dp->d_path, k.path, PATH_MAX);
+    }
+};
+
+/*
+ * Lookups walk the table under RCU; dentry_hash_lock only serializes
+ * insertions and removals.  A removed dentry (and a replaced d_path) is
+ * freed after a grace period, as readers may still be comparing it.
+ */
+static osv::rcu_hashtable<struct dentry *, dentry_hasher> dentry_table;
+static mutex dentry_hash_lock;
+
+static void
+dentry_unhash(struct dentry *dp)
+{
+    auto i = dentry_table.owner_find(dp, dentry_hasher(),
+                                     std::equal_to<struct dentry *>());
+    if (i) {
+        dentry_table.erase(i);
+    }
 }
 
+/*
+ * Take a reference unless the count already dropped to zero.
+ */
+static bool
+dref_not_zero(struct dentry *dp)
+{
+    int c = __atomic_load_n(&dp->d_refcnt, __ATOMIC_RELAXED);
+    while (c > 0) {
+        if (__atomic_compare_exchange_n(&dp->d_refcnt, &c, c + 1, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
 
 struct dentry *
 dentry_alloc(struct dentry *parent_dp, struct vnode *vp, const char *path)
@@ -95,26 +152,24 @@ dentry_alloc(struct dentry *parent_dp, struct vnode *vp, const char *path)
 
     vn_add_name(vp, dp);
 
-    mutex_lock(&dentry_hash_lock);
-    LIST_INSERT_HEAD(&dentry_hash_table[dentry_hash(mp, path)], dp, d_link);
-    mutex_unlock(&dentry_hash_lock);
+    WITH_LOCK(dentry_hash_lock) {
+        dentry_table.insert(dp);
+    }
     return dp;
 };
 
 struct dentry *
 dentry_lookup(struct mount *mp, char *path)
 {
-    struct dentry *dp;
-
-    mutex_lock(&dentry_hash_lock);
-    LIST_FOREACH(dp, &dentry_hash_table[dentry_hash(mp, path)], d_link) {
-        if (dp->d_mount == mp && !strncmp(dp->d_path, path, PATH_MAX)) {
-            dp->d_refcnt++;
-            mutex_unlock(&dentry_hash_lock);
-            return dp;
+    dentry_key key{mp, path};
+
+    WITH_LOCK(osv::rcu_read_lock) {
+        auto i = dentry_table.reader_find(key, dentry_key_hash(),
+                                          dentry_key_compare());
+        if (i && dref_not_zero(*i)) {
+            return *i;
         }
     }
-    mutex_unlock(&dentry_hash_lock);
     return nullptr;                /* not found */
 }
 
@@ -125,8 +180,7 @@ static void dentry_children_remove(struct dentry *dp)
     WITH_LOCK(dp->d_lock) {
         LIST_FOREACH(entry, &dp->d_children, d_children_link) {
             ASSERT(entry);
-            ASSERT(entry->d_refcnt > 0);
-            LIST_REMOVE(entry, d_link);
+            dentry_unhash(entry);
         }
     }
 }
@@ -156,30 +210,27 @@ dentry_move(struct dentry *dp, struct dentry *parent_dp, char *path)
         // Remove all dp's child dentries from the hashtable.
         dentry_children_remove(dp);
         // Remove dp with outdated hash info from the hashtable.
-        LIST_REMOVE(dp, d_link);
+        dentry_unhash(dp);
         // Update dp.
         dp->d_path = strdup(path);
         dp->d_parent = parent_dp;
         // Insert dp updated hash info into the hashtable.
-        LIST_INSERT_HEAD(&dentry_hash_table[dentry_hash(dp->d_mount, path)],
-            dp, d_link);
+        dentry_table.insert(dp);
     }
 
     if (old_pdp) {
         drele(old_pdp);
     }
 
-    free(old_path);
+    osv::rcu_defer([=] { free(old_path); });
 }
 
 void
 dentry_remove(struct dentry *dp)
 {
-    mutex_lock(&dentry_hash_lock);
-    LIST_REMOVE(dp, d_link);
-    /* put it on a fake list for drele() to work*/
-    LIST_INSERT_HEAD(&fake, dp, d_link);
-    mutex_unlock(&dentry_hash_lock);
+    WITH_LOCK(dentry_hash_lock) {
+        dentry_unhash(dp);
+    }
 }
 
 void
@@ -188,9 +239,7 @@ dref(struct dentry *dp)
     ASSERT(dp);
     ASSERT(dp->d_refcnt > 0);
 
-    mutex_lock(&dentry_hash_lock);
-    dp->d_refcnt++;
-    mutex_unlock(&dentry_hash_lock);
+    __atomic_fetch_add(&dp->d_refcnt, 1, __ATOMIC_RELAXED);
 }
 
 void
@@ -199,16 +248,15 @@ drele(struct dentry *dp)
     ASSERT(dp);
     ASSERT(dp->d_refcnt > 0);
 
-    mutex_lock(&dentry_hash_lock);
-    if (--dp->d_refcnt) {
-        mutex_unlock(&dentry_hash_lock);
+    if (__atomic_sub_fetch(&dp->d_refcnt, 1, __ATOMIC_ACQ_REL)) {
         return;
     }
-    LIST_REMOVE(dp, d_link);
+    // Nobody can take a new reference now, lookups skip dp.
+    WITH_LOCK(dentry_hash_lock) {
+        dentry_unhash(dp);
+    }
     vn_del_name(dp->d_vnode, dp);
 
-    mutex_unlock(&dentry_hash_lock);
-
     if (dp->d_parent) {
         WITH_LOCK(dp->d_parent->d_lock) {
             // Remove dp from its parent's children list.
@@ -219,16 +267,13 @@ drele(struct dentry *dp)
 
     vrele(dp->d_vnode);
 
-    free(dp->d_path);
-    free(dp);
+    osv::rcu_defer([=] {
+        free(dp->d_path);
+        free(dp);
+    });
 }
 
 void
 dentry_init(void)
 {
-    int i;
-
-    for (i = 0; i < DENTRY_BUCKETS; i++) {
-        LIST_INIT(&dentry_hash_table[i]);
-    }
 }
@@ -42,6 +42,8 @@
 #include <osv/prex.h>
 #include <osv/vnode.h>
 #include <osv/export.h>
+#include <osv/rcu.hh>
+#include <osv/rcu-hashtable.hh>
 #include "vfs.h"
 
 OSV_LIBSOLARIS_API
@@ -68,56 +70,95 @@ int vttoif_tab[10] = {
  * vrele      -1        *
  */
 
-#define VNODE_BUCKETS 32		/* size of vnode hash table */
+/*
+ * Get the hash value from the mount point and inode number.
+ */
+static size_t
+vn_hash(struct mount *mp, uint64_t ino)
+{
+	size_t h = (ino ^ ((uintptr_t)mp >> 4)) * 0x9e3779b97f4a7c15ull;
+	return h ^ (h >> 32);
+}
+
+struct vnode_key {
+	struct mount *mp;
+	uint64_t ino;
+};
+
+struct vnode_key_hash {
+	size_t operator()(const vnode_key& k) const {
+		return vn_hash(k.mp, k.ino);
+	}
+};
+
+struct vnode_hasher {
+	size_t operator()(struct vnode *vp) const {
+		return vn_hash(vp->v_mount, vp->v_ino);
+	}
+};
 
 /*
- * vnode table.
- * All active (opened) vnodes are stored on this hash table.
- * They can be accessed by its path name.
+ * A vnode whose reference count dropped to zero is being inactivated
+ * and is skipped; vget() then allocates a fresh one.
  */
-static LIST_HEAD(vnode_hash_head, vnode) vnode_table[VNODE_BUCKETS];
+struct vnode_key_compare {
+	bool operator()(const vnode_key& k, struct vnode *vp) const {
+		return vp->v_mount == k.mp && vp->v_ino == k.ino &&
+		    __atomic_load_n(&vp->v_refcnt, __ATOMIC_RELAXED) > 0;
+	}
+};
 
 /*
- * Global lock to access all vnodes and vnode table.
- * If a vnode is already locked, there is no need to
- * lock this global lock to access internal data.
+ * vnode table.
+ * All active (opened) vnodes are stored on this hash table.
+ * They can be accessed by mount point and inode number.
+ *
+ * Lookups walk the table under RCU.  The global lock below only
+ * serializes insertions and removals, and a vnode is freed after a
+ * grace period, once no lookup can still be looking at it.
  */
+static osv::rcu_hashtable<struct vnode *, vnode_hasher> vnode_table;
+
 static mutex_t vnode_lock = MUTEX_INITIALIZER;
 #define VNODE_LOCK()	mutex_lock(&vnode_lock)
 #define VNODE_UNLOCK()	mutex_unlock(&vnode_lock)
-#define VNODE_OWNED()	mutex_owned(&vnode_lock)
 
 /*
- * Get the hash value from the mount point and path name.
- * XXX(hch): replace with a better hash for 64-bit pointers.
+ * Take a reference unless the count already dropped to zero.
  */
-static u_int
-vn_hash(struct mount *mp, uint64_t ino)
+static bool
+vref_not_zero(struct vnode *vp)
 {
-	return (ino ^ (unsigned long)mp) & (VNODE_BUCKETS - 1);
+	int c = __atomic_load_n(&vp->v_refcnt, __ATOMIC_RELAXED);
+
+	while (c > 0) {
+		if (__atomic_compare_exchange_n(&vp->v_refcnt, &c, c + 1, true,
+		    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return true;
+	}
+	return false;
 }
 
 /*
- * Returns locked vnode for specified mount point and path.
- * vn_lock() will increment the reference count of vnode.
+ * Returns locked vnode for specified mount point and inode number.
+ * The reference count of the vnode is incremented.
  *
- * Locking: VNODE_LOCK must be held.
+ * Locking: none; the vnode lock is taken after the table lookup.
  */
 struct vnode *
 vn_lookup(struct mount *mp, uint64_t ino)
 {
-	struct vnode *vp;
+	struct vnode *vp = nullptr;
 
-	assert(VNODE_OWNED());
-	LIST_FOREACH(vp, &vnode_table[vn_hash(mp, ino)], v_link) {
-		if (vp->v_mount == mp && vp->v_ino == ino) {
-			vp->v_refcnt++;
-			mutex_lock(&vp->v_lock);
-			vp->v_nrlocks++;
-			return vp;
-		}
+	WITH_LOCK(osv::rcu_read_lock) {
+		auto i = vnode_table.reader_find(vnode_key{mp, ino},
+		    vnode_key_hash(), vnode_key_compare());
+		if (i && vref_not_zero(*i))
+			vp = *i;
 	}
-	return nullptr;		/* not found */
+	if (vp)
+		vn_lock(vp);
+	return vp;
 }
 
 #ifdef DEBUG_VFS
@@ -178,11 +219,23 @@ vget(struct mount *mp, uint64_t ino, struct vnode **vpp)
 
 	DPRINTF(VFSDB_VNODE, ("vget %LLu\n", ino));
 
-	VNODE_LOCK();
-
 	vp = vn_lookup(mp, ino);
 	if (vp) {
+		*vpp = vp;
+		return 1;
+	}
+
+	VNODE_LOCK();
+
+	/*
+	 * Somebody may have created the vnode since we looked.
+	 */
+	auto i = vnode_table.owner_find(vnode_key{mp, ino},
+	    vnode_key_hash(), vnode_key_compare());
+	if (i && vref_not_zero(*i)) {
+		vp = *i;
 		VNODE_UNLOCK();
+		vn_lock(vp);
 		*vpp = vp;
 		return 1;
 	}
@@ -211,7 +264,7 @@ vget(struct mount *mp, uint64_t ino, struct vnode **vpp)
 	mutex_lock(&vp->v_lock);
 	vp->v_nrlocks++;
 
-	LIST_INSERT_HEAD(&vnode_table[vn_hash(mp, ino)], vp, v_link);
+	vnode_table.insert(vp);
 	VNODE_UNLOCK();
 
 	*vpp = vp;
@@ -230,26 +283,12 @@ vput(struct vnode *vp)
 	ASSERT(vp->v_refcnt > 0);
 	DPRINTF(VFSDB_VNODE, ("vput: ref=%d %s\n", vp->v_refcnt, vn_path(vp)));
 
-	VNODE_LOCK();
-	vp->v_refcnt--;
-	if (vp->v_refcnt > 0) {
-	    VNODE_UNLOCK();
-		vn_unlock(vp);
-		return;
-	}
-	LIST_REMOVE(vp, v_link);
-	VNODE_UNLOCK();
-
 	/*
-	 * Deallocate fs specific vnode data
+	 * Unlock first: once our reference is gone the vnode may be
+	 * freed by whoever drops the last one.
 	 */
-	if (vp->v_op->vop_inactive)
-		VOP_INACTIVE(vp);
-	vfs_unbusy(vp->v_mount);
-	vp->v_nrlocks--;
-	ASSERT(vp->v_nrlocks == 0);
-	mutex_unlock(&vp->v_lock);
-	delete vp;
+	vn_unlock(vp);
+	vrele(vp);
 }
 
 /*
@@ -261,10 +300,8 @@ vref(struct vnode *vp)
 	ASSERT(vp);
 	ASSERT(vp->v_refcnt > 0);	/* Need vget */
 
-	VNODE_LOCK();
 	DPRINTF(VFSDB_VNODE, ("vref: ref=%d\n", vp->v_refcnt));
-	vp->v_refcnt++;
-	VNODE_UNLOCK();
+	__atomic_fetch_add(&vp->v_refcnt, 1, __ATOMIC_RELAXED);
 }
 
 /*
@@ -279,14 +316,19 @@ vrele(struct vnode *vp)
 	ASSERT(vp);
 	ASSERT(vp->v_refcnt > 0);
 
-	VNODE_LOCK();
 	DPRINTF(VFSDB_VNODE, ("vrele: ref=%d\n", vp->v_refcnt));
-	vp->v_refcnt--;
-	if (vp->v_refcnt > 0) {
-		VNODE_UNLOCK();
+	if (__atomic_sub_fetch(&vp->v_refcnt, 1, __ATOMIC_ACQ_REL) > 0)
 		return;
-	}
-	LIST_REMOVE(vp, v_link);
+
+	/*
+	 * Lookups skip the vnode from now on, so nobody can take
+	 * a new reference to it.
+	 */
+	VNODE_LOCK();
+	auto i = vnode_table.owner_find(vp, vnode_hasher(),
+	    std::equal_to<struct vnode *>());
+	ASSERT(i);
+	vnode_table.erase(i);
 	VNODE_UNLOCK();
 
 	/*
@@ -295,7 +337,7 @@ vrele(struct vnode *vp)
 	if (vp->v_op && vp->v_op->vop_inactive)
 		VOP_INACTIVE(vp);
 	vfs_unbusy(vp->v_mount);
-	delete vp;
+	osv::rcu_dispose(vp);
 }
 
 /*
@@ -447,9 +489,6 @@ vn_access(struct vnode *vp, int flags)
 void
 vnode_dump(void)
 {
-	int i;
-	struct vnode *vp;
-	struct mount *mp;
 	char type[][6] = { "VNON ", "VREG ", "VDIR ", "VBLK ", "VCHR ",
 			   "VLNK ", "VSOCK", "VFIFO" };
 
@@ -458,16 +497,14 @@ vnode_dump(void)
 	kprintf(" vnode    mount    type  refcnt blkno    path\n");
 	kprintf(" -------- -------- ----- ------ -------- ------------------------------\n");
 
-	for (i = 0; i < VNODE_BUCKETS; i++) {
-	        LIST_FOREACH(vp, &vnode_table[i], v_link) {
-			mp = vp->v_mount;
+	vnode_table.owner_for_each([&] (struct vnode *vp) {
+		struct mount *mp = vp->v_mount;
 
-			kprintf(" %08x %08x %s %6d %8d %s%s\n", (u_long)vp,
-				(u_long)mp, type[vp->v_type], vp->v_refcnt,
-				(strlen(mp->m_path) == 1) ? "\0" : mp->m_path,
-				vn_path(vp));
-		}
-	}
+		kprintf(" %08x %08x %s %6d %8d %s%s\n", (u_long)vp,
+			(u_long)mp, type[vp->v_type], vp->v_refcnt,
+			(strlen(mp->m_path) == 1) ? "\0" : mp->m_path,
+			vn_path(vp));
+	});
 	kprintf("\n");
 	VNODE_UNLOCK();
 }
@@ -504,10 +541,6 @@ vop_erofs(void)
 void
 vnode_init(void)
 {
-	int i;
-
-	for (i = 0; i < VNODE_BUCKETS; i++)
-		LIST_INIT(&vnode_table[i]);
 }
 
 void vn_add_name(struct vnode *vp, struct dentry *dp)
@@ -15,8 +15,92 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+#include <sys/uio.h>
+#include <time.h>
+
 typedef struct io_context *io_context_t;
 
+typedef enum io_iocb_cmd {
+    IO_CMD_PREAD = 0,
+    IO_CMD_PWRITE = 1,
+
+    IO_CMD_FSYNC = 2,
+    IO_CMD_FDSYNC = 3,
+
+    IO_CMD_POLL = 5,
+    IO_CMD_NOOP = 6,
+    IO_CMD_PREADV = 7,
+    IO_CMD_PWRITEV = 8,
+} io_iocb_cmd_t;
+
+// Set in u.c.flags when u.c.resfd is an eventfd to signal on completion
+#define IOCB_FLAG_RESFD (1 << 0)
+
+// The layout is the one of libaio's 64-bit little-endian ABI
+struct io_iocb_common {
+    void *buf;
+    unsigned long nbytes;
+    long long offset;
+    long long __pad3;
+    unsigned flags;
+    unsigned resfd;
+};
+
+struct io_iocb_vector {
+    const struct iovec *vec;
+    int nr;
+    long long offset;
+};
+
+struct iocb {
+    void *data;
+    unsigned key;
+    unsigned aio_rw_flags;
+    short aio_lio_opcode;
+    short aio_reqprio;
+    int aio_fildes;
+    union {
+        struct io_iocb_common c;
+        struct io_iocb_vector v;
+    } u;
+};
+
+struct io_event {
+    void *data;
+    struct iocb *obj;
+    unsigned long res;
+    unsigned long res2;
+};
+
+static inline void io_prep_pread(struct iocb *iocb, int fd, void *buf,
+        size_t count, long long offset)
+{
+    __builtin_memset(iocb, 0, sizeof(*iocb));
+    iocb->aio_fildes = fd;
+    iocb->aio_lio_opcode = IO_CMD_PREAD;
+    iocb->u.c.buf = buf;
+    iocb->u.c.nbytes = count;
+    iocb->u.c.offset = offset;
+}
+
+static inline void io_prep_pwrite(struct iocb *iocb, int fd, void *buf,
+        size_t count, long long offset)
+{
+    __builtin_memset(iocb, 0, sizeof(*iocb));
+    iocb->aio_fildes = fd;
+    iocb->aio_lio_opcode = IO_CMD_PWRITE;
+    iocb->u.c.buf = buf;
+    iocb->u.c.nbytes = count;
+    iocb->u.c.offset = offset;
+}
+
+static inline void io_set_eventfd(struct iocb *iocb, int eventfd)
+{
+    iocb->u.c.flags |= IOCB_FLAG_RESFD;
+    iocb->u.c.resfd = eventfd;
+}
+
 int io_setup(int nr_events, io_context_t *ctxp_idp);
 int io_submit(io_context_t ctx, long nr, struct iocb *ios[]);
 int io_getevents(io_context_t ctx_id, long min_nr, long nr,
@@ -314,6 +314,9 @@
 #define __NR_finit_module			313
 #define __NR_getrandom				318
 #define __NR_statx				332
+#define __NR_io_uring_setup			425
+#define __NR_io_uring_enter			426
+#define __NR_io_uring_register			427
 
 #undef __NR_fstatat
 #undef __NR_pread
@@ -644,6 +647,9 @@
 #define SYS_kcmp				312
 #define SYS_finit_module			313
 #define SYS_statx				332
+#define SYS_io_uring_setup			425
+#define SYS_io_uring_enter			426
+#define SYS_io_uring_register			427
 
 #undef SYS_fstatat
 #undef SYS_pread
@@ -2,6 +2,7 @@
 #define BOOT_HH
 
 #include "arch-setup.hh"
+#include <atomic>
 
 class time_element {
 public:
@@ -9,11 +10,22 @@ public:
     u64 stamp;
 };
 
+// How long a driver took to probe and initialize one device.
+class driver_time_element {
+public:
+    char name[32];
+    u64 start;
+    u64 end;
+};
+
 class boot_time_chart {
 public:
     void event(const char *str);
     void event(int event_idx, const char *str);
     void event(int event_idx, const char *str, u64 stamp);
+    // Drivers probe in parallel, so rather than events in the chart, they
+    // get their own list of timings, printed with it.
+    void driver_event(const char *name, u64 start, u64 end);
     void print_chart();
     void print_total_time();
 private:
@@ -23,7 +35,11 @@ private:
     // call this one directly. Therefore, the measurements would appear in the
     // middle of the list, and we want to preserve order.
     int _event = 4;
-    time_element arrays[16];
+    static constexpr int max_events = 16;
+    time_element arrays[max_events];
+    static constexpr int max_driver_events = 32;
+    std::atomic<int> _driver_events = { 0 };
+    driver_time_element driver_arrays[max_driver_events];
 
     void print_one_time(int index);
     double to_msec(u64 time);
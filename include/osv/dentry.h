@@ -14,7 +14,6 @@
 struct vnode;
 
 struct dentry {
-	LIST_ENTRY(dentry) d_link;	/* link for hash list */
 	int		d_refcnt;	/* reference count */
 	char		*d_path;	/* pointer to path in fs */
 	struct vnode	*d_vnode;
@@ -24,6 +24,7 @@
 
 extern "C" {
 void dhcp_start(bool wait);
+void dhcp_wait();
 void dhcp_release();
 void dhcp_renew(bool wait);
 }
@@ -266,6 +267,8 @@ namespace dhcp {
         void init();
         // Send discover packets
         void start(bool wait);
+        // Wait for the IP after start(false)
+        void wait();
         // Send release packet for all DHCP IPs.
         void release();
         void renew(bool wait);
@@ -284,6 +287,7 @@ namespace dhcp {
         bool _have_ip;
         sched::thread * _waiter;
         void _send_and_wait(bool wait, dhcp_interface_state_send_packet iface_func);
+        bool _wait_for_ip();
     };
 
 } // namespace dhcp
@@ -108,14 +108,19 @@ struct hash<epoll_key> : private hash<int>, hash<file*> {
 }
 
 struct epoll_file;
+struct epoll_item;
 
 struct epoll_ptr {
     epoll_file* epoll;
     epoll_key key;
+    // the registration in the epoll; not part of the identity
+    epoll_item* item;
 };
 
 void epoll_wake(const epoll_ptr& ep);
 void epoll_wake_in_rcu(const epoll_ptr& ep);
+// Wake everything watching a file, but only one of the EPOLLEXCLUSIVE ones
+void epoll_wake_all(const std::vector<epoll_ptr>& eps);
 
 inline bool operator==(const epoll_ptr& p1, const epoll_ptr& p2) {
     return p1.epoll == p2.epoll && p1.key == p2.key;
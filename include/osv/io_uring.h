@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef OSV_IO_URING_H
+#define OSV_IO_URING_H
+
+// The io_uring ABI, as in Linux's <linux/io_uring.h>. Only what OSv
+// implements is defined here; applications keep using the Linux header
+// (usually through liburing) and the system calls.
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+struct io_uring_sqe {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t ioprio;
+    int32_t fd;
+    union {
+        uint64_t off;
+        uint64_t addr2;
+    };
+    uint64_t addr;
+    uint32_t len;
+    union {
+        int32_t rw_flags;
+        uint32_t fsync_flags;
+        uint16_t poll_events;
+        uint32_t poll32_events;
+        uint32_t msg_flags;
+        uint32_t timeout_flags;
+        uint32_t accept_flags;
+    };
+    uint64_t user_data;
+    uint64_t __pad2[3];
+};
+
+struct io_uring_cqe {
+    uint64_t user_data;
+    int32_t res;
+    uint32_t flags;
+};
+
+enum {
+    IORING_OP_NOP = 0,
+    IORING_OP_READV = 1,
+    IORING_OP_WRITEV = 2,
+    IORING_OP_FSYNC = 3,
+    IORING_OP_POLL_ADD = 6,
+    IORING_OP_TIMEOUT = 11,
+    IORING_OP_ACCEPT = 13,
+    IORING_OP_READ = 22,
+    IORING_OP_WRITE = 23,
+    IORING_OP_SEND = 26,
+    IORING_OP_RECV = 27,
+    IORING_OP_LAST = 28,
+};
+
+// sqe->flags
+#define IOSQE_FIXED_FILE        (1U << 0)
+#define IOSQE_IO_DRAIN          (1U << 1)
+#define IOSQE_IO_LINK           (1U << 2)
+#define IOSQE_IO_HARDLINK       (1U << 3)
+#define IOSQE_ASYNC             (1U << 4)
+
+// io_uring_setup() flags
+#define IORING_SETUP_IOPOLL     (1U << 0)
+#define IORING_SETUP_SQPOLL     (1U << 1)
+#define IORING_SETUP_SQ_AFF     (1U << 2)
+#define IORING_SETUP_CQSIZE     (1U << 3)
+#define IORING_SETUP_CLAMP      (1U << 4)
+
+#define IORING_FSYNC_DATASYNC   (1U << 0)
+#define IORING_TIMEOUT_ABS      (1U << 0)
+
+// mmap() offsets of the rings and the submission queue entries
+#define IORING_OFF_SQ_RING      0ULL
+#define IORING_OFF_CQ_RING      0x8000000ULL
+#define IORING_OFF_SQES         0x10000000ULL
+
+struct io_sqring_offsets {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t flags;
+    uint32_t dropped;
+    uint32_t array;
+    uint32_t resv1;
+    uint64_t resv2;
+};
+
+// sq_ring->flags
+#define IORING_SQ_NEED_WAKEUP   (1U << 0)
+#define IORING_SQ_CQ_OVERFLOW   (1U << 1)
+
+struct io_cqring_offsets {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t overflow;
+    uint32_t cqes;
+    uint32_t flags;
+    uint32_t resv1;
+    uint64_t resv2;
+};
+
+// io_uring_enter() flags
+#define IORING_ENTER_GETEVENTS  (1U << 0)
+#define IORING_ENTER_SQ_WAKEUP  (1U << 1)
+#define IORING_ENTER_SQ_WAIT    (1U << 2)
+
+struct io_uring_params {
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t flags;
+    uint32_t sq_thread_cpu;
+    uint32_t sq_thread_idle;
+    uint32_t features;
+    uint32_t wq_fd;
+    uint32_t resv[3];
+    struct io_sqring_offsets sq_off;
+    struct io_cqring_offsets cq_off;
+};
+
+// io_uring_params->features
+#define IORING_FEAT_SINGLE_MMAP     (1U << 0)
+#define IORING_FEAT_NODROP          (1U << 1)
+#define IORING_FEAT_SUBMIT_STABLE   (1U << 2)
+#define IORING_FEAT_RW_CUR_POS      (1U << 3)
+#define IORING_FEAT_POLL_32BITS     (1U << 6)
+
+// io_uring_register() opcodes
+enum {
+    IORING_REGISTER_EVENTFD = 4,
+    IORING_UNREGISTER_EVENTFD = 5,
+    IORING_REGISTER_PROBE = 8,
+};
+
+#define IO_URING_OP_SUPPORTED   (1U << 0)
+
+struct io_uring_probe_op {
+    uint8_t op;
+    uint8_t resv;
+    uint16_t flags;
+    uint32_t resv2;
+};
+
+struct io_uring_probe {
+    uint8_t last_op;
+    uint8_t ops_len;
+    uint16_t resv;
+    uint32_t resv2[3];
+    struct io_uring_probe_op ops[0];
+};
+
+int io_uring_setup(unsigned entries, struct io_uring_params *p);
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                   unsigned flags, const sigset_t *sig, size_t sigsz);
+int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args);
+
+__END_DECLS
+
+#endif /* OSV_IO_URING_H */
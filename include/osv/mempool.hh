@@ -11,6 +11,7 @@
 #include <cstdint>
 #include <functional>
 #include <list>
+#include <vector>
 #include <boost/intrusive/set.hpp>
 #include <boost/intrusive/list.hpp>
 #include <osv/mutex.h>
@@ -50,6 +51,10 @@ struct free_object {
     free_object* next;
 };
 
+namespace stats {
+    struct magazine_stats;
+}
+
 class pool {
 public:
     explicit pool(unsigned size);
@@ -57,20 +62,33 @@ public:
     void* alloc();
     void free(void* object);
     unsigned get_size();
+    void get_stats(stats::magazine_stats& stats);
     static pool* from_object(void* object);
     static void collect_garbage();
+    // Have every cpu give the objects cached in its magazines, and those in
+    // the depots, back to their pages, when memory runs low
+    static void reap();
 private:
     struct page_header;
+    struct magazine {
+        free_object* head;
+        unsigned rounds;
+    };
 private:
+    static void drain_all();
+    void drain();
     bool have_full_pages();
     void add_page();
+    void* alloc_from_pages();
     static page_header* to_header(free_object* object);
 
     // should get called with the preemption lock taken
     void free_same_cpu(free_object* obj, unsigned cpu_id);
     void free_different_cpu(free_object* obj, unsigned obj_cpu, unsigned cur_cpu);
+    void free_to_pages(magazine mag);
 private:
     unsigned _size;
+    unsigned _mag_rounds;
 
     struct page_header {
         pool* owner;
@@ -92,6 +110,28 @@ private:
     };
     // maintain a list of free pages percpu
     dynamic_percpu<free_list_type> _free;
+
+    // Magazine layer (Bonwick & Adams, "Magazines and Vmem"): freed objects
+    // are cached per cpu in chains of up to _mag_rounds objects, whichever
+    // cpu their page belongs to, and handed out again by alloc(). Full
+    // magazines move between cpus through the depot, so a cpu that only
+    // frees feeds a cpu that only allocates without going through the
+    // pages or the garbage collector. Only when the depot is full are
+    // objects given back to their pages.
+    struct cpu_cache {
+        magazine loaded;
+        magazine previous;
+        // statistics, see stats::magazine_stats
+        size_t alloc_hits;
+        size_t alloc_misses;
+        size_t depot_gets;
+        size_t depot_puts;
+        size_t flushes;
+        size_t remote_frees;
+    };
+    dynamic_percpu<cpu_cache> _cache;
+    static constexpr unsigned depot_size = 16;
+    boost::lockfree::stack<magazine, boost::lockfree::capacity<depot_size>> _depot;
 public:
     static const size_t max_object_size;
     static const size_t min_object_size;
@@ -109,6 +149,8 @@ struct page_range {
 
 void free_initial_memory_range(void* addr, size_t size);
 void enable_debug_allocator();
+// Re-file free memory per NUMA node once the topology was parsed
+void setup_numa_nodes();
 
 extern bool tracker_enabled;
 
@@ -216,6 +258,19 @@ namespace stats {
 
     void get_global_l2_stats(pool_stats &stats);
     void get_l1_stats(unsigned int cpu_id, stats::pool_stats &stats);
+
+    // Magazine layer counters of a malloc pool, summed over all cpus
+    struct magazine_stats {
+        size_t _size;           // object size
+        size_t _alloc_hits;     // allocations served from a magazine
+        size_t _alloc_misses;   // allocations served from the pool pages
+        size_t _depot_gets;     // full magazines taken from the depot
+        size_t _depot_puts;     // full magazines given to the depot
+        size_t _flushes;        // full magazines given back to the pages
+        size_t _remote_frees;   // objects queued to another cpu's collector
+    };
+
+    void get_malloc_pools_stats(std::vector<magazine_stats> &stats);
 }
 
 class phys_contiguous_memory final {
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef OSV_NUMA_HH_
+#define OSV_NUMA_HH_
+
+#include <osv/types.h>
+
+// NUMA topology of the machine, as described by the ACPI SRAT and SLIT
+// tables. Proximity domains are renumbered into dense node ids in order of
+// appearance. Without an SRAT everything belongs to node 0.
+namespace numa {
+
+constexpr unsigned max_nodes = 8;
+
+unsigned nr_nodes();
+
+// Node of a physical address; memory not described by the SRAT is node 0.
+unsigned phys_node(u64 paddr);
+
+// First address above paddr that may belong to a different node.
+u64 next_node_boundary(u64 paddr);
+
+// Node of a cpu, by its index in sched::cpus.
+unsigned cpu_node(unsigned cpu_id);
+
+// Nodes ordered by distance from 'node', 'node' itself first; the array
+// has nr_nodes() valid entries.
+const unsigned* fallback_order(unsigned node);
+
+// Used while parsing the firmware tables, before smp is up. Nothing is
+// visible through the functions above until setup_done(), which is called
+// by memory::setup_numa_nodes() once the page allocator is ready to re-file
+// its free memory per node.
+void add_memory(u32 domain, u64 base, u64 length);
+void add_cpu(u32 domain, u32 apic_id);
+void set_distance(u32 from_domain, u32 to_domain, u8 distance);
+void setup_done();
+
+}
+
+#endif /* OSV_NUMA_HH_ */
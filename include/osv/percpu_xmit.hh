@@ -2,6 +2,8 @@
 #define PERCPU_XMIT_HH_
 
 #include <atomic>
+#include <algorithm>
+#include <vector>
 #include <osv/nway_merger.hh>
 
 #include <osv/types.h>
@@ -189,6 +191,10 @@ private:
  *    consume packet descriptors from the per-CPU queue(s) and send them to
  *    the output iterator (which is responsible to ensure their successful
  *    sending to the HW channel).
+ *
+ * An xmitter may serve only a subset of the CPUs (e.g. one HW queue of a
+ * multiqueue device per CPU). Then xmit() may only be called from these CPUs
+ * and the caller has to hold the migration lock for the duration of the call.
  */
 template <class NetDevTxq, unsigned CpuTxqSize,
           class StopPollingPred, class XmitIterator>
@@ -209,12 +215,13 @@ private:
 public:
     explicit xmitter(NetDevTxq* txq,
                      StopPollingPred pred, XmitIterator& xmit_it,
-                     const std::string& name) :
-        _txq(txq), _stop_polling_pred(pred), _xmit_it(xmit_it),
+                     const std::string& name,
+                     const std::vector<sched::cpu*>& cpus = sched::cpus) :
+        _txq(txq), _stop_polling_pred(pred), _xmit_it(xmit_it), _cpus(cpus),
         _check_empty_queues(false) {
 
         std::string worker_name_base(name + "-");
-        for (auto c : sched::cpus) {
+        for (auto c : _cpus) {
             _cpuq.for_cpu(c)->reset(aligned_new<cpu_queue_type>());
             _all_cpuqs.push_back(_cpuq.for_cpu(c)->get());
 
@@ -228,11 +235,15 @@ public:
 
         /*
          * Initialize the "next worker thread" pointers.
-         * The worker of the last CPU points to the worker of the first CPU.
+         * The workers form a ring in topology order, so that a worker
+         * handing over the work wakes one sharing its cache if possible.
          */
-        worker_info *prev_cpu_worker =
-            _worker.for_cpu(sched::cpus[sched::cpus.size() - 1]);
-        for (auto c : sched::cpus) {
+        auto ring = sched::cpus_by_topology();
+        ring.erase(std::remove_if(ring.begin(), ring.end(), [this] (sched::cpu* c) {
+            return !_cpuq.for_cpu(c)->get();
+        }), ring.end());
+        worker_info *prev_cpu_worker = _worker.for_cpu(ring.back());
+        for (auto c : ring) {
             worker_info *cur_worker = _worker.for_cpu(c);
 
             prev_cpu_worker->next = cur_worker->me;
@@ -248,7 +259,7 @@ public:
      */
     void start()
     {
-        for (auto c : sched::cpus) {
+        for (auto c : _cpus) {
             _worker.for_cpu(c)->me->start();
         }
     }
@@ -353,7 +364,7 @@ private:
         const int qsize = _txq->qsize();
         int budget = qsize;
         auto start = osv::clock::uptime::now();
-        const bool smp = (sched::cpus.size() > 1);
+        const bool smp = (_cpus.size() > 1);
 
         //
         // Dispatcher holds the RUNNING lock all the time it doesn't sleep
@@ -458,7 +469,7 @@ lock:
     }
 
     void wake_waiters_all() {
-        for (auto c : sched::cpus) {
+        for (auto c : _cpus) {
             _cpuq.for_cpu(c)->get()->wake_waiters();
         }
     }
@@ -480,6 +491,7 @@ lock:
         sched::preempt_disable();
 
         cpu_queue_type* local_cpuq = _cpuq->get();
+        assert(local_cpuq);
         typename cpu_queue_type::value_type new_buff_desc = { get_ts(), cooky };
 
         while (!local_cpuq->push(new_buff_desc)) {
@@ -591,6 +603,8 @@ private:
     NetDevTxq* _txq; // Rename to _dev_txq
     StopPollingPred _stop_polling_pred;
     XmitIterator& _xmit_it;
+    // CPUs that transmit through this xmitter
+    std::vector<sched::cpu*> _cpus;
 
     // A collection of a per-CPU queues
     std::list<cpu_queue_type*> _all_cpuqs;
@@ -172,6 +172,8 @@ static inline file::timeout_t parse_poll_timeout(int timeout_ms)
 }
 
 int do_poll(std::vector<poll_file>& pfd, file::timeout_t _timeout);
+void poll_install(struct pollreq* p);
+void poll_uninstall(struct pollreq* p);
 void epoll_file_closed(epoll_ptr ptr);
 
 #endif
@@ -307,6 +307,16 @@ void rcu_hashtable<T, Hash>::resize(size_t new_size)
     auto p = _buckets.read_by_owner();
     _buckets.assign(n._buckets.read_by_owner());
     n._buckets.assign(nullptr);
+    // The elements were copied into the new buckets; readers may still be
+    // walking the old ones.
+    for (auto& b : *p) {
+        auto e = b.next.read_by_owner();
+        while (e) {
+            auto q = static_cast<element*>(e);
+            e = q->next.read_by_owner();
+            rcu_dispose(q);
+        }
+    }
     rcu_dispose(p);
 }
 
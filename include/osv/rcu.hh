@@ -135,6 +135,11 @@ public:
     // other assign() calls to the same objects.
     void assign(T* p);
     void assign(std::nullptr_t p);
+    // Update contents atomically, for mutators not serialized by a lock:
+    // exchange() returns the previous contents, and compare_exchange()
+    // updates them only if they are still 'expected'.
+    T* exchange(T* p);
+    bool compare_exchange(T* expected, T* p);
     // Access contents, must be called with exclusive access wrt.
     // mutator (i.e. in same context as assign().
     T* read_by_owner() const;
@@ -210,6 +215,21 @@ void rcu_ptr<T, Disposer>::assign(std::nullptr_t p)
     _ptr.store(p, std::memory_order_relaxed);
 }
 
+template <typename T, typename Disposer>
+inline
+T* rcu_ptr<T, Disposer>::exchange(T* p)
+{
+    return _ptr.exchange(p, std::memory_order_acq_rel);
+}
+
+template <typename T, typename Disposer>
+inline
+bool rcu_ptr<T, Disposer>::compare_exchange(T* expected, T* p)
+{
+    return _ptr.compare_exchange_strong(expected, p, std::memory_order_acq_rel,
+                                        std::memory_order_relaxed);
+}
+
 template <typename T, typename Disposer>
 inline
 rcu_ptr<T, Disposer>::operator bool() const
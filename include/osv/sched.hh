@@ -938,6 +938,16 @@ public:
     }
 };
 
+// How close two cpus are. Work is preferably moved between cpus sharing
+// a core or a last level cache, to keep it on warm caches.
+enum class domain : unsigned {
+    smt,        // hyperthreads of the same core
+    llc,        // sharing the last level cache
+    node,       // on the same NUMA node
+    system,     // anywhere else
+};
+constexpr unsigned nr_domains = unsigned(domain::system) + 1;
+
 typedef bi::rbtree<thread,
                    bi::member_hook<thread,
                                    bi::set_member_hook<>,
@@ -968,7 +978,27 @@ struct cpu : private timer_base::client {
     incoming_wakeup_queue* incoming_wakeups;
     thread* terminating_thread;
     osv::clock::uptime::time_point running_since;
+    // The thread this cpu runs. Only ever compared, never dereferenced,
+    // by lock() deciding whether a mutex holder is worth spinning for.
+    std::atomic<thread*> running_thread = { nullptr };
     char* percpu_base;
+    // Scheduling domains: the other cpus grouped by what they share with
+    // this one, nearest first. Each cpu appears in exactly one level.
+    std::array<std::vector<cpu*>, nr_domains> domains;
+    // Idle-time work stealing: an idle cpu sets its bit in a loaded cpu's
+    // steal_requests, and that cpu pushes it some of its queued threads the
+    // next time it reschedules.
+    cpu_set steal_requests;
+    // Set by a cpu that had nothing it could give away: idle cpus don't
+    // ask it again before then (uptime in nanoseconds).
+    std::atomic<s64> steal_backoff_until = {0};
+    struct steal_counters {
+        u64 requests = 0;               // requests sent while idle
+        u64 pushed = 0;                 // threads handed to idle cpus
+        u64 wake_forwards = 0;          // woken threads sent to idle siblings
+        std::atomic<u64> stolen = {0};  // threads received from other cpus
+    };
+    steal_counters steals;
     static cpu* current();
     void init_on_cpu();
     static void schedule();
@@ -979,6 +1009,12 @@ struct cpu : private timer_base::client {
     void idle_poll_start();
     void idle_poll_end();
     void send_wakeup_ipi();
+    bool steal_work();
+    void handle_steal_requests();
+    void init_domains();
+    domain domain_of(const cpu* other) const;
+    cpu* idle_sibling();
+    bool forward_wakeup(thread& t);
     void load_balance();
     unsigned load();
     /**
@@ -1483,6 +1519,10 @@ timer::timer(thread& t)
 
 extern std::vector<cpu*> cpus;
 
+// sched::cpus ordered so that cpus sharing a core, a last level cache or a
+// NUMA node are next to each other.
+std::vector<cpu*> cpus_by_topology();
+
 inline void migrate_disable()
 {
     thread::current()->_migration_lock_counter++;
@@ -11,6 +11,9 @@
 #include <osv/file.h>
 #include <memory>
 
+#define __NEED_socklen_t
+#include <bits/alltypes.h>
+
 struct socket;
 struct socket_closer;
 
@@ -22,6 +25,15 @@ struct socket_closer {
 
 using socketref = std::unique_ptr<socket, socket_closer>;
 
+struct msghdr;
+
+// sendmsg(), recvmsg() and accept4() on a file the caller holds a reference
+// on, for callers which must not look its descriptor up again. They take
+// Linux flags, and return an error number.
+int sendmsg_file(file* fp, const struct msghdr* msg, int flags, ssize_t* bytes);
+int recvmsg_file(file* fp, struct msghdr* msg, int flags, ssize_t* bytes);
+int accept4_file(file* fp, void* addr, socklen_t* len, int flags, int* out_fd);
+
 class socket_file final : public file {
 public:
     socket_file(unsigned flags, socket* so);
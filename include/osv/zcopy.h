@@ -1,6 +1,8 @@
 #ifndef _ZCOPY_H
 #define _ZCOPY_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -10,6 +12,18 @@ struct zmsghdr {
     int zm_txfd;
     void *zm_txhandle;
     void *zm_rxhandle;
+    uint32_t zm_txseq;
+};
+
+/*
+ * A range of completed zero-copy sends, inclusive on both ends.
+ * Sequence numbers are assigned per socket, in the order of zcopy_tx()
+ * calls, starting from 0 and wrapping around at 2^32. A call which fails
+ * without queueing anything completes its number at once.
+ */
+struct zcopy_range {
+    uint32_t zr_lo;
+    uint32_t zr_hi;
 };
 
 ssize_t zcopy_tx(int sockfd, struct zmsghdr *zm);
@@ -17,6 +31,17 @@ void zcopy_txclose(struct zmsghdr *zm);
 ssize_t zcopy_rx(int sockfd, struct zmsghdr *zm);
 int zcopy_rxgc(struct zmsghdr *zm);
 
+/*
+ * Attach a completion ring to the socket. Once attached, zcopy_tx() no
+ * longer creates an eventfd per send: it stores the sequence number of the
+ * send in zm_txseq and the returned eventfd (owned by the socket, do not
+ * close it) is signalled when the ring goes from empty to non-empty.
+ * zcopy_txreap() then returns the coalesced ranges of completed sends;
+ * callers should reap until it returns 0 before polling again.
+ */
+int zcopy_txring_open(int sockfd);
+ssize_t zcopy_txreap(int sockfd, struct zcopy_range *ranges, size_t nranges);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,11 +1,57 @@
 #ifndef _ZCOPY_HH
 #define _ZCOPY_HH
 
+#include <atomic>
+#include <vector>
+#include <osv/mutex.h>
 #include <osv/zcopy.h>
 
+struct file;
+struct zcopy_txring;
+
 struct ztx_handle {
-    ztx_handle() : zh_remained(0) {};
+    ztx_handle() : zh_remained(0), zh_ring(nullptr), zh_seq(0), zh_fd(-1),
+        zh_done(nullptr), zh_arg(nullptr) {};
     std::atomic<size_t> zh_remained;
+    zcopy_txring *zh_ring;  // completion ring, or nullptr to signal zh_fd
+    uint32_t zh_seq;
+    int zh_fd;
+    void (*zh_done)(void *);  // kernel sends: called instead of signalling
+    void *zh_arg;
+};
+
+// Per-socket ring of completed zero-copy sends. Completions of consecutive
+// sends are merged into a single range, so an application keeping many
+// sends in flight reaps them all with one zcopy_txreap() call.
+struct zcopy_txring {
+    explicit zcopy_txring(int fd);
+    ~zcopy_txring();
+    mutex zr_mtx;
+    std::atomic<unsigned> zr_refs;  // the socket plus one per pending send
+    std::atomic<uint32_t> zr_next;  // sequence number of the next send
+    int zr_fd;
+    std::vector<zcopy_range> zr_ranges;
 };
 
+// Handles are recycled through a bounded lock-free cache instead of
+// going through malloc for every send.
+ztx_handle *ztx_handle_alloc();
+void ztx_handle_free(ztx_handle *zh);
+void ztx_handle_release(ztx_handle *zh, size_t len);
+
+void zcopy_txring_complete(zcopy_txring *zr, uint32_t seq);
+void zcopy_txring_put(zcopy_txring *zr);
+
+// Send 'len' bytes at 'base' on a stream socket straight out of that
+// memory, for sendfile(). done(arg) is called exactly once, whatever the
+// outcome, once no mbuf references the memory anymore: possibly from the
+// network stack long after the call returns, or before it returns if
+// nothing was queued. Returns the bytes queued, or -1 with errno set;
+// EOPNOTSUPP means the socket isn't a stream socket.
+ssize_t zcopy_sendpages(int s, void *base, size_t len,
+                        void (*done)(void *), void *arg);
+// The same on a file the caller holds a reference to.
+ssize_t zcopy_sendpages_file(struct file *fp, void *base, size_t len,
+                             void (*done)(void *), void *arg);
+
 #endif
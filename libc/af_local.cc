@@ -5,40 +5,319 @@
  * BSD license as described in the LICENSE file in the top-level directory.
  */
 
+// Unix-domain sockets. Stream sockets are a pair of pipe buffers; datagram
+// and seqpacket sockets pass whole messages through a message queue. Names
+// live in a table of their own: an abstract name directly, and a path name
+// by the identity of the socket file bind() creates for it.
+//
+// Everything runs in one address space, so a message sent to a socket
+// whose reader is already blocked in recvmsg() is copied straight from the
+// sender's buffers to the receiver's, without going through the queue.
+
 #include "af_local.h"
 #include "pipe_buffer.hh"
 
 #include <fs/fs.hh>
 #include <osv/socket.hh>
 #include <osv/fcntl.h>
+#include <osv/poll.h>
 #include <libc/libc.hh>
 
 #include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <string.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <sys/poll.h>
 #include <utility>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <deque>
+#include <memory>
+#include <unordered_map>
 #include <sys/ioctl.h>
 
 #include <osv/stubbing.hh>
 
-using namespace std;
+// Walks an iovec array without modifying it.
+struct iov_cursor {
+    const struct iovec* iov;
+    int cnt;
+    int i = 0;
+    size_t off = 0;
+    iov_cursor(const struct iovec* iov, int cnt) : iov(iov), cnt(cnt) { }
+    // Returns the next contiguous piece, of at most n bytes.
+    std::pair<char*, size_t> next(size_t n) {
+        while (i < cnt && off == iov[i].iov_len) {
+            i++;
+            off = 0;
+        }
+        if (i == cnt) {
+            return { nullptr, 0 };
+        }
+        auto len = std::min(n, iov[i].iov_len - off);
+        auto p = static_cast<char*>(iov[i].iov_base) + off;
+        off += len;
+        return { p, len };
+    }
+};
+
+static size_t copy_to_iov(iov_cursor& c, const char* p, size_t n)
+{
+    size_t done = 0;
+    while (done < n) {
+        auto piece = c.next(n - done);
+        if (!piece.second) {
+            break;
+        }
+        memcpy(piece.first, p + done, piece.second);
+        done += piece.second;
+    }
+    return done;
+}
+
+static size_t copy_from_iov(iov_cursor& c, char* p, size_t n)
+{
+    size_t done = 0;
+    while (done < n) {
+        auto piece = c.next(n - done);
+        if (!piece.second) {
+            break;
+        }
+        memcpy(p + done, piece.first, piece.second);
+        done += piece.second;
+    }
+    return done;
+}
+
+// A receiver blocked in recvmsg(), which a sender fills directly.
+struct msg_waiter {
+    msg_waiter(const struct iovec* iov, int iovcnt) : to(iov, iovcnt) { }
+    iov_cursor to;
+    size_t len = 0;
+    bool done = false;
+    std::string from;
+};
+
+struct af_local_msg {
+    std::vector<char> data;
+    std::string from;
+};
+
+// The receive queue of a datagram or seqpacket socket.
+struct msg_queue {
+    static constexpr size_t max_bytes = 212992;
+    mutex mtx;
+    condvar readable;
+    condvar writable;
+    std::deque<af_local_msg> q;
+    std::deque<msg_waiter*> waiters;
+    size_t bytes = 0;
+    // The socket reading from the queue, and for a connected socket the
+    // one writing to it, to wake up on poll.
+    file* reader = nullptr;
+    file* writer = nullptr;
+    // No more messages will come (the connected peer is gone).
+    bool eof = false;
+    int send(const struct iovec* iov, int iovcnt, size_t len, const std::string& from,
+             bool nonblock);
+    int recv(const struct iovec* iov, int iovcnt, size_t resid, int flags,
+             bool nonblock, size_t* len, std::string* from);
+};
+
+typedef std::shared_ptr<msg_queue> msg_queue_ref;
+
+int msg_queue::send(const struct iovec* iov, int iovcnt, size_t len,
+                    const std::string& from, bool nonblock)
+{
+    if (len > max_bytes) {
+        return EMSGSIZE;
+    }
+    iov_cursor c(iov, iovcnt);
+    WITH_LOCK(mtx) {
+        if (!reader) {
+            return writer ? EPIPE : ECONNREFUSED;
+        }
+        if (q.empty() && !waiters.empty()) {
+            auto w = waiters.front();
+            waiters.pop_front();
+            size_t done = 0;
+            while (done < len) {
+                auto piece = c.next(len - done);
+                auto n = copy_to_iov(w->to, piece.first, piece.second);
+                done += piece.second;
+                if (!piece.second || n < piece.second) {
+                    break;
+                }
+            }
+            w->len = len;
+            w->from = from;
+            w->done = true;
+            readable.wake_all();
+            return 0;
+        }
+        while (reader && bytes + len > max_bytes) {
+            if (nonblock) {
+                return EAGAIN;
+            }
+            writable.wait(&mtx);
+        }
+        if (!reader) {
+            return writer ? EPIPE : ECONNREFUSED;
+        }
+        af_local_msg m;
+        m.data.resize(len);
+        copy_from_iov(c, m.data.data(), len);
+        m.from = from;
+        q.push_back(std::move(m));
+        bytes += len;
+        poll_wake(reader, POLLIN | POLLRDNORM);
+        readable.wake_all();
+    }
+    return 0;
+}
+
+// Receives one message into the buffers. *len is set to the message's full
+// length, which is more than resid if it was truncated, and 0 at the end of
+// a connection.
+int msg_queue::recv(const struct iovec* iov, int iovcnt, size_t resid, int flags,
+                    bool nonblock, size_t* len, std::string* from)
+{
+    WITH_LOCK(mtx) {
+        if (q.empty() && !eof && !nonblock && !(flags & MSG_PEEK)) {
+            msg_waiter w(iov, iovcnt);
+            waiters.push_back(&w);
+            while (!w.done && q.empty() && !eof) {
+                readable.wait(&mtx);
+            }
+            if (w.done) {
+                *len = w.len;
+                *from = std::move(w.from);
+                return 0;
+            }
+            waiters.erase(std::find(waiters.begin(), waiters.end(), &w));
+        }
+        while (q.empty()) {
+            if (eof) {
+                *len = 0;
+                return 0;
+            }
+            if (nonblock) {
+                return EAGAIN;
+            }
+            readable.wait(&mtx);
+        }
+        auto& m = q.front();
+        iov_cursor c(iov, iovcnt);
+        copy_to_iov(c, m.data.data(), std::min(resid, m.data.size()));
+        *len = m.data.size();
+        *from = m.from;
+        if (!(flags & MSG_PEEK)) {
+            bytes -= m.data.size();
+            q.pop_front();
+            poll_wake(writer, POLLOUT | POLLWRNORM);
+            writable.wake_all();
+        }
+    }
+    return 0;
+}
+
+struct af_local;
+
+// A name given to a socket with bind(). Stream and seqpacket sockets
+// accept connections on it after listen(); datagrams sent to it go to the
+// bound socket's queue.
+struct af_local_endpoint {
+    int type;
+    std::string name;
+    std::string key;
+    msg_queue_ref rq;
+    mutex mtx;
+    condvar may_accept;
+    condvar may_connect;
+    std::deque<fileref> pending;
+    int backlog = 0;
+    file* listener = nullptr;
+};
+
+typedef std::shared_ptr<af_local_endpoint> endpoint_ref;
+
+static mutex names_lock;
+static std::unordered_map<std::string, endpoint_ref> names;
 
 struct af_local final : public special_file {
+    explicit af_local(int type)
+            : special_file(FREAD|FWRITE, DTYPE_UNSPEC), type(type) { }
     af_local(const pipe_buffer_ref& s, const pipe_buffer_ref& r)
-            : special_file(FREAD|FWRITE, DTYPE_UNSPEC), send(s), receive(r) { init(); }
+            : special_file(FREAD|FWRITE, DTYPE_UNSPEC), type(SOCK_STREAM) { connect_stream(s, r); }
     af_local(pipe_buffer_ref&& s, pipe_buffer_ref&& r)
-            : special_file(FREAD|FWRITE, DTYPE_UNSPEC), send(std::move(s)), receive(std::move(r)) { init(); }
-    void init();
+            : special_file(FREAD|FWRITE, DTYPE_UNSPEC), type(SOCK_STREAM) { connect_stream(s, r); }
+    void connect_stream(const pipe_buffer_ref& s, const pipe_buffer_ref& r);
+    void connect_msg(const msg_queue_ref& r, const msg_queue_ref& p);
     virtual int ioctl(u_long com, void *data) override;
     virtual int read(uio* data, int flags) override;
     virtual int write(uio* data, int flags) override;
     virtual int poll(int events) override;
     virtual int close() override;
 
+    int sendmsg(const struct msghdr* msg, int flags, size_t* bytes);
+    int recvmsg(struct msghdr* msg, int flags, size_t* bytes);
+
+    // The peer's queue, and our name to send from
+    msg_queue_ref get_peer_q(std::string* from = nullptr) {
+        WITH_LOCK(mtx) {
+            if (from) {
+                *from = name;
+            }
+            return peer_q;
+        }
+    }
+
+    int type;
+    // Guards the state below against concurrent bind() and connect().
+    // connected is set last, so once it is seen the stream buffers and the
+    // seqpacket queues, which never change again, may be used without it.
+    mutex mtx;
+    // SOCK_STREAM, once connected
     pipe_buffer_ref send;
     pipe_buffer_ref receive;
+    // SOCK_DGRAM (always) and SOCK_SEQPACKET (once connected): our queue,
+    // and the peer's
+    msg_queue_ref rq;
+    msg_queue_ref peer_q;
+    // Bound to a name, or listening
+    endpoint_ref ep;
+    std::string name;
+    std::string peer_name;
+    std::atomic<bool> connected {false};
 };
 
+void af_local::connect_stream(const pipe_buffer_ref& s, const pipe_buffer_ref& r)
+{
+    send = s;
+    receive = r;
+    send->attach_sender(this);
+    send->set_no_receiver_event(POLLRDHUP);
+    receive->attach_receiver(this);
+    connected.store(true, std::memory_order_release);
+}
+
+void af_local::connect_msg(const msg_queue_ref& r, const msg_queue_ref& p)
+{
+    rq = r;
+    WITH_LOCK(rq->mtx) {
+        rq->reader = this;
+    }
+    peer_q = p;
+    WITH_LOCK(peer_q->mtx) {
+        peer_q->writer = this;
+    }
+    connected.store(true, std::memory_order_release);
+}
+
 int af_local::ioctl(u_long cmd, void *data)
 {
     int error = ENOTTY;
@@ -62,26 +341,95 @@ int af_local::ioctl(u_long cmd, void *data)
     return error;
 }
 
-void af_local::init()
-{
-    send->attach_sender(this);
-    send->set_no_receiver_event(POLLRDHUP);
-    receive->attach_receiver(this);
-}
-
 int af_local::read(uio* data, int flags)
 {
-    return receive->read(data, is_nonblock(this));
+    if (type == SOCK_STREAM) {
+        if (!connected) {
+            return ENOTCONN;
+        }
+        return receive->read(data, is_nonblock(this));
+    }
+    if (type == SOCK_SEQPACKET && !connected) {
+        return ENOTCONN;
+    }
+    size_t len;
+    std::string from;
+    auto resid = data->uio_resid;
+    auto error = rq->recv(data->uio_iov, data->uio_iovcnt, resid, 0,
+                          is_nonblock(this), &len, &from);
+    if (!error) {
+        data->uio_resid -= std::min<size_t>(len, resid);
+    }
+    return error;
 }
 
 int af_local::write(uio* data, int flags)
 {
-    return send->write(data, is_nonblock(this));
+    if (type == SOCK_STREAM) {
+        if (!connected) {
+            return ENOTCONN;
+        }
+        return send->write(data, is_nonblock(this));
+    }
+    std::string from;
+    auto q = get_peer_q(&from);
+    if (!q) {
+        return type == SOCK_DGRAM ? EDESTADDRREQ : ENOTCONN;
+    }
+    auto error = q->send(data->uio_iov, data->uio_iovcnt, data->uio_resid,
+                         from, is_nonblock(this));
+    if (!error) {
+        data->uio_resid = 0;
+    }
+    return error;
 }
 
 int af_local::poll(int events)
 {
-    return (receive->read_events() | send->write_events()) & events;
+    int ret = 0;
+    if (type == SOCK_STREAM && connected) {
+        ret = receive->read_events() | send->write_events();
+        return ret & events;
+    }
+    endpoint_ref ep;
+    msg_queue_ref rq, peer_q;
+    WITH_LOCK(mtx) {
+        ep = this->ep;
+        rq = this->rq;
+        peer_q = this->peer_q;
+    }
+    if (type == SOCK_STREAM) {
+        if (ep) {
+            WITH_LOCK(ep->mtx) {
+                ret = ep->pending.empty() ? 0 : POLLIN;
+            }
+        }
+        return ret & events;
+    }
+    if (ep && ep->listener) {
+        WITH_LOCK(ep->mtx) {
+            ret = ep->pending.empty() ? 0 : POLLIN;
+        }
+        return ret & events;
+    }
+    if (rq) {
+        WITH_LOCK(rq->mtx) {
+            ret |= rq->q.empty() ? 0 : POLLIN;
+            ret |= rq->eof ? (POLLIN | POLLRDHUP | POLLHUP) : 0;
+        }
+    }
+    if (peer_q) {
+        WITH_LOCK(peer_q->mtx) {
+            if (!peer_q->reader) {
+                ret |= POLLERR | POLLOUT;
+            } else if (peer_q->bytes < msg_queue::max_bytes) {
+                ret |= POLLOUT;
+            }
+        }
+    } else if (type == SOCK_DGRAM) {
+        ret |= POLLOUT;
+    }
+    return ret & events;
 }
 
 int af_local::close()
@@ -94,18 +442,576 @@ int af_local::close()
     }
     send.reset();
     receive.reset();
+    if (rq) {
+        WITH_LOCK(rq->mtx) {
+            rq->reader = nullptr;
+            rq->q.clear();
+            rq->bytes = 0;
+            rq->writable.wake_all();
+            if (rq->writer) {
+                poll_wake(rq->writer, POLLERR | POLLOUT);
+            }
+        }
+    }
+    if (peer_q && connected) {
+        WITH_LOCK(peer_q->mtx) {
+            peer_q->writer = nullptr;
+            peer_q->eof = true;
+            peer_q->readable.wake_all();
+            if (peer_q->reader) {
+                poll_wake(peer_q->reader, POLLIN | POLLRDHUP | POLLHUP);
+            }
+        }
+    }
+    rq.reset();
+    peer_q.reset();
+    if (ep) {
+        WITH_LOCK(names_lock) {
+            auto i = names.find(ep->key);
+            if (i != names.end() && i->second == ep) {
+                names.erase(i);
+            }
+        }
+        std::deque<fileref> pending;
+        WITH_LOCK(ep->mtx) {
+            ep->listener = nullptr;
+            pending.swap(ep->pending);
+            ep->may_connect.wake_all();
+            ep->may_accept.wake_all();
+        }
+        ep.reset();
+    }
+    return 0;
+}
+
+static af_local* af_local_from_fd(int fd, fileref& fr)
+{
+    fr = fileref_from_fd(fd);
+    return fr ? dynamic_cast<af_local*>(fr.get()) : nullptr;
+}
+
+// Parse a sockaddr_un into the name to report (sun_path as given) and the
+// key to the names table. bind() first creates the socket file for a path
+// name; it is found again by its device and inode.
+static int af_local_name(const void* addr, socklen_t len, bool create,
+                         std::string* name, std::string* key)
+{
+    auto sun = static_cast<const struct sockaddr_un*>(addr);
+    auto off = offsetof(struct sockaddr_un, sun_path);
+    if (!addr || len <= off || len > sizeof(*sun) || sun->sun_family != AF_UNIX) {
+        return EINVAL;
+    }
+    if (sun->sun_path[0] == '\0') {
+        *name = std::string(sun->sun_path, len - off);
+        *key = *name;
+        return 0;
+    }
+    *name = std::string(sun->sun_path, strnlen(sun->sun_path, len - off));
+    if (create && mknod(name->c_str(), S_IFSOCK | 0777, 0) < 0) {
+        return errno == EEXIST ? EADDRINUSE : errno;
+    }
+    struct stat st;
+    if (stat(name->c_str(), &st) < 0) {
+        return errno;
+    }
+    *key = "/" + std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino);
+    return 0;
+}
+
+static void af_local_addr(const std::string& name, void* addr, socklen_t* len)
+{
+    if (!addr || !len) {
+        return;
+    }
+    struct sockaddr_un sun = {};
+    sun.sun_family = AF_UNIX;
+    auto n = std::min(name.size(), sizeof(sun.sun_path));
+    memcpy(sun.sun_path, name.data(), n);
+    // Path names get their terminating null if it fits
+    socklen_t full = offsetof(struct sockaddr_un, sun_path) + n +
+        (n && name[0] && n < sizeof(sun.sun_path) ? 1 : 0);
+    memcpy(addr, &sun, std::min(*len, full));
+    *len = full;
+}
+
+// Like Linux, a name bound by a socket of another type is not found.
+static endpoint_ref af_local_lookup(const void* addr, socklen_t len, int type,
+                                    int* error)
+{
+    std::string name, key;
+    *error = af_local_name(addr, len, false, &name, &key);
+    if (*error) {
+        return nullptr;
+    }
+    WITH_LOCK(names_lock) {
+        auto i = names.find(key);
+        if (i != names.end() && i->second->type == type) {
+            return i->second;
+        }
+    }
+    *error = ECONNREFUSED;
+    return nullptr;
+}
+
+int af_local::sendmsg(const struct msghdr* msg, int flags, size_t* bytes)
+{
+    size_t len = 0;
+    for (int i = 0; i < (int)msg->msg_iovlen; i++) {
+        len += msg->msg_iov[i].iov_len;
+    }
+    bool nonblock = is_nonblock(this) || (flags & MSG_DONTWAIT);
+    if (type == SOCK_STREAM) {
+        if (!connected) {
+            return ENOTCONN;
+        }
+        std::vector<iovec> iov(msg->msg_iov, msg->msg_iov + msg->msg_iovlen);
+        struct uio data = {};
+        data.uio_iov = iov.data();
+        data.uio_iovcnt = iov.size();
+        data.uio_resid = len;
+        data.uio_rw = UIO_WRITE;
+        auto error = send->write(&data, nonblock);
+        *bytes = len - data.uio_resid;
+        return *bytes ? 0 : error;
+    }
+    std::string from;
+    msg_queue_ref q = get_peer_q(&from);
+    if (msg->msg_name && type == SOCK_DGRAM) {
+        int error;
+        auto target = af_local_lookup(msg->msg_name, msg->msg_namelen, type, &error);
+        if (!target) {
+            return error;
+        }
+        q = target->rq;
+    } else if (msg->msg_name && connected) {
+        return EISCONN;
+    }
+    if (!q) {
+        return type == SOCK_DGRAM ? EDESTADDRREQ : ENOTCONN;
+    }
+    auto error = q->send(msg->msg_iov, msg->msg_iovlen, len, from, nonblock);
+    *bytes = error ? 0 : len;
+    return error;
+}
+
+int af_local::recvmsg(struct msghdr* msg, int flags, size_t* bytes)
+{
+    size_t resid = 0;
+    for (int i = 0; i < (int)msg->msg_iovlen; i++) {
+        resid += msg->msg_iov[i].iov_len;
+    }
+    bool nonblock = is_nonblock(this) || (flags & MSG_DONTWAIT);
+    msg->msg_controllen = 0;
+    msg->msg_flags = 0;
+    if (type == SOCK_STREAM) {
+        if (!connected) {
+            return ENOTCONN;
+        }
+        std::vector<iovec> iov(msg->msg_iov, msg->msg_iov + msg->msg_iovlen);
+        struct uio data = {};
+        data.uio_iov = iov.data();
+        data.uio_iovcnt = iov.size();
+        data.uio_resid = resid;
+        data.uio_rw = UIO_READ;
+        auto error = receive->read(&data, nonblock);
+        *bytes = resid - data.uio_resid;
+        if (!error) {
+            af_local_addr(peer_name, msg->msg_name, &msg->msg_namelen);
+        }
+        return error;
+    }
+    if (type == SOCK_SEQPACKET && !connected) {
+        return ENOTCONN;
+    }
+    size_t len;
+    std::string from;
+    auto error = rq->recv(msg->msg_iov, msg->msg_iovlen, resid, flags, nonblock,
+                          &len, &from);
+    if (error) {
+        return error;
+    }
+    if (len > resid) {
+        msg->msg_flags |= MSG_TRUNC;
+    }
+    *bytes = (flags & MSG_TRUNC) ? len : std::min(len, resid);
+    af_local_addr(from, msg->msg_name, &msg->msg_namelen);
+    return 0;
+}
+
+int socket_af_local(int type, int proto, int* fd)
+{
+    int flags = type & (SOCK_NONBLOCK | SOCK_CLOEXEC);
+    type &= ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (type != SOCK_STREAM && type != SOCK_DGRAM && type != SOCK_SEQPACKET) {
+        return EPROTOTYPE;
+    }
+    if (proto != 0) {
+        return EPROTONOSUPPORT;
+    }
+    try {
+        auto f = make_file<af_local>(type);
+        auto s = static_cast<af_local*>(f.get());
+        if (type == SOCK_DGRAM) {
+            s->rq = std::make_shared<msg_queue>();
+            s->rq->reader = s;
+        }
+        if (flags & SOCK_NONBLOCK) {
+            f->f_flags |= FNONBLOCK;
+        }
+        fdesc fd1(f);
+        *fd = fd1.release();
+        return 0;
+    } catch (int error) {
+        return error;
+    }
+}
+
+int bind_af_local(int fd, const void* addr, socklen_t len)
+{
+    fileref fr;
+    auto s = af_local_from_fd(fd, fr);
+    if (!s) {
+        return ENOTSOCK;
+    }
+    SCOPE_LOCK(s->mtx);
+    if (s->ep || s->connected) {
+        return EINVAL;
+    }
+    auto ep = std::make_shared<af_local_endpoint>();
+    auto error = af_local_name(addr, len, true, &ep->name, &ep->key);
+    if (error) {
+        return error;
+    }
+    ep->type = s->type;
+    ep->rq = s->rq;
+    WITH_LOCK(names_lock) {
+        // A path's socket file was just created, so an entry with the same
+        // key belongs to a socket whose file has since been removed.
+        auto& e = names[ep->key];
+        if (e && ep->key[0] == '\0') {
+            return EADDRINUSE;
+        }
+        e = ep;
+    }
+    s->ep = ep;
+    s->name = ep->name;
+    return 0;
+}
+
+int listen_af_local(int fd, int backlog)
+{
+    fileref fr;
+    auto s = af_local_from_fd(fd, fr);
+    if (!s) {
+        return ENOTSOCK;
+    }
+    if (s->type == SOCK_DGRAM) {
+        return EOPNOTSUPP;
+    }
+    SCOPE_LOCK(s->mtx);
+    if (!s->ep || s->connected) {
+        return EINVAL;
+    }
+    WITH_LOCK(s->ep->mtx) {
+        s->ep->backlog = std::max(backlog, 1);
+        s->ep->listener = s;
+        s->ep->may_connect.wake_all();
+    }
+    return 0;
+}
+
+int connect_af_local(int fd, const void* addr, socklen_t len)
+{
+    fileref fr;
+    auto s = af_local_from_fd(fd, fr);
+    if (!s) {
+        return ENOTSOCK;
+    }
+    int error;
+    auto ep = af_local_lookup(addr, len, s->type, &error);
+    if (!ep) {
+        return error;
+    }
+    SCOPE_LOCK(s->mtx);
+    if (s->type == SOCK_DGRAM) {
+        // Just sets the default destination
+        s->peer_q = ep->rq;
+        s->peer_name = ep->name;
+        return 0;
+    }
+    if (s->connected) {
+        return EISCONN;
+    }
+
+    // Wait for room in the backlog, then build the accepting end and
+    // connect ours to it before it's visible to accept(), so the peer never
+    // sees a half-made connection.
+    bool nonblock = is_nonblock(s);
+    WITH_LOCK(ep->mtx) {
+        while (ep->listener && ep->pending.size() >= (size_t)ep->backlog) {
+            if (nonblock) {
+                return EAGAIN;
+            }
+            ep->may_connect.wait(&ep->mtx);
+        }
+        if (!ep->listener) {
+            return ECONNREFUSED;
+        }
+        fileref peer;
+        try {
+            peer = make_file<af_local>(s->type);
+        } catch (int error) {
+            return error;
+        }
+        auto p = static_cast<af_local*>(peer.get());
+        p->name = ep->name;
+        p->peer_name = s->name;
+        s->peer_name = ep->name;
+        if (s->type == SOCK_STREAM) {
+            pipe_buffer_ref b1{new pipe_buffer};
+            pipe_buffer_ref b2{new pipe_buffer};
+            s->connect_stream(b1, b2);
+            p->connect_stream(b2, b1);
+        } else {
+            auto q1 = std::make_shared<msg_queue>();
+            auto q2 = std::make_shared<msg_queue>();
+            s->connect_msg(q1, q2);
+            p->connect_msg(q2, q1);
+        }
+        ep->pending.push_back(peer);
+        poll_wake(ep->listener, POLLIN | POLLRDNORM);
+        ep->may_accept.wake_all();
+    }
+    return 0;
+}
+
+int accept_af_local(int fd, void* addr, socklen_t* len, int flags, int* out)
+{
+    fileref fr = fileref_from_fd(fd);
+    return fr ? accept_af_local_file(fr.get(), addr, len, flags, out) : ENOTSOCK;
+}
+
+int accept_af_local_file(struct file* fp, void* addr, socklen_t* len, int flags,
+                         int* out)
+{
+    auto s = dynamic_cast<af_local*>(fp);
+    if (!s) {
+        return ENOTSOCK;
+    }
+    if (s->type == SOCK_DGRAM) {
+        return EOPNOTSUPP;
+    }
+    endpoint_ref ep;
+    WITH_LOCK(s->mtx) {
+        ep = s->ep;
+    }
+    if (!ep) {
+        return EINVAL;
+    }
+    fileref f;
+    WITH_LOCK(ep->mtx) {
+        if (!ep->listener) {
+            return EINVAL;
+        }
+        while (ep->pending.empty() && ep->listener) {
+            if (is_nonblock(s)) {
+                return EAGAIN;
+            }
+            ep->may_accept.wait(&ep->mtx);
+        }
+        if (ep->pending.empty()) {
+            return EINVAL;
+        }
+        f = std::move(ep->pending.front());
+        ep->pending.pop_front();
+        ep->may_connect.wake_all();
+    }
+    if (flags & SOCK_NONBLOCK) {
+        f->f_flags |= FNONBLOCK;
+    }
+    try {
+        fdesc fd1(f);
+        af_local_addr(static_cast<af_local*>(f.get())->peer_name, addr, len);
+        *out = fd1.release();
+        return 0;
+    } catch (int error) {
+        return error;
+    }
+}
+
+int getsockname_af_local(int fd, void* addr, socklen_t* len)
+{
+    fileref fr;
+    auto s = af_local_from_fd(fd, fr);
+    if (!s) {
+        return ENOTSOCK;
+    }
+    SCOPE_LOCK(s->mtx);
+    af_local_addr(s->name, addr, len);
+    return 0;
+}
+
+int getpeername_af_local(int fd, void* addr, socklen_t* len)
+{
+    fileref fr;
+    auto s = af_local_from_fd(fd, fr);
+    if (!s) {
+        return ENOTSOCK;
+    }
+    SCOPE_LOCK(s->mtx);
+    if (!s->connected && !s->peer_q) {
+        return ENOTCONN;
+    }
+    af_local_addr(s->peer_name, addr, len);
+    return 0;
+}
+
+int sendmsg_af_local(int fd, const struct msghdr* msg, int flags, ssize_t* bytes)
+{
+    fileref fr = fileref_from_fd(fd);
+    return fr ? sendmsg_af_local_file(fr.get(), msg, flags, bytes) : ENOTSOCK;
+}
+
+int sendmsg_af_local_file(struct file* fp, const struct msghdr* msg, int flags,
+                          ssize_t* bytes)
+{
+    auto s = dynamic_cast<af_local*>(fp);
+    if (!s) {
+        return ENOTSOCK;
+    }
+    if (!(s->f_flags & FWRITE)) {
+        return EPIPE;
+    }
+    size_t n = 0;
+    auto error = s->sendmsg(msg, flags, &n);
+    *bytes = n;
+    return error;
+}
+
+int recvmsg_af_local(int fd, struct msghdr* msg, int flags, ssize_t* bytes)
+{
+    fileref fr = fileref_from_fd(fd);
+    return fr ? recvmsg_af_local_file(fr.get(), msg, flags, bytes) : ENOTSOCK;
+}
+
+int recvmsg_af_local_file(struct file* fp, struct msghdr* msg, int flags,
+                          ssize_t* bytes)
+{
+    auto s = dynamic_cast<af_local*>(fp);
+    if (!s) {
+        return ENOTSOCK;
+    }
+    if (!(s->f_flags & FREAD)) {
+        *bytes = 0;
+        return 0;
+    }
+    size_t n = 0;
+    auto error = s->recvmsg(msg, flags, &n);
+    *bytes = n;
+    return error;
+}
+
+int getsockopt_af_local(int fd, int level, int optname, void* optval,
+                        socklen_t* optlen)
+{
+    fileref fr;
+    auto s = af_local_from_fd(fd, fr);
+    if (!s) {
+        return ENOTSOCK;
+    }
+    if (level != SOL_SOCKET) {
+        return ENOPROTOOPT;
+    }
+    int val;
+    switch (optname) {
+    case SO_TYPE:
+        val = s->type;
+        break;
+    case SO_ERROR:
+        val = 0;
+        break;
+    case SO_ACCEPTCONN:
+        WITH_LOCK(s->mtx) {
+            val = s->ep && s->ep->listener;
+        }
+        break;
+    case SO_SNDBUF:
+    case SO_RCVBUF:
+        val = s->type == SOCK_STREAM ? pipe_buffer::default_size : msg_queue::max_bytes;
+        break;
+    case SO_PEERCRED: {
+        // Everybody is the same process
+        struct ucred cred = { getpid(), 0, 0 };
+        if (*optlen < sizeof(cred)) {
+            return EINVAL;
+        }
+        memcpy(optval, &cred, sizeof(cred));
+        *optlen = sizeof(cred);
+        return 0;
+    }
+    default:
+        return ENOPROTOOPT;
+    }
+    if (*optlen < sizeof(val)) {
+        return EINVAL;
+    }
+    memcpy(optval, &val, sizeof(val));
+    *optlen = sizeof(val);
     return 0;
 }
 
+int setsockopt_af_local(int fd, int level, int optname, const void* optval,
+                        socklen_t optlen)
+{
+    fileref fr;
+    auto s = af_local_from_fd(fd, fr);
+    if (!s) {
+        return ENOTSOCK;
+    }
+    if (level != SOL_SOCKET) {
+        return ENOPROTOOPT;
+    }
+    switch (optname) {
+    case SO_REUSEADDR:
+    case SO_PASSCRED:
+    case SO_SNDBUF:
+    case SO_RCVBUF:
+    case SO_KEEPALIVE:
+        return 0;
+    default:
+        return ENOPROTOOPT;
+    }
+}
+
 int socketpair_af_local(int type, int proto, int sv[2])
 {
-    assert(type == SOCK_STREAM);
-    assert(proto == 0);
-    pipe_buffer_ref b1{new pipe_buffer};
-    pipe_buffer_ref b2{new pipe_buffer};
+    int flags = type & (SOCK_NONBLOCK | SOCK_CLOEXEC);
+    type &= ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (type != SOCK_STREAM && type != SOCK_DGRAM && type != SOCK_SEQPACKET) {
+        return libc_error(EPROTOTYPE);
+    }
+    if (proto != 0) {
+        return libc_error(EPROTONOSUPPORT);
+    }
     try {
-        fileref f1 = make_file<af_local>(b1, b2);
-        fileref f2 = make_file<af_local>(std::move(b2), std::move(b1));
+        fileref f1, f2;
+        if (type == SOCK_STREAM) {
+            pipe_buffer_ref b1{new pipe_buffer};
+            pipe_buffer_ref b2{new pipe_buffer};
+            f1 = make_file<af_local>(b1, b2);
+            f2 = make_file<af_local>(std::move(b2), std::move(b1));
+        } else {
+            f1 = make_file<af_local>(type);
+            f2 = make_file<af_local>(type);
+            auto q1 = std::make_shared<msg_queue>();
+            auto q2 = std::make_shared<msg_queue>();
+            static_cast<af_local*>(f1.get())->connect_msg(q1, q2);
+            static_cast<af_local*>(f2.get())->connect_msg(q2, q1);
+        }
+        if (flags & SOCK_NONBLOCK) {
+            f1->f_flags |= FNONBLOCK;
+            f2->f_flags |= FNONBLOCK;
+        }
         fdesc fd1(f1);
         fdesc fd2(f2);
         // all went well, user owns descriptors now
@@ -126,6 +1032,30 @@ int shutdown_af_local(int fd, int how) {
     if (!f) {
         return ENOTSOCK;
     }
+    if (f->type != SOCK_STREAM) {
+        if (!f->connected) {
+            return ENOTCONN;
+        }
+        if (how != SHUT_RD && how != SHUT_WR && how != SHUT_RDWR) {
+            return EINVAL;
+        }
+        if (how != SHUT_RD) {
+            // The peer reads the end of the connection
+            auto q = f->get_peer_q();
+            WITH_LOCK(q->mtx) {
+                q->eof = true;
+                q->readable.wake_all();
+                poll_wake(q->reader, POLLIN | POLLRDHUP);
+            }
+        }
+        FD_LOCK(f);
+        f->f_flags &= ~((how != SHUT_WR ? FREAD : 0) | (how != SHUT_RD ? FWRITE : 0));
+        FD_UNLOCK(f);
+        return 0;
+    }
+    if (!f->connected) {
+        return ENOTCONN;
+    }
     switch (how) {
     case SHUT_RD:
         f->receive->detach_receiver();
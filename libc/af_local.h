@@ -8,14 +8,45 @@
 #ifndef AF_LOCAL_H_
 #define AF_LOCAL_H_
 
+#define __NEED_socklen_t
+#define __NEED_ssize_t
+#include <bits/alltypes.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct msghdr;
+struct file;
+
 int socketpair_af_local(int type, int proto, int sv[2]);
 
 int shutdown_af_local(int fd, int how);
 
+// The functions below return an error number, ENOTSOCK if fd isn't an
+// AF_LOCAL socket, and the address arguments are struct sockaddr_un.
+int socket_af_local(int type, int proto, int *fd);
+int bind_af_local(int fd, const void *addr, socklen_t len);
+int listen_af_local(int fd, int backlog);
+int connect_af_local(int fd, const void *addr, socklen_t len);
+int accept_af_local(int fd, void *addr, socklen_t *len, int flags, int *out);
+int getsockname_af_local(int fd, void *addr, socklen_t *len);
+int getpeername_af_local(int fd, void *addr, socklen_t *len);
+int sendmsg_af_local(int fd, const struct msghdr *msg, int flags, ssize_t *bytes);
+int recvmsg_af_local(int fd, struct msghdr *msg, int flags, ssize_t *bytes);
+int getsockopt_af_local(int fd, int level, int optname, void *optval,
+                        socklen_t *optlen);
+int setsockopt_af_local(int fd, int level, int optname, const void *optval,
+                        socklen_t optlen);
+
+// As above, on a file the caller holds a reference on.
+int accept_af_local_file(struct file *fp, void *addr, socklen_t *len, int flags,
+                         int *out);
+int sendmsg_af_local_file(struct file *fp, const struct msghdr *msg, int flags,
+                          ssize_t *bytes);
+int recvmsg_af_local_file(struct file *fp, struct msghdr *msg, int flags,
+                          ssize_t *bytes);
+
 #ifdef __cplusplus
 }
 #endif
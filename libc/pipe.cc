@@ -5,40 +5,20 @@
  * BSD license as described in the LICENSE file in the top-level directory.
  */
 
-#include "pipe_buffer.hh"
+#include "pipe.hh"
 
 #include <fs/fs.hh>
+#include <fs/vfs/vfs.h>
 #include <osv/fcntl.h>
 #include <libc/libc.hh>
 
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/poll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
 
-struct pipe_writer {
-    pipe_buffer_ref buf;
-    pipe_writer(pipe_buffer *b) : buf(b) { }
-    ~pipe_writer() { buf->detach_sender(); }
-};
-
-struct pipe_reader {
-    pipe_buffer_ref buf;
-    pipe_reader(pipe_buffer *b) : buf(b) { }
-    ~pipe_reader() { buf->detach_receiver(); }
-};
-
-class pipe_file final : public special_file {
-public:
-    explicit pipe_file(std::unique_ptr<pipe_reader>&& s);
-    explicit pipe_file(std::unique_ptr<pipe_writer>&& s);
-    virtual int read(uio* data, int flags) override;
-    virtual int write(uio* data, int flags) override;
-    virtual int poll(int events) override;
-    virtual int close() override;
-private:
-    pipe_writer* writer = nullptr;
-    pipe_reader* reader = nullptr;
-};
+#include <osv/zcopy.hh>
 
 pipe_file::pipe_file(std::unique_ptr<pipe_writer>&& s)
     : special_file(FWRITE, DTYPE_UNSPEC)
@@ -64,6 +44,19 @@ int pipe_file::write(uio *data, int flags)
     return writer->buf->write(data, is_nonblock(this));
 }
 
+int pipe_file::pipe_size()
+{
+    return buffer()->size();
+}
+
+int pipe_file::set_pipe_size(int size)
+{
+    if (size < 0) {
+        return EINVAL;
+    }
+    return buffer()->resize(size);
+}
+
 int pipe_file::poll(int events)
 {
     // One end of the pipe is read-only, the other write-only:
@@ -121,3 +114,155 @@ int pipe(int pipefd[2])
 {
     return pipe2(pipefd, 0);
 }
+
+static pipe_file* to_pipe(file* fp)
+{
+    return dynamic_cast<pipe_file*>(fp);
+}
+
+// Write a pipe page to a stream socket by reference: the socket's mbufs
+// point into the page, which stays alive until the last of them is freed.
+static void pipe_page_sent(void* arg)
+{
+    intrusive_ptr_release(static_cast<pipe_page*>(arg));
+}
+
+OSV_LIBC_API
+ssize_t splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+               size_t len, unsigned flags)
+{
+    fileref in{fileref_from_fd(fd_in)};
+    fileref out{fileref_from_fd(fd_out)};
+    if (!in || !out || !(in->f_flags & FREAD) || !(out->f_flags & FWRITE)) {
+        return libc_error(EBADF);
+    }
+    auto pin = to_pipe(in.get());
+    auto pout = to_pipe(out.get());
+    if ((off_in && (pin || in->f_type != DTYPE_VNODE)) ||
+        (off_out && (pout || out->f_type != DTYPE_VNODE))) {
+        return libc_error(ESPIPE);
+    }
+    if ((off_in && *off_in < 0) || (off_out && *off_out < 0)) {
+        return libc_error(EINVAL);
+    }
+
+    size_t moved = 0;
+    int error;
+    if (pin && pout) {
+        if (pin->buffer() == pout->buffer()) {
+            return libc_error(EINVAL);
+        }
+        error = pipe_buffer::splice_pipe(pin->buffer(), pout->buffer(), len,
+            (flags & SPLICE_F_NONBLOCK) || is_nonblock(pin) || is_nonblock(pout),
+            false, &moved);
+    } else if (pin) {
+        auto fp = out.get();
+        bool zcopy = fp->f_type == DTYPE_SOCKET;
+        off_t off = off_out ? *off_out : -1;
+        error = pin->buffer()->splice_to(len,
+            (flags & SPLICE_F_NONBLOCK) || is_nonblock(pin),
+            [&] (const pipe_slot& s, size_t& done) {
+                if (zcopy) {
+                    auto page = s.page.get();
+                    intrusive_ptr_add_ref(page);
+                    // pipe_page_sent() drops this reference in every case
+                    auto ret = zcopy_sendpages_file(fp, page->data + s.off,
+                                                    s.len, pipe_page_sent, page);
+                    if (ret >= 0) {
+                        done = ret;
+                        return 0;
+                    } else if (errno != EOPNOTSUPP) {
+                        return errno;
+                    }
+                    zcopy = false;
+                }
+                struct iovec iov = { s.page->data + s.off, s.len };
+                auto error = sys_write(fp, &iov, 1, off, &done);
+                if (off >= 0) {
+                    off += done;
+                }
+                return error;
+            }, &moved);
+    } else if (pout) {
+        auto fp = in.get();
+        off_t off = off_in ? *off_in : -1;
+        error = pout->buffer()->splice_from(len,
+            (flags & SPLICE_F_NONBLOCK) || is_nonblock(pout),
+            [&] (char* buf, size_t n, size_t& done) {
+                struct iovec iov = { buf, n };
+                auto error = sys_read(fp, &iov, 1, off, &done);
+                if (off >= 0) {
+                    off += done;
+                }
+                return error;
+            }, &moved);
+    } else {
+        return libc_error(EINVAL);
+    }
+
+    if (off_in) {
+        *off_in += moved;
+    }
+    if (off_out) {
+        *off_out += moved;
+    }
+    if (error) {
+        return libc_error(error);
+    }
+    return moved;
+}
+
+// The user's pages can't be taken over (SPLICE_F_GIFT), so vmsplice() is a
+// writev() to the pipe, or a readv() from it.
+OSV_LIBC_API
+ssize_t vmsplice(int fd, const struct iovec *iov, size_t nr_segs, unsigned flags)
+{
+    fileref f{fileref_from_fd(fd)};
+    auto p = f ? to_pipe(f.get()) : nullptr;
+    if (!p) {
+        return libc_error(EBADF);
+    }
+    struct uio uio = {};
+    uio.uio_iov = const_cast<struct iovec*>(iov);
+    uio.uio_iovcnt = nr_segs;
+    for (size_t i = 0; i < nr_segs; i++) {
+        uio.uio_resid += iov[i].iov_len;
+    }
+    auto len = uio.uio_resid;
+    bool nonblock = (flags & SPLICE_F_NONBLOCK) || is_nonblock(p);
+    int error;
+    if (f->f_flags & FWRITE) {
+        uio.uio_rw = UIO_WRITE;
+        error = p->buffer()->write(&uio, nonblock);
+    } else {
+        uio.uio_rw = UIO_READ;
+        error = p->buffer()->read(&uio, nonblock);
+    }
+    if (error && uio.uio_resid == len) {
+        return libc_error(error);
+    }
+    return len - uio.uio_resid;
+}
+
+OSV_LIBC_API
+ssize_t tee(int fd_in, int fd_out, size_t len, unsigned flags)
+{
+    fileref in{fileref_from_fd(fd_in)};
+    fileref out{fileref_from_fd(fd_out)};
+    if (!in || !out || !(in->f_flags & FREAD) || !(out->f_flags & FWRITE)) {
+        return libc_error(EBADF);
+    }
+    auto pin = to_pipe(in.get());
+    auto pout = to_pipe(out.get());
+    if (!pin || !pout || pin->buffer() == pout->buffer()) {
+        return libc_error(EINVAL);
+    }
+    size_t copied;
+    auto error = pipe_buffer::splice_pipe(pin->buffer(), pout->buffer(), len,
+        (flags & SPLICE_F_NONBLOCK) || is_nonblock(pin) || is_nonblock(pout),
+        true, &copied);
+    if (error) {
+        return libc_error(error);
+    }
+    return copied;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef PIPE_HH_
+#define PIPE_HH_
+
+#include "pipe_buffer.hh"
+
+#include <memory>
+
+#include <osv/file.h>
+#include <osv/fcntl.h>
+
+struct pipe_writer {
+    pipe_buffer_ref buf;
+    pipe_writer(pipe_buffer *b) : buf(b) { }
+    ~pipe_writer() { buf->detach_sender(); }
+};
+
+struct pipe_reader {
+    pipe_buffer_ref buf;
+    pipe_reader(pipe_buffer *b) : buf(b) { }
+    ~pipe_reader() { buf->detach_receiver(); }
+};
+
+class pipe_file final : public special_file {
+public:
+    explicit pipe_file(std::unique_ptr<pipe_reader>&& s);
+    explicit pipe_file(std::unique_ptr<pipe_writer>&& s);
+    virtual int read(uio* data, int flags) override;
+    virtual int write(uio* data, int flags) override;
+    virtual int poll(int events) override;
+    virtual int close() override;
+    pipe_buffer* buffer() {
+        return (f_flags & FWRITE) ? writer->buf.get() : reader->buf.get();
+    }
+    // fcntl(F_GETPIPE_SZ) and fcntl(F_SETPIPE_SZ)
+    int pipe_size();
+    int set_pipe_size(int size);
+private:
+    pipe_writer* writer = nullptr;
+    pipe_reader* reader = nullptr;
+};
+
+#endif /* PIPE_HH_ */
@@ -11,6 +11,24 @@
 #include "pipe_buffer.hh"
 
 #include <osv/poll.h>
+#include <osv/pagealloc.hh>
+
+#include <string.h>
+
+pipe_page::pipe_page()
+    : data(static_cast<char*>(memory::alloc_page()))
+{
+}
+
+pipe_page::~pipe_page()
+{
+    memory::free_page(data);
+}
+
+pipe_buffer::pipe_buffer()
+    : ring(default_size / pipe_page::size)
+{
+}
 
 void pipe_buffer::detach_sender()
 {
@@ -49,7 +67,7 @@ void pipe_buffer::attach_receiver(struct file *f)
 int pipe_buffer::read_events_unlocked()
 {
     int ret = 0;
-    ret |= !q.empty() ? POLLIN : 0;
+    ret |= bytes ? POLLIN : 0;
     ret |= !sender ? POLLHUP : 0;
     return ret;
 }
@@ -60,7 +78,7 @@ int pipe_buffer::write_events_unlocked()
         return no_receiver_event;
     }
     int ret = 0;
-    ret |= q.size() < max_buf ? POLLOUT : 0;
+    ret |= room() ? POLLOUT : 0;
     return ret;
 }
 
@@ -78,17 +96,148 @@ int pipe_buffer::write_events()
     }
 }
 
+// Writes may go on filling the last page only as long as nobody else
+// (another pipe after tee(), or a socket after splice()) refers to it.
+size_t pipe_buffer::tail_room()
+{
+    if (!used) {
+        return 0;
+    }
+    auto& s = slot(used - 1);
+    if (s.page->refs.load(std::memory_order_relaxed) != 1) {
+        return 0;
+    }
+    return pipe_page::size - (s.off + s.len);
+}
+
+size_t pipe_buffer::room()
+{
+    return (ring.size() - used) * pipe_page::size + tail_room();
+}
+
+void pipe_buffer::push(const pipe_slot& s)
+{
+    assert(!full());
+    slot(used++) = s;
+    bytes += s.len;
+}
+
+// Drop n bytes, no more than the first slot holds, from the head.
+void pipe_buffer::consume(size_t n)
+{
+    auto& s = slot(0);
+    assert(n <= s.len);
+    s.off += n;
+    s.len -= n;
+    bytes -= n;
+    if (!s.len) {
+        if (s.page->refs.load(std::memory_order_relaxed) == 1) {
+            spare = std::move(s.page);
+        }
+        s.page.reset();
+        head = (head + 1) & (ring.size() - 1);
+        used--;
+    }
+}
+
+pipe_page_ref pipe_buffer::new_page()
+{
+    if (spare) {
+        return std::move(spare);
+    }
+    return new pipe_page;
+}
+
+// Copy up to n bytes into the pipe, filling the last page first and then
+// fresh ones while there are free slots. Returns the bytes copied.
+size_t pipe_buffer::append(const char* p, size_t n)
+{
+    size_t done = 0;
+    while (done < n) {
+        auto room = tail_room();
+        if (!room) {
+            if (full()) {
+                break;
+            }
+            push(pipe_slot{new_page(), 0, 0});
+            room = pipe_page::size;
+        }
+        auto& s = slot(used - 1);
+        auto len = std::min(room, n - done);
+        memcpy(s.page->data + s.off + s.len, p + done, len);
+        s.len += len;
+        bytes += len;
+        done += len;
+    }
+    return done;
+}
+
+size_t pipe_buffer::size()
+{
+    WITH_LOCK(mtx) {
+        return ring.size() * pipe_page::size;
+    }
+}
+
+// F_SETPIPE_SZ: the size is rounded up to a power of two of pages, and may
+// not drop below the data already in the pipe.
+int pipe_buffer::resize(size_t size)
+{
+    if (size > max_size) {
+        return EPERM;
+    }
+    size_t slots = 1;
+    while (slots * pipe_page::size < size) {
+        slots *= 2;
+    }
+    WITH_LOCK(mtx) {
+        if (used > slots) {
+            return EBUSY;
+        }
+        std::vector<pipe_slot> n(slots);
+        for (size_t i = 0; i < used; i++) {
+            n[i] = std::move(slot(i));
+        }
+        ring = std::move(n);
+        head = 0;
+        if (write_events_unlocked() & POLLOUT) {
+            poll_wake(sender, (POLLOUT | POLLWRNORM));
+        }
+    }
+    may_write.wake_all();
+    return 0;
+}
+
+void pipe_buffer::wake_reader()
+{
+    if (read_events_unlocked() & POLLIN)
+        poll_wake(receiver, (POLLIN | POLLRDNORM));
+    may_read.wake_all();
+}
+
+void pipe_buffer::wake_writer()
+{
+    if (write_events_unlocked() & POLLOUT)
+        poll_wake(sender, (POLLOUT | POLLWRNORM));
+    may_write.wake_all();
+}
+
 // Copy from the pipe into the given iovec array, until the array is full
-// or the queue is empty. Decrements uio->uio_resid.
-static void copy_to_uio(std::deque<char> &q, uio *uio)
+// or the pipe is empty. Decrements uio->uio_resid.
+void pipe_buffer::copy_to_uio(uio *uio)
 {
-    for (int i = 0; i < uio->uio_iovcnt && !q.empty(); i++) {
+    for (int i = 0; i < uio->uio_iovcnt && used; i++) {
         auto &iov = uio->uio_iov[i];
-        auto n = std::min(q.size(), iov.iov_len);
         char* p = static_cast<char*>(iov.iov_base);
-        std::copy(q.begin(), q.begin() + n, p);
-        q.erase(q.begin(), q.begin() + n);
-        uio->uio_resid -= n;
+        size_t done = 0;
+        while (done < iov.iov_len && used) {
+            auto& s = slot(0);
+            auto n = std::min(s.len, iov.iov_len - done);
+            memcpy(p + done, s.page->data + s.off, n);
+            consume(n);
+            done += n;
+        }
+        uio->uio_resid -= done;
     }
 }
 
@@ -97,17 +246,18 @@ int pipe_buffer::read(uio* data, bool nonblock)
     if (!data->uio_resid) {
         return 0;
     }
+    std::lock_guard<mutex> serialize(read_mtx);
     std::unique_lock<mutex> lock(mtx);
-    if (nonblock && q.empty()) {
+    if (nonblock && !bytes) {
         return sender ? EAGAIN : 0;
     }
-    while (sender && q.empty()) {
+    while (sender && !bytes) {
         may_read.wait(&mtx);
     }
-    if (q.empty()) {
+    if (!bytes) {
         return 0;
     }
-    copy_to_uio(q, data);
+    copy_to_uio(data);
     if (write_events_unlocked() & POLLOUT)
         poll_wake(sender, (POLLOUT | POLLWRNORM));
     lock.unlock();
@@ -116,25 +266,24 @@ int pipe_buffer::read(uio* data, bool nonblock)
 }
 
 // Copy from a certain iovec array into a pipe, starting at a given index
-// and offset, until the buffer or the array ends. Decrements uio->uio_resid,
-// and modifies ind and offset to where the copy stopped.
-static void copy_from_uio(uio *uio, size_t *ind, size_t *offset,
-        std::deque<char> &buf, size_t bufsize)
+// and offset, until the pipe is full or the array ends. Decrements
+// uio->uio_resid, and modifies ind and offset to where the copy stopped.
+void pipe_buffer::copy_from_uio(uio *uio, size_t *ind, size_t *offset)
 {
     int i = *ind;
     size_t off = *offset;
 
-    while (i < uio->uio_iovcnt && buf.size() < bufsize) {
+    while (i < uio->uio_iovcnt) {
         auto &iov = uio->uio_iov[i];
-        auto n = std::min(bufsize - buf.size(), iov.iov_len - off);
         char* p = static_cast<char*>(iov.iov_base) + off;
-        std::copy(p, p + n, std::back_inserter(buf));
+        auto n = append(p, iov.iov_len - off);
         uio->uio_resid -= n;
         off += n;
-        if (off == iov.iov_len) {
-            ++i;
-            off = 0;
+        if (off < iov.iov_len) {
+            break;
         }
+        ++i;
+        off = 0;
     }
 
     *offset = off;
@@ -150,17 +299,17 @@ int pipe_buffer::write(uio* data, bool nonblock)
         // A write() smaller than PIPE_BUF (=4096 in Linux) will not be split
         // (i.e., will be "atomic"): For such a small write, we need to wait
         // until there's enough room for all it in the buffer.
-        int needroom = data->uio_resid <= 4096 ? data->uio_resid : 1;
+        size_t needroom = data->uio_resid <= 4096 ? data->uio_resid : 1;
         if (nonblock) {
             if (!receiver) {
                 // FIXME: If we don't generate a SIGPIPE here, at least assert
                 // that the user did not install a SIGPIPE handler.
                 return EPIPE;
-            } else if (q.size() + needroom > max_buf) {
+            } else if (room() < needroom) {
                 return EAGAIN;
             }
         } else {
-            while (receiver && q.size() + needroom > max_buf) {
+            while (receiver && room() < needroom) {
                 may_write.wait(&mtx);
             }
             if (!receiver) {
@@ -173,17 +322,17 @@ int pipe_buffer::write(uio* data, bool nonblock)
         // times, until the whole given buffer is written.
         size_t ind = 0, offset = 0;
         while (data->uio_resid && receiver) {
-            copy_from_uio(data, &ind, &offset, q, max_buf);
+            copy_from_uio(data, &ind, &offset);
             if (data->uio_resid) {
                 // The buffer is full but we still have more to send. Wake up
                 // readers, and go to sleep ourselves.
-                assert(q.size() == max_buf);
+                assert(!room());
                 poll_wake(receiver, (POLLIN | POLLRDNORM));
                 may_read.wake_all();
                 if (nonblock) {
                     return 0;
                 }
-                while (receiver && q.size() == max_buf) {
+                while (receiver && !room()) {
                     may_write.wait(&mtx);
                 }
             }
@@ -194,3 +343,168 @@ int pipe_buffer::write(uio* data, bool nonblock)
     may_read.wake_all();
     return 0;
 }
+
+// The actor may block, in a socket's send buffer or writing a file, so it
+// runs with the pipe unlocked: writers, poll() and close() don't wait for
+// it. read_mtx keeps other readers from consuming the slot meanwhile, and
+// our reference to the page keeps writers from appending to it.
+int pipe_buffer::splice_to(size_t len, bool nonblock, splice_to_actor actor,
+                           size_t* moved)
+{
+    *moved = 0;
+    std::lock_guard<mutex> serialize(read_mtx);
+    std::unique_lock<mutex> lock(mtx);
+    if (nonblock && !bytes) {
+        return sender ? EAGAIN : 0;
+    }
+    while (sender && !bytes) {
+        may_read.wait(&mtx);
+    }
+    int error = 0;
+    while (len && used) {
+        pipe_slot s = slot(0);
+        s.len = std::min(s.len, len);
+        size_t done = 0;
+        lock.unlock();
+        error = actor(s, done);
+        s.page.reset();
+        lock.lock();
+        if (done) {
+            consume(done);
+            *moved += done;
+            len -= done;
+            wake_writer();
+        }
+        if (error || done < s.len) {
+            break;
+        }
+    }
+    return *moved ? 0 : error;
+}
+
+// Pages are filled, by reading a file or a socket, with the pipe unlocked,
+// and queued only once full; another writer may take the free slots
+// meanwhile, so we wait for room again before queueing.
+int pipe_buffer::splice_from(size_t len, bool nonblock, splice_from_actor actor,
+                             size_t* moved)
+{
+    *moved = 0;
+    std::unique_lock<mutex> lock(mtx);
+    if (nonblock && receiver && full()) {
+        return EAGAIN;
+    }
+    while (receiver && full()) {
+        may_write.wait(&mtx);
+    }
+    if (!receiver) {
+        return EPIPE;
+    }
+    int error = 0;
+    while (len && !full()) {
+        auto page = new_page();
+        auto want = std::min(len, pipe_page::size);
+        size_t done = 0;
+        lock.unlock();
+        error = actor(page->data, want, done);
+        lock.lock();
+        if (done) {
+            while (receiver && full()) {
+                may_write.wait(&mtx);
+            }
+            if (!receiver) {
+                error = EPIPE;
+                break;
+            }
+            push(pipe_slot{std::move(page), 0, done});
+            *moved += done;
+            len -= done;
+            wake_reader();
+        } else if (!spare) {
+            spare = std::move(page);
+        }
+        if (error || done < want) {
+            break;
+        }
+    }
+    return *moved ? 0 : error;
+}
+
+// Two pipes are always locked in address order.
+static void lock_pair(mutex& a, mutex& b)
+{
+    if (&a < &b) {
+        a.lock();
+        b.lock();
+    } else {
+        b.lock();
+        a.lock();
+    }
+}
+
+int pipe_buffer::splice_pipe(pipe_buffer* from, pipe_buffer* to, size_t len,
+                             bool nonblock, bool tee, size_t* moved)
+{
+    // Wait, with only the pipe waited on locked, until at least one page
+    // can go from one pipe to the other.
+    *moved = 0;
+    std::unique_lock<mutex> serialize(from->read_mtx, std::defer_lock);
+    if (!tee) {
+        serialize.lock();
+    }
+    for (;;) {
+        lock_pair(from->mtx, to->mtx);
+        int error = -1;
+        if (!to->receiver) {
+            error = EPIPE;
+        } else if (!from->bytes) {
+            if (!from->sender) {
+                error = 0;
+            } else if (nonblock) {
+                error = EAGAIN;
+            } else {
+                to->mtx.unlock();
+                from->may_read.wait(&from->mtx);
+                from->mtx.unlock();
+                continue;
+            }
+        } else if (to->full()) {
+            if (nonblock) {
+                error = EAGAIN;
+            } else {
+                from->mtx.unlock();
+                to->may_write.wait(&to->mtx);
+                to->mtx.unlock();
+                continue;
+            }
+        }
+        if (error >= 0) {
+            from->mtx.unlock();
+            to->mtx.unlock();
+            return error;
+        }
+        break;
+    }
+
+    // The pages are shared, not copied: a partially moved page ends up
+    // referenced by both pipes, and neither writes to it anymore.
+    size_t i = 0;
+    while (len && i < from->used && !to->full()) {
+        pipe_slot s = from->slot(i);
+        s.len = std::min(s.len, len);
+        to->push(s);
+        len -= s.len;
+        *moved += s.len;
+        if (tee) {
+            i++;
+        } else {
+            from->consume(s.len);
+        }
+    }
+    to->wake_reader();
+    if (!tee) {
+        from->wake_writer();
+    }
+    from->mtx.unlock();
+    to->mtx.unlock();
+    return 0;
+}
@@ -8,19 +8,52 @@
 #ifndef PIPE_BUFFER_HH_
 #define PIPE_BUFFER_HH_
 
-#include <deque>
+#include <vector>
 #include <atomic>
+#include <functional>
 #include <boost/intrusive_ptr.hpp>
 
 #include <osv/mutex.h>
 #include <osv/condvar.h>
 #include <osv/file.h>
+#include <osv/mmu-defs.hh>
+
+// Pipe data lives in whole pages. The pages are reference counted, so
+// splice() and tee() can pass them to another pipe, or to a socket, without
+// copying the data. A page referenced from more than one place is never
+// written to again.
+struct pipe_page {
+    static constexpr size_t size = mmu::page_size;
+    pipe_page();
+    ~pipe_page();
+    pipe_page(const pipe_page&) = delete;
+    char* data;
+    std::atomic<unsigned> refs = {};
+    friend void intrusive_ptr_add_ref(pipe_page* p) {
+        p->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    friend void intrusive_ptr_release(pipe_page* p) {
+        if (p->refs.fetch_add(-1, std::memory_order_acq_rel) == 1) {
+            delete p;
+        }
+    }
+};
+
+typedef boost::intrusive_ptr<pipe_page> pipe_page_ref;
+
+// 'len' bytes of pipe data, starting at 'off' in 'page'.
+struct pipe_slot {
+    pipe_page_ref page;
+    size_t off;
+    size_t len;
+};
 
 struct pipe_buffer {
-private:
-    static constexpr size_t max_buf = 8192;
 public:
-    pipe_buffer() = default;
+    // Like Linux: 16 pages by default, and up to 1MB with F_SETPIPE_SZ.
+    static constexpr size_t default_size = 16 * pipe_page::size;
+    static constexpr size_t max_size = 1024 * 1024;
+    pipe_buffer();
     pipe_buffer(const pipe_buffer&) = delete;
     int read(uio* data, bool nonblock);
     int write(uio* data, bool nonblock);
@@ -33,12 +66,53 @@ public:
     void set_no_receiver_event(int event) {
         this->no_receiver_event = event;
     }
+    size_t size();
+    int resize(size_t size);
+    // splice() support. splice_to() hands up to len bytes of the buffered
+    // slots to actor(), which sets how many bytes of the slot it consumed
+    // (it may keep a reference to the page), and splice_from() queues pages
+    // that actor() filled (e.g., read from a file). Both stop at the first
+    // short transfer and wait, like read() and write(), only for the first
+    // byte. The actors run with the pipe unlocked. splice_pipe() moves (or with tee, copies) page references
+    // between two pipes.
+    typedef std::function<int (const pipe_slot& slot, size_t& done)> splice_to_actor;
+    typedef std::function<int (char* buf, size_t len, size_t& done)> splice_from_actor;
+    int splice_to(size_t len, bool nonblock, splice_to_actor actor, size_t* moved);
+    int splice_from(size_t len, bool nonblock, splice_from_actor actor, size_t* moved);
+    static int splice_pipe(pipe_buffer* from, pipe_buffer* to, size_t len,
+                           bool nonblock, bool tee, size_t* moved);
 private:
     int read_events_unlocked();
     int write_events_unlocked();
+    pipe_slot& slot(size_t i) {
+        return ring[(head + i) & (ring.size() - 1)];
+    }
+    bool full() { return used == ring.size(); }
+    size_t tail_room();
+    size_t room();
+    void push(const pipe_slot& s);
+    void consume(size_t n);
+    size_t append(const char* p, size_t n);
+    pipe_page_ref new_page();
+    void copy_to_uio(uio* uio);
+    void copy_from_uio(uio* uio, size_t* ind, size_t* offset);
+    void wake_reader();
+    void wake_writer();
 private:
+    // Taken before mtx by everything that consumes data (read(),
+    // splice_to(), splice_pipe()), so splice_to() can drop mtx while its
+    // actor does I/O without the slot it works on being consumed under it.
+    mutex read_mtx;
     mutex mtx;
-    std::deque<char> q;
+    // A ring of slots, a power of two in size, of which 'used' starting at
+    // 'head' hold 'bytes' bytes of data.
+    std::vector<pipe_slot> ring;
+    size_t head = 0;
+    size_t used = 0;
+    size_t bytes = 0;
+    // The last page consumed, kept to avoid a page allocation per write
+    // when the reader keeps up.
+    pipe_page_ref spare;
     struct file *receiver = nullptr;
     struct file *sender = nullptr;
     std::atomic<unsigned> refs = {};
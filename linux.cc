@@ -12,8 +12,10 @@
 #include <osv/sched.hh>
 #include <osv/mutex.h>
 #include <osv/waitqueue.hh>
+#include <osv/wait_record.hh>
 #include <osv/stubbing.hh>
 #include <osv/export.h>
+#include <osv/io_uring.h>
 #include <memory>
 
 #include <syscall.h>
@@ -42,7 +44,7 @@
 #include <sys/vfs.h>
 #include <termios.h>
 
-#include <unordered_map>
+#include <boost/intrusive/list.hpp>
 
 #include <musl/src/internal/ksigaction.h>
 
@@ -53,99 +55,541 @@ extern "C" OSV_LIBC_API long gettid()
     return sched::thread::current()->id();
 }
 
-// We don't expect applications to use the Linux futex() system call (it is
-// normally only used to implement higher-level synchronization mechanisms),
-// but unfortunately gcc's C++ runtime uses a subset of futex in the
-// __cxa__guard_* functions, which safeguard the concurrent initialization
-// of function-scope static objects. We only implement here this subset.
-// The __cxa_guard_* functions only call futex in the rare case of contention,
-// in fact so rarely that OSv existed for a year before anyone noticed futex
-// was missing. So the performance of this implementation is not critical.
-static std::unordered_map<void*, waitqueue> queues;
-static mutex queues_mutex;
+// Linux futex() system call. Besides gcc's C++ runtime (__cxa_guard_*),
+// the synchronization primitives of statically linked Go and Rust runtimes
+// and of glibc-style PI mutexes and condition variables are built on it, so
+// it needs both the full set of operations and to scale with many threads
+// waiting on unrelated futexes.
+//
+// Waiters are kept in a fixed table of hash buckets, each with its own lock
+// and on its own cache line, so waits and wakes on different futex words
+// rarely touch the same lock. Operations involving two futex words (the
+// requeue ones and FUTEX_WAKE_OP) lock both buckets in address order.
+//
+// The PI operations implement the ownership protocol on the futex word
+// (owner TID, FUTEX_WAITERS) with direct hand-off to the first waiter on
+// unlock. OSv's scheduler has no priority inheritance, so the owner's
+// priority is not boosted.
+enum {
+    FUTEX_WAIT            = 0,
+    FUTEX_WAKE            = 1,
+    FUTEX_REQUEUE         = 3,
+    FUTEX_CMP_REQUEUE     = 4,
+    FUTEX_WAKE_OP         = 5,
+    FUTEX_LOCK_PI         = 6,
+    FUTEX_UNLOCK_PI       = 7,
+    FUTEX_TRYLOCK_PI      = 8,
+    FUTEX_WAIT_BITSET     = 9,
+    FUTEX_WAKE_BITSET     = 10,
+    FUTEX_WAIT_REQUEUE_PI = 11,
+    FUTEX_CMP_REQUEUE_PI  = 12,
+    FUTEX_LOCK_PI2        = 13,
+    FUTEX_PRIVATE_FLAG    = 128,
+    FUTEX_CLOCK_REALTIME  = 256,
+    FUTEX_CMD_MASK        = ~(FUTEX_PRIVATE_FLAG|FUTEX_CLOCK_REALTIME),
+};
+
 enum {
-    FUTEX_WAIT           = 0,
-    FUTEX_WAKE           = 1,
-    FUTEX_WAIT_BITSET    = 9,
-    FUTEX_PRIVATE_FLAG   = 128,
-    FUTEX_CLOCK_REALTIME = 256,
-    FUTEX_CMD_MASK       = ~(FUTEX_PRIVATE_FLAG|FUTEX_CLOCK_REALTIME),
+    FUTEX_OP_SET          = 0,
+    FUTEX_OP_ADD          = 1,
+    FUTEX_OP_OR           = 2,
+    FUTEX_OP_ANDN         = 3,
+    FUTEX_OP_XOR          = 4,
+    FUTEX_OP_OPARG_SHIFT  = 8,
+};
+
+enum {
+    FUTEX_OP_CMP_EQ       = 0,
+    FUTEX_OP_CMP_NE       = 1,
+    FUTEX_OP_CMP_LT       = 2,
+    FUTEX_OP_CMP_LE       = 3,
+    FUTEX_OP_CMP_GT       = 4,
+    FUTEX_OP_CMP_GE       = 5,
 };
 
 #define FUTEX_BITSET_MATCH_ANY  0xffffffff
+#define FUTEX_WAITERS           0x80000000
+#define FUTEX_OWNER_DIED        0x40000000
+#define FUTEX_TID_MASK          0x3fffffff
 
-int futex(int *uaddr, int op, int val, const struct timespec *timeout,
-        int *uaddr2, uint32_t val3)
+struct futex_bucket;
+
+struct futex_waiter : public waiter {
+    futex_waiter(int* uaddr, uint32_t bitset)
+        : waiter(sched::thread::current()), uaddr(uaddr), bitset(bitset),
+          tid(sched::thread::current()->id()) {}
+    int* uaddr;
+    uint32_t bitset;
+    unsigned tid;
+    // Waiting to be handed the PI futex at uaddr
+    bool pi = false;
+    // FUTEX_WAIT_REQUEUE_PI: the PI futex this waiter may be requeued to
+    int* requeue_pi = nullptr;
+    // Changes on requeue, under the locks of both buckets
+    std::atomic<futex_bucket*> bucket;
+    boost::intrusive::list_member_hook<> hook;
+};
+
+struct futex_bucket {
+    mutex lock;
+    boost::intrusive::list<futex_waiter,
+        boost::intrusive::member_hook<futex_waiter,
+                                      boost::intrusive::list_member_hook<>,
+                                      &futex_waiter::hook>,
+        boost::intrusive::constant_time_size<false>> waiters;
+} CACHELINE_ALIGNED;
+
+static constexpr unsigned futex_hash_bits = 8;
+static futex_bucket futex_buckets[1 << futex_hash_bits];
+
+static futex_bucket& futex_hash(int* uaddr)
 {
-    switch (op & FUTEX_CMD_MASK) {
-    case FUTEX_WAIT_BITSET:
-        if (val3 != FUTEX_BITSET_MATCH_ANY) {
-            abort("Unimplemented futex() operation %d\n", op);
+    uint64_t h = reinterpret_cast<uintptr_t>(uaddr) >> 2;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return futex_buckets[h >> (64 - futex_hash_bits)];
+}
+
+static inline int futex_load(int* uaddr)
+{
+    return __atomic_load_n(uaddr, __ATOMIC_SEQ_CST);
+}
+
+static inline bool futex_cmpxchg(int* uaddr, int& expected, int desired)
+{
+    return __atomic_compare_exchange_n(uaddr, &expected, desired, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// Locks the buckets of two futex words, in address order
+class futex_double_lock {
+public:
+    futex_double_lock(futex_bucket& b1, futex_bucket& b2)
+        : _b1(std::min(&b1, &b2)), _b2(std::max(&b1, &b2)) {
+        _b1->lock.lock();
+        if (_b2 != _b1) {
+            _b2->lock.lock();
+        }
+    }
+    ~futex_double_lock() {
+        if (_b2 != _b1) {
+            _b2->lock.unlock();
         }
+        _b1->lock.unlock();
+    }
+private:
+    futex_bucket* _b1;
+    futex_bucket* _b2;
+};
 
-    case FUTEX_WAIT:
-        WITH_LOCK(queues_mutex) {
-            if (*uaddr == val) {
-                waitqueue &q = queues[uaddr];
-                if (timeout) {
-                    sched::timer tmr(*sched::thread::current());
-                    if ((op & FUTEX_CMD_MASK) == FUTEX_WAIT_BITSET) {
-                        // If FUTEX_WAIT_BITSET we need to interpret timeout as an absolute
-                        // time point. If futex operation FUTEX_CLOCK_REALTIME is set we will use
-                        // real-time clock otherwise we will use monotonic clock
-                        if (op & FUTEX_CLOCK_REALTIME) {
-                            tmr.set(osv::clock::wall::time_point(std::chrono::seconds(timeout->tv_sec) +
-                                                                 std::chrono::nanoseconds(timeout->tv_nsec)));
-                        } else {
-                            tmr.set(osv::clock::uptime::time_point(std::chrono::seconds(timeout->tv_sec) +
-                                                                   std::chrono::nanoseconds(timeout->tv_nsec)));
-                        }
-                    } else {
-                        tmr.set(std::chrono::seconds(timeout->tv_sec) +
-                                std::chrono::nanoseconds(timeout->tv_nsec));
-                    }
-                    sched::thread::wait_for(queues_mutex, tmr, q);
-                    // FIXME: testing if tmr was expired isn't quite right -
-                    // we could have had both a wakeup and timer expiration
-                    // racing. It would be more correct to check if we were
-                    // waken by a FUTEX_WAKE. But how?
-                    if (tmr.expired()) {
-                        errno = ETIMEDOUT;
-                        return -1;
-                    }
-                } else {
-                    q.wait(queues_mutex);
-                }
-                return 0;
-            } else {
-                errno = EWOULDBLOCK;
-                return -1;
-            }
+static void futex_enqueue(futex_bucket& b, futex_waiter& w)
+{
+    w.bucket.store(&b, std::memory_order_relaxed);
+    b.waiters.push_back(w);
+}
+
+static void futex_wake_waiter(futex_bucket& b, futex_waiter& w)
+{
+    b.waiters.erase(b.waiters.iterator_to(w));
+    w.wake();
+}
+
+static void futex_move_waiter(futex_bucket& from, futex_bucket& to,
+                              futex_waiter& w, int* uaddr)
+{
+    from.waiters.erase(from.waiters.iterator_to(w));
+    w.uaddr = uaddr;
+    futex_enqueue(to, w);
+}
+
+static void futex_set_timer(sched::timer& tmr, const struct timespec* timeout,
+                            bool absolute, bool realtime)
+{
+    auto t = std::chrono::seconds(timeout->tv_sec) +
+             std::chrono::nanoseconds(timeout->tv_nsec);
+    if (!absolute) {
+        tmr.set(t);
+    } else if (realtime) {
+        tmr.set(osv::clock::wall::time_point(t));
+    } else {
+        tmr.set(osv::clock::uptime::time_point(t));
+    }
+}
+
+// Waits for a queued waiter to be woken or for the timer to expire.
+// Returns 0 if woken, or -ETIMEDOUT after taking the waiter off its queue.
+static int futex_wait_queued(futex_waiter& w, sched::timer* tmr)
+{
+    w.wait(tmr);
+    if (w.woken()) {
+        return 0;
+    }
+    // The waiter may have been requeued since we looked at its bucket
+    for (;;) {
+        futex_bucket* b = w.bucket.load(std::memory_order_acquire);
+        SCOPE_LOCK(b->lock);
+        if (w.bucket.load(std::memory_order_relaxed) != b) {
+            continue;
         }
-    case FUTEX_WAKE:
-        if(val < 0) {
-            errno = EINVAL;
-            return -1;
+        // The wake may have raced with the timer
+        if (w.woken()) {
+            return 0;
+        }
+        b->waiters.erase(b->waiters.iterator_to(w));
+        return -ETIMEDOUT;
+    }
+}
+
+static int futex_wait(int* uaddr, int val, const struct timespec* timeout,
+                      bool absolute, bool realtime, uint32_t bitset,
+                      int* requeue_pi)
+{
+    if (!bitset || (requeue_pi && requeue_pi == uaddr)) {
+        return -EINVAL;
+    }
+    futex_waiter w(uaddr, bitset);
+    w.requeue_pi = requeue_pi;
+    sched::timer tmr(*sched::thread::current());
+    if (timeout) {
+        futex_set_timer(tmr, timeout, absolute, realtime);
+    }
+    auto& b = futex_hash(uaddr);
+    WITH_LOCK(b.lock) {
+        if (futex_load(uaddr) != val) {
+            return -EWOULDBLOCK;
+        }
+        futex_enqueue(b, w);
+    }
+    return futex_wait_queued(w, timeout ? &tmr : nullptr);
+}
+
+// Wakes up to nr plain waiters on uaddr whose bitset intersects the given
+// one. Called with the bucket locked.
+static int futex_wake_locked(futex_bucket& b, int* uaddr, int nr, uint32_t bitset)
+{
+    int woken = 0;
+    for (auto it = b.waiters.begin(); it != b.waiters.end() && woken < nr; ) {
+        futex_waiter& w = *it++;
+        if (w.uaddr == uaddr && (w.bitset & bitset) && !w.pi && !w.requeue_pi) {
+            futex_wake_waiter(b, w);
+            woken++;
+        }
+    }
+    return woken;
+}
+
+static int futex_wake(int* uaddr, int nr, uint32_t bitset)
+{
+    if (nr < 0 || !bitset) {
+        return -EINVAL;
+    }
+    auto& b = futex_hash(uaddr);
+    WITH_LOCK(b.lock) {
+        return futex_wake_locked(b, uaddr, nr, bitset);
+    }
+}
+
+// FUTEX_REQUEUE and FUTEX_CMP_REQUEUE: wakes up to nr_wake waiters on uaddr
+// and moves up to nr_requeue of the remaining ones to wait on uaddr2.
+static int futex_requeue(int* uaddr, int nr_wake, int nr_requeue, int* uaddr2,
+                         const int* cmpval)
+{
+    if (nr_wake < 0 || nr_requeue < 0) {
+        return -EINVAL;
+    }
+    auto& b1 = futex_hash(uaddr);
+    auto& b2 = futex_hash(uaddr2);
+    futex_double_lock guard(b1, b2);
+    if (cmpval && futex_load(uaddr) != *cmpval) {
+        return -EAGAIN;
+    }
+    int woken = 0, requeued = 0;
+    for (auto it = b1.waiters.begin(); it != b1.waiters.end(); ) {
+        futex_waiter& w = *it++;
+        if (w.uaddr != uaddr || w.pi || w.requeue_pi) {
+            continue;
         }
+        if (woken < nr_wake) {
+            futex_wake_waiter(b1, w);
+            woken++;
+        } else if (requeued < nr_requeue) {
+            futex_move_waiter(b1, b2, w, uaddr2);
+            requeued++;
+        } else {
+            break;
+        }
+    }
+    return woken + requeued;
+}
 
-        WITH_LOCK(queues_mutex) {
-            auto i = queues.find(uaddr);
-            if (i != queues.end()) {
-                int waken = 0;
-                while( (val > waken) && !(i->second.empty()) ) {
-                    i->second.wake_one(queues_mutex);
-                    waken++;
+static bool futex_atomic_op(uint32_t encoded_op, int* uaddr, int* oldval)
+{
+    int op = (encoded_op >> 28) & 7;
+    int oparg = (int)(encoded_op << 8) >> 20;
+    if (encoded_op & (FUTEX_OP_OPARG_SHIFT << 28)) {
+        if (oparg < 0 || oparg > 31) {
+            return false;
+        }
+        oparg = 1 << oparg;
+    }
+    switch (op) {
+    case FUTEX_OP_SET:
+        *oldval = __atomic_exchange_n(uaddr, oparg, __ATOMIC_SEQ_CST);
+        return true;
+    case FUTEX_OP_ADD:
+        *oldval = __atomic_fetch_add(uaddr, oparg, __ATOMIC_SEQ_CST);
+        return true;
+    case FUTEX_OP_OR:
+        *oldval = __atomic_fetch_or(uaddr, oparg, __ATOMIC_SEQ_CST);
+        return true;
+    case FUTEX_OP_ANDN:
+        *oldval = __atomic_fetch_and(uaddr, ~oparg, __ATOMIC_SEQ_CST);
+        return true;
+    case FUTEX_OP_XOR:
+        *oldval = __atomic_fetch_xor(uaddr, oparg, __ATOMIC_SEQ_CST);
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool futex_op_cmp(uint32_t encoded_op, int oldval)
+{
+    int cmp = (encoded_op >> 24) & 15;
+    int cmparg = (int)(encoded_op << 20) >> 20;
+    switch (cmp) {
+    case FUTEX_OP_CMP_EQ: return oldval == cmparg;
+    case FUTEX_OP_CMP_NE: return oldval != cmparg;
+    case FUTEX_OP_CMP_LT: return oldval < cmparg;
+    case FUTEX_OP_CMP_LE: return oldval <= cmparg;
+    case FUTEX_OP_CMP_GT: return oldval > cmparg;
+    case FUTEX_OP_CMP_GE: return oldval >= cmparg;
+    default: return false;
+    }
+}
+
+static int futex_wake_op(int* uaddr, int nr_wake, int nr_wake2, int* uaddr2,
+                         uint32_t encoded_op)
+{
+    if (nr_wake < 0 || nr_wake2 < 0) {
+        return -EINVAL;
+    }
+    int cmp = (encoded_op >> 24) & 15;
+    if (cmp > FUTEX_OP_CMP_GE) {
+        return -ENOSYS;
+    }
+    auto& b1 = futex_hash(uaddr);
+    auto& b2 = futex_hash(uaddr2);
+    futex_double_lock guard(b1, b2);
+    int oldval;
+    if (!futex_atomic_op(encoded_op, uaddr2, &oldval)) {
+        return -ENOSYS;
+    }
+    int woken = futex_wake_locked(b1, uaddr, nr_wake, FUTEX_BITSET_MATCH_ANY);
+    if (futex_op_cmp(encoded_op, oldval)) {
+        woken += futex_wake_locked(b2, uaddr2, nr_wake2, FUTEX_BITSET_MATCH_ANY);
+    }
+    return woken;
+}
+
+static bool futex_has_pi_waiters(futex_bucket& b, int* uaddr)
+{
+    for (auto& w : b.waiters) {
+        if (w.uaddr == uaddr && w.pi) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Takes the PI futex at uaddr for tid if it has no owner. Called with the
+// bucket of uaddr locked.
+static bool futex_try_acquire_pi(futex_bucket& b, int* uaddr, unsigned tid)
+{
+    int v = futex_load(uaddr);
+    while (!(v & FUTEX_TID_MASK)) {
+        int waiters = futex_has_pi_waiters(b, uaddr) ? FUTEX_WAITERS : 0;
+        if (futex_cmpxchg(uaddr, v, tid | waiters)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int futex_lock_pi(int* uaddr, const struct timespec* timeout,
+                         bool realtime, bool trylock)
+{
+    futex_waiter w(uaddr, FUTEX_BITSET_MATCH_ANY);
+    w.pi = true;
+    sched::timer tmr(*sched::thread::current());
+    if (timeout) {
+        futex_set_timer(tmr, timeout, true, realtime);
+    }
+    auto& b = futex_hash(uaddr);
+    WITH_LOCK(b.lock) {
+        int v = futex_load(uaddr);
+        for (;;) {
+            if (!(v & FUTEX_TID_MASK)) {
+                if (futex_try_acquire_pi(b, uaddr, w.tid)) {
+                    return 0;
                 }
-                if(i->second.empty()) {
-                    queues.erase(i);
+                v = futex_load(uaddr);
+                continue;
+            }
+            if ((unsigned)(v & FUTEX_TID_MASK) == w.tid) {
+                return -EDEADLK;
+            }
+            if (trylock) {
+                return -EWOULDBLOCK;
+            }
+            // Make the owner's unlock come to the kernel
+            if ((v & FUTEX_WAITERS) || futex_cmpxchg(uaddr, v, v | FUTEX_WAITERS)) {
+                break;
+            }
+        }
+        futex_enqueue(b, w);
+    }
+    // When woken, the unlocking thread has made us the owner
+    return futex_wait_queued(w, timeout ? &tmr : nullptr);
+}
+
+static int futex_unlock_pi(int* uaddr)
+{
+    unsigned tid = sched::thread::current()->id();
+    auto& b = futex_hash(uaddr);
+    WITH_LOCK(b.lock) {
+        int v = futex_load(uaddr);
+        if ((unsigned)(v & FUTEX_TID_MASK) != tid) {
+            return -EPERM;
+        }
+        futex_waiter* next = nullptr;
+        bool more = false;
+        for (auto& w : b.waiters) {
+            if (w.uaddr == uaddr && w.pi) {
+                if (next) {
+                    more = true;
+                    break;
                 }
-                return waken;
+                next = &w;
             }
         }
+        if (!next) {
+            __atomic_store_n(uaddr, 0, __ATOMIC_SEQ_CST);
+            return 0;
+        }
+        // Hand the futex over to the first waiter
+        __atomic_store_n(uaddr, next->tid | (more ? FUTEX_WAITERS : 0), __ATOMIC_SEQ_CST);
+        futex_wake_waiter(b, *next);
         return 0;
+    }
+}
+
+// FUTEX_CMP_REQUEUE_PI: the first FUTEX_WAIT_REQUEUE_PI waiter on uaddr
+// is given the PI futex at uaddr2 if it is free, up to nr_requeue others
+// are moved to wait for it as FUTEX_LOCK_PI waiters.
+static int futex_cmp_requeue_pi(int* uaddr, int nr_wake, int nr_requeue,
+                                int* uaddr2, int cmpval)
+{
+    if (nr_wake != 1 || nr_requeue < 0 || uaddr == uaddr2) {
+        return -EINVAL;
+    }
+    auto& b1 = futex_hash(uaddr);
+    auto& b2 = futex_hash(uaddr2);
+    futex_double_lock guard(b1, b2);
+    if (futex_load(uaddr) != cmpval) {
+        return -EAGAIN;
+    }
+    int count = 0, requeued = 0;
+    bool first = true;
+    for (auto it = b1.waiters.begin(); it != b1.waiters.end(); ) {
+        futex_waiter& w = *it++;
+        if (w.uaddr != uaddr) {
+            continue;
+        }
+        if (w.requeue_pi != uaddr2) {
+            return count ? count : -EINVAL;
+        }
+        if (first) {
+            first = false;
+            if (futex_try_acquire_pi(b2, uaddr2, w.tid)) {
+                futex_wake_waiter(b1, w);
+                count++;
+                continue;
+            }
+        }
+        if (requeued == nr_requeue) {
+            break;
+        }
+        __atomic_fetch_or(uaddr2, FUTEX_WAITERS, __ATOMIC_SEQ_CST);
+        w.pi = true;
+        futex_move_waiter(b1, b2, w, uaddr2);
+        requeued++;
+        count++;
+    }
+    return count;
+}
+
+int futex(int *uaddr, int op, int val, const struct timespec *timeout,
+        int *uaddr2, uint32_t val3)
+{
+    // The requeue and wake-op operations pass a second count instead of
+    // the timeout
+    int val2 = (int)reinterpret_cast<uintptr_t>(timeout);
+    bool realtime = op & FUTEX_CLOCK_REALTIME;
+    int ret;
+
+    switch (op & FUTEX_CMD_MASK) {
+    case FUTEX_WAIT:
+        ret = futex_wait(uaddr, val, timeout, false, false, FUTEX_BITSET_MATCH_ANY, nullptr);
+        break;
+    case FUTEX_WAIT_BITSET:
+        // The timeout is an absolute time point, of the real-time clock if
+        // FUTEX_CLOCK_REALTIME is set and of the monotonic clock otherwise
+        ret = futex_wait(uaddr, val, timeout, true, realtime, val3, nullptr);
+        break;
+    case FUTEX_WAKE:
+        ret = futex_wake(uaddr, val, FUTEX_BITSET_MATCH_ANY);
+        break;
+    case FUTEX_WAKE_BITSET:
+        ret = futex_wake(uaddr, val, val3);
+        break;
+    case FUTEX_REQUEUE:
+        ret = futex_requeue(uaddr, val, val2, uaddr2, nullptr);
+        break;
+    case FUTEX_CMP_REQUEUE:
+        ret = futex_requeue(uaddr, val, val2, uaddr2, reinterpret_cast<int*>(&val3));
+        break;
+    case FUTEX_WAKE_OP:
+        ret = futex_wake_op(uaddr, val, val2, uaddr2, val3);
+        break;
+    case FUTEX_LOCK_PI:
+        // Always an absolute time point of the real-time clock
+        ret = futex_lock_pi(uaddr, timeout, true, false);
+        break;
+    case FUTEX_LOCK_PI2:
+        ret = futex_lock_pi(uaddr, timeout, realtime, false);
+        break;
+    case FUTEX_TRYLOCK_PI:
+        ret = futex_lock_pi(uaddr, nullptr, false, true);
+        break;
+    case FUTEX_UNLOCK_PI:
+        ret = futex_unlock_pi(uaddr);
+        break;
+    case FUTEX_WAIT_REQUEUE_PI:
+        ret = futex_wait(uaddr, val, timeout, true, realtime, FUTEX_BITSET_MATCH_ANY, uaddr2);
+        break;
+    case FUTEX_CMP_REQUEUE_PI:
+        ret = futex_cmp_requeue_pi(uaddr, val, val2, uaddr2, val3);
+        break;
     default:
-        abort("Unimplemented futex() operation %d\n", op);
+        ret = -ENOSYS;
+        break;
     }
+
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+    return ret;
 }
 
 // We're not supposed to export the get_mempolicy() function, as this
@@ -568,6 +1012,12 @@ OSV_LIBC_API long syscall(long number, ...)
     SYSCALL4(clock_nanosleep, clockid_t, int, const struct timespec *, struct timespec *);
     SYSCALL4(mknodat, int, const char *, mode_t, dev_t);
     SYSCALL5(statx, int, const char *, int, unsigned int, struct statx *);
+    SYSCALL2(io_uring_setup, unsigned, struct io_uring_params *);
+    SYSCALL6(io_uring_enter, int, unsigned, unsigned, unsigned, const sigset_t *, size_t);
+    SYSCALL4(io_uring_register, int, unsigned, void *, unsigned);
+    SYSCALL6(splice, int, off_t *, int, off_t *, size_t, unsigned);
+    SYSCALL4(vmsplice, int, const struct iovec *, size_t, unsigned);
+    SYSCALL4(tee, int, int, size_t, unsigned);
     }
 
     debug_always("syscall(): unimplemented system call %d\n", number);
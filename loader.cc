@@ -167,6 +167,8 @@ static std::chrono::nanoseconds boot_delay;
 std::vector<mntent> opt_mount_fs;
 bool opt_maxnic = false;
 int maxnic;
+int net_rx_loan_limit;
+bool opt_fast_fdalloc = false;
 bool opt_pci_disabled = false;
 
 static int sampler_frequency;
@@ -185,6 +187,8 @@ static void usage()
     std::cout << "  --rootfs=arg          root filesystem to use (zfs, rofs, ramfs or virtiofs)\n";
     std::cout << "  --assign-net          assign virtio network to the application\n";
     std::cout << "  --maxnic=arg          maximum NIC number\n";
+    std::cout << "  --rx-loan-limit=arg   max receive buffers a NIC loans out before copying\n";
+    std::cout << "  --fast-fdalloc        don't insist on the lowest free file descriptor\n";
     std::cout << "  --norandom            don't initialize any random device\n";
     std::cout << "  --noshutdown          continue running after main() returns\n";
     std::cout << "  --power-off-on-abort  use poweroff instead of halt if it's aborted\n";
@@ -256,6 +260,14 @@ static void parse_options(int loader_argc, char** loader_argv)
         maxnic = options::extract_option_int_value(options_values, "maxnic", handle_parse_error);
     }
 
+    if (options::option_value_exists(options_values, "rx-loan-limit")) {
+        net_rx_loan_limit = options::extract_option_int_value(options_values, "rx-loan-limit", handle_parse_error);
+    }
+
+    if (extract_option_flag(options_values, "fast-fdalloc")) {
+        opt_fast_fdalloc = true;
+    }
+
     if (extract_option_flag(options_values, "trace-backtrace")) {
         opt_log_backtrace = true;
     }
@@ -460,6 +472,24 @@ void* do_main_thread(void *_main_args)
     }
     boot_time.event("drivers loaded");
 
+    // Bring up the network interfaces and start DHCP now, and wait for the
+    // IP only after mounting the root filesystem, so the two overlap.
+    bool has_if = false;
+    osv::for_each_if([&has_if] (std::string if_name) {
+        if (if_name == "lo0")
+            return;
+
+        has_if = true;
+        // Configured by DHCP, unless --ip gives the address
+        if (osv::start_if(if_name, "0.0.0.0", "255.255.255.0") != 0 ||
+            osv::ifup(if_name) != 0)
+            debug("Could not initialize network interface.\n");
+    });
+    bool use_dhcp = has_if && opt_ip.size() == 0;
+    if (use_dhcp) {
+        dhcp_start(false);
+    }
+
     if (opt_mount) {
         unmount_devfs();
 
@@ -510,20 +540,10 @@ void* do_main_thread(void *_main_args)
         load_zfs_library();
     }
 
-    bool has_if = false;
-    osv::for_each_if([&has_if] (std::string if_name) {
-        if (if_name == "lo0")
-            return;
-
-        has_if = true;
-        // Start DHCP by default and wait for an IP
-        if (osv::start_if(if_name, "0.0.0.0", "255.255.255.0") != 0 ||
-            osv::ifup(if_name) != 0)
-            debug("Could not initialize network interface.\n");
-    });
     if (has_if) {
-        if (opt_ip.size() == 0) {
-            dhcp_start(true);
+        if (use_dhcp) {
+            dhcp_wait();
+            boot_time.event("DHCP done");
         } else {
             for (auto t : opt_ip) {
                 std::vector<std::string> tmp;
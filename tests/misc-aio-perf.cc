@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// libaio queue depth and latency: keeps a fixed number of random reads in
+// flight with io_submit()/io_getevents() on a block device (or a file) for
+// each of a range of queue depths, and reports IOPS and the average and
+// worst completion latency at each depth.
+//
+// On a block device the reads go straight to the driver as bios, so this
+// shows how far a single thread gets by deepening the queue instead of
+// adding threads. It requires a standalone block device like
+// misc-bdev-rw.cc does:
+//
+// dd if=/dev/zero of=/tmp/test1.raw bs=1M count=512
+// ./scripts/run.py -e '/tests/misc-aio-perf.so /dev/vblk1' --cloud-init-image /tmp/test1.raw
+//
+// Usage: misc-aio-perf.so [path [block-size [span-MB [seconds]]]]
+// Reads are spread over the first span-MB (default 64) megabytes.
+
+#include <api/libaio.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+
+using clk = std::chrono::high_resolution_clock;
+
+struct request {
+    struct iocb iocb;
+    clk::time_point submitted;
+};
+
+static off_t random_offset(off_t size, size_t bs)
+{
+    return (random() % (size / bs)) * bs;
+}
+
+static bool bench(int fd, off_t size, size_t bs, int depth, int seconds)
+{
+    io_context_t ctx = nullptr;
+    int ret = io_setup(depth, &ctx);
+    if (ret < 0) {
+        printf("io_setup: %s\n", strerror(-ret));
+        return false;
+    }
+
+    std::vector<request> reqs(depth);
+    std::vector<char*> bufs(depth);
+    std::vector<struct iocb*> iocbs;
+    for (int i = 0; i < depth; i++) {
+        bufs[i] = static_cast<char*>(aligned_alloc(4096, bs));
+        io_prep_pread(&reqs[i].iocb, fd, bufs[i], bs, random_offset(size, bs));
+        reqs[i].iocb.data = &reqs[i];
+        reqs[i].submitted = clk::now();
+        iocbs.push_back(&reqs[i].iocb);
+    }
+
+    bool ok = true;
+    long completed = 0;
+    double total_latency = 0, max_latency = 0;
+    auto start = clk::now();
+    auto end = start + std::chrono::seconds(seconds);
+    if (io_submit(ctx, depth, iocbs.data()) != depth) {
+        printf("io_submit failed\n");
+        ok = false;
+    }
+
+    std::vector<io_event> events(depth);
+    int inflight = ok ? depth : 0;
+    while (inflight > 0) {
+        int n = io_getevents(ctx, 1, depth, events.data(), nullptr);
+        if (n < 0) {
+            printf("io_getevents: %s\n", strerror(-n));
+            ok = false;
+            break;
+        }
+        auto now = clk::now();
+        iocbs.clear();
+        for (int i = 0; i < n; i++) {
+            auto req = static_cast<request*>(events[i].data);
+            if ((long)events[i].res != (long)bs) {
+                printf("read failed: %ld\n", (long)events[i].res);
+                ok = false;
+            }
+            std::chrono::duration<double, std::micro> latency = now - req->submitted;
+            total_latency += latency.count();
+            if (latency.count() > max_latency) {
+                max_latency = latency.count();
+            }
+            completed++;
+            inflight--;
+            if (ok && now < end) {
+                req->iocb.u.c.offset = random_offset(size, bs);
+                req->submitted = now;
+                iocbs.push_back(&req->iocb);
+            }
+        }
+        if (!iocbs.empty()) {
+            if (io_submit(ctx, iocbs.size(), iocbs.data()) != (int)iocbs.size()) {
+                printf("io_submit failed\n");
+                ok = false;
+            } else {
+                inflight += iocbs.size();
+            }
+        }
+    }
+    std::chrono::duration<double> sec = clk::now() - start;
+
+    if (ok) {
+        printf("%5d %10.0f %12.1f %12.1f\n", depth, completed / sec.count(),
+               total_latency / completed, max_latency);
+    }
+
+    io_destroy(ctx);
+    for (auto buf : bufs) {
+        free(buf);
+    }
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = "/dev/vblk1";
+    size_t bs = 4096;
+    off_t size = 64 << 20;
+    int seconds = 5;
+    if (argc > 1) {
+        path = argv[1];
+    }
+    if (argc > 2) {
+        bs = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        size = (off_t)atoi(argv[3]) << 20;
+    }
+    if (argc > 4) {
+        seconds = atoi(argv[4]);
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    if (size < (off_t)bs) {
+        printf("span smaller than the block size\n");
+        return 1;
+    }
+
+    printf("%s: %zu byte reads\n", path, bs);
+    printf("depth       IOPS  avg lat(us)  max lat(us)\n");
+    bool ok = true;
+    for (int depth = 1; depth <= 64 && ok; depth *= 2) {
+        ok = bench(fd, size, bs, depth, seconds);
+    }
+    close(fd);
+    printf("Test %s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : 1;
+}
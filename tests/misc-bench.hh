@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef _MISC_BENCH_HH
+#define _MISC_BENCH_HH
+
+// Scalability harness shared by the misc-*-perf tests: an operation is run
+// in a loop on 1, 2, 4... threads up to the number of CPUs, and one line
+// per thread count reports the total and per-thread rate.
+
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+static void bench_header(const char* unit)
+{
+    printf("%-10s %7s %15s %15s\n", "op", "threads", unit, "per thread");
+}
+
+// Run op(i, j) in a loop on each of nthreads threads for the given number
+// of seconds, i being the thread's index and j the number of calls it made
+// before. op() returns how many operations it did, or -1 after a failure,
+// which stops the run and fails the test.
+template <typename Op>
+static bool bench(const char* name, unsigned nthreads, int seconds, Op op)
+{
+    std::atomic<bool> done(false);
+    std::atomic<bool> ok(true);
+    std::atomic<long> total(0);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned i = 0; i < nthreads; i++) {
+        threads.emplace_back([&, i] {
+            long ops = 0;
+            for (unsigned long j = 0; !done.load(std::memory_order_relaxed); j++) {
+                long n = op(i, j);
+                if (n < 0) {
+                    ok = false;
+                    break;
+                }
+                ops += n;
+            }
+            total += ops;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    done = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+    std::chrono::duration<double> sec =
+        std::chrono::high_resolution_clock::now() - start;
+    double rate = total / sec.count();
+    printf("%-10s %7u %15.0f %15.0f\n", name, nthreads, rate, rate / nthreads);
+    return ok;
+}
+
+// bench() on 1, 2, 4... threads up to the number of CPUs, and on all of
+// them if that isn't a power of two. Stops at the first failure.
+template <typename Op>
+static bool bench_scaling(const char* name, int seconds, Op op)
+{
+    unsigned ncpus = std::thread::hardware_concurrency();
+    bool ok = true;
+    for (unsigned n = 1; n <= ncpus && ok; n *= 2) {
+        ok = bench(name, n, seconds, op);
+    }
+    if (ok && (ncpus & (ncpus - 1))) {
+        ok = bench(name, ncpus, seconds, op);
+    }
+    return ok;
+}
+
+#endif
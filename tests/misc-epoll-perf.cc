@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// epoll scalability: registers many eventfds with one epoll and measures
+// (1) how fast EPOLL_CTL_ADD/DEL go, (2) how many events per second a
+// thread gets through epoll_wait() while another thread signals random
+// files among the registered ones, and (3) the thundering herd when
+// several threads, each with its own epoll, wait for connections on one
+// listening socket, with and without EPOLLEXCLUSIVE.
+//
+// Usage: misc-epoll-perf.so [nfiles [seconds [nthreads]]]
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1U << 28)
+#endif
+
+using clk = std::chrono::high_resolution_clock;
+
+static double seconds_since(clk::time_point start)
+{
+    return std::chrono::duration<double>(clk::now() - start).count();
+}
+
+static bool bench_ctl(int ep, const std::vector<int>& fds)
+{
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    auto start = clk::now();
+    for (auto fd : fds) {
+        ev.data.fd = fd;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl ADD");
+            return false;
+        }
+    }
+    double add = seconds_since(start);
+    start = clk::now();
+    for (auto fd : fds) {
+        if (epoll_ctl(ep, EPOLL_CTL_DEL, fd, nullptr) < 0) {
+            perror("epoll_ctl DEL");
+            return false;
+        }
+    }
+    double del = seconds_since(start);
+    printf("ctl: %.0f adds/s, %.0f dels/s\n", fds.size() / add, fds.size() / del);
+    return true;
+}
+
+static bool bench_wait(int ep, const std::vector<int>& fds, int seconds)
+{
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    for (auto fd : fds) {
+        ev.data.fd = fd;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl ADD");
+            return false;
+        }
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<long> signalled(0);
+    std::thread producer([&] {
+        uint64_t one = 1;
+        while (!done.load(std::memory_order_relaxed)) {
+            // keep a few hundred events outstanding at a time
+            if (signalled.load(std::memory_order_relaxed) > 256) {
+                std::this_thread::yield();
+                continue;
+            }
+            int fd = fds[random() % fds.size()];
+            if (write(fd, &one, sizeof(one)) == sizeof(one)) {
+                signalled.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    });
+
+    long events = 0, waits = 0;
+    struct epoll_event evs[64];
+    auto start = clk::now();
+    while (seconds_since(start) < seconds) {
+        int n = epoll_wait(ep, evs, 64, 100);
+        if (n < 0) {
+            perror("epoll_wait");
+            break;
+        }
+        waits++;
+        for (int i = 0; i < n; i++) {
+            uint64_t v;
+            if (read(evs[i].data.fd, &v, sizeof(v)) == sizeof(v)) {
+                signalled.fetch_sub(v, std::memory_order_relaxed);
+                events++;
+            }
+        }
+    }
+    double sec = seconds_since(start);
+    done = true;
+    producer.join();
+
+    printf("wait: %zu files, %.0f events/s, %.1f events per epoll_wait\n",
+           fds.size(), events / sec, waits ? (double)events / waits : 0.0);
+    for (auto fd : fds) {
+        epoll_ctl(ep, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    return events > 0;
+}
+
+// Each thread waits on its own epoll for the shared listening socket, and
+// counts the wakeups in which it found no connection to accept.
+static bool bench_accept(int nthreads, int connections, bool exclusive)
+{
+    int ls = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (ls < 0 || bind(ls, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(ls, 1024) < 0 || getsockname(ls, (struct sockaddr*)&addr, &len) < 0) {
+        perror("listening socket");
+        return false;
+    }
+    fcntl(ls, F_SETFL, fcntl(ls, F_GETFL) | O_NONBLOCK);
+
+    std::atomic<bool> done(false);
+    std::atomic<int> accepted(0);
+    std::atomic<long> wakeups(0), empty(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nthreads; i++) {
+        threads.emplace_back([&] {
+            int ep = epoll_create1(0);
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN | (exclusive ? EPOLLEXCLUSIVE : 0);
+            epoll_ctl(ep, EPOLL_CTL_ADD, ls, &ev);
+            while (!done.load(std::memory_order_relaxed)) {
+                if (epoll_wait(ep, &ev, 1, 100) != 1) {
+                    continue;
+                }
+                wakeups++;
+                int s = accept(ls, nullptr, nullptr);
+                if (s < 0) {
+                    empty++;
+                    continue;
+                }
+                close(s);
+                accepted++;
+            }
+            close(ep);
+        });
+    }
+
+    auto start = clk::now();
+    for (int i = 0; i < connections; i++) {
+        int s = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(s, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror("connect");
+            close(s);
+            break;
+        }
+        close(s);
+        // one connection at a time, so every waiter may see it
+        while (accepted.load() <= i && seconds_since(start) < 10) {
+            std::this_thread::yield();
+        }
+    }
+    double sec = seconds_since(start);
+    done = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+    close(ls);
+
+    printf("accept%s: %d threads, %.0f connections/s, %.2f wakeups per connection "
+           "(%ld found nothing)\n", exclusive ? " EPOLLEXCLUSIVE" : "",
+           nthreads, accepted / sec, accepted ? (double)wakeups / accepted : 0.0,
+           empty.load());
+    return accepted == connections;
+}
+
+int main(int argc, char** argv)
+{
+    int nfiles = 10000;
+    int seconds = 5;
+    int nthreads = 8;
+    if (argc > 1) {
+        nfiles = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        seconds = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        nthreads = atoi(argv[3]);
+    }
+
+    std::vector<int> fds;
+    for (int i = 0; i < nfiles; i++) {
+        int fd = eventfd(0, EFD_NONBLOCK);
+        if (fd < 0) {
+            perror("eventfd");
+            return 1;
+        }
+        fds.push_back(fd);
+    }
+
+    int ep = epoll_create1(0);
+    bool ok = bench_ctl(ep, fds) && bench_wait(ep, fds, seconds);
+    close(ep);
+    for (auto fd : fds) {
+        close(fd);
+    }
+
+    ok = ok && bench_accept(nthreads, 2000, false);
+    ok = ok && bench_accept(nthreads, 2000, true);
+
+    printf("Test %s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// File descriptor allocation under concurrency: each thread keeps a window
+// of open sockets and repeatedly closes its oldest one and opens a new
+// one, like an accept()-heavy server does, and the test reports the
+// socket open/close rate for 1, 2, 4... threads up to the number of CPUs.
+//
+// Run it as is for the POSIX lowest-free-descriptor allocation, and with
+// the --fast-fdalloc loader option for the per-CPU one:
+//
+// ./scripts/run.py -e '--fast-fdalloc /tests/misc-fd-perf.so'
+//
+// Usage: misc-fd-perf.so [seconds [window]]
+
+#include "misc-bench.hh"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// Replace the oldest of the sockets a thread keeps open
+static long reopen(std::vector<int>& fds, unsigned long j)
+{
+    int& fd = fds[j % fds.size()];
+    if (fd >= 0) {
+        close(fd);
+    }
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    int seconds = 5;
+    int window = 64;
+    if (argc > 1) {
+        seconds = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        window = atoi(argv[2]);
+    }
+
+    // Sanity check of the allocation policy: the descriptor just closed is
+    // the lowest free one and must be reused, unless --fast-fdalloc was
+    // given, which is then told by the descriptor being above FD_SETSIZE.
+    int a = socket(AF_INET, SOCK_STREAM, 0);
+    int b = socket(AF_INET, SOCK_STREAM, 0);
+    close(a);
+    int c = socket(AF_INET, SOCK_STREAM, 0);
+    close(b);
+    close(c);
+    if (a >= FD_SETSIZE) {
+        printf("fast descriptor allocation\n");
+    } else if (c != a) {
+        printf("closed descriptor %d not reused, got %d\n", a, c);
+        printf("Test FAILED\n");
+        return 1;
+    }
+
+    std::vector<std::vector<int>> windows(std::thread::hardware_concurrency(),
+                                          std::vector<int>(window, -1));
+    bench_header("open+close/sec");
+    bool ok = bench_scaling("socket", seconds, [&] (unsigned i, unsigned long j) {
+        return reopen(windows[i], j);
+    });
+    for (auto& fds : windows) {
+        for (auto fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+    printf("Test %s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : 1;
+}
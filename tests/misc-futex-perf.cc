@@ -13,14 +13,20 @@
 #include <chrono>
 #include <iostream>
 #include <vector>
+#include <string>
 
 // This test is based on misc-mutex2.cc written by Nadav Har'El. But unlike
 // the other one, it focuses on measuring the performance of the futex()
 // syscall implementation. It does it indirectly by implementing mutex based
 // on futex syscall according to the formula specified in the Ulrich Drepper's
 // paper "Futexes Are Tricky".
-// It takes three parameters: mandatory number of threads (nthreads) and
-// a computation length (worklen) and optional number of mutexes (nmutexes).
+// It takes four parameters: mandatory number of threads (nthreads) and
+// a computation length (worklen), optional number of mutexes (nmutexes)
+// and optional mutex type: "plain" (the default) for the FUTEX_WAIT/
+// FUTEX_WAKE based mutex below, or "pi" for a priority-inheritance mutex
+// built on FUTEX_LOCK_PI/FUTEX_UNLOCK_PI like glibc's PTHREAD_PRIO_INHERIT
+// ones. Many mutexes contended at once exercise how well the futex
+// implementation scales across unrelated futex words.
 // The test groups all threads (nthreads * nmutexes) into nmutexes sets
 // where nthreads threads loop trying to take the group mutex (one out of nmutexes)
 // and increment the group counter and then do some short computation of the
@@ -96,6 +102,35 @@ private:
     uint32_t _state;
 };
 
+// A priority-inheritance mutex: the futex word holds the owner's TID, and
+// the kernel is only entered on contention, to wait for the owner or to hand
+// the mutex over to a waiter.
+class pimutex {
+public:
+    pimutex() : _state(0) {}
+    void lock()
+    {
+        if (cmpxchg(&_state, 0, tid()) != 0) {
+            syscall(SYS_futex, &_state, FUTEX_LOCK_PI_PRIVATE, 0, 0, 0, 0);
+        }
+    }
+
+    void unlock()
+    {
+        uint32_t me = tid();
+        if (cmpxchg(&_state, me, 0) != me) {
+            syscall(SYS_futex, &_state, FUTEX_UNLOCK_PI_PRIVATE, 0, 0, 0, 0);
+        }
+    }
+private:
+    static uint32_t tid()
+    {
+        static thread_local uint32_t id = syscall(SYS_gettid);
+        return id;
+    }
+    uint32_t _state;
+};
+
 void loop(int iterations)
 {
     for (register int i=0; i<iterations; i++) {
@@ -104,14 +139,51 @@ void loop(int iterations)
     }
 }
 
+template <typename Mutex>
+static long run(int nthreads, int nmutexes, int worklen, double secs)
+{
+    // Our mutex-protected operation will be a silly increment of a counter,
+    // taking a tiny amount of time, but still can happen concurrently if
+    // run very frequently from many cores in parallel.
+    long counters[nmutexes] = {0};
+    bool done = false;
+
+    Mutex mut[nmutexes];
+    std::vector<std::thread> threads;
+    for (int m = 0; m < nmutexes; m++) {
+        for (int i = 0; i < nthreads; i++) {
+            threads.push_back(std::thread([&, m]() {
+                while (!done) {
+                    mut[m].lock();
+                    counters[m]++;
+                    mut[m].unlock();
+                    loop(worklen);
+                }
+            }));
+        }
+    }
+    threads.push_back(std::thread([&]() {
+        std::this_thread::sleep_for(std::chrono::duration<double>(secs));
+        done = true;
+    }));
+    for (auto &t : threads) {
+        t.join();
+    }
+    long total = 0;
+    for (int m = 0; m < nmutexes; m++) {
+        total += counters[m];
+    }
+    return total;
+}
+
 int main(int argc, char** argv) {
     if (argc <= 2) {
-        std::cerr << "Usage: " << argv[0] << " nthreads worklen <nmutexes>\n";
+        std::cerr << "Usage: " << argv[0] << " nthreads worklen <nmutexes> <plain|pi>\n";
         return 1;
     }
     int nthreads = atoi(argv[1]);
     if (nthreads <= 0) {
-        std::cerr << "Usage: " << argv[0] << " nthreads worklen <nmutexes>\n";
+        std::cerr << "Usage: " << argv[0] << " nthreads worklen <nmutexes> <plain|pi>\n";
         return 2;
     }
     // "worklen" is the amount of work to do in each loop iteration, outside
@@ -121,7 +193,7 @@ int main(int argc, char** argv) {
     // parallel.
     int worklen = atoi(argv[2]);
     if (worklen < 0) {
-        std::cerr << "Usage: " << argv[0] << " nthreads worklen <nmutexes>\n";
+        std::cerr << "Usage: " << argv[0] << " nthreads worklen <nmutexes> <plain|pi>\n";
         return 3;
     }
 
@@ -135,6 +207,11 @@ int main(int argc, char** argv) {
             nmutexes = 1;
     }
 
+    bool pi = false;
+    if (argc >= 5) {
+        pi = std::string(argv[4]) == "pi";
+    }
+
     int concurrency = 0;
     cpu_set_t cs;
     sched_getaffinity(0, sizeof(cs), &cs);
@@ -145,7 +222,7 @@ int main(int argc, char** argv) {
     }
     std::cerr << "Running " << (nthreads * nmutexes) << " threads on " <<
             concurrency << " cores with " << nmutexes <<
-            " mutexes. Worklen = " <<
+            (pi ? " PI" : "") << " mutexes. Worklen = " <<
             worklen << "\n";
 
     // Set secs to the desired number of seconds a measurement should
@@ -153,37 +230,8 @@ int main(int argc, char** argv) {
     // secs, as we do several tests each lasting at least this long.
     double secs = 30.0;
 
-    // Our mutex-protected operation will be a silly increment of a counter,
-    // taking a tiny amount of time, but still can happen concurrently if
-    // run very frequently from many cores in parallel.
-    long counters[nmutexes] = {0};
-    bool done = false;
-
-    fmutex mut[nmutexes];
-    std::vector<std::thread> threads;
-    for (int m = 0; m < nmutexes; m++) {
-        for (int i = 0; i < nthreads; i++) {
-            threads.push_back(std::thread([&, m]() {
-                while (!done) {
-                    mut[m].lock();
-                    counters[m]++;
-                    mut[m].unlock();
-                    loop(worklen);
-                }
-            }));
-        }
-    }
-    threads.push_back(std::thread([&]() {
-        std::this_thread::sleep_for(std::chrono::duration<double>(secs));
-        done = true;
-    }));
-    for (auto &t : threads) {
-        t.join();
-    }
-    long total = 0;
-    for (int m = 0; m < nmutexes; m++) {
-        total += counters[m];
-    }
+    long total = pi ? run<pimutex>(nthreads, nmutexes, worklen, secs) :
+                      run<fmutex>(nthreads, nmutexes, worklen, secs);
     std::cout << total << " counted in " << secs << " seconds (" << (total/secs) << " per sec)\n";
 
     return 0;
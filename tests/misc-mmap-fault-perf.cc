@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Page fault scalability on file mappings: every thread repeatedly maps a
+// file read-only, touches each page and unmaps it. After the first pass
+// all pages are in the page cache, so this measures how well faults on
+// cached pages proceed in parallel.
+//
+// Usage: misc-mmap-fault-perf.so [file [seconds]]
+// The file defaults to this test's own binary, which is on the root
+// filesystem of any test image.
+
+#include "misc-bench.hh"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+
+static const char* file = "/tests/misc-mmap-fault-perf.so";
+static size_t file_size;
+static int fd;
+
+static long fault_pages()
+{
+    void* p = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    volatile char sum = 0;
+    long pages = 0;
+    for (size_t off = 0; off < file_size; off += 4096) {
+        sum += static_cast<char*>(p)[off];
+        pages++;
+    }
+    munmap(p, file_size);
+    return pages;
+}
+
+int main(int argc, char** argv)
+{
+    int seconds = 2;
+    if (argc > 1) {
+        file = argv[1];
+    }
+    if (argc > 2) {
+        seconds = atoi(argv[2]);
+    }
+    fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        perror(file);
+        return 1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    file_size = st.st_size;
+
+    // bring the whole file into the page cache
+    bool ok = fault_pages() >= 0;
+
+    printf("%s: %zu pages\n", file, (file_size + 4095) / 4096);
+    bench_header("faults/sec");
+    ok = ok && bench_scaling("fault", seconds, [] (unsigned, unsigned long) {
+        return fault_pages();
+    });
+    close(fd);
+    printf("Test %s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : 1;
+}
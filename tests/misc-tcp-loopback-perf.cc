@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// TCP over 127.0.0.1: streaming throughput for several write sizes, and
+// the round trip time of a one byte ping-pong, with an AF_UNIX socket pair
+// as a reference for what a local byte stream can do. The writer shuts
+// down its end when done, and the reader checks that it got every byte
+// before the EOF.
+//
+// To compare against the full TCP path, run it once more after setting
+// net.inet.tcp.loop_bypass to 0.
+//
+// Usage: misc-tcp-loopback-perf.so [seconds [port]]
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <functional>
+
+using clk = std::chrono::high_resolution_clock;
+
+// A connected pair of stream sockets.
+typedef std::function<bool (int fds[2])> connector;
+
+static bool tcp_pair(int port, int fds[2])
+{
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sin = {};
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(lfd, (struct sockaddr*)&sin, sizeof(sin)) < 0 ||
+        listen(lfd, 1) < 0) {
+        perror("bind/listen");
+        close(lfd);
+        return false;
+    }
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fds[0], (struct sockaddr*)&sin, sizeof(sin)) < 0) {
+        perror("connect");
+        close(fds[0]);
+        close(lfd);
+        return false;
+    }
+    fds[1] = accept(lfd, nullptr, nullptr);
+    close(lfd);
+    if (fds[1] < 0) {
+        perror("accept");
+        close(fds[0]);
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        setsockopt(fds[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return true;
+}
+
+static bool unix_pair(int fds[2])
+{
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        return false;
+    }
+    return true;
+}
+
+static bool throughput(const char* name, connector conn, size_t wsize,
+                       int seconds)
+{
+    int fds[2];
+    if (!conn(fds)) {
+        return false;
+    }
+    std::atomic<bool> done(false);
+    long sent = 0;
+    bool ok = true;
+    std::thread writer([&] {
+        std::vector<char> buf(wsize, 'x');
+        while (!done.load(std::memory_order_relaxed)) {
+            ssize_t n = write(fds[0], buf.data(), buf.size());
+            if (n < 0) {
+                perror("write");
+                ok = false;
+                break;
+            }
+            sent += n;
+        }
+        shutdown(fds[0], SHUT_WR);
+    });
+    std::vector<char> buf(65536);
+    long received = 0;
+    auto start = clk::now();
+    auto end = start + std::chrono::seconds(seconds);
+    for (;;) {
+        ssize_t n = read(fds[1], buf.data(), buf.size());
+        if (n <= 0) {
+            if (n < 0) {
+                perror("read");
+                ok = false;
+            }
+            break;
+        }
+        received += n;
+        if (!done.load(std::memory_order_relaxed) && clk::now() >= end) {
+            done = true;
+        }
+    }
+    std::chrono::duration<double> sec = clk::now() - start;
+    writer.join();
+    close(fds[0]);
+    close(fds[1]);
+    if (received != sent) {
+        printf("%s: sent %ld bytes, received %ld\n", name, sent, received);
+        ok = false;
+    }
+    printf("%-6s %8zu %12.1f\n", name, wsize, received / sec.count() / 1e6);
+    return ok;
+}
+
+static bool latency(const char* name, connector conn, int seconds)
+{
+    int fds[2];
+    if (!conn(fds)) {
+        return false;
+    }
+    bool ok = true;
+    std::thread echo([&] {
+        char c;
+        while (read(fds[1], &c, 1) == 1) {
+            if (write(fds[1], &c, 1) != 1) {
+                break;
+            }
+        }
+    });
+    long rounds = 0;
+    auto start = clk::now();
+    auto end = start + std::chrono::seconds(seconds);
+    char c = 0;
+    while (clk::now() < end) {
+        if (write(fds[0], &c, 1) != 1 || read(fds[0], &c, 1) != 1) {
+            perror("ping");
+            ok = false;
+            break;
+        }
+        rounds++;
+    }
+    std::chrono::duration<double> sec = clk::now() - start;
+    shutdown(fds[0], SHUT_WR);
+    echo.join();
+    close(fds[0]);
+    close(fds[1]);
+    printf("%-6s %12.2f\n", name, rounds ? sec.count() * 1e6 / rounds : 0.0);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    int seconds = 3;
+    int port = 10000;
+    if (argc > 1) {
+        seconds = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        port = atoi(argv[2]);
+    }
+    connector tcp = [&] (int fds[2]) { return tcp_pair(port++, fds); };
+    connector local = unix_pair;
+
+    bool ok = true;
+    printf("%-6s %8s %12s\n", "socket", "write", "MB/sec");
+    for (size_t wsize : { 64, 1024, 16384, 65536 }) {
+        ok &= throughput("tcp", tcp, wsize, seconds);
+        ok &= throughput("unix", local, wsize, seconds);
+    }
+    printf("\n%-6s %12s\n", "socket", "rtt (usec)");
+    ok &= latency("tcp", tcp, seconds);
+    ok &= latency("unix", local, seconds);
+
+    printf("Test %s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Path lookup under concurrency: threads stat() or open()+close() files
+// from a shared set, like a JVM loading classes or Python importing
+// modules, and the test reports the lookup rate for 1, 2, 4... threads up
+// to the number of CPUs. Every lookup walks the dentry and vnode caches,
+// so the rate should grow with the number of threads.
+//
+// Usage: misc-vfs-lookup-perf.so [seconds [nfiles [dir]]]
+
+#include "misc-bench.hh"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+
+static long lookup(const std::string& path, bool do_open)
+{
+    if (do_open) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            perror("open");
+            return -1;
+        }
+        close(fd);
+    } else {
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0) {
+            perror("stat");
+            return -1;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    int seconds = 5;
+    int nfiles = 256;
+    std::string dir = "/tmp/misc-vfs-lookup-perf";
+    if (argc > 1) {
+        seconds = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        nfiles = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        dir = argv[3];
+    }
+
+    // A few levels of directories, so that each lookup walks several
+    // path components.
+    std::vector<std::string> dirs = { dir, dir + "/a", dir + "/a/b", dir + "/a/b/c" };
+    for (auto& d : dirs) {
+        mkdir(d.c_str(), 0755);
+    }
+    std::vector<std::string> paths;
+    for (int i = 0; i < nfiles; i++) {
+        auto path = dirs.back() + "/f" + std::to_string(i);
+        int fd = open(path.c_str(), O_CREAT | O_WRONLY, 0644);
+        if (fd < 0) {
+            perror("create");
+            return 1;
+        }
+        close(fd);
+        paths.push_back(path);
+    }
+
+    bench_header("lookups/sec");
+    bool ok = true;
+    for (bool do_open : { false, true }) {
+        ok = ok && bench_scaling(do_open ? "open+close" : "stat", seconds,
+                [&] (unsigned i, unsigned long j) {
+            // Each thread goes through the files from a different one on
+            return lookup(paths[(i + j) % paths.size()], do_open);
+        });
+    }
+
+    for (auto& path : paths) {
+        unlink(path.c_str());
+    }
+    for (auto d = dirs.rbegin(); d != dirs.rend(); d++) {
+        rmdir(d->c_str());
+    }
+
+    printf("Test %s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -6,12 +6,17 @@
  */
 
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <cstdio>
 #include <cstring>
 #include <thread>
 #include <vector>
+#include <string>
 
 int tests = 0, fails = 0;
 
@@ -22,6 +27,174 @@ static void report(bool ok, const char* msg)
     printf("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
 }
 
+static socklen_t make_addr(sockaddr_un& addr, const char* path, bool abstract)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    // An abstract name starts with a null byte, and isn't null terminated
+    strcpy(addr.sun_path + abstract, path);
+    return offsetof(sockaddr_un, sun_path) + strlen(path) + 1;
+}
+
+static void test_named_stream(bool abstract)
+{
+    const char* path = "/tmp/tst-af-local.sock";
+    unlink(path);
+    sockaddr_un addr;
+    auto len = make_addr(addr, path, abstract);
+    const char* kind = abstract ? " (abstract)" : " (path)";
+    auto name = [&] (const char* msg) { return std::string(msg) + kind; };
+
+    int ls = socket(AF_UNIX, SOCK_STREAM, 0);
+    report(ls >= 0, name("stream socket").c_str());
+    int r = bind(ls, (sockaddr*)&addr, len);
+    report(r == 0, name("bind").c_str());
+    int other = socket(AF_UNIX, SOCK_STREAM, 0);
+    r = bind(other, (sockaddr*)&addr, len);
+    report(r == -1 && errno == EADDRINUSE, name("bind to name in use").c_str());
+    close(other);
+    int cs = socket(AF_UNIX, SOCK_STREAM, 0);
+    r = connect(cs, (sockaddr*)&addr, len);
+    report(r == -1 && errno == ECONNREFUSED, name("connect before listen").c_str());
+    close(cs);
+    r = listen(ls, 5);
+    report(r == 0, name("listen").c_str());
+
+    pollfd poller = { ls, POLLIN, 0 };
+    r = poll(&poller, 1, 0);
+    report(r == 0, name("poll listener, no connection").c_str());
+    cs = socket(AF_UNIX, SOCK_STREAM, 0);
+    r = connect(cs, (sockaddr*)&addr, len);
+    report(r == 0, name("connect").c_str());
+    r = poll(&poller, 1, 0);
+    report(r == 1 && poller.revents == POLLIN, name("poll listener, connection pending").c_str());
+    int as = accept(ls, nullptr, nullptr);
+    report(as >= 0, name("accept").c_str());
+
+    sockaddr_un peer;
+    socklen_t plen = sizeof(peer);
+    r = getpeername(cs, (sockaddr*)&peer, &plen);
+    report(r == 0 && plen == len && !memcmp(&peer, &addr, len),
+           name("getpeername").c_str());
+
+    char msg[] = "hello", reply[] = "wrong";
+    r = write(cs, msg, 5);
+    report(r == 5, name("write to connected socket").c_str());
+    r = read(as, reply, 5);
+    report(r == 5 && !memcmp(msg, reply, 5), name("read from accepted socket").c_str());
+    close(cs);
+    r = read(as, reply, 5);
+    report(r == 0, name("read after peer closed").c_str());
+    close(as);
+
+    std::thread t([&] {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        connect(fd, (sockaddr*)&addr, len);
+        write(fd, msg, 5);
+        close(fd);
+    });
+    as = accept(ls, nullptr, nullptr);
+    memset(reply, 0, 5);
+    r = read(as, reply, 5);
+    t.join();
+    report(as >= 0 && r == 5 && !memcmp(msg, reply, 5), name("accept before connect").c_str());
+    close(as);
+
+    fcntl(ls, F_SETFL, O_NONBLOCK);
+    r = accept(ls, nullptr, nullptr);
+    report(r == -1 && errno == EAGAIN, name("non-blocking accept").c_str());
+    close(ls);
+    if (!abstract) {
+        unlink(path);
+    }
+}
+
+static void test_dgram()
+{
+    sockaddr_un addr1, addr2;
+    auto len1 = make_addr(addr1, "tst-af-local-1", true);
+    auto len2 = make_addr(addr2, "tst-af-local-2", true);
+    int s1 = socket(AF_UNIX, SOCK_DGRAM, 0);
+    int s2 = socket(AF_UNIX, SOCK_DGRAM, 0);
+    int r = bind(s1, (sockaddr*)&addr1, len1);
+    report(s1 >= 0 && s2 >= 0 && r == 0, "datagram socket and bind");
+    r = sendto(s2, "x", 1, 0, (sockaddr*)&addr2, len2);
+    report(r == -1 && errno == ECONNREFUSED, "sendto unbound name");
+    r = bind(s2, (sockaddr*)&addr2, len2);
+    report(r == 0, "bind second datagram socket");
+
+    r = sendto(s2, "hello", 5, 0, (sockaddr*)&addr1, len1);
+    int r2 = sendto(s2, "world!", 6, 0, (sockaddr*)&addr1, len1);
+    report(r == 5 && r2 == 6, "sendto");
+    char buf[16] = {};
+    sockaddr_un from;
+    socklen_t flen = sizeof(from);
+    r = recvfrom(s1, buf, sizeof(buf), 0, (sockaddr*)&from, &flen);
+    report(r == 5 && !memcmp(buf, "hello", 5), "recvfrom keeps message boundaries");
+    report(flen == len2 && !memcmp(&from, &addr2, len2), "recvfrom sender address");
+    r = recv(s1, buf, 3, 0);
+    report(r == 3 && !memcmp(buf, "wor", 3), "recv truncates datagram");
+    r = recv(s1, buf, sizeof(buf), MSG_DONTWAIT);
+    report(r == -1 && errno == EAGAIN, "rest of truncated datagram is dropped");
+
+    memset(buf, 0, sizeof(buf));
+    std::thread t([&] { r2 = recv(s1, buf, sizeof(buf), 0); });
+    sleep(1);
+    r = sendto(s2, "direct", 6, 0, (sockaddr*)&addr1, len1);
+    t.join();
+    report(r == 6 && r2 == 6 && !memcmp(buf, "direct", 6), "send to blocked receiver");
+
+    r = connect(s2, (sockaddr*)&addr1, len1);
+    r2 = send(s2, "abc", 3, 0);
+    report(r == 0 && r2 == 3, "send on connected datagram socket");
+    r = recv(s1, buf, sizeof(buf), MSG_PEEK);
+    r2 = recv(s1, buf, sizeof(buf), 0);
+    report(r == 3 && r2 == 3 && !memcmp(buf, "abc", 3), "MSG_PEEK");
+    close(s1);
+    r = send(s2, "abc", 3, 0);
+    report(r == -1 && errno == ECONNREFUSED, "send after receiver closed");
+    close(s2);
+}
+
+static void test_seqpacket()
+{
+    sockaddr_un addr;
+    auto len = make_addr(addr, "tst-af-local-seqpacket", true);
+    int ls = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    int r = bind(ls, (sockaddr*)&addr, len);
+    int r2 = listen(ls, 1);
+    report(ls >= 0 && r == 0 && r2 == 0, "seqpacket bind and listen");
+    int ds = socket(AF_UNIX, SOCK_DGRAM, 0);
+    r = connect(ds, (sockaddr*)&addr, len);
+    report(r == -1 && errno == ECONNREFUSED, "connect to other socket type");
+    close(ds);
+    int cs = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    r = connect(cs, (sockaddr*)&addr, len);
+    int as = accept(ls, nullptr, nullptr);
+    report(r == 0 && as >= 0, "seqpacket connect and accept");
+    r = write(cs, "one", 3);
+    r2 = write(cs, "two", 3);
+    char buf[16] = {};
+    int r3 = read(as, buf, sizeof(buf));
+    report(r == 3 && r2 == 3 && r3 == 3 && !memcmp(buf, "one", 3),
+           "seqpacket keeps message boundaries");
+    r = read(as, buf, sizeof(buf));
+    report(r == 3 && !memcmp(buf, "two", 3), "seqpacket second message");
+    close(cs);
+    r = read(as, buf, sizeof(buf));
+    report(r == 0, "seqpacket read after peer closed");
+    close(as);
+    close(ls);
+
+    int s[2];
+    r = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, s);
+    r2 = write(s[0], "pair", 4);
+    r3 = read(s[1], buf, sizeof(buf));
+    report(r == 0 && r2 == 4 && r3 == 4 && !memcmp(buf, "pair", 4), "seqpacket socketpair");
+    close(s[0]);
+    close(s[1]);
+}
+
 int main(int ac, char** av)
 {
     int s[2];
@@ -119,6 +292,10 @@ int main(int ac, char** av)
     r = close(s[1]);
     report(r == 0, "close when other end is SHUT_WR");
 
+    test_named_stream(false);
+    test_named_stream(true);
+    test_dgram();
+    test_seqpacket();
 
     std::vector<int> sockets;
     while (socketpair(AF_LOCAL, SOCK_STREAM, 0, s) == 0) {
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Zero-copy sends on a socket with a completion ring: many zcopy_tx()
+// calls are issued back to back and their completions are reaped as
+// coalesced sequence ranges instead of one eventfd per send.
+
+#define BOOST_TEST_MODULE tst-bsd-tcp1-zsnd-ring
+
+#include <boost/test/unit_test.hpp>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+#include <osv/zcopy.h>
+
+#define LISTEN_PORT (5556)
+#define SENDS (1000)
+const int buf_size = 4096;
+
+static int listen_on(int port)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    int optval = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    struct sockaddr_in laddr = {};
+    laddr.sin_family = AF_INET;
+    inet_aton("127.0.0.1", &laddr.sin_addr);
+    laddr.sin_port = htons(port);
+    if (bind(s, (struct sockaddr *)&laddr, sizeof(laddr)) < 0 ||
+        listen(s, 1) < 0) {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+BOOST_AUTO_TEST_CASE(test_txring_completions)
+{
+    int listen_s = listen_on(LISTEN_PORT);
+    BOOST_REQUIRE(listen_s >= 0);
+
+    size_t received = 0;
+    std::thread server([&] {
+        int s = accept(listen_s, nullptr, nullptr);
+        char buf[buf_size];
+        int n;
+        while ((n = read(s, buf, sizeof(buf))) > 0) {
+            received += n;
+        }
+        close(s);
+    });
+
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in raddr = {};
+    raddr.sin_family = AF_INET;
+    inet_aton("127.0.0.1", &raddr.sin_addr);
+    raddr.sin_port = htons(LISTEN_PORT);
+    BOOST_REQUIRE(connect(s, (struct sockaddr *)&raddr, sizeof(raddr)) == 0);
+
+    int efd = zcopy_txring_open(s);
+    BOOST_REQUIRE(efd >= 0);
+    BOOST_REQUIRE_EQUAL(zcopy_txring_open(s), efd);
+
+    std::vector<char> buf(buf_size, 'z');
+    std::vector<bool> done(SENDS);
+    size_t sent = 0, ncompleted = 0;
+    uint32_t next_seq = 0;
+    struct zcopy_range ranges[16];
+
+    auto reap = [&] {
+        ssize_t n;
+        while ((n = zcopy_txreap(s, ranges, 16)) > 0) {
+            for (ssize_t i = 0; i < n; i++) {
+                for (uint32_t seq = ranges[i].zr_lo; seq <= ranges[i].zr_hi; seq++) {
+                    BOOST_REQUIRE(seq < next_seq);
+                    BOOST_REQUIRE(!done[seq]);
+                    done[seq] = true;
+                    ncompleted++;
+                }
+            }
+        }
+        BOOST_REQUIRE(n == 0);
+    };
+
+    while (next_seq < SENDS) {
+        struct zmsghdr zm = {};
+        struct iovec iov = { buf.data(), buf.size() };
+        zm.zm_msg.msg_iov = &iov;
+        zm.zm_msg.msg_iovlen = 1;
+        ssize_t bytes = zcopy_tx(s, &zm);
+        if (bytes == EWOULDBLOCK || bytes == 0) {
+            struct pollfd pfd = { efd, POLLIN, 0 };
+            poll(&pfd, 1, 100);
+            reap();
+            continue;
+        }
+        BOOST_REQUIRE(bytes > 0);
+        BOOST_REQUIRE_EQUAL(zm.zm_txseq, next_seq);
+        BOOST_REQUIRE_EQUAL(zm.zm_txfd, -1);
+        // zcopy_txclose() must not close the socket's ring eventfd
+        zcopy_txclose(&zm);
+        sent += bytes;
+        next_seq++;
+    }
+
+    while (ncompleted < SENDS) {
+        struct pollfd pfd = { efd, POLLIN, 0 };
+        BOOST_REQUIRE(poll(&pfd, 1, 5000) == 1);
+        uint64_t v;
+        read(efd, &v, sizeof(v));
+        reap();
+    }
+
+    close(s);
+    server.join();
+    close(listen_s);
+    BOOST_REQUIRE_EQUAL(received, sent);
+}
@@ -20,6 +20,12 @@
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <vector>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1U << 28)
+#endif
 
 static int tests = 0, fails = 0;
 
@@ -238,6 +244,74 @@ failed:
     }
 }
 
+// EPOLLEXCLUSIVE: a file added to several epolls this way wakes only some
+// of them (on OSv, exactly one) instead of all, and the flag can't be
+// changed by EPOLL_CTL_MOD.
+static void test_epollexclusive()
+{
+    struct epoll_event events[16];
+
+    int s[2];
+    int r = pipe(s);
+    report(r == 0, "create pipe");
+
+    int ep1 = epoll_create1(0);
+    int ep2 = epoll_create1(0);
+    report(ep1 >= 0 && ep2 >= 0, "epoll_create1");
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLEXCLUSIVE | EPOLLONESHOT;
+    event.data.u32 = 1;
+    r = epoll_ctl(ep1, EPOLL_CTL_ADD, s[0], &event);
+    report(r == -1 && errno == EINVAL, "EPOLLEXCLUSIVE with EPOLLONESHOT is EINVAL");
+
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    r = epoll_ctl(ep1, EPOLL_CTL_ADD, ep2, &event);
+    report(r == -1 && errno == EINVAL, "EPOLLEXCLUSIVE on an epoll is EINVAL");
+
+    r = epoll_ctl(ep1, EPOLL_CTL_ADD, s[0], &event);
+    report(r == 0, "epoll_ctl ADD EPOLLEXCLUSIVE");
+    event.data.u32 = 2;
+    r = epoll_ctl(ep2, EPOLL_CTL_ADD, s[0], &event);
+    report(r == 0, "epoll_ctl ADD EPOLLEXCLUSIVE to a second epoll");
+
+    r = epoll_ctl(ep1, EPOLL_CTL_MOD, s[0], &event);
+    report(r == -1 && errno == EINVAL, "epoll_ctl MOD of an EPOLLEXCLUSIVE fd is EINVAL");
+
+    // Two threads block, one on each epoll; a single write must wake
+    // at least one of them.
+    std::atomic<int> woken(0);
+    std::vector<std::thread> threads;
+    for (int ep : {ep1, ep2}) {
+        threads.emplace_back([ep, &woken] {
+            struct epoll_event ev;
+            if (epoll_wait(ep, &ev, 1, 500) == 1) {
+                woken++;
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    write_one(s[1]);
+    for (auto& t : threads) {
+        t.join();
+    }
+    report(woken >= 1, "EPOLLEXCLUSIVE event wakes a waiter");
+
+    char c;
+    r = read(s[0], &c, 1);
+    report(r == 1, "read");
+    r = epoll_wait(ep1, events, 16, 0) + epoll_wait(ep2, events, 16, 0);
+    report(r == 0, "nothing left after reading");
+
+    r = epoll_ctl(ep2, EPOLL_CTL_DEL, s[0], nullptr);
+    report(r == 0, "epoll_ctl DEL");
+
+    close(ep1);
+    close(ep2);
+    close(s[0]);
+    close(s[1]);
+}
+
 int main(int ac, char** av)
 {
     int ep = epoll_create(1);
@@ -393,6 +467,7 @@ int main(int ac, char** av)
     test_epoll_file();
     test_socket_epollrdhup();
     test_af_local_epollrdhup();
+    test_epollexclusive();
 
     std::cout << "SUMMARY: " << tests << ", " << fails << " failures\n";
     return !!fails;
@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Tests of the futex() operations beyond plain FUTEX_WAIT/FUTEX_WAKE:
+// bitset wakes, requeueing, FUTEX_WAKE_OP and the PI operations.
+// Can also be run on Linux.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    printf("%s: %s\n", ok ? "PASS" : "FAIL", msg);
+}
+
+static long futex(int* uaddr, int op, int val, const struct timespec* timeout = nullptr,
+                  int* uaddr2 = nullptr, int val3 = 0)
+{
+    return syscall(SYS_futex, uaddr, op, val, timeout, uaddr2, val3);
+}
+
+static long futex2(int* uaddr, int op, int val, int val2, int* uaddr2, int val3)
+{
+    return syscall(SYS_futex, uaddr, op, val, (void*)(uintptr_t)val2, uaddr2, val3);
+}
+
+static int gettid_()
+{
+    return syscall(SYS_gettid);
+}
+
+// Starts n threads waiting on uaddr with the given bitset, and returns once
+// they are all (very likely) asleep
+static std::vector<std::thread> start_waiters(int* uaddr, int n, std::atomic<int>& woken,
+                                              uint32_t bitset = FUTEX_BITSET_MATCH_ANY)
+{
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n; i++) {
+        threads.emplace_back([=, &woken] {
+            while (futex(uaddr, FUTEX_WAIT_BITSET_PRIVATE, 0, nullptr, nullptr, bitset) != 0 &&
+                   errno != EAGAIN) {
+            }
+            woken++;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    return threads;
+}
+
+static void join(std::vector<std::thread>& threads)
+{
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+static void test_timeout()
+{
+    int f = 0;
+    struct timespec ts = { 0, 10000000 };
+    long ret = futex(&f, FUTEX_WAIT_PRIVATE, 0, &ts);
+    report(ret == -1 && errno == ETIMEDOUT, "FUTEX_WAIT times out");
+    ret = futex(&f, FUTEX_WAIT_PRIVATE, 1, &ts);
+    report(ret == -1 && errno == EAGAIN, "FUTEX_WAIT with a changed value");
+}
+
+static void test_bitset()
+{
+    int f = 0;
+    std::atomic<int> woken(0);
+    auto threads = start_waiters(&f, 2, woken, 1);
+    auto more = start_waiters(&f, 2, woken, 2);
+    report(futex(&f, FUTEX_WAKE_BITSET_PRIVATE, 10, nullptr, nullptr, 4) == 0,
+           "FUTEX_WAKE_BITSET wakes no waiter of other bits");
+    report(futex(&f, FUTEX_WAKE_BITSET_PRIVATE, 10, nullptr, nullptr, 2) == 2,
+           "FUTEX_WAKE_BITSET wakes the matching waiters");
+    join(more);
+    report(woken == 2, "waiters of the other bits still wait");
+    report(futex(&f, FUTEX_WAKE_PRIVATE, 10) == 2, "FUTEX_WAKE wakes all bits");
+    join(threads);
+}
+
+static void test_requeue()
+{
+    int f1 = 0, f2 = 0;
+    std::atomic<int> woken(0);
+    auto threads = start_waiters(&f1, 4, woken);
+    report(futex2(&f1, FUTEX_CMP_REQUEUE_PRIVATE, 1, 10, &f2, 1) == -1 && errno == EAGAIN,
+           "FUTEX_CMP_REQUEUE with a changed value");
+    report(futex2(&f1, FUTEX_CMP_REQUEUE_PRIVATE, 1, 10, &f2, 0) == 4,
+           "FUTEX_CMP_REQUEUE wakes one and requeues the rest");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    report(woken == 1, "one waiter woken");
+    report(futex(&f1, FUTEX_WAKE_PRIVATE, 10) == 0, "no waiters left on the first futex");
+    report(futex2(&f2, FUTEX_REQUEUE_PRIVATE, 0, 1, &f1, 0) == 1, "FUTEX_REQUEUE back");
+    report(futex(&f2, FUTEX_WAKE_PRIVATE, 10) == 2, "requeued waiters woken on the second futex");
+    report(futex(&f1, FUTEX_WAKE_PRIVATE, 10) == 1, "waiter requeued back woken");
+    join(threads);
+}
+
+static void test_wake_op()
+{
+    int f1 = 0, f2 = 0;
+    std::atomic<int> woken(0);
+    auto t1 = start_waiters(&f1, 1, woken);
+    auto t2 = start_waiters(&f2, 1, woken);
+    // *f2 += 1, then wake on f2 if the old value was 0
+    int op = FUTEX_OP(FUTEX_OP_ADD, 1, FUTEX_OP_CMP_EQ, 0);
+    report(futex2(&f1, FUTEX_WAKE_OP_PRIVATE, 1, 1, &f2, op) == 2,
+           "FUTEX_WAKE_OP wakes both futexes");
+    report(f2 == 1, "FUTEX_WAKE_OP updated the second futex");
+    join(t1);
+    join(t2);
+    op = FUTEX_OP(FUTEX_OP_SET, 5, FUTEX_OP_CMP_EQ, 0);
+    report(futex2(&f1, FUTEX_WAKE_OP_PRIVATE, 1, 1, &f2, op) == 0 && f2 == 5,
+           "FUTEX_WAKE_OP with a false comparison");
+}
+
+static void test_pi()
+{
+    int f = 0;
+    int me = gettid_();
+    report(futex(&f, FUTEX_LOCK_PI_PRIVATE, 0) == 0 && f == me, "FUTEX_LOCK_PI of a free futex");
+    report(futex(&f, FUTEX_LOCK_PI_PRIVATE, 0) == -1 && errno == EDEADLK,
+           "FUTEX_LOCK_PI by the owner");
+
+    std::atomic<int> state(0);
+    std::thread other([&] {
+        report(futex(&f, FUTEX_TRYLOCK_PI_PRIVATE, 0) == -1 && errno == EAGAIN,
+               "FUTEX_TRYLOCK_PI of an owned futex");
+        report(futex(&f, FUTEX_UNLOCK_PI_PRIVATE, 0) == -1 && errno == EPERM,
+               "FUTEX_UNLOCK_PI by another thread");
+        state = 1;
+        long ret = futex(&f, FUTEX_LOCK_PI_PRIVATE, 0);
+        report(ret == 0 && (f & FUTEX_TID_MASK) == gettid_(), "FUTEX_LOCK_PI hands over the futex");
+        state = 2;
+        futex(&f, FUTEX_UNLOCK_PI_PRIVATE, 0);
+    });
+    while (state != 1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    report((f & FUTEX_WAITERS) != 0, "a waiter sets FUTEX_WAITERS");
+    report(futex(&f, FUTEX_UNLOCK_PI_PRIVATE, 0) == 0, "FUTEX_UNLOCK_PI");
+    other.join();
+    report(state == 2 && f == 0, "the futex is free after the last unlock");
+}
+
+static void test_requeue_pi()
+{
+    int cond = 0, lock = 0;
+    std::atomic<int> owned(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 3; i++) {
+        threads.emplace_back([&] {
+            if (futex(&cond, FUTEX_WAIT_REQUEUE_PI_PRIVATE, 0, nullptr, &lock) == 0) {
+                owned++;
+                report((lock & FUTEX_TID_MASK) == gettid_(), "requeued waiter owns the PI futex");
+                futex(&lock, FUTEX_UNLOCK_PI_PRIVATE, 0);
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    report(futex(&lock, FUTEX_LOCK_PI_PRIVATE, 0) == 0, "FUTEX_LOCK_PI");
+    report(futex2(&cond, FUTEX_CMP_REQUEUE_PI_PRIVATE, 1, 10, &lock, 0) == 3,
+           "FUTEX_CMP_REQUEUE_PI requeues all waiters");
+    futex(&lock, FUTEX_UNLOCK_PI_PRIVATE, 0);
+    join(threads);
+    report(owned == 3 && lock == 0, "each waiter got the PI futex in turn");
+}
+
+int main()
+{
+    test_timeout();
+    test_bitset();
+    test_requeue();
+    test_wake_op();
+    test_pi();
+    test_requeue_pi();
+    printf("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails == 0 ? 0 : 1;
+}
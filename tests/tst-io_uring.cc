@@ -0,0 +1,396 @@
+/*
+ * Copyright (C) 2026 The OSv Authors
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Tests of the io_uring system calls, driven through the raw rings the way
+// liburing does: file, pipe and socket I/O, polls, timeouts, eventfd
+// notification and the submission queue polling thread.
+// Can also be run on Linux.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    printf("%s: %s\n", ok ? "PASS" : "FAIL", msg);
+}
+
+class ring {
+public:
+    explicit ring(unsigned entries, unsigned flags = 0) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        p.flags = flags;
+        p.sq_thread_idle = 10;
+        _fd = syscall(__NR_io_uring_setup, entries, &p);
+        if (_fd < 0) {
+            return;
+        }
+        _features = p.features;
+        size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        }
+        _sq_size = sq_size;
+        _sq = static_cast<char*>(mmap(nullptr, sq_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING));
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+            _cq = _sq;
+        } else {
+            _cq_size = cq_size;
+            _cq = static_cast<char*>(mmap(nullptr, cq_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING));
+        }
+        _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        _sqes = static_cast<io_uring_sqe*>(mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES));
+        if (_sq == MAP_FAILED || _cq == MAP_FAILED || _sqes == MAP_FAILED) {
+            ::close(_fd);
+            _fd = -1;
+            return;
+        }
+        _sq_head = u32(_sq, p.sq_off.head);
+        _sq_tail = u32(_sq, p.sq_off.tail);
+        _sq_mask = *u32(_sq, p.sq_off.ring_mask);
+        _sq_flags = u32(_sq, p.sq_off.flags);
+        _sq_array = u32(_sq, p.sq_off.array);
+        _cq_head = u32(_cq, p.cq_off.head);
+        _cq_tail = u32(_cq, p.cq_off.tail);
+        _cq_mask = *u32(_cq, p.cq_off.ring_mask);
+        _cqes = reinterpret_cast<io_uring_cqe*>(_cq + p.cq_off.cqes);
+        _sqpoll = flags & IORING_SETUP_SQPOLL;
+    }
+    ~ring() {
+        if (_fd >= 0) {
+            munmap(_sqes, _sqes_size);
+            if (_cq != _sq) {
+                munmap(_cq, _cq_size);
+            }
+            munmap(_sq, _sq_size);
+            ::close(_fd);
+        }
+    }
+    bool ok() const { return _fd >= 0; }
+    int fd() const { return _fd; }
+    unsigned features() const { return _features; }
+    io_uring_sqe* get_sqe(uint8_t opcode, int fd, uint64_t user_data) {
+        unsigned tail = __atomic_load_n(_sq_tail, __ATOMIC_RELAXED) + _queued;
+        io_uring_sqe* sqe = &_sqes[tail & _sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->user_data = user_data;
+        _sq_array[tail & _sq_mask] = tail & _sq_mask;
+        _queued++;
+        return sqe;
+    }
+    // Publishes the queued entries and enters the kernel if needed
+    int submit(unsigned wait_nr = 0) {
+        unsigned n = _queued;
+        __atomic_store_n(_sq_tail, *_sq_tail + n, __ATOMIC_RELEASE);
+        _queued = 0;
+        unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+        if (_sqpoll) {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(_sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+                flags |= IORING_ENTER_SQ_WAKEUP;
+            }
+            if (!flags) {
+                return n;
+            }
+        }
+        return syscall(__NR_io_uring_enter, _fd, n, wait_nr, flags, nullptr, 0);
+    }
+    bool peek(io_uring_cqe& cqe) {
+        unsigned head = *_cq_head;
+        if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        cqe = _cqes[head & _cq_mask];
+        __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+    io_uring_cqe wait() {
+        io_uring_cqe cqe;
+        while (!peek(cqe)) {
+            syscall(__NR_io_uring_enter, _fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        }
+        return cqe;
+    }
+private:
+    static uint32_t* u32(char* base, unsigned off) {
+        return reinterpret_cast<uint32_t*>(base + off);
+    }
+    int _fd;
+    unsigned _features = 0;
+    char* _sq = nullptr;
+    char* _cq = nullptr;
+    size_t _sq_size = 0, _cq_size = 0, _sqes_size = 0;
+    io_uring_sqe* _sqes = nullptr;
+    uint32_t *_sq_head, *_sq_tail, *_sq_flags, *_sq_array;
+    uint32_t *_cq_head, *_cq_tail;
+    uint32_t _sq_mask, _cq_mask;
+    io_uring_cqe* _cqes;
+    unsigned _queued = 0;
+    bool _sqpoll = false;
+};
+
+static void test_nop()
+{
+    ring r(8);
+    report(r.ok(), "io_uring_setup");
+    report(r.features() & IORING_FEAT_SINGLE_MMAP, "single mmap feature");
+    for (int i = 0; i < 20; i++) {
+        r.get_sqe(IORING_OP_NOP, -1, 1000 + i);
+        if (i % 4 == 3) {
+            r.submit();
+        }
+    }
+    r.submit();
+    bool ok = true;
+    for (int i = 0; i < 20; i++) {
+        auto cqe = r.wait();
+        ok &= cqe.user_data == (uint64_t)1000 + i && cqe.res == 0;
+    }
+    report(ok, "nops complete in order");
+    r.get_sqe(255, -1, 1);
+    r.submit();
+    report(r.wait().res == -EINVAL, "unknown opcode");
+    r.get_sqe(IORING_OP_READ, 12345, 2);
+    r.submit();
+    report(r.wait().res == -EBADF, "bad file descriptor");
+}
+
+static void test_file()
+{
+    ring r(8);
+    const char* path = "/tmp/tst-io_uring.dat";
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    char wbuf[8192], rbuf[8192];
+    for (unsigned i = 0; i < sizeof(wbuf); i++) {
+        wbuf[i] = i * 7;
+    }
+    auto sqe = r.get_sqe(IORING_OP_WRITE, fd, 1);
+    sqe->addr = (uintptr_t)wbuf;
+    sqe->len = 4096;
+    sqe->off = 0;
+    struct iovec wiov[] = { { wbuf + 4096, 1000 }, { wbuf + 5096, 3096 } };
+    sqe = r.get_sqe(IORING_OP_WRITEV, fd, 2);
+    sqe->addr = (uintptr_t)wiov;
+    sqe->len = 2;
+    sqe->off = 4096;
+    r.submit(2);
+    auto c1 = r.wait(), c2 = r.wait();
+    report(c1.res == 4096 || c2.res == 4096, "IORING_OP_WRITE");
+    report(c1.res == 4096 && c2.res == 4096, "IORING_OP_WRITEV");
+
+    r.get_sqe(IORING_OP_FSYNC, fd, 3);
+    r.submit(1);
+    report(r.wait().res == 0, "IORING_OP_FSYNC");
+
+    memset(rbuf, 0, sizeof(rbuf));
+    struct iovec riov[] = { { rbuf, 100 }, { rbuf + 100, 8092 } };
+    sqe = r.get_sqe(IORING_OP_READV, fd, 4);
+    sqe->addr = (uintptr_t)riov;
+    sqe->len = 2;
+    sqe->off = 0;
+    r.submit(1);
+    report(r.wait().res == 8192 && !memcmp(rbuf, wbuf, 8192), "IORING_OP_READV");
+
+    sqe = r.get_sqe(IORING_OP_READ, fd, 5);
+    sqe->addr = (uintptr_t)rbuf;
+    sqe->len = 4096;
+    sqe->off = 8000;
+    r.submit(1);
+    report(r.wait().res == 192, "IORING_OP_READ at the end of the file");
+    close(fd);
+    unlink(path);
+}
+
+static void test_pipe()
+{
+    ring r(8);
+    int p[2];
+    pipe(p);
+    auto sqe = r.get_sqe(IORING_OP_POLL_ADD, p[0], 1);
+    sqe->poll32_events = POLLIN;
+    char buf[16] = {};
+    sqe = r.get_sqe(IORING_OP_READ, p[0], 2);
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = sizeof(buf);
+    sqe->off = -1;
+    r.submit();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    io_uring_cqe cqe;
+    report(!r.peek(cqe), "poll and read of an empty pipe wait");
+    write(p[1], "hello", 5);
+    bool poll_ok = false, read_ok = false;
+    for (int i = 0; i < 2; i++) {
+        cqe = r.wait();
+        if (cqe.user_data == 1) {
+            poll_ok = cqe.res & POLLIN;
+        } else {
+            read_ok = cqe.res == 5 && !memcmp(buf, "hello", 5);
+        }
+    }
+    report(poll_ok, "IORING_OP_POLL_ADD on a pipe");
+    report(read_ok, "IORING_OP_READ on a pipe");
+    close(p[0]);
+    close(p[1]);
+}
+
+static void test_socket()
+{
+    ring r(8);
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(lfd, (struct sockaddr*)&addr, sizeof(addr));
+    listen(lfd, 1);
+    socklen_t len = sizeof(addr);
+    getsockname(lfd, (struct sockaddr*)&addr, &len);
+
+    r.get_sqe(IORING_OP_ACCEPT, lfd, 1);
+    r.submit();
+    int cfd = socket(AF_INET, SOCK_STREAM, 0);
+    std::thread t([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        connect(cfd, (struct sockaddr*)&addr, sizeof(addr));
+    });
+    auto cqe = r.wait();
+    t.join();
+    int sfd = cqe.res;
+    report(sfd >= 0, "IORING_OP_ACCEPT");
+
+    char buf[16] = {};
+    auto sqe = r.get_sqe(IORING_OP_RECV, sfd, 2);
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = sizeof(buf);
+    r.submit();
+    sqe = r.get_sqe(IORING_OP_SEND, cfd, 3);
+    sqe->addr = (uintptr_t)"ping";
+    sqe->len = 4;
+    r.submit();
+    bool send_ok = false, recv_ok = false;
+    for (int i = 0; i < 2; i++) {
+        cqe = r.wait();
+        if (cqe.user_data == 3) {
+            send_ok = cqe.res == 4;
+        } else {
+            recv_ok = cqe.res == 4 && !memcmp(buf, "ping", 4);
+        }
+    }
+    report(send_ok, "IORING_OP_SEND");
+    report(recv_ok, "IORING_OP_RECV");
+    close(sfd);
+    close(cfd);
+    close(lfd);
+}
+
+static void test_timeout()
+{
+    ring r(8);
+    struct __kernel_timespec ts = { 0, 20000000 };
+    auto sqe = r.get_sqe(IORING_OP_TIMEOUT, -1, 1);
+    sqe->addr = (uintptr_t)&ts;
+    sqe->len = 1;
+    auto start = std::chrono::steady_clock::now();
+    r.submit();
+    auto cqe = r.wait();
+    report(cqe.res == -ETIME && std::chrono::steady_clock::now() - start >=
+           std::chrono::milliseconds(15), "IORING_OP_TIMEOUT expires");
+
+    struct __kernel_timespec long_ts = { 10, 0 };
+    sqe = r.get_sqe(IORING_OP_TIMEOUT, -1, 2);
+    sqe->addr = (uintptr_t)&long_ts;
+    sqe->len = 1;
+    sqe->off = 2;
+    r.submit();
+    r.get_sqe(IORING_OP_NOP, -1, 3);
+    r.get_sqe(IORING_OP_NOP, -1, 4);
+    r.submit();
+    bool ok = false;
+    for (int i = 0; i < 3; i++) {
+        cqe = r.wait();
+        if (cqe.user_data == 2) {
+            ok = cqe.res == 0;
+        }
+    }
+    report(ok, "IORING_OP_TIMEOUT completes after a count of completions");
+}
+
+static void test_eventfd()
+{
+    ring r(8);
+    int efd = eventfd(0, 0);
+    report(syscall(__NR_io_uring_register, r.fd(), IORING_REGISTER_EVENTFD, &efd, 1) == 0,
+           "IORING_REGISTER_EVENTFD");
+    r.get_sqe(IORING_OP_NOP, -1, 1);
+    r.submit(1);
+    r.wait();
+    uint64_t count = 0;
+    read(efd, &count, sizeof(count));
+    report(count == 1, "completion signals the eventfd");
+    report(syscall(__NR_io_uring_register, r.fd(), IORING_UNREGISTER_EVENTFD, nullptr, 0) == 0,
+           "IORING_UNREGISTER_EVENTFD");
+    close(efd);
+}
+
+static void test_sqpoll()
+{
+    ring r(8, IORING_SETUP_SQPOLL);
+    if (!r.ok()) {
+        // Linux before 5.11 requires privileges for this
+        printf("SKIP: IORING_SETUP_SQPOLL: %s\n", strerror(errno));
+        return;
+    }
+    bool ok = true;
+    for (int round = 0; round < 3; round++) {
+        r.get_sqe(IORING_OP_NOP, -1, round);
+        r.submit();
+        ok &= r.wait().user_data == (uint64_t)round;
+        // Lets the thread go idle, so the next round needs a wakeup
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    report(ok, "IORING_SETUP_SQPOLL");
+}
+
+int main()
+{
+    test_nop();
+    test_file();
+    test_pipe();
+    test_socket();
+    test_timeout();
+    test_eventfd();
+    test_sqpoll();
+    printf("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails == 0 ? 0 : 1;
+}
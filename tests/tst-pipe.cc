@@ -6,6 +6,7 @@
  */
 
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <sys/poll.h>
 #include <sys/uio.h>
 #include <unistd.h>
@@ -101,14 +102,9 @@ int main(int ac, char** av)
 
 
     // test atomic writes.
-#ifdef __OSV__
-    // Assumes our af_local_buffer size is 8192 bytes -
-    // if this changes we need to change this test!
-#define PIPE_BUFFER_SIZE 8192
-#else
-    // The pipe buffer size since Linux 2.6.11 was dramatically increased to 64K.
+    // The pipe buffer size since Linux 2.6.11 was dramatically increased to
+    // 64K, and OSv uses the same default.
 #define PIPE_BUFFER_SIZE 65536
-#endif
 #define TSTBUFSIZE PIPE_BUFFER_SIZE*3
     char *buf1 = (char *)calloc(1,TSTBUFSIZE);
     char *buf2 = (char *)calloc(1,TSTBUFSIZE);
@@ -381,6 +377,95 @@ int main(int ac, char** av)
     report(r == 0, "close also write side");
 
 
+    // F_GETPIPE_SZ / F_SETPIPE_SZ
+    r = pipe(s);
+    report(r == 0, "pipe call");
+    r = fcntl(s[0], F_GETPIPE_SZ);
+    report(r == PIPE_BUFFER_SIZE, "F_GETPIPE_SZ");
+    r = fcntl(s[1], F_SETPIPE_SZ, 10000);
+    report(r == 16384, "F_SETPIPE_SZ rounds up to a power of two of pages");
+    r = fcntl(s[0], F_GETPIPE_SZ);
+    report(r == 16384, "F_GETPIPE_SZ after F_SETPIPE_SZ");
+    r = fcntl(s[1], F_SETFL, O_NONBLOCK);
+    buf1 = (char*) calloc(1, TSTBUFSIZE);
+    r = write(s[1], buf1, TSTBUFSIZE);
+    report(r == 16384, "write fills resized pipe");
+    r = fcntl(s[1], F_SETPIPE_SZ, 4096);
+    report(r == -1 && errno == EBUSY, "F_SETPIPE_SZ below contents");
+    r = read(s[0], buf1, TSTBUFSIZE);
+    report(r == 16384, "read resized pipe");
+    free(buf1);
+    r = close(s[0]);
+    r2 = close(s[1]);
+    report(r == 0 && r2 == 0, "close pipe");
+
+    // splice, tee and vmsplice
+    int s2[2];
+    r = pipe(s);
+    r2 = pipe(s2);
+    report(r == 0 && r2 == 0, "pipe calls");
+    struct iovec viov[2] = { { b1, 3 }, { b2, 2 } };
+    memcpy(b1, "spl", 3);
+    memcpy(b2, "ic", 2);
+    r = vmsplice(s[1], viov, 2, 0);
+    report(r == 5, "vmsplice to pipe");
+    r = tee(s[0], s2[1], 100, 0);
+    report(r == 5, "tee between pipes");
+    r = splice(s[0], nullptr, s2[1], nullptr, 3, 0);
+    report(r == 3, "splice between pipes");
+    char sbuf[16] = {};
+    r = read(s2[0], sbuf, sizeof(sbuf));
+    report(r == 8 && memcmp(sbuf, "splicspl", 8) == 0, "read after tee and splice");
+    r = read(s[0], sbuf, sizeof(sbuf));
+    report(r == 2 && memcmp(sbuf, "ic", 2) == 0, "splice leaves the rest");
+    r = tee(s[0], s[1], 1, 0);
+    report(r == -1 && errno == EINVAL, "tee to the same pipe");
+
+    char tmpl[] = "/tmp/tst-pipe-XXXXXX";
+    int fd = mkstemp(tmpl);
+    report(fd >= 0, "create temporary file");
+    r = write(fd, "0123456789", 10);
+    report(r == 10, "write temporary file");
+    off_t off = 2;
+    r = splice(fd, &off, s[1], nullptr, 5, 0);
+    report(r == 5 && off == 7, "splice from file to pipe");
+    off = 20;
+    r = splice(s[0], nullptr, fd, &off, 5, 0);
+    report(r == 5 && off == 25, "splice from pipe to file");
+    r = pread(fd, sbuf, 5, 20);
+    report(r == 5 && memcmp(sbuf, "23456", 5) == 0, "read spliced data from file");
+    r = splice(fd, &off, fd, nullptr, 5, 0);
+    report(r == -1 && errno == EINVAL, "splice without a pipe");
+    close(fd);
+    unlink(tmpl);
+
+    // A TCP socket gets the pipe's pages without a copy
+    int ls = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof(addr);
+    r = bind(ls, (struct sockaddr*)&addr, sizeof(addr));
+    r2 = listen(ls, 1);
+    getsockname(ls, (struct sockaddr*)&addr, &addrlen);
+    int cs = socket(AF_INET, SOCK_STREAM, 0);
+    report(r == 0 && r2 == 0 && connect(cs, (struct sockaddr*)&addr, sizeof(addr)) == 0,
+           "connect TCP socket");
+    int as = accept(ls, nullptr, nullptr);
+    r = write(s[1], "socket", 6);
+    r = splice(s[0], nullptr, cs, nullptr, 6, 0);
+    report(r == 6, "splice from pipe to socket");
+    r = read(as, sbuf, 6);
+    report(r == 6 && memcmp(sbuf, "socket", 6) == 0, "read spliced data from socket");
+    close(as);
+    close(cs);
+    close(ls);
+
+    close(s[0]);
+    close(s[1]);
+    close(s2[0]);
+    close(s2[1]);
+
     std::cout << "SUMMARY: " << tests << " tests, " << fails << " failures\n";
     return fails == 0 ? 0 : 1;
 }